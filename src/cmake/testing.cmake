@@ -18,6 +18,7 @@ add_custom_target ( CopyFiles ALL DEPENDS "${CMAKE_BINARY_DIR}/testsuite/runtest
 
 
 set (OSL_TEST_BIG_TIMEOUT 800 CACHE STRING "Timeout for tests that take a long time")
+option (OSL_TESTSUITE_PERF "Add the performance regression tests (those with a PERF marker file)" OFF)
 
 
 # add_one_testsuite() - set up one testsuite entry
@@ -127,6 +128,21 @@ macro ( TESTSUITE )
 
         set (ALL_TEST_LIST "${ALL_TEST_LIST} ${_testname}")
 
+        # Tests with a PERF marker file are performance regression tests,
+        # they only run in the perf mode of runtest.py, and one at a time
+        # so that their timings don't disturb each other.
+        if (EXISTS "${_testsrcdir}/PERF")
+            if (OSL_TESTSUITE_PERF)
+                add_one_testsuite ("${_testname}.perf" "${_testsrcdir}"
+                                   ENV TESTSHADE_OPT=2 OSL_PERF_TEST=1
+                                       OSL_PERF_BATCHED=${OSL_BUILD_BATCHED} )
+                set_tests_properties ("${_testname}.perf" PROPERTIES
+                                      LABELS perf RUN_SERIAL TRUE
+                                      TIMEOUT ${OSL_TEST_BIG_TIMEOUT})
+            endif ()
+            continue ()
+        endif ()
+
         # Run the test unoptimized, unless it matches a few patterns that
         # we don't test unoptimized (or has an OPTIMIZEONLY marker file).
         if (NOT _testname MATCHES "optix"
@@ -172,6 +188,15 @@ macro ( TESTSUITE )
             add_one_testsuite ("${_testname}.opt.rs_bitcode" "${_testsrcdir}"
                                ENV TESTSHADE_OPT=2 TESTSHADE_RS_BITCODE=1)
         endif ()
+        # Run the same test again shading each row of points with a single
+        # execute_many call, if there is an EXECMANY marker file in the
+        # directory. It has to match the same reference output.
+        if (EXISTS "${_testsrcdir}/EXECMANY"
+            AND NOT EXISTS "${_testsrcdir}/NOSCALAR"
+            AND NOT EXISTS "${_testsrcdir}/NOOPTIMIZE")
+            add_one_testsuite ("${_testname}.execmany" "${_testsrcdir}"
+                               ENV TESTSHADE_OPT=2 TESTSHADE_EXECMANY=1 )
+        endif ()
         # When building for OptiX support, also run it in OptiX mode
         # if there is an OPTIX marker file in the directory.
         # If an environment variable $TESTSUITE_OPTIX is nonzero, then
@@ -284,17 +309,19 @@ macro (osl_add_all_tests)
                 control-flow-reg connect-components
                 const-array-params const-array-fill
                 debugnan debug-uninit
-                derivs derivs-muldiv-clobber
+                derivs derivs-muldiv-clobber derivs-pervalue
                 draw_string
                 error-dupes error-serialized
                 example-deformer
-                example-batched-deformer
+                example-batched-deformer example-batched-stream
                 exit exponential
                 filterwidth-reg
                 for-reg format-reg fprintf
                 function-earlyreturn function-simple function-outputelem
                 function-overloads function-redef
-                geomath getattribute-camera getattribute-shader getattribute-shading
+                geomath getattribute-camera getattribute-object-cache
+                getattribute-shader getattribute-shading
+                getstats-structured
                 getsymbol-nonheap gettextureinfo gettextureinfo-reg
                 gettextureinfo-udim gettextureinfo-udim-reg
                 globals-needed
@@ -310,7 +337,7 @@ macro (osl_add_all_tests)
                 length-reg linearstep
                 lockgeom
                 logic loop luminance-reg
-                matrix matrix-reg matrix-arithmetic-reg
+                matrix matrix-cache matrix-reg matrix-arithmetic-reg
                 matrix-compref-reg max-reg message message-no-closure message-reg
                 mergeinstances-duplicate-entrylayers
                 mergeinstances-nouserdata mergeinstances-vararray
@@ -320,17 +347,19 @@ macro (osl_add_all_tests)
                 nestedloop-reg
                 noise noise-cell
                 noise-gabor noise-gabor2d-filter noise-gabor3d-filter
-                noise-gabor-reg
+                noise-gabor-reg noise-gabor-table
                 noise-generic
                 noise-perlin noise-simplex
                 noise-reg
                 normalize-reg
+                perf-layers perf-noise perf-texture
                 pnoise pnoise-cell pnoise-gabor
                 pnoise-generic pnoise-perlin
                 pnoise-reg
-                operator-overloading
+                octave-noise operator-overloading
                 opt-warnings
-                oslc-comma oslc-D oslc-M
+                oslc-cache oslc-comma oslc-D oslc-M oslc-multifile
+                oslc-multifile-struct
                 oslc-err-arrayindex oslc-err-assignmenttypes
                 oslc-err-closuremul oslc-err-field
                 oslc-err-format oslc-err-funcoverload
@@ -355,12 +384,12 @@ macro (osl_add_all_tests)
                 pragma-nowarn
                 printf-reg
                 printf-whole-array
-                raytype raytype-reg raytype-specialized regex-reg
+                raytype raytype-reg raytype-specialized regex-cache regex-reg
                 reparam reparam-arrays reparam-string testoptix-reparam
                 render-background render-bumptest
                 render-bunny
                 render-cornell
-                render-displacement
+                render-displacement render-displacement-seam
                 render-furnace-diffuse
                 render-mx-furnace-burley-diffuse
                 render-mx-furnace-oren-nayar
@@ -372,7 +401,7 @@ macro (osl_add_all_tests)
                 render-mx-layer
                 render-mx-sheen
                 render-microfacet render-oren-nayar
-                render-uv render-veachmis render-ward
+                render-uv render-veachmis render-ward render-wavefront
                 render-raytypes
                 select select-reg shaderglobals shortcircuit
                 smoothstep-reg
@@ -399,9 +428,10 @@ macro (osl_add_all_tests)
                 texture-missingalpha texture-missingcolor texture-opts-reg texture-simple
                 texture-smallderivs texture-swirl texture-udim
                 texture-width texture-withderivs texture-wrap
-                trace-reg
+                trace-chrome trace-reg
                 trailing-commas
                 transcendental-reg
+                transient-strings
                 transitive-assign
                 transform transform-reg transformc transformc-reg trig trig-reg
                 typecast
@@ -7,7 +7,6 @@
 #include <OSL/optautomata.h>
 #include <OSL/oslconfig.h>
 #include <list>
-#include <stack>
 
 OSL_NAMESPACE_BEGIN
 
@@ -121,6 +120,17 @@ public:
     /// Once all the desired rules have been added, compile the automata
     void compile();
 
+    /// Serialize the compiled automata, along with the rules it was built
+    /// from, so later runs can call load() instead of compile()
+    std::string save() const;
+
+    /// Alternative to compile(). Takes the output of save() and rebuilds
+    /// the compiled automata from it. The very same rules (pattern, output
+    /// and alpha flag, in the same order) must have been added with
+    /// addRule, otherwise it returns false and leaves the automata
+    /// uncompiled, so you can fall back to compile().
+    bool load(string_view data);
+
     /// Performs an accumulation in the given outputs vector if any rule is activated in the given state
     void accum(int state, const Color3& color,
                std::vector<AovOutput>& outputs) const;
@@ -140,7 +150,40 @@ public:
         return m_dfoptautomata.getRules(state, count);
     };
 
+    /// Entry of the dense per state output table: how many of the rules
+    /// of a state add to one output as color and as alpha. Like in
+    /// accum(), each of those rules adds the value once more.
+    struct OutputRuleCount {
+        unsigned char color = 0;
+        unsigned char alpha = 0;
+    };
+
+    /// Number of states in the compiled automata
+    int numStates() const { return m_dfoptautomata.numStates(); };
+
+    /// Number of outputs referenced by the rules (max output index + 1)
+    int numOutputs() const { return m_noutputs; };
+
+    /// Largest count found in the dense output table, 1 unless several
+    /// rules add to the same output from the same state
+    int maxRulesPerOutput() const { return m_max_rules_per_output; };
+
+    /// Dense version of the rules for a given state. Returns an array of
+    /// numOutputs() entries telling how that state contributes to each
+    /// output. Used by the batched accumulator to add to all outputs
+    /// without walking rule lists.
+    const OutputRuleCount* getOutputCountsInState(int state) const
+    {
+        return m_state_output_counts.data() + size_t(state) * m_noutputs;
+    };
+
 private:
+    // Fill m_state_output_counts from the compiled automata
+    void buildOutputCounts();
+    // The rules linked from the automata in a vector, indices are used
+    // for serialization
+    std::vector<void*> ruleVector() const;
+
     // Compiled lpexp's we save while creating the rules with addRule.
     // It gets nuked after you call compile()
     std::list<lpexp::Rule*> m_rules;
@@ -148,6 +191,12 @@ private:
     DfOptimizedAutomata m_dfoptautomata;
     // List of rules linked as void * from the automata's states
     std::list<AccumRule> m_accumrules;
+    // Source pattern of each rule, same order as m_accumrules
+    std::vector<std::string> m_patterns;
+    // numStates() x m_noutputs table of rule counts
+    std::vector<OutputRuleCount> m_state_output_counts;
+    int m_noutputs             = 0;
+    int m_max_rules_per_output = 0;
     // Custom symbols to support on expressions as events
     std::vector<ustring> m_user_events;
     // Custom symbols to support on expressions as scattering
@@ -164,6 +213,10 @@ private:
 ///
 class OSLEXECPUBLIC Accumulator {
 public:
+    /// Maximum nesting of pushState() calls. The stack lives inside the
+    /// accumulator so pushing and popping never touches the heap.
+    static constexpr int max_stack_depth = 64;
+
     Accumulator(const AccumAutomata* accauto);
 
     void setAov(int outidx, Aov* aov, bool neg_color, bool neg_alpha);
@@ -224,7 +277,8 @@ private:
     // by rules and NULL for the rest
     std::vector<AovOutput> m_outputs;
     // Current state stack, this is state information
-    std::stack<int> m_stack;
+    int m_stack[max_stack_depth];
+    int m_stack_size;
     // And the current state
     int m_state;
 };
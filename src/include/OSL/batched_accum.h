@@ -0,0 +1,255 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <algorithm>
+#include <memory>
+
+#include <OSL/accum.h>
+#include <OSL/oslclosure.h>
+#include <OSL/wide.h>
+
+OSL_NAMESPACE_BEGIN
+
+/// Batched AOV slot, the SOA counterpart of AovOutput
+///
+/// Holds the accumulated values of WidthT paths for a single AOV. Owned
+/// by BatchedAccumulator, one per active AOV.
+template<int WidthT> struct BatchedAovOutput {
+    // Accumulated values
+    Block<Color3, WidthT> color;
+    Block<float, WidthT> alpha;
+    // Non zero when some value has been added to color / alpha
+    Block<int, WidthT> has_color;
+    Block<int, WidthT> has_alpha;
+    // It is also possible to "invert" values before flushing
+    bool neg_color = false;
+    bool neg_alpha = false;
+    // The abstract AOV to send the data to
+    Aov* aov = nullptr;
+
+    // Reset the accumulated values to start a new integration
+    void reset()
+    {
+        OSL_OMP_SIMD_LOOP(simdlen(WidthT))
+        for (int lane = 0; lane < WidthT; ++lane) {
+            color.x[lane]        = 0.0f;
+            color.y[lane]        = 0.0f;
+            color.z[lane]        = 0.0f;
+            alpha.data[lane]     = 0.0f;
+            has_color.data[lane] = 0;
+            has_alpha.data[lane] = 0;
+        }
+    }
+
+    /// Sends the color information of the lanes in mask to the AOV,
+    /// flush_data holds one entry per lane
+    void flush(void* const* flush_data, Mask<WidthT> mask) const
+    {
+        if (!aov)
+            return;
+        mask.foreach ([&](ActiveLane lane) -> void {
+            Color3 c   = color.get(lane);
+            float a    = alpha.get(lane);
+            bool has_c = has_color.get(lane) != 0;
+            bool has_a = has_alpha.get(lane) != 0;
+            if (neg_color) {
+                c.setValue(1.0f - c.x, 1.0f - c.y, 1.0f - c.z);
+                has_c = true;
+            }
+            if (neg_alpha) {
+                a     = 1.0f - a;
+                has_a = true;
+            }
+            aov->write(flush_data[lane], c, a, has_c, has_a);
+        });
+    }
+};
+
+
+
+/// Batched state sensitive render accumulator
+///
+/// Equivalent of Accumulator for wavefront and batched integrators, it
+/// tracks the automata state of WidthT paths at once. Outputs are kept
+/// in SOA layout and contributions are added to all the AOV's with
+/// SIMD loops over the dense per state output table of AccumAutomata,
+/// so no rule list is walked per path. The state stack is fixed size
+/// and nothing is allocated after construction.
+///
+/// The automata must be compiled before creating the accumulator.
+///
+template<int WidthT> class BatchedAccumulator {
+public:
+    static constexpr int width           = WidthT;
+    static constexpr int max_stack_depth = Accumulator::max_stack_depth;
+
+    BatchedAccumulator(const AccumAutomata* accauto)
+        : m_accum_automata(accauto)
+        , m_noutputs(accauto->numOutputs())
+        , m_outputs(new BatchedAovOutput<WidthT>[std::max(m_noutputs, 1)])
+        , m_stack_size(0)
+    {
+        // 0 is our initial state always
+        m_state.set_all(0);
+    }
+
+    BatchedAccumulator(const BatchedAccumulator&) = delete;
+
+    void setAov(int outidx, Aov* aov, bool neg_color, bool neg_alpha)
+    {
+        OSL_ASSERT(0 <= outidx && outidx < m_noutputs);
+        m_outputs[outidx].aov       = aov;
+        m_outputs[outidx].neg_color = neg_color;
+        m_outputs[outidx].neg_alpha = neg_alpha;
+    }
+
+    /// Lanes whose machine is broken, no result will be stored for them
+    /// and you can cut those branches
+    Mask<WidthT> broken() const
+    {
+        Mask<WidthT> result(false);
+        for (int lane = 0; lane < WidthT; ++lane)
+            result.set_on_if(lane, m_state.get(lane) < 0);
+        return result;
+    }
+
+    /// Push / pop the state of all lanes at once
+    void pushState()
+    {
+        OSL_ASSERT(m_stack_size < max_stack_depth);
+        Block<int, WidthT>& top = m_stack[m_stack_size++];
+        OSL_OMP_SIMD_LOOP(simdlen(WidthT))
+        for (int lane = 0; lane < WidthT; ++lane)
+            top.data[lane] = m_state.data[lane];
+    }
+
+    void popState()
+    {
+        OSL_ASSERT(m_stack_size > 0);
+        const Block<int, WidthT>& top = m_stack[--m_stack_size];
+        OSL_OMP_SIMD_LOOP(simdlen(WidthT))
+        for (int lane = 0; lane < WidthT; ++lane)
+            m_state.data[lane] = top.data[lane];
+    }
+
+    /// Push the same label on all the lanes in mask
+    void move(ustring symbol, Mask<WidthT> mask)
+    {
+        mask.foreach ([&](ActiveLane lane) -> void {
+            advance(lane, symbol);
+        });
+    }
+
+    /// Push one label per lane (symbols holds WidthT entries)
+    void move(const ustring* symbols, Mask<WidthT> mask)
+    {
+        mask.foreach ([&](ActiveLane lane) -> void {
+            advance(lane, symbols[lane]);
+        });
+    }
+
+    /// Per lane version of Accumulator::move(event, scatt, custom, stop).
+    /// events and scatts hold WidthT entries, customs can be NULL or hold
+    /// WidthT NONE terminated arrays (each of them can be NULL too).
+    void move(const ustring* events, const ustring* scatts,
+              const ustring* const* customs, ustring stop, Mask<WidthT> mask)
+    {
+        mask.foreach ([&](ActiveLane lane) -> void {
+            advance(lane, events[lane]);
+            advance(lane, scatts[lane]);
+            const ustring* custom = customs ? customs[lane] : nullptr;
+            while (m_state.get(lane) >= 0 && custom
+                   && *custom != Labels::NONE)
+                advance(lane, *(custom++));
+            advance(lane, stop);
+        });
+    }
+
+    /// Clears all the outputs to start integrating
+    void begin()
+    {
+        for (int i = 0; i < m_noutputs; ++i)
+            m_outputs[i].reset();
+    }
+
+    /// Finishes and flushes the outputs of the lanes in mask to the sample
+    /// store, flush_data holds one entry per lane
+    void end(void* const* flush_data, Mask<WidthT> mask)
+    {
+        for (int i = 0; i < m_noutputs; ++i)
+            m_outputs[i].flush(flush_data, mask);
+    }
+
+    /// Send one result per lane to whatever rules might be active in the
+    /// current state of that lane. Like Accumulator::accum, an output that
+    /// several rules of the state point to gets the value once per rule.
+    void accum(const Block<Color3, WidthT>& color, Mask<WidthT> mask)
+    {
+        using OutputRuleCount = AccumAutomata::OutputRuleCount;
+        const OutputRuleCount* table
+            = m_accum_automata->getOutputCountsInState(0);
+        int max_rules = m_accum_automata->maxRulesPerOutput();
+        // Row of the output table for each lane, -1 for lanes that are
+        // masked off or whose automata is broken
+        Block<int, WidthT> row;
+        for (int lane = 0; lane < WidthT; ++lane) {
+            int state      = m_state.get(lane);
+            row.data[lane] = (mask.is_on(lane) && state >= 0)
+                                 ? state * m_noutputs
+                                 : -1;
+        }
+        for (int i = 0; i < m_noutputs; ++i) {
+            BatchedAovOutput<WidthT>& out = m_outputs[i];
+            // One pass per rule, so the values are added in the same order
+            // and with the same rounding as the scalar accumulator
+            for (int pass = 0; pass < max_rules; ++pass) {
+                OSL_OMP_SIMD_LOOP(simdlen(WidthT))
+                for (int lane = 0; lane < WidthT; ++lane) {
+                    int r     = row.data[lane];
+                    bool to_c = r >= 0 && table[r + i].color > pass;
+                    bool to_a = r >= 0 && table[r + i].alpha > pass;
+                    float cx  = color.x[lane];
+                    float cy  = color.y[lane];
+                    float cz  = color.z[lane];
+                    float a   = (cx + cy + cz) * 1.0f / 3.0f;
+                    out.color.x[lane] += to_c ? cx : 0.0f;
+                    out.color.y[lane] += to_c ? cy : 0.0f;
+                    out.color.z[lane] += to_c ? cz : 0.0f;
+                    out.alpha.data[lane] += to_a ? a : 0.0f;
+                    out.has_color.data[lane] |= int(to_c);
+                    out.has_alpha.data[lane] |= int(to_a);
+                }
+            }
+        }
+    }
+
+    const BatchedAovOutput<WidthT>& getOutput(int idx) const
+    {
+        return m_outputs[idx];
+    }
+
+private:
+    void advance(int lane, ustring symbol)
+    {
+        int state = m_state.get(lane);
+        if (state >= 0)
+            m_state.set(lane, m_accum_automata->getTransition(state, symbol));
+    }
+
+    // A reference to the stateless automata that can be shared between
+    // multiple threads
+    const AccumAutomata* m_accum_automata;
+    // Number of outputs, they share the index with the AOV's like in
+    // Accumulator
+    int m_noutputs;
+    std::unique_ptr<BatchedAovOutput<WidthT>[]> m_outputs;
+    // Current state of every lane and the fixed size stack of states
+    Block<int, WidthT> m_state;
+    Block<int, WidthT> m_stack[max_stack_depth];
+    int m_stack_size;
+};
+
+OSL_NAMESPACE_END
@@ -147,6 +147,35 @@ public:
                                       const std::string& name = std::string(),
                                       std::string* err        = NULL);
 
+    /// Return the module parsed from the buffer bitcode[0..size-1], fully
+    /// materialized, for use with module_from_prototype(). The buffer is
+    /// only parsed the first time this thread asks for it (each
+    /// PerThreadInfo has its own LLVM context) and the module is kept
+    /// until the PerThreadInfo is destroyed. If extra_bitcode is not NULL,
+    /// that buffer is linked into the prototype as well, and each
+    /// combination of buffer and extra bitcode contents gets a prototype
+    /// of its own. The name
+    /// identifies the buffer. Return NULL on failure, in which case error
+    /// messages will be stored in err if it is not NULL.
+    ///
+    /// Memory: every thread that JITs keeps one materialized copy of each
+    /// library it used, that is the in-memory IR of the whole library,
+    /// several times the size of its bitcode. It is the price of not
+    /// parsing the library again for every group.
+    const llvm::Module*
+    prototype_module(const char* bitcode, size_t size,
+                     const std::string& name   = std::string(),
+                     std::string* err          = NULL,
+                     const char* extra_bitcode = NULL, size_t extra_size = 0);
+
+    /// Set the current module to a new module that only declares the
+    /// functions and globals of the prototype. The definitions that the
+    /// module ends up referencing, directly or indirectly, are copied from
+    /// the prototype by prune_and_internalize_module() (or before
+    /// optimizing or JITing, if it isn't called), so a module never holds
+    /// more of the library than it needs.
+    void module_from_prototype(const llvm::Module* prototype);
+
     bool debug_is_enabled() const;
     void debug_setup_compilation_unit(const char* compile_unit_name);
     void debug_push_function(const std::string& function_name,
@@ -1156,6 +1185,12 @@ private:
     bool m_ModuleIsFinalized;
     bool m_ModuleIsPruned;
 
+    // Module made by module_from_prototype() still waiting for the
+    // definitions it uses, see clone_prototype_definitions()
+    struct PrototypeClone;
+    PrototypeClone* m_prototype_clone = nullptr;
+    void clone_prototype_definitions();
+
     // Additional tracking for masked conditionals, shaders, subroutines, and loop flow control
     struct MaskInfo {
         llvm::Value* mask;
@@ -4,11 +4,13 @@
 
 #pragma once
 
+#include <OpenImageIO/string_view.h>
 #include <OpenImageIO/ustring.h>
 
 #include <OSL/export.h>
 #include <OSL/oslversion.h>
 
+#include <string>
 #include <vector>
 
 OSL_NAMESPACE_BEGIN
@@ -49,6 +51,18 @@ public:
         return &m_rules[m_states[state].begin_rules];
     }
 
+    int numStates() const { return (int)m_states.size(); }
+
+    /// Serialize the compiled automata to text. Rules are opaque here, so
+    /// they are written as their index in the given rules vector, which
+    /// has to contain every rule referenced by the automata.
+    std::string serialize(const std::vector<void*>& rules) const;
+
+    /// Rebuild the automata from serialize() output. Rule indices are
+    /// mapped back to pointers with the given rules vector. Returns false
+    /// if the data is malformed, leaving the automata empty.
+    bool deserialize(OIIO::string_view data, const std::vector<void*>& rules);
+
 protected:
     struct State {
         unsigned int begin_trans;
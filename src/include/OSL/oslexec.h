@@ -4,11 +4,13 @@
 
 #pragma once
 
+#include <functional>
 #include <memory>
 
 #include <OSL/oslconfig.h>
 #include <OSL/shaderglobals.h>
 
+#include <OpenImageIO/paramlist.h>
 #include <OpenImageIO/refcnt.h>
 
 
@@ -197,6 +199,11 @@ public:
     ///                              from interleaving lines. (1)
     ///    int profile            Perform some rudimentary profiling (0)
     ///    int no_noise           Replace noise with constant value. (0)
+    ///    int gabor_impulse_table  Evaluate gabor noise from a table of
+    ///                              precomputed impulses, shared by all
+    ///                              threads (same results, less work).
+    ///                              Scalar execution only: batched and
+    ///                              OptiX shading ignore it. (0)
     ///    int no_pointcloud      Skip pointcloud lookups. (0)
     ///    int exec_repeat        How many times to run each group (1).
     ///    int opt_warnings       Warn on failure to runtime-optimize certain
@@ -260,6 +267,20 @@ public:
     ///                              interpolated geometric parameters.
     ///                              This option is slated for deprecation.
     ///    int countlayerexecs    Add extra code to count total layers run.
+    ///    int profile_layers     Add extra code to time each layer and the
+    ///                              expensive ops (texture, noise,
+    ///                              getattribute, trace, pointcloud,
+    ///                              closures) within it, reported per
+    ///                              group by getstats (0).
+    ///    int trace_events       Record a per-thread timeline of master
+    ///                              loads, runtime optimization and the
+    ///                              LLVM phases (1), and also of sampled
+    ///                              shader executions (2), see
+    ///                              write_trace() (0).
+    ///    int trace_sample_rate  Trace one of every N executions of each
+    ///                              thread when trace_events is 2 (1000).
+    ///    int trace_buffer_size  Most recent events kept per thread (65536).
+    ///    string trace_filename  Write the trace here at shutdown ("").
     ///    int allow_shader_replacement Allow shader to be specified more than
     ///                              once, replacing former definition.
     ///    string archive_groupname  Name of a group to pickle and archive.
@@ -282,7 +303,8 @@ public:
     ///         opt_peephole, opt_coalesce_temps, opt_assign, opt_mix
     ///         opt_merge_instances, opt_merge_instance_with_userdata,
     ///         opt_fold_getattribute, opt_middleman, opt_texture_handle
-    ///         opt_seed_bblock_aliases, opt_groupdata
+    ///         opt_seed_bblock_aliases, opt_groupdata, opt_matrix_cache,
+    ///         opt_transient_strings, opt_octave_loops
     ///    int opt_passes         Number of optimization passes per layer (10)
     ///    int llvm_optimize      Which of several LLVM optimize strategies (1)
     ///    int llvm_debug         Set LLVM extra debug level (0)
@@ -796,6 +818,20 @@ public:
                  void* userdata_base_ptr, void* output_base_ptr,
                  bool run = true);
 
+    /// Execute the shader group on `globals.size()` shading points, point
+    /// i using `globals[i]` and shade index `shadeindex_begin + i`. The
+    /// group level work of execute (optimize/JIT check, heap reservation,
+    /// profiling and stats bookkeeping, processing of errors and printfs
+    /// the shaders queued) is done once for the whole span, with only the
+    /// per point resets in between. This amortizes the per call overhead
+    /// for very cheap groups such as displacement or light filters. The
+    /// closures of all the points stay valid until the next execution on
+    /// this context. Returns false if the group has nothing to run.
+    bool execute_many(ShadingContext& ctx, ShaderGroup& group,
+                      int thread_index, int shadeindex_begin,
+                      span<ShaderGlobals> globals, void* userdata_base_ptr,
+                      void* output_base_ptr);
+
     /// Future execute signature that will be range based. Shader globals will be
     /// obtained from renderer services.
 #if 0  // TODO in future PR
@@ -986,6 +1022,39 @@ public:
                            BatchedShaderGlobals<WidthT>& globals_batch,
                            void* userdata_base_ptr, void* output_base_ptr,
                            const ShaderSymbol* symbol);
+
+        /// One shading point of a stream: execute `group` with the single
+        /// point globals `sg`.  Its userdata and outputs are found at
+        /// `shadeindex` in the arenas, as for execute().  (sg->shade_index
+        /// is not an input, the shading system sets it.)
+        struct ShadeRequest {
+            ShaderGroup* group;
+            const ShaderGlobals* sg;
+            int shadeindex;
+        };
+
+        /// Called after each batch of a stream has executed, while its
+        /// results are still in the context, with the indices (into the
+        /// request stream) of the points in each lane.
+        using BatchDone
+            = std::function<void(int batch_size, const int* request_indices,
+                                 BatchedShaderGlobals<WidthT>& globals_batch)>;
+
+        /// Execute an arbitrary number of shading points that may use
+        /// different groups, without the caller having to form the
+        /// batches. The requests are binned by group and by the members
+        /// of the ShaderGlobals that are uniform across a batch (raytype,
+        /// renderstate, tracedata, objdata and renderer), keeping the
+        /// stream order within each bin, and every bin is executed as
+        /// full batches of WidthT points plus a final tail-masked batch.
+        /// Everything runs on the calling thread with `ctx`; to shade on
+        /// several threads, give each its own slice of the stream and its
+        /// own context. Return false if any batch failed to execute.
+        bool execute_stream(ShadingContext& ctx,
+                            cspan<ShadeRequest> requests,
+                            void* userdata_base_ptr = nullptr,
+                            void* output_base_ptr   = nullptr,
+                            const BatchDone& batch_done = {});
     };
 
     template<int WidthT> OSL_FORCEINLINE BatchedExecutor<WidthT> batched()
@@ -999,6 +1068,32 @@ public:
     ///
     std::string getstats(int level = 1) const;
 
+    /// Replace the contents of `stats` with all the statistics as typed
+    /// name/value pairs: every counter, timer and memory counter under
+    /// the same "stat:" names getattribute() accepts (int, int64 or
+    /// double seconds), and when profiling is on, the execution profile
+    /// as "profile:group:<group>:time|executions" and the layer profile
+    /// as "profile:group:<group>:layer:<index>:<field>", where groups that
+    /// are unnamed or share their name are told apart as "<group>#<id>".
+    /// Cheap enough to be polled while shading.
+    void getstats(OIIO::ParamValueList& stats) const;
+
+    /// Return the statistics of getstats(ParamValueList&) as a flat JSON
+    /// object.
+    std::string getstats_json() const;
+
+    /// Reset the counters, timers and profiles so that the statistics
+    /// only reflect what happens from now on, and restart the memory
+    /// peaks from the current usage. Counts of things that still exist
+    /// (instances, contexts, current memory) are kept. Meant to be called
+    /// between frames, while no shading is in flight.
+    void reset_stats();
+
+    /// Write the timeline recorded with the "trace_events" option in the
+    /// Chrome trace event format (chrome://tracing, Perfetto). Return
+    /// false if the file could not be written.
+    bool write_trace(string_view filename) const;
+
     void register_closure(string_view name, int id, const ClosureParam* params,
                           PrepareClosureFunc prepare, SetupClosureFunc setup);
 
@@ -467,6 +467,14 @@ struct CellNoise: public IntHashNoiseBase<CellNoise>  {
     {
         return OIIO::ifloor(val);
     }
+
+#ifndef __CUDA_ARCH__
+    static OSL_FORCEINLINE vint4
+    transformToUint(const vfloat4& val)
+    {
+        return OIIO::simd::ifloor(val);
+    }
+#endif
 };
 
 struct HashNoise: public IntHashNoiseBase<HashNoise>  {
@@ -477,8 +485,60 @@ struct HashNoise: public IntHashNoiseBase<HashNoise>  {
     {
         return bitcast_to_uint(val);
     }
+
+#ifndef __CUDA_ARCH__
+    static OSL_FORCEINLINE vint4
+    transformToUint(const vfloat4& val)
+    {
+        return OIIO::simd::bitcast_to_int(val);
+    }
+#endif
 };
 
+
+
+// The octave loop of fBm (or turbulence) over cell or hash noise, the way
+// shaders write it: each octave adds amp * noise(p * freq) to sum (for
+// turbulence, amp * |2 * noise(p * freq) - 1|), then scales freq by
+// lacunarity and amp by gain. The arithmetic is done in the same order as
+// the loop, so the result is identical, but the hashes of four octaves are
+// computed at once. Returns the new sum; freq and amp are left as the loop
+// would have left them.
+template<typename BaseNoiseT, bool Turbulence>
+OSL_FORCEINLINE OSL_HOSTDEVICE float
+octave_noise (float sum, const Vec3& p, float& freq, float& amp,
+              int octaves, float lacunarity, float gain)
+{
+    auto accumulate = [&](float n) {
+        if (Turbulence)
+            n = fabsf(n * 2.0f - 1.0f);
+        sum = sum + amp * n;
+        freq *= lacunarity;
+        amp *= gain;
+    };
+    int k = 0;
+#if OIIO_SIMD && !defined(__CUDA_ARCH__)
+    for (; k + 4 <= octaves; k += 4) {
+        float f1 = freq * lacunarity;
+        float f2 = f1 * lacunarity;
+        float f3 = f2 * lacunarity;
+        vfloat4 f (freq, f1, f2, f3);
+        vint4 h = inthash_simd (BaseNoiseT::transformToUint(p.x * f),
+                                BaseNoiseT::transformToUint(p.y * f),
+                                BaseNoiseT::transformToUint(p.z * f));
+        OIIO_SIMD4_ALIGN int bits[4];
+        h.store (bits);
+        for (int i = 0; i < 4; ++i)
+            accumulate (bits_to_01 ((unsigned int)bits[i]));
+    }
+#endif
+    for (; k < octaves; ++k)
+        accumulate (bits_to_01 (inthash (BaseNoiseT::transformToUint(p.x * freq),
+                                         BaseNoiseT::transformToUint(p.y * freq),
+                                         BaseNoiseT::transformToUint(p.z * freq))));
+    return sum;
+}
+
 // Periodic Cell and Hash Noise simply wraps its inputs before
 // performing the same conversions and hashing as the non-periodic version.
 // We define a wrapper on top of Cell or Hash Noise to reuse
@@ -3376,6 +3436,26 @@ DECLNOISE (cellnoise, CellNoise)
 DECLNOISE (hashnoise, HashNoise)
 
 #undef DECLNOISE
+
+
+// Sum of octaves k = 0..octaves-1 of gain^k * noise(x * lacunarity^k) for
+// the fbm functions, or of gain^k * |2 * noise(x * lacunarity^k) - 1| for
+// the turbulence functions.
+#define DECLOCTAVES(name,impl,turbulence)                               \
+    OSL_HOSTDEVICE inline float                                         \
+    name (const Vec3& x, int octaves, float lacunarity = 2.0f,          \
+          float gain = 0.5f) {                                          \
+        float freq = 1.0f, amp = 1.0f;                                  \
+        return pvt::octave_noise<pvt::impl, turbulence> (0.0f, x, freq, \
+                         amp, octaves, lacunarity, gain);               \
+    }
+
+DECLOCTAVES (cellnoise_fbm, CellNoise, false)
+DECLOCTAVES (cellnoise_turbulence, CellNoise, true)
+DECLOCTAVES (hashnoise_fbm, HashNoise, false)
+DECLOCTAVES (hashnoise_turbulence, HashNoise, true)
+
+#undef DECLOCTAVES
 }   // namespace oslnoise
 
 
@@ -80,6 +80,7 @@ public:
     ///    "OptiX"
     ///    "build_attribute_getter"
     ///    "build_interpolated_getter"
+    ///    "cache_object_attributes"
     ///
     /// This allows some customization of JIT generated code based on the
     /// facilities and features of a particular renderer. It also allows
@@ -275,6 +276,15 @@ public:
     /// otherwise just fail by returning 'false'.
     /// NOTE: During shader compilation/optimization when type==TypeDesc::STRING,
     ///       val should be populated with a ustring
+    ///
+    /// If supports("cache_object_attributes"), the renderer promises that
+    /// the attributes named "object:*" only depend on the object (and
+    /// type, array index and derivatives), not on the shading point,
+    /// for as long as sg->objdata stays the same. Each ShadingContext
+    /// then remembers them, and only asks again once it shades another
+    /// objdata or is released. A renderer that edits the attributes of an
+    /// object between shades must release the contexts that may hold them
+    /// (release_context clears what they remember) before shading it again.
     virtual bool get_attribute(ShaderGlobals* sg, bool derivatives,
                                ustringhash object, TypeDesc type,
                                ustringhash name, void* val);
@@ -187,10 +187,25 @@ public:
     ///
     static int new_struct(StructSpec* n);
 
-    /// Return a reference to the structure list.
-    ///
+    /// Return a reference to the structure list: the one a
+    /// StructListScope installed on this thread, if any, else the one of
+    /// the process.
     static std::vector<std::shared_ptr<StructSpec>>& struct_list();
 
+    /// While alive, makes `structs` the structure list of this thread, so
+    /// that compiles running at the same time each number their own
+    /// structs.
+    class StructListScope {
+    public:
+        StructListScope(std::vector<std::shared_ptr<StructSpec>>& structs);
+        ~StructListScope();
+        StructListScope(const StructListScope&)            = delete;
+        StructListScope& operator=(const StructListScope&) = delete;
+
+    private:
+        std::vector<std::shared_ptr<StructSpec>>* m_prev;
+    };
+
     /// Is this an array (either a simple array, or an array of structs)?
     ///
     bool is_array() const { return m_simple.arraylen != 0; }
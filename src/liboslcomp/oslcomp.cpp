@@ -3,9 +3,13 @@
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
 
+#include <algorithm>
+#include <cctype>
 #include <cerrno>
 #include <cstdio>
 #include <fstream>
+#include <map>
+#include <mutex>
 #include <streambuf>
 #include <string>
 #include <vector>
@@ -13,6 +17,7 @@
 #include "oslcomp_pvt.h"
 
 #include <OpenImageIO/filesystem.h>
+#include <OpenImageIO/hash.h>
 #include <OpenImageIO/platform.h>
 #include <OpenImageIO/strutil.h>
 #include <OpenImageIO/sysutil.h>
@@ -145,7 +150,7 @@ OSLCompilerImpl::preprocess_buffer(const std::string& buffer,
                                    const std::string& stdoslpath,
                                    const std::vector<std::string>& defines,
                                    const std::vector<std::string>& includepaths,
-                                   std::string& result)
+                                   std::string& result, bool keep_macros)
 {
     using OIIO::Strutil::fmt::format;
     std::string instring;
@@ -193,7 +198,7 @@ OSLCompilerImpl::preprocess_buffer(const std::string& buffer,
     sm.setMainFileID(sm.createFileID(std::move(mbuf), clang::SrcMgr::C_User));
 
     inst.getPreprocessorOutputOpts().ShowCPP               = 1;
-    inst.getPreprocessorOutputOpts().ShowMacros            = 0;
+    inst.getPreprocessorOutputOpts().ShowMacros            = keep_macros;
     inst.getPreprocessorOutputOpts().ShowComments          = 0;
     inst.getPreprocessorOutputOpts().ShowLineMarkers       = 1;
     inst.getPreprocessorOutputOpts().ShowMacroComments     = 0;
@@ -229,6 +234,14 @@ OSLCompilerImpl::preprocess_buffer(const std::string& buffer,
         else if (d[1] == 'U')
             preprocOpts.addMacroUndef(d.c_str() + 2);
     }
+    if (m_share_stdosl && !stdoslpath.empty()) {
+        // Stand in the shared, already preprocessed stdosl.h for the file
+        if (auto text = shared_stdosl(stdoslpath, defines, includepaths))
+            preprocOpts.addRemappedFile(stdoslpath,
+                                        llvm::MemoryBuffer::getMemBufferCopy(
+                                            *text, stdoslpath)
+                                            .release());
+    }
 
     inst.getLangOpts().LineComment = 1;
     inst.createPreprocessor(clang::TU_Prefix);
@@ -251,12 +264,68 @@ OSLCompilerImpl::preprocess_buffer(const std::string& buffer,
 
 
 
+std::shared_ptr<const std::string>
+OSLCompilerImpl::shared_stdosl(const std::string& stdoslpath,
+                               const std::vector<std::string>& defines,
+                               const std::vector<std::string>& includepaths)
+{
+    static std::mutex shared_mutex;
+    static std::map<std::string, std::shared_ptr<const std::string>> shared;
+
+    std::string key = stdoslpath;
+    for (auto&& d : defines)
+        key += "\n" + d;
+    for (auto&& inc : includepaths)
+        key += "\n-I" + inc;
+    // Other compiles wanting the same header wait for the first one
+    std::lock_guard<std::mutex> lock(shared_mutex);
+    auto found = shared.find(key);
+    if (found != shared.end())
+        return found->second;
+
+    std::shared_ptr<const std::string> text;
+    std::string source, expanded;
+    if (OIIO::Filesystem::read_text_file(stdoslpath, source)
+        && preprocess_buffer(source, stdoslpath, std::string(), defines,
+                             includepaths, expanded, true /*keep_macros*/)) {
+        // Drop what belongs to the <built-in> and <command line> pseudo
+        // files, which every compile sets up by itself, and the enter and
+        // leave flags of the line markers, which would not balance once
+        // the text is included from the shader.
+        std::string filtered;
+        bool pseudo = false;
+        for (string_view line : OIIO::Strutil::splitsv(expanded, "\n")) {
+            if (line.size() > 2 && line[0] == '#' && line[1] == ' '
+                && isdigit((unsigned char)line[2])) {
+                size_t q = line.find('"');
+                size_t e = line.find('"', q + 1);
+                pseudo   = (q != string_view::npos && q + 1 < line.size()
+                          && line[q + 1] == '<');
+                if (!pseudo && e != string_view::npos)
+                    line = line.substr(0, e + 1);
+                if (!pseudo)
+                    filtered += std::string(line) + "\n";
+                continue;
+            }
+            if (!pseudo)
+                filtered += std::string(line) + "\n";
+        }
+        text = std::make_shared<const std::string>(std::move(filtered));
+    }
+    // Failures are remembered too, those compiles use the real header
+    shared[key] = text;
+    return text;
+}
+
+
+
 void
 OSLCompilerImpl::read_compile_options(const std::vector<std::string>& options,
                                       std::vector<std::string>& defines,
                                       std::vector<std::string>& includepaths)
 {
     m_output_filename.clear();
+    m_cache_dir.clear();
     m_preprocess_only = false;
     for (size_t i = 0; i < options.size(); ++i) {
         if (options[i] == "-v") {
@@ -284,6 +353,12 @@ OSLCompilerImpl::read_compile_options(const std::vector<std::string>& options,
         } else if (options[i] == "-embed-source"
                    || options[i] == "--embed-source") {
             m_embed_source = true;
+        } else if (options[i] == "-share-stdosl"
+                   || options[i] == "--share-stdosl") {
+            m_share_stdosl = true;
+        } else if ((options[i] == "-cache" || options[i] == "--cache")
+                   && i < options.size() - 1) {
+            m_cache_dir = options[++i];
         } else if (options[i] == "-MD"
                    || options[i] == "--write-dependencies") {
             // write depfile w/ user and system headers
@@ -404,6 +479,10 @@ OSLCompilerImpl::compile(string_view filename,
                          const std::vector<std::string>& options,
                          string_view stdoslpath)
 {
+    // Structs are numbered per compile, not in the table of the process
+    // that other compiles or the shading system may be using
+    TypeSpec::StructListScope structs(symtab().structs());
+
     if (!OIIO::Filesystem::exists(filename)) {
         errorfmt(ustring(), 0, "Input file \"{}\" not found", filename);
         return false;
@@ -435,8 +514,37 @@ OSLCompilerImpl::compile(string_view filename,
         return false;
     }
 
+    // Write the oso text to the output file
+    auto write_output = [&](const std::string& oso) {
+        OIIO::ofstream oso_output;
+        OIIO::Filesystem::open(oso_output, m_output_filename);
+        if (!oso_output.good()) {
+            errorfmt(ustring(), 0, "Could not open \"{}\"", m_output_filename);
+            return false;
+        }
+        oso_output << oso;
+        oso_output.close();
+        if (!oso_output.good()) {
+            errorfmt(ustring(), 0, "Failed to write to \"{}\"",
+                     m_output_filename);
+            return false;
+        }
+        return true;
+    };
+
+    std::string cachekey, cached_oso;
+    if (m_cache_dir.size() && !m_preprocess_only)
+        cachekey = cache_key(options, preprocess_result);
+
     if (m_preprocess_only && !m_generate_deps) {
         std::cout << preprocess_result;
+    } else if (cachekey.size() && cache_fetch(cachekey, options, cached_oso)) {
+        // Same source, options and compiler as a previous compile
+        if (m_generate_deps) {
+            add_file_dependencies(preprocess_result);
+            write_dependency_file(filename);
+        }
+        return write_output(cached_oso);
     } else {
         bool parseerr = osl_parse_buffer(preprocess_result);
         if (!parseerr) {
@@ -469,13 +577,8 @@ OSLCompilerImpl::compile(string_view filename,
             if (m_output_filename.size() == 0)
                 m_output_filename = default_output_filename();
 
-            OIIO::ofstream oso_output;
-            OIIO::Filesystem::open(oso_output, m_output_filename);
-            if (!oso_output.good()) {
-                errorfmt(ustring(), 0, "Could not open \"{}\"",
-                         m_output_filename);
-                return false;
-            }
+            std::ostringstream oso_output;
+            oso_output.imbue(std::locale::classic());  // force C locale
             OSL_DASSERT(m_osofile == nullptr);
             m_osofile = &oso_output;
 
@@ -483,12 +586,10 @@ OSLCompilerImpl::compile(string_view filename,
                            preprocess_result);
             OSL_DASSERT(m_osofile == nullptr);
 
-            oso_output.close();
-            if (!oso_output.good()) {
-                errorfmt(ustring(), 0, "Failed to write to \"{}\"",
-                         m_output_filename);
+            if (!write_output(oso_output.str()))
                 return false;
-            }
+            if (cachekey.size())
+                cache_store(cachekey, oso_output.str());
         }
     }
 
@@ -502,6 +603,8 @@ OSLCompilerImpl::compile_buffer(string_view sourcecode, std::string& osobuffer,
                                 const std::vector<std::string>& options,
                                 string_view stdoslpath, string_view filename)
 {
+    TypeSpec::StructListScope structs(symtab().structs());
+
     if (filename.empty())
         filename = string_view("<buffer>");
 
@@ -527,8 +630,15 @@ OSLCompilerImpl::compile_buffer(string_view sourcecode, std::string& osobuffer,
         return false;
     }
 
+    std::string cachekey;
+    if (m_cache_dir.size() && !m_preprocess_only)
+        cachekey = cache_key(options, preprocess_result);
+
     if (m_preprocess_only) {
         std::cout << preprocess_result;
+    } else if (cachekey.size() && cache_fetch(cachekey, options, osobuffer)) {
+        // Same source, options and compiler as a previous compile
+        return true;
     } else {
         bool parseerr = osl_parse_buffer(preprocess_result);
         if (!parseerr) {
@@ -567,6 +677,8 @@ OSLCompilerImpl::compile_buffer(string_view sourcecode, std::string& osobuffer,
                            preprocess_result);
             osobuffer = oso_output.str();
             OSL_DASSERT(m_osofile == nullptr);
+            if (cachekey.size())
+                cache_store(cachekey, osobuffer);
         }
     }
 
@@ -622,6 +734,146 @@ OSLCompilerImpl::write_dependency_file(string_view filename)
 
 
 
+std::string
+OSLCompilerImpl::cache_key(const std::vector<std::string>& options,
+                           const std::string& preprocessed) const
+{
+    // The same source, compiled by the same oslc with the same options,
+    // always produces the same oso.  Options that only say where the
+    // output, the depfile, the cache and the includes are, or how chatty to
+    // be, don't change it (the includes are in the preprocessed source),
+    // so they are left out of the key.
+    std::string keyed_options;
+    for (size_t i = 0; i < options.size(); ++i) {
+        const std::string& opt(options[i]);
+        if (opt == "-o" || opt == "-cache" || opt == "--cache" || opt == "-MF"
+            || opt == "-MT") {
+            ++i;  // and its value
+            continue;
+        }
+        if (opt == "-v" || opt == "-q" || opt == "-MD" || opt == "-MMD"
+            || opt == "--write-dependencies"
+            || opt == "--write-user-dependencies"
+            || OIIO::Strutil::starts_with(opt, "-MF")
+            || OIIO::Strutil::starts_with(opt, "-MT")
+            || OIIO::Strutil::starts_with(opt, "-I"))
+            continue;
+        keyed_options += opt + " ";
+    }
+    std::string header = OIIO::Strutil::fmt::format(
+        "oslc {} oso {}.{:02d}\n{}\n", OSL_LIBRARY_VERSION_STRING,
+        OSO_FILE_VERSION_MAJOR, OSO_FILE_VERSION_MINOR, keyed_options);
+    OIIO::SHA1 sha;
+    sha.append(header.data(), header.size());
+
+    // Likewise only the file names of the paths in the line markers count,
+    // so that checkouts and installs in different places share entries.
+    // The oso of a hit still names the files where the compile that filled
+    // the entry found them.
+    for (size_t pos = 0, end = preprocessed.size(); pos < end;) {
+        size_t eol = std::min(preprocessed.find('\n', pos), end - 1) + 1;
+        size_t first = preprocessed.find_first_not_of(" \t", pos);
+        size_t q0   = preprocessed.find('"', pos);
+        size_t q1   = q0 < eol ? preprocessed.find('"', q0 + 1) : eol;
+        if (first < eol && preprocessed[first] == '#' && q1 < eol) {
+            std::string name = OIIO::Filesystem::filename(
+                string_view(preprocessed).substr(q0 + 1, q1 - q0 - 1));
+            sha.append(preprocessed.data() + pos, q0 + 1 - pos);
+            sha.append(name.data(), name.size());
+            sha.append(preprocessed.data() + q1, eol - q1);
+        } else {
+            sha.append(preprocessed.data() + pos, eol - pos);
+        }
+        pos = eol;
+    }
+    return sha.digest();
+}
+
+
+
+void
+OSLCompilerImpl::add_file_dependencies(string_view preprocessed)
+{
+    // The files named by the line markers, recorded as the lexer does when
+    // it parses them
+    for (string_view line : OIIO::Strutil::splitsv(preprocessed, "\n")) {
+        int lineno = 0;
+        string_view name;
+        if (!OIIO::Strutil::parse_char(line, '#'))
+            continue;
+        OIIO::Strutil::parse_prefix(line, "line");
+        if (!OIIO::Strutil::parse_int(line, lineno) || lineno <= 0
+            || !OIIO::Strutil::parse_string(line, name))
+            continue;
+        if (OIIO::Strutil::starts_with(name, m_cwd)) {
+            name.remove_prefix(m_cwd.size());
+            if (name.size() && (name[0] == '/' || name[0] == '\\'))
+                name.remove_prefix(1);
+        }
+        m_file_dependencies.emplace(name);
+    }
+}
+
+
+
+bool
+OSLCompilerImpl::cache_fetch(const std::string& key,
+                             const std::vector<std::string>& options,
+                             std::string& oso)
+{
+    std::string base = m_cache_dir + "/" + key;
+    if (!OIIO::Filesystem::read_text_file(base + ".oso", oso))
+        return false;
+    // The options line is the one of the compile that filled the entry,
+    // with its own output, include and cache paths: write ours instead.
+    size_t opt = oso.find("\n# options: ");
+    if (opt != std::string::npos) {
+        opt += 12;
+        size_t eol = oso.find('\n', opt);
+        oso.replace(opt, eol == std::string::npos ? eol : eol - opt,
+                    OIIO::Strutil::join(options, " "));
+    }
+    if (m_output_filename.empty()) {
+        // The default output is named after the shader, which is on the
+        // first line of the oso that is not a comment or the version.
+        for (string_view line : OIIO::Strutil::splitsv(oso, "\n")) {
+            if (line.empty() || line[0] == '#'
+                || OIIO::Strutil::starts_with(line, "OpenShadingLanguage"))
+                continue;
+            auto tokens = OIIO::Strutil::splitsv(line);
+            if (tokens.size() >= 2)
+                m_output_filename = std::string(tokens[1]) + ".oso";
+            break;
+        }
+    }
+    if (m_verbose)
+        infofmt(m_main_filename, 0, "Using cached oso {}.oso", base);
+    return m_output_filename.size();
+}
+
+
+
+void
+OSLCompilerImpl::cache_store(const std::string& key,
+                             const std::string& oso) const
+{
+    if (!OIIO::Filesystem::is_directory(m_cache_dir))
+        OIIO::Filesystem::create_directory(m_cache_dir);
+    // Write to a unique temporary and rename it in place, so concurrent
+    // compiles never see a partial entry.
+    std::string base = m_cache_dir + "/" + key;
+    std::string tmp = OIIO::Filesystem::unique_path(base + ".%%%%%%%%.tmp");
+    std::string err;
+    OIIO::ofstream out;
+    OIIO::Filesystem::open(out, tmp);
+    out << oso;
+    out.close();
+    if (!out.good() || !OIIO::Filesystem::rename(tmp, base + ".oso", err))
+        OIIO::Filesystem::remove(tmp, err);
+}
+
+
+
 struct GlobalTable {
     const char* name;
     TypeSpec type;
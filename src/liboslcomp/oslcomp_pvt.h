@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <memory>
 #include <map>
 #include <set>
 #include <stack>
@@ -158,12 +159,24 @@ public:
                          const std::vector<std::string>& includepaths,
                          std::string& result);
 
+    /// Preprocess buffer, with stdosl.h included first. When keep_macros
+    /// is true the macro definitions are kept in the result, like
+    /// "cpp -dD" does.
     bool preprocess_buffer(const std::string& buffer,
                            const std::string& filename,
                            const std::string& stdoslpath,
                            const std::vector<std::string>& defines,
                            const std::vector<std::string>& includepaths,
-                           std::string& result);
+                           std::string& result, bool keep_macros = false);
+
+    /// Return stdosl.h already preprocessed for these defines and include
+    /// paths, macro definitions included, so that it can stand in for the
+    /// real header. It is only preprocessed once per process and shared by
+    /// all compiles (-share-stdosl). Return nullptr if it failed.
+    std::shared_ptr<const std::string>
+    shared_stdosl(const std::string& stdoslpath,
+                  const std::vector<std::string>& defines,
+                  const std::vector<std::string>& includepaths);
 
     /// Has a shader already been defined?
     bool shader_is_defined() const { return (bool)m_shader; }
@@ -361,6 +374,23 @@ private:
     void write_oso_metadata(const ASTNode* metanode) const;
     void write_dependency_file(string_view filename);
 
+    /// Key of the build cache (-cache) entry for this compile: a hash of
+    /// the compiler and oso versions, the options that affect the oso and
+    /// the preprocessed source, without the directories of its files.
+    std::string cache_key(const std::vector<std::string>& options,
+                          const std::string& preprocessed) const;
+    /// Look up the oso of a cache entry, with its options line rewritten
+    /// to this compile's options. Return false if there is no such entry.
+    bool cache_fetch(const std::string& key,
+                     const std::vector<std::string>& options,
+                     std::string& oso);
+    /// Add the files named by the line markers of the preprocessed source
+    /// to the dependencies, as parsing it would, for cache hits.
+    void add_file_dependencies(string_view preprocessed);
+    /// Add a cache entry for a successful compile. Failures to write the
+    /// cache are not errors, the compile just won't be cached.
+    void cache_store(const std::string& key, const std::string& oso) const;
+
     // Output text to the osofile, using std::format formatting conventions.
     template<typename... Args>
     inline void osofmt(const char* fmt, Args&&... args) const
@@ -444,6 +474,8 @@ private:
     bool m_generate_deps = false;  ///< Generate dependencies? -MD or -MMD?
     bool m_generate_system_deps = false;  ///< Generate system header deps? -MD
     bool m_embed_source         = false;  ///< Embed preprocessed source in oso?
+    bool m_share_stdosl         = false;  ///< Use the shared stdosl.h?
+    std::string m_cache_dir;              ///< Build cache directory: -cache
     bool m_err_on_warning;                ///< Treat warnings as errors?
     int m_optimizelevel;                  ///< Optimization level
     OpcodeVec m_ircode;                   ///< Generated IR code
@@ -281,7 +281,7 @@ SymbolTable::delete_syms()
     for (auto& sym : m_allsyms)
         delete sym;
     m_allsyms.clear();
-    TypeSpec::struct_list().clear();
+    m_structs.clear();
 }
 
 
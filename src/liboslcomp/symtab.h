@@ -255,12 +255,17 @@ public:
 
     SymbolPtrVec& allsyms() { return m_allsyms; }
 
+    /// The structures declared by this compile, see
+    /// TypeSpec::StructListScope.
+    std::vector<std::shared_ptr<StructSpec>>& structs() { return m_structs; }
+
 private:
     OSLCompilerImpl& m_comp;        ///< Back-reference to compiler
     SymbolPtrVec m_allsyms;         ///< Master list of all symbols
     ScopeTableStack m_scopetables;  ///< Stack of symbol scopes
     std::stack<int> m_scopestack;   ///< Stack of current scope IDs
     ScopeTable m_allmangled;        ///< All syms, mangled, in a hash table
+    std::vector<std::shared_ptr<StructSpec>> m_structs;  ///< Our structs
     int m_scopeid;                  ///< Current scope ID
     int m_nextscopeid;              ///< Next unique scope ID
 };
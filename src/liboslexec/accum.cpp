@@ -6,9 +6,13 @@
 #include <OSL/oslclosure.h>
 #include "lpeparse.h"
 
+#include <OpenImageIO/strutil.h>
+
 
 OSL_NAMESPACE_BEGIN
 
+namespace Strutil = OIIO::Strutil;
+
 
 
 void
@@ -65,6 +69,7 @@ AccumAutomata::addRule(const char* pattern, int outidx, bool toalpha)
         return NULL;
     }
     m_accumrules.emplace_back(outidx, toalpha);
+    m_patterns.emplace_back(pattern);
     // it is a list, so as long as we don't remove it from there, the pointer is valid
     void* rule = (void*)&(m_accumrules.back());
     m_rules.push_back(new lpexp::Rule(e, rule));
@@ -86,6 +91,101 @@ AccumAutomata::compile()
     DfAutomata dfautomata;
     ndfautoToDfauto(ndfautomata, dfautomata);
     m_dfoptautomata.compileFrom(dfautomata);
+    buildOutputCounts();
+}
+
+
+
+void
+AccumAutomata::buildOutputCounts()
+{
+    // Flatten the rules into a dense state x output table for the
+    // batched accumulator
+    m_noutputs = 0;
+    for (const auto& r : m_accumrules)
+        m_noutputs = std::max(r.getOutputIndex() + 1, m_noutputs);
+    int nstates = m_dfoptautomata.numStates();
+    m_state_output_counts.assign(size_t(nstates) * m_noutputs,
+                                 OutputRuleCount());
+    m_max_rules_per_output = 0;
+    for (int s = 0; s < nstates; ++s) {
+        int nrules              = 0;
+        void* const* rules      = getRulesInState(s, nrules);
+        OutputRuleCount* counts = m_state_output_counts.data()
+                                  + size_t(s) * m_noutputs;
+        for (int i = 0; i < nrules; ++i) {
+            const AccumRule* rule = (const AccumRule*)rules[i];
+            OutputRuleCount& c    = counts[rule->getOutputIndex()];
+            unsigned char& n      = rule->toAlpha() ? c.alpha : c.color;
+            OSL_ASSERT(n < 255);
+            ++n;
+            m_max_rules_per_output = std::max(int(n), m_max_rules_per_output);
+        }
+    }
+}
+
+
+
+std::vector<void*>
+AccumAutomata::ruleVector() const
+{
+    std::vector<void*> rules;
+    for (const auto& r : m_accumrules)
+        rules.push_back((void*)&r);
+    return rules;
+}
+
+
+
+std::string
+AccumAutomata::save() const
+{
+    std::string out = Strutil::fmt::format("lpeautomata 1 {}\n",
+                                           m_accumrules.size());
+    size_t i = 0;
+    for (const auto& r : m_accumrules) {
+        const std::string& pattern = m_patterns[i++];
+        out += Strutil::fmt::format("{} {} {}:", r.getOutputIndex(),
+                                    int(r.toAlpha()), pattern.size());
+        out += pattern;
+        out += "\n";
+    }
+    out += m_dfoptautomata.serialize(ruleVector());
+    return out;
+}
+
+
+
+bool
+AccumAutomata::load(string_view data)
+{
+    int version = 0, nrules = 0;
+    if (!Strutil::parse_prefix(data, "lpeautomata")
+        || !Strutil::parse_int(data, version) || version != 1
+        || !Strutil::parse_int(data, nrules)
+        || nrules != (int)m_accumrules.size())
+        return false;
+    // Make sure the rules match the ones we have
+    size_t i = 0;
+    for (const auto& r : m_accumrules) {
+        int outidx = -1, toalpha = -1, len = -1;
+        if (!Strutil::parse_int(data, outidx)
+            || !Strutil::parse_int(data, toalpha)
+            || !Strutil::parse_int(data, len) || !Strutil::parse_char(data, ':')
+            || outidx != r.getOutputIndex() || toalpha != int(r.toAlpha())
+            || len < 0 || size_t(len) > data.size()
+            || data.substr(0, len) != m_patterns[i++])
+            return false;
+        data.remove_prefix(len);
+    }
+    if (!m_dfoptautomata.deserialize(data, ruleVector()))
+        return false;
+    // Same as compile(), we don't need the parsed expressions anymore
+    for (auto& r : m_rules)
+        delete r;
+    m_rules.clear();
+    buildOutputCounts();
+    return true;
 }
 
 
@@ -116,7 +216,8 @@ Accumulator::Accumulator(const AccumAutomata* accauto)
     m_outputs.resize(maxouts + 1);
 
     // 0 is our initial state always
-    m_state = 0;
+    m_state      = 0;
+    m_stack_size = 0;
 }
 
 
@@ -136,7 +237,8 @@ void
 Accumulator::pushState()
 {
     OSL_ASSERT(m_state >= 0);
-    m_stack.push(m_state);
+    OSL_ASSERT(m_stack_size < max_stack_depth);
+    m_stack[m_stack_size++] = m_state;
 }
 
 
@@ -144,9 +246,8 @@ Accumulator::pushState()
 void
 Accumulator::popState()
 {
-    OSL_ASSERT(m_stack.size());
-    m_state = m_stack.top();
-    m_stack.pop();
+    OSL_ASSERT(m_stack_size > 0);
+    m_state = m_stack[--m_stack_size];
 }
 
 
@@ -3,6 +3,7 @@
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
 #include <OSL/accum.h>
+#include <OSL/batched_accum.h>
 #include <OSL/oslclosure.h>
 #include <OpenImageIO/unittest.h>
 
@@ -58,9 +59,34 @@ protected:
     std::vector<bool> m_received;
 };
 
+// Another fake AOV that records the values it gets, to compare the
+// accumulators bit for bit
+class ValueAov final : public Aov {
+public:
+    explicit ValueAov(size_t ntests) : m_color(ntests), m_alpha(ntests) {}
+    virtual ~ValueAov() {}
+
+    virtual void write(void* flush_data, Color3& color, float alpha,
+                       bool has_color, bool has_alpha)
+    {
+        size_t testno   = reinterpret_cast<size_t>(flush_data);
+        m_color[testno] = has_color ? color : Color3(-1.0f);
+        m_alpha[testno] = has_alpha ? alpha : -1.0f;
+    }
+
+    bool operator==(const ValueAov& other) const
+    {
+        return m_color == other.m_color && m_alpha == other.m_alpha;
+    }
+
+    std::vector<Color3> m_color;
+    std::vector<float> m_alpha;
+};
+
 // Simulate the tracing of a path with the accumulator
 void
-simulate(Accumulator& accum, const char** events, size_t testno)
+simulate(Accumulator& accum, const char** events, size_t testno,
+         const Color3& light = Color3(1, 1, 1))
 {
     accum.begin();
     accum.pushState();
@@ -79,12 +105,70 @@ simulate(Accumulator& accum, const char** events, size_t testno)
         events++;
     }
     // Here is were we have reached a light, accumulate color
-    accum.accum(Color3(1, 1, 1));
+    accum.accum(light);
     // Restore state and flush
     accum.popState();
     accum.end(reinterpret_cast<void*>(testno));
 }
 
+// Simulate the tracing of up to WidthT paths at once with the batched
+// accumulator, test cases [first, first + ntests) go to lanes [0, ntests)
+template<int WidthT>
+void
+simulate_batch(BatchedAccumulator<WidthT>& accum, const TestPath* test,
+               int first, int ntests, const Color3& light = Color3(1, 1, 1))
+{
+    Mask<WidthT> active(false);
+    const char* const* events[WidthT];
+    void* flush_data[WidthT];
+    for (int lane = 0; lane < WidthT; ++lane) {
+        active.set_on_if(lane, lane < ntests);
+        events[lane]     = lane < ntests ? test[first + lane].path : nullptr;
+        flush_data[lane] = reinterpret_cast<void*>(size_t(first + lane));
+    }
+    accum.begin();
+    accum.pushState();
+    // for each ray stop in the paths ...
+    for (;;) {
+        Mask<WidthT> walking(false);
+        const char* e[WidthT];
+        for (int lane = 0; lane < WidthT; ++lane) {
+            walking.set_on_if(lane, active[lane] && *events[lane]);
+            e[lane] = walking[lane] ? *events[lane] : "";
+        }
+        if (walking.all_off())
+            break;
+        // for each label in this hit, lanes may have different counts
+        for (;;) {
+            Mask<WidthT> labeled(false);
+            ustring syms[WidthT];
+            for (int lane = 0; lane < WidthT; ++lane) {
+                if (*e[lane]) {
+                    syms[lane] = ustring(e[lane], 1);
+                    labeled.set_on(lane);
+                    e[lane]++;
+                }
+            }
+            if (labeled.all_off())
+                break;
+            accum.move(syms, labeled);
+        }
+        // always finish the hit with a stop label
+        accum.move(Labels::STOP, walking);
+        for (int lane = 0; lane < WidthT; ++lane)
+            if (walking[lane])
+                events[lane]++;
+    }
+    // Here is were we have reached a light, accumulate color
+    Block<Color3, WidthT> color;
+    for (int lane = 0; lane < WidthT; ++lane)
+        color.set(lane, light);
+    accum.accum(color, active);
+    // Restore state and flush
+    accum.popState();
+    accum.end(flush_data, active);
+}
+
 int
 main()
 {
@@ -133,23 +217,26 @@ main()
     for (int i = 0; i < naovs; ++i)
         aovs.emplace_back(test, i);
 
-    // Create the automata and add the rules
-    AccumAutomata automata;
-
-    automata.addEventType(ustring("U"));
-    automata.addScatteringType(ustring("Y"));
+    // Add the custom symbols and the rules to an automata
+    auto add_rules = [&](AccumAutomata& automata) {
+        automata.addEventType(ustring("U"));
+        automata.addScatteringType(ustring("Y"));
 
-    OIIO_CHECK_ASSERT(automata.addRule("C[SG]*D*L", beauty));
-    OIIO_CHECK_ASSERT(automata.addRule("C[SG]*D{2,3}L", diffuse2_3));
-    OIIO_CHECK_ASSERT(automata.addRule("C[SG]*D*<L.'3'>", light3));
-    OIIO_CHECK_ASSERT(automata.addRule("C[SG]*<.D'1'>D*L", object_1));
-    OIIO_CHECK_ASSERT(automata.addRule("C<.[SG]>+D*L", specular));
-    OIIO_CHECK_ASSERT(automata.addRule("CD+L", diffuse));
-    OIIO_CHECK_ASSERT(automata.addRule("CD+<Ts>L", transpshadow));
-    OIIO_CHECK_ASSERT(automata.addRule("C<R[^D]>+D*L", reflections));
-    OIIO_CHECK_ASSERT(automata.addRule("C([SG]*D){1,2}L", nocaustic));
-    OIIO_CHECK_ASSERT(automata.addRule("CDY+U", custom));
+        OIIO_CHECK_ASSERT(automata.addRule("C[SG]*D*L", beauty));
+        OIIO_CHECK_ASSERT(automata.addRule("C[SG]*D{2,3}L", diffuse2_3));
+        OIIO_CHECK_ASSERT(automata.addRule("C[SG]*D*<L.'3'>", light3));
+        OIIO_CHECK_ASSERT(automata.addRule("C[SG]*<.D'1'>D*L", object_1));
+        OIIO_CHECK_ASSERT(automata.addRule("C<.[SG]>+D*L", specular));
+        OIIO_CHECK_ASSERT(automata.addRule("CD+L", diffuse));
+        OIIO_CHECK_ASSERT(automata.addRule("CD+<Ts>L", transpshadow));
+        OIIO_CHECK_ASSERT(automata.addRule("C<R[^D]>+D*L", reflections));
+        OIIO_CHECK_ASSERT(automata.addRule("C([SG]*D){1,2}L", nocaustic));
+        OIIO_CHECK_ASSERT(automata.addRule("CDY+U", custom));
+    };
 
+    // Create the automata and add the rules
+    AccumAutomata automata;
+    add_rules(automata);
     automata.compile();
 
     // now create the accumulator
@@ -175,6 +262,81 @@ main()
     OIIO_CHECK_ASSERT(aovs[reflections].check());
     OIIO_CHECK_ASSERT(aovs[nocaustic].check());
 
+    // Now the same simulation tracking 4 paths at once with the batched
+    // accumulator, it has to give the exact same results
+    std::vector<MyAov> batched_aovs;
+    for (int i = 0; i < naovs; ++i)
+        batched_aovs.emplace_back(test, i);
+
+    BatchedAccumulator<4> batched_accum(&automata);
+    for (int i = 0; i < naovs; ++i)
+        batched_accum.setAov(i, &batched_aovs[i], false, false);
+
+    int ntests = 0;
+    while (test[ntests].path[0])
+        ++ntests;
+    for (int i = 0; i < ntests; i += 4)
+        simulate_batch(batched_accum, test, i, std::min(4, ntests - i));
+
+    for (int i = beauty; i <= nocaustic; ++i)
+        OIIO_CHECK_ASSERT(batched_aovs[i].check());
+
+    // Save the compiled automata and reload it in a new one with the same
+    // rules, which has to give the same results without compiling
+    std::string saved = automata.save();
+    AccumAutomata mismatched;
+    OIIO_CHECK_ASSERT(mismatched.addRule("CD+L", beauty));
+    OIIO_CHECK_ASSERT(!mismatched.load(saved));
+
+    AccumAutomata reloaded;
+    add_rules(reloaded);
+    OIIO_CHECK_ASSERT(reloaded.load(saved));
+    OIIO_CHECK_EQUAL(reloaded.numStates(), automata.numStates());
+
+    std::vector<MyAov> reloaded_aovs;
+    for (int i = 0; i < naovs; ++i)
+        reloaded_aovs.emplace_back(test, i);
+
+    Accumulator reloaded_accum(&reloaded);
+    for (int i = 0; i < naovs; ++i)
+        reloaded_accum.setAov(i, &reloaded_aovs[i], false, false);
+    for (int i = 0; test[i].path[0]; ++i)
+        simulate(reloaded_accum, test[i].path, i);
+
+    for (int i = beauty; i <= nocaustic; ++i)
+        OIIO_CHECK_ASSERT(reloaded_aovs[i].check());
+
+    // Several rules adding to the same output from the same state add the
+    // value once per rule in both accumulators. Use a light color whose
+    // repeated sums round, so any difference in order shows.
+    AccumAutomata shared;
+    OIIO_CHECK_ASSERT(shared.addRule("C[SG]*D*L", 0));
+    OIIO_CHECK_ASSERT(shared.addRule("CD+L", 0));
+    OIIO_CHECK_ASSERT(shared.addRule("C.*L", 0));
+    OIIO_CHECK_ASSERT(shared.addRule("CD+L", 1, true));
+    OIIO_CHECK_ASSERT(shared.addRule("C[SG]*D*L", 1, true));
+    shared.compile();
+    OIIO_CHECK_EQUAL(shared.maxRulesPerOutput(), 3);
+
+    const Color3 light(0.1f, 0.7f, 1.3f);
+    std::vector<ValueAov> scalar_values(2, ValueAov(ntests));
+    std::vector<ValueAov> batched_values(2, ValueAov(ntests));
+    Accumulator shared_accum(&shared);
+    BatchedAccumulator<4> shared_batched(&shared);
+    for (int i = 0; i < 2; ++i) {
+        shared_accum.setAov(i, &scalar_values[i], false, false);
+        shared_batched.setAov(i, &batched_values[i], false, false);
+    }
+    for (int i = 0; i < ntests; ++i)
+        simulate(shared_accum, test[i].path, i, light);
+    for (int i = 0; i < ntests; i += 4)
+        simulate_batch(shared_batched, test, i, std::min(4, ntests - i),
+                       light);
+    OIIO_CHECK_ASSERT(scalar_values[0] == batched_values[0]);
+    OIIO_CHECK_ASSERT(scalar_values[1] == batched_values[1]);
+    // The diffuse only path gets the light three times
+    OIIO_CHECK_ASSERT(scalar_values[0].m_color[5] == light + light + light);
+
     std::cout << "Light expressions check OK" << std::endl;
     return unit_test_failures;
 }
@@ -270,10 +270,12 @@ void
 keyFromStateSet(const IntSet& states, StateSetKey& out_key)
 {
     out_key.clear();  // just in case
-    for (IntSet::const_iterator i = states.begin(); i != states.end(); ++i)
-        out_key.push_back(*i);
-    // Sort the ids so we make sure the vector is unique for each set
-    sort(out_key.begin(), out_key.end());
+    if (states.empty())
+        return;
+    // IntSet is sorted, so the last id tells us how many words we need
+    out_key.resize(*states.rbegin() / 64 + 1, 0);
+    for (int i : states)
+        out_key[i / 64] |= uint64_t(1) << (i % 64);
 }
 
 
@@ -414,105 +416,94 @@ DfAutomata::tostr() const
 
 
 
-bool
-DfAutomata::equivalent(const State* dfstateA, const State* dfstateB)
-{
-    // early exit if the size of the tables is different
-    if (dfstateA->m_symbol_trans.size() != dfstateB->m_symbol_trans.size())
-        return false;
-    // The pointed state by both transitions have to be the same or any of dfstateA and dfstateB
-    int destA = (dfstateA->m_wildcard_trans == dfstateA->getId()
-                 || dfstateA->m_wildcard_trans == dfstateB->getId())
-                    ? -2
-                    : dfstateA->m_wildcard_trans;
-    int destB = (dfstateB->m_wildcard_trans == dfstateA->getId()
-                 || dfstateB->m_wildcard_trans == dfstateB->getId())
-                    ? -2
-                    : dfstateB->m_wildcard_trans;
-    if (destA != destB)
-        return false;
-    // Rules have to be the same
-    if (dfstateA->m_rules != dfstateB->m_rules)
-        return false;
-    for (SymbolToInt::const_iterator i = dfstateA->m_symbol_trans.begin();
-         i != dfstateA->m_symbol_trans.end(); ++i) {
-        SymbolToInt::const_iterator other = dfstateB->m_symbol_trans.find(
-            i->first);
-        if (other == dfstateB->m_symbol_trans.end())
-            return false;
-        // The pointed state by both transitions have to be the same or any of dfstateA and dfstateB
-        int destA = (i->second == dfstateA->getId()
-                     || i->second == dfstateB->getId())
-                        ? -2
-                        : i->second;
-        int destB = (other->second == dfstateA->getId()
-                     || other->second == dfstateB->getId())
-                        ? -2
-                        : other->second;
-        // when they are -1 is because they are in the wildcard black list, anyway they have to match so ...
-        if (destA != destB)
-            return false;
-    }
-    // if everything passed, they are equivalent, congratulations.
-    return true;
-}
-
-
-
 void
 DfAutomata::removeEquivalentStates()
 {
-    std::vector<State*> newstatelist;
-    HashIntInt newfromold;
+    size_t nstates = m_states.size();
+    if (!nstates)
+        return;
+
+    // Block (equivalence class) of every state. Start by grouping the
+    // states with the same rules. Blocks are always numbered by first
+    // appearance so the initial state stays in block 0.
+    std::vector<int> block(nstates), newblock(nstates);
+    int nblocks = 0;
+    {
+        std::map<RuleSet, int> byrules;
+        for (size_t i = 0; i < nstates; ++i) {
+            RuleSet rules = m_states[i]->m_rules;
+            std::sort(rules.begin(), rules.end());
+            auto found = byrules.emplace(rules, nblocks);
+            if (found.second)
+                ++nblocks;
+            block[i] = found.first->second;
+        }
+    }
 
-    // First go through all states and delete all those
-    // that are equivalent with a previous one
-    for (size_t i = 0; i < m_states.size(); ++i) {
-        if (!m_states[i])  // it has already been removed
-            continue;
-        // create a new state id from newstatelist.size()
-        // move the pointer there and register the translation
-        int newstate = newfromold[i] = newstatelist.size();
-        newstatelist.push_back(m_states[i]);
-        for (size_t j = i + 1; j < m_states.size(); ++j)
-            if (m_states[j] && equivalent(m_states[i], m_states[j])) {
-                // put in the record that this state will be known as
-                // the one in newstate from now on
-                newfromold[j] = newstate;
-                delete m_states[j];
-                m_states[j] = NULL;
+    // Refine the partition until it is stable. Two states stay together
+    // only if every symbol takes them to the same block. The signature of
+    // a state is its current block, the block its wildcard leads to and
+    // the sorted (symbol, block) pairs that don't go where the wildcard
+    // does. A plain bitset key is also a word vector, so we reuse its hash.
+    std::vector<std::pair<uint64_t, uint64_t>> trans;
+    StateSetKey signature;
+    for (;;) {
+        std::unordered_map<StateSetKey, int, StateSetKeyHash> bysignature;
+        int newnblocks = 0;
+        for (size_t i = 0; i < nstates; ++i) {
+            const State* state = m_states[i];
+            int wildcard       = state->m_wildcard_trans >= 0
+                                     ? block[state->m_wildcard_trans]
+                                     : -1;
+            trans.clear();
+            for (const auto& t : state->m_symbol_trans) {
+                // -1 is for symbols in the wildcard's black list
+                int dest = t.second >= 0 ? block[t.second] : -1;
+                if (dest != wildcard)
+                    trans.emplace_back((uint64_t)t.first.data(),
+                                       (uint64_t)(int64_t)dest);
+            }
+            std::sort(trans.begin(), trans.end());
+            signature.clear();
+            signature.push_back(block[i]);
+            signature.push_back((uint64_t)(int64_t)wildcard);
+            for (const auto& t : trans) {
+                signature.push_back(t.first);
+                signature.push_back(t.second);
             }
+            auto found = bysignature.emplace(signature, newnblocks);
+            if (found.second)
+                ++newnblocks;
+            newblock[i] = found.first->second;
+        }
+        block.swap(newblock);
+        // Blocks can only be split, so same count means nothing changed
+        bool stable = newnblocks == nblocks;
+        nblocks     = newnblocks;
+        if (stable)
+            break;
+    }
+
+    // Keep the first state of every block and delete the rest
+    std::vector<State*> newstatelist(nblocks, NULL);
+    for (size_t i = 0; i < nstates; ++i) {
+        if (!newstatelist[block[i]]) {
+            newstatelist[block[i]] = m_states[i];
+            m_states[i]->m_id      = block[i];
+        } else
+            delete m_states[i];
     }
     // Everything has been moved now, but we still have to fix the
     // transitions so they point to the right states!
-    for (size_t i = 0; i < newstatelist.size(); ++i) {
-        State* state = newstatelist[i];
-        for (SymbolToInt::iterator j = state->m_symbol_trans.begin();
-             j != state->m_symbol_trans.end(); ++j) {
-            if (j->second
-                != -1) {  // if it is -1 it is just in the wildcards black list
-                // Get the new state that maps to the oldstate pointed by the transition
-                HashIntInt::const_iterator trans = newfromold.find(j->second);
-                if (trans != newfromold.end())
-                    j->second = trans->second;
-                else
-                    std::cerr
-                        << "[pathexp] broken translation list between states"
-                        << std::endl;
-            }
-        }
-        // Do the same with the wildcard
-        if (state->m_wildcard_trans >= 0) {
-            HashIntInt::const_iterator trans = newfromold.find(
-                state->m_wildcard_trans);
-            if (trans != newfromold.end())
-                state->m_wildcard_trans = trans->second;
-            else
-                std::cerr << "[pathexp] broken translation list between states"
-                          << std::endl;
-        }
+    for (State* state : newstatelist) {
+        for (auto& t : state->m_symbol_trans)
+            // if it is -1 it is just in the wildcards black list
+            if (t.second >= 0)
+                t.second = block[t.second];
+        if (state->m_wildcard_trans >= 0)
+            state->m_wildcard_trans = block[state->m_wildcard_trans];
     }
-    // switch to the new hopefully reduced state vector
+    // switch to the new reduced state vector
     m_states = newstatelist;
 }
 
@@ -687,4 +678,91 @@ DfOptimizedAutomata::compileFrom(const DfAutomata& dfautomata)
 }
 
 
+
+std::string
+DfOptimizedAutomata::serialize(const std::vector<void*>& rules) const
+{
+    std::string out = Strutil::fmt::format("dfoptautomata {}\n",
+                                           m_states.size());
+    for (const State& state : m_states) {
+        out += Strutil::fmt::format("{} {} {}\n", state.ntrans, state.nrules,
+                                    state.wildcard_trans);
+        // Symbols are length prefixed, they can contain any character
+        for (unsigned int i = 0; i < state.ntrans; ++i) {
+            const Transition& t = m_trans[state.begin_trans + i];
+            out += Strutil::fmt::format("{} {}:", t.state, t.symbol.length());
+            out += t.symbol.string();
+            out += "\n";
+        }
+        for (unsigned int i = 0; i < state.nrules; ++i) {
+            auto r = std::find(rules.begin(), rules.end(),
+                               m_rules[state.begin_rules + i]);
+            out += Strutil::fmt::format("{}\n", int(r - rules.begin()));
+        }
+    }
+    return out;
+}
+
+
+
+bool
+DfOptimizedAutomata::deserialize(string_view data,
+                                 const std::vector<void*>& rules)
+{
+    m_trans.clear();
+    m_rules.clear();
+    m_states.clear();
+    int nstates = 0;
+    bool ok     = Strutil::parse_prefix(data, "dfoptautomata")
+                  && Strutil::parse_int(data, nstates) && nstates >= 0;
+    for (int s = 0; ok && s < nstates; ++s) {
+        int ntrans = 0, nrules = 0, wildcard = -1;
+        ok = Strutil::parse_int(data, ntrans)
+             && Strutil::parse_int(data, nrules)
+             && Strutil::parse_int(data, wildcard) && ntrans >= 0
+             && nrules >= 0 && wildcard >= -1 && wildcard < nstates;
+        State state;
+        state.begin_trans    = m_trans.size();
+        state.ntrans         = 0;
+        state.begin_rules    = m_rules.size();
+        state.nrules         = 0;
+        state.wildcard_trans = wildcard;
+        for (int i = 0; ok && i < ntrans; ++i) {
+            int dest = -1, len = 0;
+            ok = Strutil::parse_int(data, dest) && Strutil::parse_int(data, len)
+                 && Strutil::parse_char(data, ':') && dest >= -1
+                 && dest < nstates && len >= 0 && size_t(len) <= data.size();
+            if (ok) {
+                Transition t;
+                t.state  = dest;
+                t.symbol = len ? ustring(data.substr(0, len)) : ustring();
+                data.remove_prefix(len);
+                m_trans.push_back(t);
+                state.ntrans++;
+            }
+        }
+        for (int i = 0; ok && i < nrules; ++i) {
+            int r = -1;
+            ok    = Strutil::parse_int(data, r) && r >= 0
+                    && r < (int)rules.size();
+            if (ok) {
+                m_rules.push_back(rules[r]);
+                state.nrules++;
+            }
+        }
+        // The transitions are sorted by symbol address, which is different
+        // on every run, so they have to be sorted again
+        std::sort(m_trans.begin() + state.begin_trans, m_trans.end(),
+                  DfOptimizedAutomata::Transition::trans_comp);
+        m_states.push_back(state);
+    }
+    if (!ok) {
+        m_trans.clear();
+        m_rules.clear();
+        m_states.clear();
+    }
+    return ok;
+}
+
+
 OSL_NAMESPACE_END
@@ -13,6 +13,8 @@
 
 #include <OSL/oslconfig.h>
 
+#include <OpenImageIO/hash.h>
+
 
 OSL_NAMESPACE_BEGIN
 
@@ -173,10 +175,18 @@ protected:
 
 
 // We need to make a set of sets of integers (states). For doing that
-// we need a unique key for a single set, which is going to be the list
-// of state ids sorted by value. And this is the type that is going to hold
-// that. Legal to use in a std::set
-typedef std::vector<int> StateSetKey;
+// we need a unique key for a single set, which is going to be a bitset
+// of the state ids packed in 64 bit words, with no trailing empty words.
+// Cheap to compare and hash, so it can index an unordered_map
+typedef std::vector<uint64_t> StateSetKey;
+
+struct StateSetKeyHash {
+    size_t operator()(const StateSetKey& key) const
+    {
+        return OIIO::farmhash::Hash((const char*)key.data(),
+                                    key.size() * sizeof(uint64_t));
+    }
+};
 
 // Compute the unique key for the given set of states
 void
@@ -251,6 +261,10 @@ public:
     void clear();
 
     /// Colapse all the equivalent states into single ones
+    ///
+    /// Uses partition refinement: states start grouped by their rules and
+    /// the groups are split by where their transitions lead until nothing
+    /// changes, which leaves the minimal automata.
     void removeEquivalentStates();
     /// Go through all the states and perform removeUselessTransitions
     /// method call on them
@@ -260,12 +274,6 @@ public:
     std::string tostr() const;
 
 protected:
-    /// Return true if two states are equivalent
-    ///
-    /// Two states are equivalent if their transition tables lead
-    /// to the same states for the same symbols
-    bool equivalent(const State* dfstateA, const State* dfstateB);
-
     // State vector with the automata
     std::vector<State*> m_states;
 };
@@ -284,7 +292,9 @@ public:
     // for it and the state(int) set in the original automata
     typedef std::pair<DfAutomata::State*, IntSet> Discovery;
     // The type that will index our new created states indexed by the set key
-    typedef std::map<StateSetKey, DfAutomata::State*> StateSetMap;
+    typedef std::unordered_map<StateSetKey, DfAutomata::State*,
+                               StateSetKeyHash>
+        StateSetMap;
 
     /// Take a state set and build a new df state (or return existing one)
     /// Also, if it was newly created, append it to the discovered list so we
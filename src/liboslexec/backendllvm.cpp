@@ -26,6 +26,7 @@ BackendLLVM::BackendLLVM(ShadingSystemImpl& shadingsys, ShaderGroup& group,
     , m_stat_llvm_irgen_time(0)
     , m_stat_llvm_opt_time(0)
     , m_stat_llvm_jit_time(0)
+    , m_cached_matrix_field(-1)
 {
     m_use_optix      = shadingsys.use_optix();
     m_use_rs_bitcode = !shadingsys.m_rs_bitcode.empty();
@@ -682,6 +683,126 @@ BackendLLVM::userdata_initialized_ref(int userdata_index)
 
 
 
+void
+BackendLLVM::collect_cached_matrices()
+{
+    m_cached_matrix_slots.clear();
+    // The renderer computes matrices for OptiX, and the batched backend
+    // keeps its own groupdata.
+    if (!shadingsys().opt_matrix_cache() || use_optix())
+        return;
+
+    ustring synonym = shadingsys().commonspace_synonym();
+    auto canonical  = [&](ustring space) {
+        return space == synonym ? Strings::common : space;
+    };
+    auto add = [&](ustring from, ustring to) {
+        from = canonical(from);
+        to   = canonical(to);
+        if (from.empty() || to.empty() || from == to)
+            return;
+        int slot = int(m_cached_matrix_slots.size());
+        m_cached_matrix_slots.emplace(std::make_pair(from.c_str(), to.c_str()),
+                                      slot);
+    };
+    // Transforms that the renderer may do nonlinearly don't use a matrix.
+    RendererServices* rend(shadingsys().renderer());
+    auto linear = [&](ustring from, ustring to, TypeDesc::VECSEMANTICS vec) {
+        return !rend->transform_points(NULL, from, to, 0.0f, NULL, NULL, 0,
+                                       vec);
+    };
+    auto vecsemantics = [](ustring opname) {
+        if (opname == "vector" || opname == "transformv")
+            return TypeDesc::VECTOR;
+        if (opname == "normal" || opname == "transformn")
+            return TypeDesc::NORMAL;
+        return TypeDesc::POINT;
+    };
+
+    for (int layer = 0, n = group().nlayers(); layer < n; ++layer) {
+        if (m_layer_remap[layer] == -1)
+            continue;
+        set_inst(layer);
+        for (const Opcode& op : inst()->ops()) {
+            ustring opname = op.opname();
+            int nargs      = op.nargs();
+            if (opname == "transform" || opname == "transformv"
+                || opname == "transformn") {
+                // transform (to, p) or transform (from, to, p)
+                Symbol* From = (nargs == 3) ? NULL : opargsym(op, 1);
+                Symbol* To   = opargsym(op, (nargs == 3) ? 1 : 2);
+                if (!To->typespec().is_string() || !To->is_constant()
+                    || (From && !From->is_constant()))
+                    continue;
+                ustring from = From ? From->get_string() : Strings::common;
+                ustring to   = To->get_string();
+                if (linear(from, to, vecsemantics(opname)))
+                    add(from, to);
+            } else if ((opname == "point" || opname == "vector"
+                        || opname == "normal")
+                       && nargs == 5) {
+                // point (space, x, y, z)
+                Symbol* Space = opargsym(op, 1);
+                if (Space->is_constant()
+                    && linear(Space->get_string(), ustring(),
+                              vecsemantics(opname)))
+                    add(Space->get_string(), Strings::common);
+            } else if (opname == "matrix" && (nargs == 3 || nargs == 18)) {
+                // matrix (from, to), matrix (space, f), matrix (space, ...)
+                Symbol* From = opargsym(op, 1);
+                Symbol* To   = opargsym(op, 2);
+                if (nargs == 3 && To->typespec().is_string()) {
+                    if (From->is_constant() && To->is_constant())
+                        add(From->get_string(), To->get_string());
+                } else if (From->is_constant()) {
+                    add(From->get_string(), Strings::common);
+                }
+            } else if (opname == "getmatrix") {
+                // getmatrix (from, to, M)
+                Symbol* From = opargsym(op, 1);
+                Symbol* To   = opargsym(op, 2);
+                if (From->is_constant() && To->is_constant())
+                    add(From->get_string(), To->get_string());
+            }
+        }
+    }
+}
+
+
+
+int
+BackendLLVM::cached_matrix_slot(ustring from, ustring to) const
+{
+    ustring synonym = shadingsys().commonspace_synonym();
+    if (from == synonym)
+        from = Strings::common;
+    if (to == synonym)
+        to = Strings::common;
+    auto found = m_cached_matrix_slots.find(
+        std::make_pair(from.c_str(), to.c_str()));
+    return found == m_cached_matrix_slots.end() ? -1 : found->second;
+}
+
+
+
+llvm::Value*
+BackendLLVM::cached_matrix_ptr(int slot)
+{
+    return groupdata_field_ptr(m_cached_matrix_field + 1 + slot);
+}
+
+
+
+llvm::Value*
+BackendLLVM::cached_matrix_flag_ptr(int slot)
+{
+    return ll.void_ptr(ll.GEP(llvm_type_groupdata(), groupdata_ptr(), 0,
+                              m_cached_matrix_field, slot,
+                              llnamefmt("matrix_cache_flags_ref")));
+}
+
+
+
 llvm::Value*
 BackendLLVM::llvm_call_function(const char* name, cspan<const Symbol*> args,
                                 bool deriv_ptrs)
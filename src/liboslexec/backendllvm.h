@@ -381,6 +381,33 @@ public:
     /// stored for the specified userdata index.
     llvm::Value* userdata_initialized_ref(int userdata_index = 0);
 
+    /// Find the pairs of coordinate systems, named by constant strings,
+    /// that the used layers of the group transform between.  Each gets a
+    /// groupdata slot where its matrix is cached the first time a shade
+    /// needs it, so the layers don't all ask the renderer for it again.
+    void collect_cached_matrices();
+
+    /// Return the groupdata slot caching the from->to matrix, or -1 if
+    /// that matrix isn't cached.
+    int cached_matrix_slot(ustring from, ustring to) const;
+
+    /// Return a void* to the cached matrix in the given slot.
+    llvm::Value* cached_matrix_ptr(int slot);
+
+    /// Return a void* to the char that tells if the matrix in the given
+    /// slot has been fetched this shade (0 = not yet, 1 = it failed,
+    /// 2 = fetched).
+    llvm::Value* cached_matrix_flag_ptr(int slot);
+
+    /// Can the string in sym, a result of the string ops, reach anything
+    /// besides the string shadeops that know the transient strings of the
+    /// ShadingContext (outputs, messages, closures, renderer calls, ...)?
+    bool string_escapes(const Symbol& sym, int depth = 0);
+
+    /// After a string creating op, generate the call that interns its
+    /// result if string_escapes() says it must be.
+    void llvm_intern_escaping_string(const Opcode& op);
+
     /// Generate LLVM code to zero out the variable (including derivs)
     ///
     void llvm_assign_zero(const Symbol& sym);
@@ -594,6 +621,11 @@ private:
     // Name of each indexed field in the groupdata, mostly for debugging.
     std::vector<std::string> m_groupdata_field_names;
 
+    // Groupdata slot of each cached from->to matrix, keyed by the
+    // characters of the two ustrings.
+    std::map<std::pair<const char*, const char*>, int> m_cached_matrix_slots;
+    int m_cached_matrix_field;  ///< Groupdata field of the cache flags
+
     bool m_use_optix;  ///< Compile for OptiX?
     bool m_use_rs_bitcode;  /// To use free function versions of Renderer Service functions.
 
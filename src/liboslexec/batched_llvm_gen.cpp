@@ -6355,6 +6355,19 @@ LLVMGEN(llvm_gen_noise)
 
 
 
+LLVMGEN(llvm_gen_octave_noise)
+{
+    // The runtime optimizer only substitutes fbm and turbulence for octave
+    // loops in groups that won't be executed batched.
+    Opcode& op(rop.inst()->ops()[opnum]);
+    rop.shadingcontext()->errorfmt(
+        "{} is not supported in batched execution, called from ({}:{})",
+        op.opname(), op.sourcefile(), op.sourceline());
+    return false;
+}
+
+
+
 LLVMGEN(llvm_gen_getattribute)
 {
     // getattribute() has eight "flavors":
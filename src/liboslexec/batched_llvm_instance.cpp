@@ -868,6 +868,9 @@ BatchedBackendLLVM::llvm_type_noise_options()
     comp_types.push_back(ll.type_triple());  // direction;
     comp_types.push_back(ll.type_float());   // bandwidth;
     comp_types.push_back(ll.type_float());   // impulses;
+    // Matches the scalar layout; the batched gabor noise never sets or
+    // reads impulse_table, gabor_impulse_table is scalar only.
+    comp_types.push_back(ll.type_int());  // impulse_table;
 
     m_llvm_type_noise_options = ll.type_struct(comp_types, "NoiseOptions");
 
@@ -877,6 +880,7 @@ BatchedBackendLLVM::llvm_type_noise_options()
     offset_by_index.push_back(offsetof(NoiseParams, direction));
     offset_by_index.push_back(offsetof(NoiseParams, bandwidth));
     offset_by_index.push_back(offsetof(NoiseParams, impulses));
+    offset_by_index.push_back(offsetof(NoiseParams, impulse_table));
     ll.validate_struct_data_layout(m_llvm_type_noise_options, offset_by_index);
 
     return m_llvm_type_noise_options;
@@ -2763,6 +2767,7 @@ BatchedBackendLLVM::run()
     // At this point, we already hold the lock for this group, by virtue
     // of ShadingSystemImpl::batch_jit_group.
     OIIO::Timer timer;
+    TraceScope trace(shadingsys(), "batched llvm setup", group().name());
     std::string err;
 
     {
@@ -2778,12 +2783,15 @@ BatchedBackendLLVM::run()
 #ifdef OSL_LLVM_NO_BITCODE
         ll.module(ll.new_module("llvm_ops"));
 #else
-        ll.module(ll.module_from_bitcode((char*)osl_llvm_compiled_ops_block,
-                                         osl_llvm_compiled_ops_size, "llvm_ops",
-                                         &err));
+        // Parsed once per thread, the group module only gets copies of the
+        // shadeops it calls, see LLVM_Util::module_from_prototype
+        const llvm::Module* prototype
+            = ll.prototype_module((char*)osl_llvm_compiled_ops_block,
+                                  osl_llvm_compiled_ops_size, "llvm_ops", &err);
         if (err.length())
             shadingcontext()->errorfmt("ParseBitcodeFile returned '{}'\n", err);
-        OSL_ASSERT(ll.module());
+        OSL_ASSERT(prototype);
+        ll.module_from_prototype(prototype);
 #endif
         // Create the ExecutionEngine
         if (!ll.make_jit_execengine(
@@ -2806,6 +2814,7 @@ BatchedBackendLLVM::run()
     m_library_selector = m_target_lib_helper->library_selector();
 
     m_stat_llvm_setup_time += timer.lap();
+    trace.next("batched llvm irgen");
 
     // Set up m_num_used_layers to be the number of layers that are
     // actually used, and m_layer_remap[] to map original layer numbers
@@ -2882,6 +2891,7 @@ BatchedBackendLLVM::run()
     }
     // llvm::Function* entry_func = group().num_entry_layers() ? NULL : funcs[m_num_used_layers-1];
     m_stat_llvm_irgen_time += timer.lap();
+    trace.next("batched llvm opt");
 
     if (shadingsys().m_max_local_mem_KB
         && m_llvm_local_mem / 1024 > shadingsys().m_max_local_mem_KB) {
@@ -2935,6 +2945,7 @@ BatchedBackendLLVM::run()
     ll.do_optimize();
 
     m_stat_llvm_opt_time += timer.lap();
+    trace.next("batched llvm jit");
 
     if (llvm_debug()) {
 #if 1
@@ -3001,6 +3012,7 @@ BatchedBackendLLVM::run()
     ll.module(NULL);
 
     m_stat_llvm_jit_time += timer.lap();
+    trace.end();
 
     m_stat_total_llvm_time = timer();
 
@@ -141,7 +141,12 @@ DECL(osl_gen_errorfmt, "xXhiXiX")
 DECL(osl_gen_warningfmt, "xXhiXiX")
 DECL(osl_formatfmt, "hXhiXiX")
 DECL(osl_split, "ihXhii")
+DECL(osl_intern_s, "hh")
+DECL(osl_intern_strings, "xXi")
 DECL(osl_incr_layers_executed, "xX")
+DECL(osl_profile_begin, "xX")
+DECL(osl_profile_end_layer, "xXi")
+DECL(osl_profile_end_op, "xXii")
 
 // For legacy printf support
 DECL(osl_printf, "xXh*")
@@ -160,6 +165,10 @@ NOISE_IMPL(simplexnoise)
 NOISE_DERIV_IMPL(simplexnoise)
 NOISE_IMPL(usimplexnoise)
 NOISE_DERIV_IMPL(usimplexnoise)
+DECL(osl_cellnoise_fbm, "ffXXXiff")
+DECL(osl_cellnoise_turbulence, "ffXXXiff")
+DECL(osl_hashnoise_fbm, "ffXXXiff")
+DECL(osl_hashnoise_turbulence, "ffXXXiff")
 GENERIC_NOISE_DERIV_IMPL(gabornoise)
 GENERIC_NOISE_DERIV_IMPL(genericnoise)
 NOISE_IMPL(nullnoise)
@@ -180,7 +189,9 @@ DECL(osl_noiseparams_set_do_filter, "xXi")
 DECL(osl_noiseparams_set_direction, "xXv")
 DECL(osl_noiseparams_set_bandwidth, "xXf")
 DECL(osl_noiseparams_set_impulses, "xXf")
+DECL(osl_noiseparams_set_impulse_table, "xXi")
 DECL(osl_count_noise, "xX")
+DECL(osl_count_noises, "xXi")
 DECL(osl_hash_ii, "ii")
 DECL(osl_hash_if, "if")
 DECL(osl_hash_iff, "iff")
@@ -215,6 +226,9 @@ DECL(osl_get_matrix, "iXXh")
 DECL(osl_get_inverse_matrix, "iXXh")
 DECL(osl_transform_triple, "iXXiXihhi")
 DECL(osl_transform_triple_nonlinear, "iXXiXihhi")
+DECL(osl_transform_triple_cached, "iXXiXiXXhhi")
+DECL(osl_get_cached_matrix, "iXXXXhh")
+DECL(osl_prepend_cached_matrix, "iXXXXhh")
 DECL(osl_transform_vmv, "xXXX")
 DECL(osl_transform_dvmdv, "xXXX")
 DECL(osl_transformv_vmv, "xXXX")
@@ -367,6 +381,7 @@ DECL(osl_stoi_is, "ih")
 DECL(osl_stof_fs, "fh")
 DECL(osl_substr_ssii, "hhii")
 DECL(osl_regex_impl, "iXhXihi")
+DECL(osl_regex_compiled_impl, "iXhXii")
 
 // Used by wide code generator, but are uniform calls
 DECL(osl_texture_decode_wrapmode, "ih");
@@ -1448,8 +1448,10 @@ DECLFOLDER(constfold_regex_search)
         OSL_DASSERT(Subj.typespec().is_string() && Reg.typespec().is_string());
         ustring s(Subj.get_string());
         ustring r(Reg.get_string());
-        std::regex reg(r.string());
-        int result = std::regex_search(s.string(), reg);
+        const CompiledRegex& reg(rop.shadingsys().find_regex(r));
+        if (!reg.valid())
+            return 0;  // Leave the error to the shader's execution
+        int result = reg.matches(s, false);
         int cind   = rop.add_constant(result);
         rop.turn_into_assign(op, cind, "const fold regex_search");
         return 1;
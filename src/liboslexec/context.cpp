@@ -2,6 +2,7 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
 #include <cstdint>
 #include <cstdio>
 #include <string>
@@ -49,6 +50,7 @@ ShadingContext::ShadingContext(ShadingSystemImpl& shadingsys,
     , m_threadinfo(threadinfo)
     , m_group(NULL)
     , m_max_warnings(shadingsys.max_warnings_per_thread())
+    , m_npoints(0)
     , m_dictionary(NULL)
     , batch_size_executed(0)
 {
@@ -71,20 +73,18 @@ ShadingContext::~ShadingContext()
 
 
 bool
-ShadingContext::execute_init(ShaderGroup& sgroup, int threadindex,
-                             int shadeindex, ShaderGlobals& ssg,
-                             void* userdata_base_ptr, void* output_base_ptr,
-                             bool run)
+ShadingContext::bind_group(ShaderGroup& sgroup, int npoints)
 {
     if (m_group)
         execute_cleanup();
     batch_size_executed = 0;
     m_group             = &sgroup;
     m_ticks             = 0;
+    m_npoints           = npoints;
 
     // Optimize if we haven't already
     if (sgroup.nlayers()) {
-        sgroup.start_running();
+        sgroup.start_running(npoints);
         if (!sgroup.jitted()) {
             auto ctx = shadingsys().get_context(thread_info());
             shadingsys().optimize_group(sgroup, ctx, true /*do_jit*/);
@@ -101,6 +101,80 @@ ShadingContext::execute_init(ShaderGroup& sgroup, int threadindex,
         // empty shader - nothing to do!
         return false;
     }
+    if (shadingsys().profile_layers())
+        profile_layers_init();
+    return true;
+}
+
+
+
+void
+ShadingContext::profile_layers_init()
+{
+    int nlayers = group()->nlayers();
+    m_layer_profile.resize(nlayers);
+    for (int i = 0; i < nlayers; ++i) {
+        m_layer_profile[i].clear();
+        m_layer_profile[i].name = (*group())[i]->layername();
+    }
+    m_profile_depth = 0;
+}
+
+
+
+void
+ShadingContext::profile_end_layer(int layer)
+{
+    --m_profile_depth;
+    if (m_profile_depth < 0 || m_profile_depth >= max_profile_depth) {
+        // Unbalanced or too deeply nested, nothing we can time
+        m_profile_depth = std::max(m_profile_depth, 0);
+        return;
+    }
+    const ProfileFrame& frame(m_profile_stack[m_profile_depth]);
+    long long ticks = m_profile_timer.ticks() - frame.start;
+    // The enclosing layer (if any) must not count this time as its own
+    if (m_profile_depth > 0)
+        m_profile_stack[m_profile_depth - 1].children += ticks;
+    if (layer >= 0 && layer < (int)m_layer_profile.size()) {
+        LayerProfile& prof(m_layer_profile[layer]);
+        prof.ticks += ticks;
+        prof.self_ticks += ticks - frame.children;
+        prof.executions += 1;
+    }
+}
+
+
+
+void
+ShadingContext::profile_end_op(int layer, int opclass)
+{
+    --m_profile_depth;
+    if (m_profile_depth < 0 || m_profile_depth >= max_profile_depth) {
+        m_profile_depth = std::max(m_profile_depth, 0);
+        return;
+    }
+    // Op time stays part of the self time of its layer
+    long long ticks = m_profile_timer.ticks()
+                      - m_profile_stack[m_profile_depth].start;
+    if (layer >= 0 && layer < (int)m_layer_profile.size() && opclass >= 0
+        && opclass < ProfileOpNumClasses) {
+        LayerProfile& prof(m_layer_profile[layer]);
+        prof.op_ticks[opclass] += ticks;
+        prof.op_calls[opclass] += 1;
+    }
+}
+
+
+
+bool
+ShadingContext::execute_init(ShaderGroup& sgroup, int threadindex,
+                             int shadeindex, ShaderGlobals& ssg,
+                             void* userdata_base_ptr, void* output_base_ptr,
+                             bool run)
+{
+    if (!bind_group(sgroup, 1))
+        return false;
 
     int profile = shadingsys().m_profile;
     OIIO::Timer timer(profile ? OIIO::Timer::StartNow
@@ -121,6 +195,7 @@ ShadingContext::execute_init(ShaderGroup& sgroup, int threadindex,
 
     // Clear miscellaneous scratch space
     m_scratch_pool.clear();
+    m_transient_strings.clear();
 
     // Zero out stats for this execution
     clear_runtime_stats();
@@ -135,6 +210,7 @@ ShadingContext::execute_init(ShaderGroup& sgroup, int threadindex,
         ssg.Ci                  = NULL;
         ssg.thread_index        = threadindex;
         ssg.shade_index         = shadeindex;
+        TransientStrings::Scope strings(m_transient_strings);
         //TODO: Possible remove shadeindex from run_func
         run_func(&ssg, m_heap.get(), userdata_base_ptr, output_base_ptr,
                  shadeindex, sgroup.interactive_arena_ptr());
@@ -164,6 +240,7 @@ ShadingContext::execute_layer(int threadindex, int shadeindex,
     if (!run_func)
         return false;
 
+    TransientStrings::Scope strings(m_transient_strings);
     run_func(&ssg, m_heap.get(), userdata_base_ptr, output_base_ptr, shadeindex,
              group()->interactive_arena_ptr());
 
@@ -191,8 +268,13 @@ ShadingContext::execute_cleanup()
 
     if (shadingsys().m_profile) {
         record_runtime_stats();  // Transfer runtime stats to the shadingsys
-        shadingsys().m_stat_total_shading_time_ticks += m_ticks;
-        group()->m_stat_total_shading_time_ticks += m_ticks;
+        // Times go to per thread counters, gathered by getstats
+        thread_info()->record_profile(group()->name(), m_ticks, m_npoints);
+    }
+    if (!m_layer_profile.empty()) {
+        thread_info()->record_layer_profile(group()->id(), group()->name(),
+                                            m_layer_profile);
+        m_layer_profile.clear();
     }
 
     return true;
@@ -205,6 +287,7 @@ ShadingContext::execute(ShaderGroup& sgroup, int threadindex, int shadeindex,
                         ShaderGlobals& ssg, void* userdata_base_ptr,
                         void* output_base_ptr, bool run)
 {
+    TraceScope trace(shadingsys(), trace_sample("execute"), sgroup.name(), 2);
     int n = sgroup.m_exec_repeat;
     Vec3 Psave, Nsave;  // for repeats
     bool repeat = (n > 1);
@@ -240,6 +323,67 @@ ShadingContext::execute(ShaderGroup& sgroup, int threadindex, int shadeindex,
 }
 
 
+
+bool
+ShadingContext::execute_many(ShaderGroup& sgroup, int threadindex,
+                             int shadeindex_begin, span<ShaderGlobals> globals,
+                             void* userdata_base_ptr, void* output_base_ptr)
+{
+    if (globals.empty())
+        return true;
+    if (!bind_group(sgroup, int(globals.size())))
+        return false;
+    RunLLVMGroupFunc init_func  = sgroup.llvm_compiled_init();
+    RunLLVMGroupFunc entry_func = sgroup.llvm_compiled_layer(
+        sgroup.nlayers() - 1);
+    if (!init_func || !entry_func)
+        return false;
+
+    int profile = shadingsys().m_profile;
+    OIIO::Timer timer(profile ? OIIO::Timer::StartNow
+                              : OIIO::Timer::DontStartNow);
+
+    // Group level setup, done once for all the points. The closure and
+    // scratch pools are not cleared between points, so the closures of
+    // every point stay valid until the next execution on this context.
+    // Transient strings never outlive the point that made them, so their
+    // arena is reset for every point.
+    size_t heap_size_needed = sgroup.llvm_groupdata_size();
+    reserve_heap(heap_size_needed);
+    bool clearmemory = shadingsys().m_clearmemory;
+    m_closure_pool.clear();
+    m_scratch_pool.clear();
+    clear_runtime_stats();
+    void* arena = sgroup.interactive_arena_ptr();
+
+    for (size_t i = 0; i < globals.size(); ++i) {
+        ShaderGlobals& ssg = globals[i];
+        int shadeindex     = shadeindex_begin + int(i);
+        // Only the per point resets in here
+        if (clearmemory)
+            memset(m_heap.get(), 0, heap_size_needed);
+        m_messages.clear();
+        m_transient_strings.clear();
+        TransientStrings::Scope strings(m_transient_strings);
+        ssg.context             = this;
+        ssg.shadingStateUniform = &(shadingsys().m_shading_state_uniform);
+        ssg.renderer            = renderer();
+        ssg.Ci                  = NULL;
+        ssg.thread_index        = threadindex;
+        ssg.shade_index         = shadeindex;
+        init_func(&ssg, m_heap.get(), userdata_base_ptr, output_base_ptr,
+                  shadeindex, arena);
+        entry_func(&ssg, m_heap.get(), userdata_base_ptr, output_base_ptr,
+                   shadeindex, arena);
+    }
+
+    if (profile)
+        m_ticks += timer.ticks();
+    // Errors, printfs and stats of all the points are processed at once
+    return execute_cleanup();
+}
+
+
 #if OSL_USE_BATCHED
 
 template<int WidthT>
@@ -255,6 +399,7 @@ ShadingContext::Batched<WidthT>::execute_init(
     context().batch_size_executed = batch_size;
     context().m_group             = &sgroup;
     context().m_ticks             = 0;
+    context().m_npoints           = batch_size;
 
     // Optimize if we haven't already
     if (sgroup.nlayers()) {
@@ -384,6 +529,8 @@ ShadingContext::Batched<WidthT>::execute(
     void* userdata_base_ptr, void* output_base_ptr, bool run)
 {
     OSL_ASSERT(is_aligned<64>(&bsg));
+    TraceScope trace(shadingsys(), context().trace_sample("batched execute"),
+                     sgroup.name(), 2);
     int n = sgroup.m_exec_repeat;
 
     Block<Vec3, WidthT> Psave, Nsave;  // for repeats
@@ -614,17 +761,18 @@ ShadingContext::symbol_data(const Symbol& sym) const
 
 
 
-const std::regex&
+const CompiledRegex&
 ShadingContext::find_regex(ustring r)
 {
     RegexMap::const_iterator found = m_regex_map.find(r);
     if (found != m_regex_map.end())
         return *found->second;
-    // otherwise, it wasn't found, add it
-    m_regex_map[r].reset(new std::regex(r.c_str()));
-    m_shadingsys.m_stat_regexes += 1;
-    // std::cerr << "Made new regex for " << r << "\n";
-    return *m_regex_map[r];
+    // otherwise, it wasn't found, get it from the shared cache
+    const CompiledRegex& regex(shadingsys().find_regex(r));
+    if (!regex.valid())
+        errorfmt("Invalid regex \"{}\": {}", r, regex.error());
+    m_regex_map[r] = &regex;
+    return regex;
 }
 
 
@@ -640,8 +788,45 @@ ShadingContext::osl_get_attribute(ShaderGlobals* sg, void* objdata,
     // Change the #if's below if you want to
     OIIO::Timer timer;
 #endif
-    bool ok;
+    if (m_cache_object_attributes < 0)
+        m_cache_object_attributes = renderer()->supports(
+            "cache_object_attributes");
+    // The renderer may let us remember the "object:*" attributes of the
+    // object being shaded, so asking for them again costs one lookup.
+    CachedAttribute* cached = nullptr;
+    if (objdata && m_cache_object_attributes) {
+        if (objdata != m_attribute_objdata) {
+            clear_attribute_cache();
+            m_attribute_objdata = objdata;
+        }
+        const int idx = array_lookup ? index : -1;
+        for (CachedAttribute& a : m_attribute_cache) {
+            if (a.name == attr_name && a.object == obj_name
+                && a.type == attr_type && a.index == idx
+                && a.derivs == dest_derivs) {
+                cached = &a;
+                break;
+            }
+        }
+        if (cached && cached->cacheable) {
+            if (cached->ok)
+                memcpy(attr_dest, &m_attribute_values[cached->offset],
+                       cached->size);
+            return cached->ok;
+        }
+        if (!cached && m_attribute_cache.size() < max_cached_attributes) {
+            bool cacheable = OIIO::Strutil::starts_with(ustring_from(attr_name),
+                                                        "object:");
+            m_attribute_cache.push_back({ obj_name, attr_name, attr_type, idx,
+                                          dest_derivs, cacheable, false, 0,
+                                          0 });
+            cached = cacheable ? &m_attribute_cache.back() : nullptr;
+        } else {
+            cached = nullptr;
+        }
+    }
 
+    bool ok;
     if (array_lookup)
         ok = renderer()->get_array_attribute(sg, dest_derivs, obj_name,
                                              attr_type, attr_name, index,
@@ -650,6 +835,17 @@ ShadingContext::osl_get_attribute(ShaderGlobals* sg, void* objdata,
         ok = renderer()->get_attribute(sg, dest_derivs, obj_name, attr_type,
                                        attr_name, attr_dest);
 
+    if (cached) {
+        cached->ok = ok;
+        if (ok) {
+            cached->offset = m_attribute_values.size();
+            cached->size   = attr_type.size() * (dest_derivs ? 3 : 1);
+            m_attribute_values.insert(m_attribute_values.end(),
+                                      (const char*)attr_dest,
+                                      (const char*)attr_dest + cached->size);
+        }
+    }
+
 #if 0
     double time = timer();
     shadingsys().m_stat_getattribute_time += time;
@@ -670,6 +866,33 @@ osl_incr_layers_executed(ShaderGlobals* sg)
     ctx->incr_layers_executed();
 }
 
+
+
+OSL_SHADEOP void
+osl_profile_begin(ShaderGlobals* sg)
+{
+    ShadingContext* ctx = (ShadingContext*)sg->context;
+    ctx->profile_begin();
+}
+
+
+
+OSL_SHADEOP void
+osl_profile_end_layer(ShaderGlobals* sg, int layer)
+{
+    ShadingContext* ctx = (ShadingContext*)sg->context;
+    ctx->profile_end_layer(layer);
+}
+
+
+
+OSL_SHADEOP void
+osl_profile_end_op(ShaderGlobals* sg, int layer, int opclass)
+{
+    ShadingContext* ctx = (ShadingContext*)sg->context;
+    ctx->profile_end_op(layer, opclass);
+}
+
 #if OSL_USE_BATCHED
 // Explicit template instantiation for supported batch sizes
 template class ShadingContext::Batched<16>;
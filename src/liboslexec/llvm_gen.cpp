@@ -1866,6 +1866,18 @@ LLVMGEN(llvm_gen_construct_color)
 
 
 
+// Return the groupdata slot caching the matrix between two spaces given
+// by string symbols, or -1 if they aren't constant or it isn't cached.
+static int
+cached_matrix_slot(BackendLLVM& rop, const Symbol& From, const Symbol& To)
+{
+    if (!From.is_constant() || !To.is_constant())
+        return -1;
+    return rop.cached_matrix_slot(From.get_string(), To.get_string());
+}
+
+
+
 // Construct spatial triple (point, vector, normal), optionally with a
 // transformation from a named coordinate system.
 LLVMGEN(llvm_gen_construct_triple)
@@ -1909,6 +1921,26 @@ LLVMGEN(llvm_gen_construct_triple)
         llvm::Value* from_arg = rop.llvm_load_value(Space);
         llvm::Value* to_arg   = rop.llvm_const_hash(Strings::common);
 
+        RendererServices* rend(rop.shadingsys().renderer());
+        bool nonlinear = rend->transform_points(NULL, from, to, 0.0f, NULL,
+                                                NULL, 0, vectype);
+        int slot       = rop.cached_matrix_slot(from, Strings::common);
+        if (slot >= 0 && !nonlinear) {
+            // The matrix is cached in the groupdata
+            llvm::Value* args[] = { rop.sg_void_ptr(),
+                                    rop.llvm_void_ptr(Result),
+                                    rop.ll.constant(Result.has_derivs()),
+                                    rop.llvm_void_ptr(Result),
+                                    rop.ll.constant(Result.has_derivs()),
+                                    rop.cached_matrix_ptr(slot),
+                                    rop.cached_matrix_flag_ptr(slot),
+                                    from_arg,
+                                    to_arg,
+                                    rop.ll.constant((int)vectype) };
+            rop.ll.call_function("osl_transform_triple_cached", args);
+            return true;
+        }
+
         llvm::Value* args[] = { rop.sg_void_ptr(),
                                 rop.llvm_void_ptr(Result),
                                 rop.ll.constant(Result.has_derivs()),
@@ -1917,9 +1949,7 @@ LLVMGEN(llvm_gen_construct_triple)
                                 from_arg,
                                 to_arg,
                                 rop.ll.constant((int)vectype) };
-        RendererServices* rend(rop.shadingsys().renderer());
-        if (rend->transform_points(NULL, from, to, 0.0f, NULL, NULL, 0,
-                                   vectype)) {
+        if (nonlinear) {
             // renderer potentially knows about a nonlinear transformation.
             // Note that for the case of non-constant strings, passing empty
             // from & to will make transform_points just tell us if ANY
@@ -1954,13 +1984,27 @@ LLVMGEN(llvm_gen_matrix)
     OSL_DASSERT(nargs == 2 || nargs == 3 || nargs == 17 || nargs == 18);
 
     if (using_two_spaces) {
-        llvm::Value* args[] = {
-            rop.sg_void_ptr(),                          // shader globals
-            rop.llvm_void_ptr(Result),                  // result
-            rop.llvm_load_value(*rop.opargsym(op, 1)),  // from
-            rop.llvm_load_value(*rop.opargsym(op, 2)),  // to
-        };
-        rop.ll.call_function("osl_get_from_to_matrix", args);
+        int slot = cached_matrix_slot(rop, *rop.opargsym(op, 1),
+                                      *rop.opargsym(op, 2));
+        if (slot >= 0) {
+            llvm::Value* args[] = {
+                rop.sg_void_ptr(),                          // shader globals
+                rop.llvm_void_ptr(Result),                  // result
+                rop.cached_matrix_ptr(slot),                // cached matrix
+                rop.cached_matrix_flag_ptr(slot),           // cache flag
+                rop.llvm_load_value(*rop.opargsym(op, 1)),  // from
+                rop.llvm_load_value(*rop.opargsym(op, 2)),  // to
+            };
+            rop.ll.call_function("osl_get_cached_matrix", args);
+        } else {
+            llvm::Value* args[] = {
+                rop.sg_void_ptr(),                          // shader globals
+                rop.llvm_void_ptr(Result),                  // result
+                rop.llvm_load_value(*rop.opargsym(op, 1)),  // from
+                rop.llvm_load_value(*rop.opargsym(op, 2)),  // to
+            };
+            rop.ll.call_function("osl_get_from_to_matrix", args);
+        }
     } else {
         if (nfloats == 1) {
             for (int i = 0; i < 16; i++) {
@@ -1979,7 +2023,22 @@ LLVMGEN(llvm_gen_matrix)
         } else {
             OSL_ASSERT(0);
         }
-        if (using_space) {
+        Symbol& Space = *rop.opargsym(op, 1);
+        int slot      = using_space && Space.is_constant()
+                            ? rop.cached_matrix_slot(Space.get_string(),
+                                                     Strings::common)
+                            : -1;
+        if (slot >= 0) {
+            llvm::Value* args[] = {
+                rop.sg_void_ptr(),                     // shader globals
+                rop.llvm_void_ptr(Result),             // result
+                rop.cached_matrix_ptr(slot),           // cached matrix
+                rop.cached_matrix_flag_ptr(slot),      // cache flag
+                rop.llvm_load_value(Space),            // from
+                rop.llvm_const_hash(Strings::common),  // to
+            };
+            rop.ll.call_function("osl_prepend_cached_matrix", args);
+        } else if (using_space) {
             llvm::Value* args[] = {
                 rop.sg_void_ptr(),                          // shader globals
                 rop.llvm_void_ptr(Result),                  // result
@@ -2005,13 +2064,27 @@ LLVMGEN(llvm_gen_getmatrix)
     Symbol& To     = *rop.opargsym(op, 2);
     Symbol& M      = *rop.opargsym(op, 3);
 
-    llvm::Value* args[] = {
-        rop.sg_void_ptr(),     // shader globals
-        rop.llvm_void_ptr(M),  // matrix result
-        rop.llvm_load_value(From),
-        rop.llvm_load_value(To),
-    };
-    llvm::Value* result = rop.ll.call_function("osl_get_from_to_matrix", args);
+    llvm::Value* result;
+    int slot = cached_matrix_slot(rop, From, To);
+    if (slot >= 0) {
+        llvm::Value* args[] = {
+            rop.sg_void_ptr(),                 // shader globals
+            rop.llvm_void_ptr(M),              // matrix result
+            rop.cached_matrix_ptr(slot),       // cached matrix
+            rop.cached_matrix_flag_ptr(slot),  // cache flag
+            rop.llvm_load_value(From),
+            rop.llvm_load_value(To),
+        };
+        result = rop.ll.call_function("osl_get_cached_matrix", args);
+    } else {
+        llvm::Value* args[] = {
+            rop.sg_void_ptr(),     // shader globals
+            rop.llvm_void_ptr(M),  // matrix result
+            rop.llvm_load_value(From),
+            rop.llvm_load_value(To),
+        };
+        result = rop.ll.call_function("osl_get_from_to_matrix", args);
+    }
     rop.llvm_store_value(result, Result);
     rop.llvm_zero_derivs(M);
     return true;
@@ -2060,6 +2133,25 @@ LLVMGEN(llvm_gen_transform)
         vectype = TypeDesc::VECTOR;
     else if (op.opname() == "transformn")
         vectype = TypeDesc::NORMAL;
+    RendererServices* rend(rop.shadingsys().renderer());
+    bool nonlinear = rend->transform_points(NULL, from, to, 0.0f, NULL, NULL,
+                                            0, vectype);
+    int slot       = rop.cached_matrix_slot(from, to);
+    if (slot >= 0 && !nonlinear) {
+        // The matrix is cached in the groupdata
+        llvm::Value* args[] = { rop.sg_void_ptr(),
+                                rop.llvm_void_ptr(*P),
+                                rop.ll.constant(P->has_derivs()),
+                                rop.llvm_void_ptr(*Result),
+                                rop.ll.constant(Result->has_derivs()),
+                                rop.cached_matrix_ptr(slot),
+                                rop.cached_matrix_flag_ptr(slot),
+                                rop.llvm_const_hash(from),
+                                rop.llvm_const_hash(to),
+                                rop.ll.constant((int)vectype) };
+        rop.ll.call_function("osl_transform_triple_cached", args);
+        return true;
+    }
     llvm::Value* args[] = { rop.sg_void_ptr(),
                             rop.llvm_void_ptr(*P),
                             rop.ll.constant(P->has_derivs()),
@@ -2068,8 +2160,7 @@ LLVMGEN(llvm_gen_transform)
                             rop.llvm_load_value(*From),
                             rop.llvm_load_value(*To),
                             rop.ll.constant((int)vectype) };
-    RendererServices* rend(rop.shadingsys().renderer());
-    if (rend->transform_points(NULL, from, to, 0.0f, NULL, NULL, 0, vectype)) {
+    if (nonlinear) {
         // renderer potentially knows about a nonlinear transformation.
         // Note that for the case of non-constant strings, passing empty
         // from & to will make transform_points just tell us if ANY
@@ -2292,6 +2383,28 @@ LLVMGEN(llvm_gen_regex)
                 || (Match.typespec().is_array()
                     && Match.typespec().elementtype().is_int()));
 
+    if (Pattern.is_constant() && !rop.use_optix()) {
+        // Compile a constant pattern now, the call gets the compiled regex
+        ustring pattern(Pattern.get_string());
+        const CompiledRegex& regex(rop.shadingsys().find_regex(pattern));
+        if (!regex.valid())
+            rop.shadingcontext()->errorfmt("Invalid regex \"{}\": {}",
+                                           pattern, regex.error());
+        llvm::Value* args[] = {
+            rop.ll.constant_ptr(const_cast<CompiledRegex*>(&regex)),
+            rop.llvm_load_value(Subject),
+            rop.llvm_void_ptr(Match),
+            rop.ll.constant(do_match_results
+                                ? Match.typespec().arraylength()
+                                : 0),
+            rop.ll.constant(fullmatch),
+        };
+        llvm::Value* ret = rop.ll.call_function("osl_regex_compiled_impl",
+                                                args);
+        rop.llvm_store_value(ret, Result);
+        return true;
+    }
+
     llvm::Value* call_args[] = {
         rop.sg_void_ptr(),             // First arg is ShaderGlobals ptr
         rop.llvm_load_value(Subject),  // Next arg is subject string
@@ -3085,6 +3198,10 @@ llvm_gen_noise_options(BackendLLVM& rop, int opnum, int first_optional_arg)
 {
     llvm::Value* opt = rop.temp_noise_options_void_ptr();
     rop.ll.call_function("osl_init_noise_options", rop.sg_void_ptr(), opt);
+    // The shared gabor impulse table is host only
+    if (rop.shadingsys().gabor_impulse_table() && !rop.use_optix())
+        rop.ll.call_function("osl_noiseparams_set_impulse_table", opt,
+                             rop.ll.constant(1));
 
     Opcode& op(rop.inst()->ops()[opnum]);
     for (int a = first_optional_arg; a < op.nargs(); ++a) {
@@ -3325,6 +3442,51 @@ LLVMGEN(llvm_gen_noise)
 
 
 
+// fbm and turbulence aren't in the language; the runtime optimizer
+// substitutes them for the octave loops over cell or hash noise:
+//     fbm|turbulence sum name P freq amp octaves lacunarity gain
+// reads and writes sum, freq, and amp, like the loop would have.
+LLVMGEN(llvm_gen_octave_noise)
+{
+    Opcode& op(rop.inst()->ops()[opnum]);
+
+    OSL_DASSERT(op.nargs() == 8);
+    Symbol& Sum        = *rop.opargsym(op, 0);
+    Symbol& Name       = *rop.opargsym(op, 1);
+    Symbol& P          = *rop.opargsym(op, 2);
+    Symbol& Freq       = *rop.opargsym(op, 3);
+    Symbol& Amp        = *rop.opargsym(op, 4);
+    Symbol& Octaves    = *rop.opargsym(op, 5);
+    Symbol& Lacunarity = *rop.opargsym(op, 6);
+    Symbol& Gain       = *rop.opargsym(op, 7);
+    OSL_DASSERT(Name.is_constant() && Name.typespec().is_string());
+
+    std::string funcname = fmtformat("osl_{}_{}", Name.get_string(),
+                                     op.opname());
+    llvm::Value* args[] = { rop.llvm_load_value(Sum),
+                            rop.llvm_load_arg(P, false),
+                            rop.llvm_void_ptr(Freq),
+                            rop.llvm_void_ptr(Amp),
+                            rop.llvm_load_value(Octaves),
+                            rop.llvm_load_value(Lacunarity),
+                            rop.llvm_load_value(Gain) };
+    llvm::Value* r = rop.ll.call_function(funcname.c_str(), args);
+    // The octaves add nothing to the derivatives of sum (the optimizer
+    // made sure of it), so those are left as they were.
+    rop.llvm_store_value(r, Sum);
+
+    // Count each octave as one noise call, as the loop would have
+    if (rop.shadingsys().profile() >= 1) {
+        llvm::Value* args[] = { rop.sg_void_ptr(),
+                                rop.llvm_load_value(Octaves) };
+        rop.ll.call_function("osl_count_noises", args);
+    }
+
+    return true;
+}
+
+
+
 LLVMGEN(llvm_gen_getattribute)
 {
     // getattribute() has eight "flavors":
@@ -4260,6 +4422,9 @@ LLVMGEN(llvm_gen_split)
     args[4]          = rop.ll.constant(Results.typespec().arraylength());
     llvm::Value* ret = rop.ll.call_function("osl_split", args);
     rop.llvm_store_value(ret, R);
+    if (!rop.use_optix() && rop.string_escapes(Results))
+        rop.ll.call_function("osl_intern_strings", rop.llvm_void_ptr(Results),
+                             ret);
     return true;
 }
 
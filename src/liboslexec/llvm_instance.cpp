@@ -2,6 +2,7 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
 #include <bitset>
 #include <cmath>
 #include <iostream>
@@ -58,6 +59,11 @@ Schematically, we want to create code that resembles the following:
         // interpolated from the geom, or are connected to other layers.
         float param_0_foo;   // number is layer ID
         float param_1_bar;
+        // Array telling if we have already fetched each cached matrix
+        // this shade (0 = not yet, 1 = it failed, 2 = fetched), and the
+        // matrices between the named spaces the layers transform between
+        char matrix_cache_flags[num_cached_matrices];
+        Matrix44 matrix_object_to_common;
     };
 
     // Data for the interactively adjusted parameters of this group -- these
@@ -146,9 +152,43 @@ static ustring op_useparam("useparam");
 static ustring op_pointcloud_get("pointcloud_get");
 static ustring op_spline("spline");
 static ustring op_splineinverse("splineinverse");
+static ustring op_assign("assign");
+static ustring op_substr("substr");
+static ustring op_split("split");
+static ustring op_regex_search("regex_search");
+static ustring op_regex_match("regex_match");
 static ustring unknown_shader_group_name("<Unknown Shader Group Name>");
 
 
+
+// Which ProfileOpClass the layer profiler times an op as, or -1 if the op
+// isn't one of the expensive ones.
+static int
+profile_op_class(ustring opname)
+{
+    static const std::unordered_map<ustring, int> op_classes {
+        { ustring("texture"), ProfileOpTexture },
+        { ustring("texture3d"), ProfileOpTexture },
+        { ustring("environment"), ProfileOpTexture },
+        { ustring("gettextureinfo"), ProfileOpTexture },
+        { ustring("noise"), ProfileOpNoise },
+        { ustring("pnoise"), ProfileOpNoise },
+        { ustring("snoise"), ProfileOpNoise },
+        { ustring("psnoise"), ProfileOpNoise },
+        { ustring("cellnoise"), ProfileOpNoise },
+        { ustring("hashnoise"), ProfileOpNoise },
+        { ustring("getattribute"), ProfileOpGetattribute },
+        { ustring("trace"), ProfileOpTrace },
+        { ustring("pointcloud_search"), ProfileOpPointcloud },
+        { ustring("pointcloud_get"), ProfileOpPointcloud },
+        { ustring("pointcloud_write"), ProfileOpPointcloud },
+        { ustring("closure"), ProfileOpClosure },
+    };
+    auto found = op_classes.find(opname);
+    return found != op_classes.end() ? found->second : -1;
+}
+
+
 struct HelperFuncRecord {
     const char* argtypes;
     void (*function)();
@@ -403,6 +443,30 @@ BackendLLVM::llvm_type_groupdata()
             ++order;
         }
     }
+    // Last, the flags and slots of the cached matrices.
+    int ncached = int(m_cached_matrix_slots.size());
+    if (ncached) {
+        m_cached_matrix_field = order;
+        int sz                = (ncached + 3) & (~3);
+        fields.push_back(ll.type_array(ll.type_int8(), sz));
+        m_groupdata_field_names.emplace_back("matrix_cache_flags");
+        offset += sz * sizeof(int8_t);
+        ++order;
+        std::vector<std::string> names(ncached);
+        for (auto& s : m_cached_matrix_slots)
+            names[s.second] = fmtformat("matrix_{}_to_{}", s.first.first,
+                                        s.first.second);
+        for (int i = 0; i < ncached; ++i) {
+            fields.push_back(llvm_type(TypeMatrix));
+            m_groupdata_field_names.emplace_back(names[i]);
+            if (llvm_debug() >= 2)
+                print("  cached {}, field {}, offset {}\n", names[i], order,
+                      offset);
+            offset += int(sizeof(Matrix44));
+            ++order;
+        }
+    }
+
     group().llvm_groupdata_size(offset);
     if (llvm_debug() >= 2)
         print(" Group struct had {} fields, total size {}\n\n", order, offset);
@@ -603,6 +667,7 @@ BackendLLVM::llvm_type_noise_options()
     comp_types.push_back(ll.type_triple());  // direction;
     comp_types.push_back(ll.type_float());   // bandwidth;
     comp_types.push_back(ll.type_float());   // impulses;
+    comp_types.push_back(ll.type_int());     // impulse_table;
 
     m_llvm_type_noise_options = ll.type_struct(comp_types, "NoiseOptions");
 
@@ -613,6 +678,7 @@ BackendLLVM::llvm_type_noise_options()
     offset_by_index.push_back(offsetof(NoiseParams, direction));
     offset_by_index.push_back(offsetof(NoiseParams, bandwidth));
     offset_by_index.push_back(offsetof(NoiseParams, impulses));
+    offset_by_index.push_back(offsetof(NoiseParams, impulse_table));
     ll.validate_struct_data_layout(m_llvm_type_noise_options, offset_by_index);
 #endif
 
@@ -1240,6 +1306,70 @@ BackendLLVM::llvm_generate_debug_op_printf(const Opcode& op)
 
 
 
+// Does argument `arg` of op only go to a string shadeop that looks up
+// the transient strings of the context?
+static bool
+reads_transient_string(const Opcode& op, int arg)
+{
+    static ustring readers[] = { ustring("concat"),     ustring("strlen"),
+                                 ustring("hash"),       ustring("getchar"),
+                                 ustring("startswith"), ustring("endswith"),
+                                 ustring("stoi"),       ustring("stof"),
+                                 ustring("eq"),         ustring("neq") };
+    ustring opname = op.opname();
+    if (opname == op_substr || opname == op_regex_search
+        || opname == op_regex_match)
+        return arg == 1;  // The subject, not a regex pattern
+    if (opname == op_split)
+        return arg == 1 || arg == 3;
+    return std::find(std::begin(readers), std::end(readers), opname)
+           != std::end(readers);
+}
+
+
+
+bool
+BackendLLVM::string_escapes(const Symbol& sym, int depth)
+{
+    if (!shadingsys().opt_transient_strings() || depth > 8)
+        return true;
+    // Only the ops of this layer see temps and locals
+    if (sym.symtype() != SymTypeTemp && sym.symtype() != SymTypeLocal)
+        return true;
+    const OpcodeVec& ops(inst()->ops());
+    int end = std::min(sym.lastread() + 1, int(ops.size()));
+    for (int opnum = std::max(sym.firstread(), 0); opnum < end; ++opnum) {
+        const Opcode& op(ops[opnum]);
+        for (int a = 0; a < op.nargs(); ++a) {
+            if (opargsym(op, a) != &sym || !op.argread(a))
+                continue;
+            if ((op.opname() == op_assign || op.opname() == op_aref)
+                && a == 1) {
+                // Copied to another variable, follow that one
+                if (string_escapes(*opargsym(op, 0), depth + 1))
+                    return true;
+            } else if (!reads_transient_string(op, a)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+
+void
+BackendLLVM::llvm_intern_escaping_string(const Opcode& op)
+{
+    Symbol& R(*opargsym(op, 0));
+    if (!R.typespec().is_string() || !string_escapes(R))
+        return;
+    llvm::Value* s = ll.call_function("osl_intern_s", llvm_load_value(R));
+    llvm_store_value(s, R);
+}
+
+
+
 bool
 BackendLLVM::build_llvm_code(int beginop, int endop, llvm::BasicBlock* bb)
 {
@@ -1257,9 +1387,27 @@ BackendLLVM::build_llvm_code(int beginop, int endop, llvm::BasicBlock* bb)
             if (ll.debug_is_enabled())
                 ll.debug_set_location(op.sourcefile(),
                                       std::max(op.sourceline(), 1));
+            // Time the expensive ops when profiling layers. Jumping ops
+            // are control flow and never among them.
+            int opclass = -1;
+            if (shadingsys().profile_layers() && !use_optix()
+                && op.farthest_jump() < 0) {
+                opclass = profile_op_class(op.opname());
+                if (opclass >= 0)
+                    ll.call_function("osl_profile_begin", sg_void_ptr());
+            }
             bool ok = (*opd->llvmgen)(*this, opnum);
             if (!ok)
                 return false;
+            if (opclass >= 0) {
+                llvm::Value* args[] = { sg_void_ptr(), ll.constant(layer()),
+                                        ll.constant(opclass) };
+                ll.call_function("osl_profile_end_op", args);
+            }
+            // The string ops make transient strings, interned only when
+            // they escape (see TransientStrings)
+            if ((opd->flags & OpDescriptor::StrCreate) && !use_optix())
+                llvm_intern_escaping_string(op);
             if (shadingsys().debug_nan() /* debug NaN/Inf */
                 && op.farthest_jump() < 0 /* Jumping ops don't need it */) {
                 llvm_generate_debugnan(op);
@@ -1337,7 +1485,7 @@ BackendLLVM::build_llvm_init()
     }
 #endif
 
-    // Group init clears all the "layer_run" and "userdata_initialized" flags.
+    // Group init clears all the "layer_run" and "userdata_initialized" flags,
     if (m_num_used_layers > 1) {
         int sz = (m_num_used_layers + 3) & (~3);  // round up to 32 bits
         ll.op_memset(ll.void_ptr(layer_run_ref(0)), 0, sz, 4 /*align*/);
@@ -1348,6 +1496,13 @@ BackendLLVM::build_llvm_init()
         ll.op_memset(ll.void_ptr(userdata_initialized_ref(0)), 0, sz,
                      4 /*align*/);
     }
+    // ...and the flags of the cached matrices, which are then fetched
+    // lazily, the first time a layer needs them.
+    int num_cached_matrices = (int)m_cached_matrix_slots.size();
+    if (num_cached_matrices) {
+        int sz = (num_cached_matrices + 3) & (~3);  // round up to 32 bits
+        ll.op_memset(cached_matrix_flag_ptr(0), 0, sz, 4 /*align*/);
+    }
 
     // Group init also needs to allot space for ALL layers' params
     // that are closures (to avoid weird order of layer eval problems).
@@ -1630,6 +1785,11 @@ BackendLLVM::build_llvm_instance(bool groupentry)
         if (shadingsys().countlayerexecs())
             ll.call_function("osl_incr_layers_executed", sg_void_ptr());
     }
+    // Time the layer when profiling, the matching end is right before the
+    // return at the bottom of the layer function
+    bool profile_layer = shadingsys().profile_layers() && !use_optix();
+    if (profile_layer)
+        ll.call_function("osl_profile_begin", sg_void_ptr());
 
     // Setup the symbols
     m_named_values.clear();
@@ -1852,6 +2012,10 @@ BackendLLVM::build_llvm_instance(bool groupentry)
         llvm_gen_debug_printf(fmtformat("exit layer {} {} {}", this->layer(),
                                         inst()->layername(),
                                         inst()->shadername()));
+    if (profile_layer) {
+        llvm::Value* args[] = { sg_void_ptr(), ll.constant(this->layer()) };
+        ll.call_function("osl_profile_end_layer", args);
+    }
     ll.op_return();
 
     if (llvm_debug())
@@ -2091,6 +2255,7 @@ BackendLLVM::run()
     // At this point, we already hold the lock for this group, by virtue
     // of ShadingSystemImpl::optimize_group.
     OIIO::Timer timer;
+    TraceScope trace(shadingsys(), "llvm setup", group().name());
     std::string err;
 
     {
@@ -2121,16 +2286,12 @@ BackendLLVM::run()
 #    endif
 #else
         if (!use_optix()) {
+            // The shadeop library is parsed once per thread and kept as a
+            // prototype. The group module starts out with just its
+            // declarations, and gets copies of only the functions it ends
+            // up calling when it is pruned.
+            const llvm::Module* prototype = nullptr;
             if (use_rs_bitcode()) {
-                ll.module(ll.module_from_bitcode(
-                    (char*)osl_llvm_compiled_rs_dependent_ops_block,
-                    osl_llvm_compiled_rs_dependent_ops_size,
-                    "llvm_rs_dependent_ops", &err));
-                if (err.length())
-                    shadingcontext()->errorfmt(
-                        "llvm::parseBitcodeFile returned '{}' for llvm_rs_dependent_ops\n",
-                        err);
-
 //Leaving this around for developers to make sure LLVM's shaderglobals and C++'s are binary compatible
 #    if 0
                 std::vector<unsigned int> offset_by_index;
@@ -2143,30 +2304,27 @@ BackendLLVM::run()
                 OSL_ASSERT(rs_free_function_bitcode.size()
                            && "Free Function bitcode is empty");
 
-                llvm::Module* rs_free_functions_module = ll.module_from_bitcode(
-                    static_cast<const char*>(rs_free_function_bitcode.data()),
-                    rs_free_function_bitcode.size(), "rs_free_functions", &err);
+                prototype = ll.prototype_module(
+                    (char*)osl_llvm_compiled_rs_dependent_ops_block,
+                    osl_llvm_compiled_rs_dependent_ops_size,
+                    "llvm_rs_dependent_ops", &err,
+                    rs_free_function_bitcode.data(),
+                    rs_free_function_bitcode.size());
                 if (err.length())
                     shadingcontext()->errorfmt(
-                        "llvm::parseBitcodeFile returned '{}' for rs_free_functions\n",
+                        "llvm::parseBitcodeFile returned '{}' for llvm_rs_dependent_ops\n",
                         err);
-                std::unique_ptr<llvm::Module> rs_free_functions_module_ptr(
-                    rs_free_functions_module);
-                bool success = ll.absorb_module(
-                    std::move(rs_free_functions_module_ptr));
-                if (!success)
-                    shadingcontext()->errorfmt(
-                        "LLVM_Util::absorb_module failed'\n");
             } else {
-                ll.module(
-                    ll.module_from_bitcode((char*)osl_llvm_compiled_ops_block,
-                                           osl_llvm_compiled_ops_size,
-                                           "llvm_ops", &err));
+                prototype = ll.prototype_module(
+                    (char*)osl_llvm_compiled_ops_block,
+                    osl_llvm_compiled_ops_size, "llvm_ops", &err);
                 if (err.length())
                     shadingcontext()->errorfmt(
                         "llvm::parseBitcodeFile returned '{}' for llvm_ops\n",
                         err);
             }
+            OSL_ASSERT(prototype);
+            ll.module_from_prototype(prototype);
 
         } else {
 #    ifdef OSL_LLVM_CUDA_BITCODE
@@ -2275,6 +2433,7 @@ BackendLLVM::run()
     }
 
     m_stat_llvm_setup_time += timer.lap();
+    trace.next("llvm irgen");
 
     // Set up m_num_used_layers to be the number of layers that are
     // actually used, and m_layer_remap[] to map original layer numbers
@@ -2299,6 +2458,7 @@ BackendLLVM::run()
         }
     }
     shadingsys().m_stat_empty_instances += nlayers - m_num_used_layers;
+    collect_cached_matrices();
 
     initialize_llvm_group();
 
@@ -2323,6 +2483,7 @@ BackendLLVM::run()
 
     // llvm::Function* entry_func = group().num_entry_layers() ? NULL : funcs[m_num_used_layers-1];
     m_stat_llvm_irgen_time += timer.lap();
+    trace.next("llvm opt");
 
     if (shadingsys().m_max_local_mem_KB
         && m_llvm_local_mem / 1024 > shadingsys().m_max_local_mem_KB) {
@@ -2431,6 +2592,7 @@ BackendLLVM::run()
 #endif
 
     m_stat_llvm_opt_time += timer.lap();
+    trace.next("llvm jit");
 
     if (llvm_debug()) {
 #if 1
@@ -2530,6 +2692,7 @@ BackendLLVM::run()
     ll.module(NULL);
 
     m_stat_llvm_jit_time += timer.lap();
+    trace.end();
 
     m_stat_total_llvm_time = timer();
 
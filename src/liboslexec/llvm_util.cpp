@@ -4,9 +4,14 @@
 
 
 #include <cinttypes>
+#include <map>
 #include <memory>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <OpenImageIO/fmath.h>
+#include <OpenImageIO/strutil.h>
 #include <OpenImageIO/thread.h>
 
 #include <OSL/llvm_util.h>
@@ -77,7 +82,9 @@
 #include <llvm/Transforms/Scalar.h>
 #include <llvm/Transforms/Scalar/GVN.h>
 #include <llvm/Transforms/Utils.h>
+#include <llvm/Transforms/Utils/Cloning.h>
 #include <llvm/Transforms/Utils/UnifyFunctionExitNodes.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
 
 #include <llvm/Support/DynamicLibrary.h>
 
@@ -230,6 +237,8 @@ struct LLVM_Util::PerThreadInfo::Impl {
     Impl() {}
     ~Impl()
     {
+        // The prototypes belong to the context, they must go first
+        prototype_modules.clear();
         delete llvm_context;
         // N.B. Do NOT delete the jitmm -- another thread may need the
         // code! Don't worry, we stashed a pointer in jitmm_hold.
@@ -237,6 +246,20 @@ struct LLVM_Util::PerThreadInfo::Impl {
 
     llvm::LLVMContext* llvm_context = nullptr;
     LLVMMemoryManager* llvm_jitmm   = nullptr;
+    // Parsed libraries, by bitcode buffer and the hash of the extra
+    // bitcode (and their sizes), see prototype_module()
+    typedef std::tuple<const char*, size_t, uint64_t, size_t> PrototypeKey;
+    std::map<PrototypeKey, std::unique_ptr<llvm::Module>> prototype_modules;
+};
+
+
+
+// A module made by module_from_prototype(), with the map from the values
+// of the prototype to their declarations in the module.
+struct LLVM_Util::PrototypeClone {
+    const llvm::Module* prototype = nullptr;
+    llvm::Module* module          = nullptr;
+    llvm::ValueToValueMapTy vmap;
 };
 
 
@@ -581,6 +604,7 @@ LLVM_Util::~LLVM_Util()
     delete m_builder;
     delete m_llvm_debug_builder;
     delete m_nvptx_target_machine;
+    delete m_prototype_clone;
     module(NULL);
     // DO NOT delete m_llvm_jitmm;  // just the dummy wrapper around the real MM
 }
@@ -1014,6 +1038,174 @@ LLVM_Util::module_from_bitcode(const char* bitcode, size_t size,
 }
 
 
+
+const llvm::Module*
+LLVM_Util::prototype_module(const char* bitcode, size_t size,
+                            const std::string& name, std::string* err,
+                            const char* extra_bitcode, size_t extra_size)
+{
+    if (err)
+        err->clear();
+    // The same library may be linked with different extra bitcode, each
+    // combination is a prototype of its own. The extra bitcode is known by
+    // its contents: the renderer may refill the same buffer with new
+    // bitcode of the same size.
+    uint64_t extra_hash = extra_bitcode
+                              ? OIIO::Strutil::strhash(
+                                    string_view(extra_bitcode, extra_size))
+                              : 0;
+    PerThreadInfo::Impl::PrototypeKey key(bitcode, size, extra_hash,
+                                          extra_bitcode ? extra_size : 0);
+    auto found = m_thread->prototype_modules.find(key);
+    if (found != m_thread->prototype_modules.end())
+        return found->second.get();
+
+    std::unique_ptr<llvm::Module> proto(
+        module_from_bitcode(bitcode, size, name, err));
+    if (!proto)
+        return nullptr;
+    if (extra_bitcode) {
+        std::unique_ptr<llvm::Module> extra(
+            module_from_bitcode(extra_bitcode, extra_size, name, err));
+        if (!extra || llvm::Linker::linkModules(*proto, std::move(extra))) {
+            if (err && err->empty())
+                *err = "could not link the extra bitcode of " + name;
+            return nullptr;
+        }
+    }
+    // Every module cloned from the prototype needs definitions out of it,
+    // pay for materializing them only once.
+    LLVMErr llvm_err = proto->materializeAll();
+    if (error_string(std::move(llvm_err), err))
+        return nullptr;
+
+    const llvm::Module* result       = proto.get();
+    m_thread->prototype_modules[key] = std::move(proto);
+    return result;
+}
+
+
+
+void
+LLVM_Util::module_from_prototype(const llvm::Module* prototype)
+{
+    OSL_ASSERT(prototype);
+    delete m_prototype_clone;
+    m_prototype_clone            = new PrototypeClone;
+    m_prototype_clone->prototype = prototype;
+    // Only declarations, except for the aliases which can't be declared,
+    // they point to declarations until their aliasee is copied over.
+    std::unique_ptr<llvm::Module> clone = llvm::CloneModule(
+        *prototype, m_prototype_clone->vmap,
+        [](const llvm::GlobalValue* gv) {
+            return llvm::isa<llvm::GlobalAlias>(gv);
+        });
+    m_prototype_clone->module = clone.get();
+    module(clone.release());
+}
+
+
+
+void
+LLVM_Util::clone_prototype_definitions()
+{
+    if (!m_prototype_clone)
+        return;
+    std::unique_ptr<PrototypeClone> pc(m_prototype_clone);
+    m_prototype_clone = nullptr;
+    if (pc->module != m_llvm_module)
+        return;  // The module was replaced, nothing to complete
+    llvm::ValueToValueMapTy& vmap(pc->vmap);
+
+    // Gather the definitions of the prototype needed by the module: the
+    // ones our code refers to, and then whatever those refer to.
+    std::vector<const llvm::GlobalValue*> needed;
+    std::unordered_set<const llvm::GlobalValue*> seen;
+    auto need = [&](const llvm::GlobalValue* gv) {
+        if (!gv->isDeclaration() && seen.insert(gv).second)
+            needed.push_back(gv);
+    };
+    for (const llvm::GlobalValue& gv : pc->prototype->global_values()) {
+        const llvm::Value* ours = vmap.lookup(&gv);
+        if (!ours)
+            continue;
+        // Being the aliasee of an alias doesn't make it needed, using
+        // the alias does.
+        for (const llvm::User* user : ours->users()) {
+            if (!llvm::isa<llvm::GlobalAlias>(user)) {
+                need(&gv);
+                break;
+            }
+        }
+    }
+    std::vector<const llvm::Constant*> constants;
+    std::unordered_set<const llvm::Constant*> visited;
+    auto visit = [&](const llvm::Value* val) {
+        auto c = llvm::dyn_cast<llvm::Constant>(val);
+        if (c && visited.insert(c).second)
+            constants.push_back(c);
+    };
+    for (size_t i = 0; i < needed.size(); ++i) {
+        const llvm::GlobalValue* gv = needed[i];
+        if (auto func = llvm::dyn_cast<llvm::Function>(gv)) {
+            for (const llvm::BasicBlock& bb : *func)
+                for (const llvm::Instruction& inst : bb)
+                    for (const llvm::Value* op : inst.operands())
+                        visit(op);
+            if (func->hasPersonalityFn())
+                visit(func->getPersonalityFn());
+        } else if (auto var = llvm::dyn_cast<llvm::GlobalVariable>(gv)) {
+            if (var->hasInitializer())
+                visit(var->getInitializer());
+        } else if (auto alias = llvm::dyn_cast<llvm::GlobalAlias>(gv)) {
+            visit(alias->getAliasee());
+        }
+        while (!constants.empty()) {
+            const llvm::Constant* c = constants.back();
+            constants.pop_back();
+            if (auto g = llvm::dyn_cast<llvm::GlobalValue>(c)) {
+                need(g);
+            } else {
+                for (const llvm::Value* op : c->operands())
+                    visit(op);
+            }
+        }
+    }
+
+    // Copy the definitions into the declarations. Aliases were already
+    // cloned by module_from_prototype().
+    for (const llvm::GlobalValue* gv : needed) {
+        if (auto func = llvm::dyn_cast<llvm::Function>(gv)) {
+            auto newfunc = llvm::cast<llvm::Function>(vmap[func]);
+            auto dest    = newfunc->arg_begin();
+            for (const llvm::Argument& arg : func->args()) {
+                dest->setName(arg.getName());
+                vmap[&arg] = &*dest++;
+            }
+            llvm::SmallVector<llvm::ReturnInst*, 8> returns;
+#if OSL_LLVM_VERSION >= 130
+            llvm::CloneFunctionInto(newfunc, func, vmap,
+                                    llvm::CloneFunctionChangeType::ClonedModule,
+                                    returns);
+#else
+            llvm::CloneFunctionInto(newfunc, func, vmap,
+                                    /*ModuleLevelChanges=*/true, returns);
+#endif
+            newfunc->setLinkage(func->getLinkage());
+            if (func->hasPersonalityFn())
+                newfunc->setPersonalityFn(
+                    llvm::MapValue(func->getPersonalityFn(), vmap));
+        } else if (auto var = llvm::dyn_cast<llvm::GlobalVariable>(gv)) {
+            auto newvar = llvm::cast<llvm::GlobalVariable>(vmap[var]);
+            if (var->hasInitializer())
+                newvar->setInitializer(
+                    llvm::MapValue(var->getInitializer(), vmap));
+            newvar->setLinkage(var->getLinkage());
+        }
+    }
+}
+
+
 void
 LLVM_Util::push_function_mask(llvm::Value* startMaskValue)
 {
@@ -1845,6 +2037,7 @@ void*
 LLVM_Util::getPointerToFunction(llvm::Function* func)
 {
     OSL_DASSERT(func && "passed NULL to getPointerToFunction");
+    clone_prototype_definitions();
 
     if (debug_is_enabled()) {
         // We have to finalize debug info before jit happens
@@ -2648,6 +2841,7 @@ void
 LLVM_Util::do_optimize(std::string* out_err)
 {
     OSL_ASSERT(m_llvm_module && "No module to optimize!");
+    clone_prototype_definitions();
 
 #if !defined(OSL_FORCE_BITCODE_PARSE)
     LLVMErr err = m_llvm_module->materializeAll();
@@ -2733,6 +2927,10 @@ LLVM_Util::prune_and_internalize_module(
 #    define __OSL_PRUNE_ONLY(...)
 #endif
 
+    // A module made from a prototype gets the definitions it uses now,
+    // there is then nothing left to materialize below.
+    clone_prototype_definitions();
+
     bool materialized_at_least_once;
     __OSL_PRUNE_ONLY(int materialization_pass_count = 0);
     do {
@@ -578,6 +578,7 @@ ShadingSystemImpl::loadshader(string_view cname)
         errorfmt("No .oso file could be found for shader \"{}\"", name);
         return NULL;
     }
+    TraceScope trace(*this, "master load", name);
     OIIO::Timer timer;
     bool ok                = oso.parse_file(filename);
     ShaderMaster::ref r    = ok ? oso.master() : nullptr;
@@ -632,6 +633,7 @@ ShadingSystemImpl::LoadMemoryCompiledShader(string_view shadername,
 
     // Not found in the map
     OSOReaderToMaster reader(*this);
+    TraceScope trace(*this, "master load", name);
     OIIO::Timer timer;
     bool ok                = reader.parse_memory(buffer);
     ShaderMaster::ref r    = ok ? reader.master() : nullptr;
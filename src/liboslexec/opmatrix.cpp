@@ -241,23 +241,52 @@ osl_get_from_to_matrix(OpaqueExecContextPtr oec, void* r, ustringhash_pod from_,
 
 
 
+// The from->to matrices with constant space names are cached in the
+// groupdata: `cache` is fetched the first time a shade needs it, and
+// `flag` says if that happened yet (0 = not yet, 1 = it failed,
+// 2 = fetched).
+static OSL_HOSTDEVICE inline int
+fetch_cached_matrix(OpaqueExecContextPtr oec, void* cache, void* flag,
+                    ustringhash_pod from_, ustringhash_pod to_)
+{
+    char& status = *(char*)flag;
+    if (!status)
+        status = osl_get_from_to_matrix(oec, cache, from_, to_) ? 2 : 1;
+    return status == 2;
+}
+
+
+
 OSL_SHADEOP OSL_HOSTDEVICE int
-osl_transform_triple(OpaqueExecContextPtr oec, void* Pin, int Pin_derivs,
-                     void* Pout, int Pout_derivs, ustringhash_pod from_,
-                     ustringhash_pod to_, int vectype)
+osl_get_cached_matrix(OpaqueExecContextPtr oec, void* r, void* cache,
+                      void* flag, ustringhash_pod from_, ustringhash_pod to_)
 {
-    Matrix44 M;
-    int ok;
-    Pin_derivs &= Pout_derivs;  // ignore derivs if output doesn't need it
-    ustringhash from = ustringhash_from(from_);
-    ustringhash to   = ustringhash_from(to_);
+    int ok = fetch_cached_matrix(oec, cache, flag, from_, to_);
+    MAT(r) = MAT(cache);
+    return ok;
+}
 
-    if (from == Hashes::common)
-        ok = osl_get_inverse_matrix(oec, &M, to_);
-    else if (to == Hashes::common)
-        ok = osl_get_matrix(oec, &M, from_);
-    else
-        ok = osl_get_from_to_matrix(oec, &M, from_, to_);
+
+
+OSL_SHADEOP OSL_HOSTDEVICE int
+osl_prepend_cached_matrix(OpaqueExecContextPtr oec, void* r, void* cache,
+                          void* flag, ustringhash_pod from_,
+                          ustringhash_pod to_)
+{
+    int ok = fetch_cached_matrix(oec, cache, flag, from_, to_);
+    if (ok)
+        MAT(r) = MAT(cache) * MAT(r);
+    return ok;
+}
+
+
+
+// Transform Pin by M into Pout, or just copy it if !ok.
+static OSL_HOSTDEVICE inline int
+transform_triple_by(Matrix44& M, int ok, void* Pin, int Pin_derivs,
+                    void* Pout, int Pout_derivs, int vectype)
+{
+    Pin_derivs &= Pout_derivs;  // ignore derivs if output doesn't need it
     if (ok) {
         if (vectype == TypeDesc::POINT) {
             if (Pin_derivs)
@@ -299,6 +328,41 @@ osl_transform_triple(OpaqueExecContextPtr oec, void* Pin, int Pin_derivs,
 
 
 
+OSL_SHADEOP OSL_HOSTDEVICE int
+osl_transform_triple(OpaqueExecContextPtr oec, void* Pin, int Pin_derivs,
+                     void* Pout, int Pout_derivs, ustringhash_pod from_,
+                     ustringhash_pod to_, int vectype)
+{
+    Matrix44 M;
+    int ok;
+    ustringhash from = ustringhash_from(from_);
+    ustringhash to   = ustringhash_from(to_);
+
+    if (from == Hashes::common)
+        ok = osl_get_inverse_matrix(oec, &M, to_);
+    else if (to == Hashes::common)
+        ok = osl_get_matrix(oec, &M, from_);
+    else
+        ok = osl_get_from_to_matrix(oec, &M, from_, to_);
+    return transform_triple_by(M, ok, Pin, Pin_derivs, Pout, Pout_derivs,
+                               vectype);
+}
+
+
+
+OSL_SHADEOP OSL_HOSTDEVICE int
+osl_transform_triple_cached(OpaqueExecContextPtr oec, void* Pin,
+                            int Pin_derivs, void* Pout, int Pout_derivs,
+                            void* cache, void* flag, ustringhash_pod from_,
+                            ustringhash_pod to_, int vectype)
+{
+    int ok = fetch_cached_matrix(oec, cache, flag, from_, to_);
+    return transform_triple_by(MAT(cache), ok, Pin, Pin_derivs, Pout,
+                               Pout_derivs, vectype);
+}
+
+
+
 OSL_SHADEOP OSL_HOSTDEVICE int
 osl_transform_triple_nonlinear(OpaqueExecContextPtr oec, void* Pin,
                                int Pin_derivs, void* Pout, int Pout_derivs,
@@ -273,6 +273,23 @@ NOISE_IMPL_DERIV (usimplexnoise, USimplexNoise)
 
 
 
+// All the octaves of an fBm or turbulence loop over cell or hash noise,
+// which the runtime optimizer substitutes for the loop. Returns the new
+// sum, and updates freq and amp as the loop would have.
+#define OCTAVE_NOISE_IMPL(opname,implname,turbulence)                   \
+OSL_SHADEOP OSL_HOSTDEVICE float osl_ ##opname (float sum, char *p,    \
+        char *freq, char *amp, int octaves, float lacunarity, float gain) { \
+    return octave_noise<implname, turbulence> (sum, VEC(p),            \
+                *(float *)freq, *(float *)amp, octaves, lacunarity, gain); \
+}
+
+OCTAVE_NOISE_IMPL (cellnoise_fbm, CellNoise, false)
+OCTAVE_NOISE_IMPL (cellnoise_turbulence, CellNoise, true)
+OCTAVE_NOISE_IMPL (hashnoise_fbm, HashNoise, false)
+OCTAVE_NOISE_IMPL (hashnoise_turbulence, HashNoise, true)
+
+
+
 #define PNOISE_IMPL(opname,implname)                                    \
 OSL_SHADEOP OSL_HOSTDEVICE float osl_ ##opname## _fff (float x, float px) { \
     implname impl;                                                      \
@@ -935,6 +952,14 @@ osl_noiseparams_set_impulses(void* opt, float i)
 
 
 
+OSL_SHADEOP OSL_HOSTDEVICE void
+osl_noiseparams_set_impulse_table(void* opt, int t)
+{
+    ((NoiseParams*)opt)->impulse_table = t;
+}
+
+
+
 OSL_SHADEOP void
 osl_count_noise(void* sg_)
 {
@@ -944,6 +969,15 @@ osl_count_noise(void* sg_)
 
 
 
+OSL_SHADEOP void
+osl_count_noises(void* sg_, int number)
+{
+    ShaderGlobals* sg = (ShaderGlobals*)sg_;
+    sg->context->shadingsys().count_noise(number);
+}
+
+
+
 OSL_SHADEOP OSL_HOSTDEVICE int
 osl_hash_ii(int x)
 {
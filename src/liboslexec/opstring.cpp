@@ -25,15 +25,56 @@ OSL_NAMESPACE_BEGIN
 namespace pvt {
 
 
+// Characters of a string argument, which may be one made by the string
+// ops earlier in this execution and never interned.
+static inline string_view
+string_from(ustringhash_pod h)
+{
+    string_view s;
+    TransientStrings* strings = TransientStrings::current();
+    if (strings && strings->find(h, s))
+        return s;
+    return ustring_from(h);
+}
+
+
+// Hash of a string made by the string ops. While shaders execute it is
+// only kept by the context's TransientStrings, until osl_intern_s.
+static inline ustringhash_pod
+make_string(string_view s)
+{
+    if (TransientStrings* strings = TransientStrings::current())
+        return strings->add(s);
+    return ustring(s).hash();
+}
+
+
+
+OSL_SHADEOP ustringhash_pod
+osl_intern_s(ustringhash_pod s_)
+{
+    string_view s;
+    TransientStrings* strings = TransientStrings::current();
+    if (strings && strings->find(s_, s))
+        return ustring(s).hash();
+    return s_;
+}
+
+OSL_SHADEOP void
+osl_intern_strings(ustringhash_pod* s, int n)
+{
+    for (int i = 0; i < n; ++i)
+        s[i] = osl_intern_s(s[i]);
+}
+
+
+
 // Only define 2-arg version of concat, sort it out upstream
 OSL_SHADEOP ustringhash_pod
 osl_concat_sss(ustringhash_pod s_, ustringhash_pod t_)
 {
-    ustringhash s_uh = ustringhash_from(s_);
-    ustringhash t_uh = ustringhash_from(t_);
-
-    ustring s = ustring_from(s_uh);
-    ustring t = ustring_from(t_uh);
+    string_view s = string_from(s_);
+    string_view t = string_from(t_);
 
     size_t sl  = s.size();
     size_t tl  = t.size();
@@ -45,82 +86,79 @@ osl_concat_sss(ustringhash_pod s_, ustringhash_pod t_)
         heap_buf.reset(new char[len]);
         buf = heap_buf.get();
     }
-    memcpy(buf, s.c_str(), sl);
-    memcpy(buf + sl, t.c_str(), tl);
-    ustring result(buf, len);
-
-    return result.uhash().hash();
+    memcpy(buf, s.data(), sl);
+    memcpy(buf + sl, t.data(), tl);
+    return make_string(string_view(buf, len));
 }
 
 OSL_SHADEOP int
 osl_strlen_is(ustringhash_pod s_)
 {
-    auto s = ustring_from(s_);
-    return (int)s.length();
+    return (int)string_from(s_).length();
 }
 
 OSL_SHADEOP int
 osl_hash_is(ustringhash_pod s_)
 {
-    auto s = ustring_from(s_);
-    return (int)s.hash();
+    // The hash of a transient string is the one its ustring would have
+    return (int)s_;
 }
 
 OSL_SHADEOP int
 osl_getchar_isi(ustringhash_pod str_, int index)
 {
-    auto str = ustring_from(str_);
-    return str.data() && unsigned(index) < str.length() ? str[index] : 0;
+    auto str = string_from(str_);
+    return unsigned(index) < str.length() ? str[index] : 0;
 }
 
 
 OSL_SHADEOP int
 osl_startswith_iss(ustringhash_pod s_, ustringhash_pod substr_)
 {
-    auto substr       = ustring_from(substr_);
+    auto substr       = string_from(substr_);
     size_t substr_len = substr.length();
     if (substr_len == 0)  // empty substr always matches
         return 1;
-    auto s       = ustring_from(s_);
+    auto s       = string_from(s_);
     size_t s_len = s.length();
     if (substr_len > s_len)  // longer needle than haystack can't
         return 0;            // match (including empty s)
-    return strncmp(s.c_str(), substr.c_str(), substr_len) == 0;
+    return strncmp(s.data(), substr.data(), substr_len) == 0;
 }
 
 OSL_SHADEOP int
 osl_endswith_iss(ustringhash_pod s_, ustringhash_pod substr_)
 {
-    auto substr       = ustring_from(substr_);
+    auto substr       = string_from(substr_);
     size_t substr_len = substr.length();
     if (substr_len == 0)  // empty substr always matches
         return 1;
-    auto s       = ustring_from(s_);
+    auto s       = string_from(s_);
     size_t s_len = s.length();
     if (substr_len > s_len)  // longer needle than haystack can't
         return 0;            // match (including empty s)
-    return strncmp(s.c_str() + s_len - substr_len, substr.c_str(), substr_len)
+    return strncmp(s.data() + s_len - substr_len, substr.data(), substr_len)
            == 0;
 }
 
 OSL_SHADEOP int
 osl_stoi_is(ustringhash_pod str_)
 {
-    auto str = ustring_from(str_);
-    return str.data() ? Strutil::from_string<int>(str) : 0;
+    auto str = string_from(str_);
+    return str.size() ? Strutil::from_string<int>(str) : 0;
 }
 
 OSL_SHADEOP float
 osl_stof_fs(ustringhash_pod str_)
 {
-    auto str = ustring_from(str_);
-    return str.data() ? Strutil::from_string<float>(str) : 0.0f;
+    auto str = string_from(str_);
+    return str.size() ? Strutil::from_string<float>(str) : 0.0f;
 }
 
 OSL_SHADEOP ustringhash_pod
 osl_substr_ssii(ustringhash_pod s_, int start, int length)
 {
-    auto s   = ustring_from(s_);
+    auto s   = string_from(s_);
     int slen = int(s.length());
     if (slen == 0)
         return ustringhash_pod();  // No substring of empty string
@@ -128,7 +166,7 @@ osl_substr_ssii(ustringhash_pod s_, int start, int length)
     if (b < 0)
         b += slen;
     b = Imath::clamp(b, 0, slen);
-    return ustringhash_from(ustring(s, b, Imath::clamp(length, 0, slen))).hash();
+    return make_string(s.substr(b, Imath::clamp(length, 0, slen)));
 }
 
 
@@ -136,35 +174,21 @@ OSL_SHADEOP int
 osl_regex_impl(void* sg_, ustringhash_pod subject_, void* results, int nresults,
                ustringhash_pod pattern_, int fullmatch)
 {
-    ShaderGlobals* sg        = (ShaderGlobals*)sg_;
-    ShadingContext* ctx      = sg->context;
-    ustringhash subject_hash = ustringhash_from(subject_);
-    ustring subject_ustr     = ustring_from(subject_hash);
-    const std::string& subject(subject_ustr.string());
-    ustringhash pattern_hash = ustringhash_from(pattern_);
-    ustring pattern          = ustring_from(pattern_hash);
-    std::match_results<std::string::const_iterator> mresults;
-    const std::regex& regex(ctx->find_regex(pattern));
-    if (nresults > 0) {
-        std::string::const_iterator start = subject.begin();
-        int res = fullmatch ? std::regex_match(subject, mresults, regex)
-                            : std::regex_search(subject, mresults, regex);
-        int* m  = (int*)results;
-        for (int r = 0; r < nresults; ++r) {
-            if (r / 2 < (int)mresults.size()) {
-                if ((r & 1) == 0)
-                    m[r] = mresults[r / 2].first - start;
-                else
-                    m[r] = mresults[r / 2].second - start;
-            } else {
-                m[r] = pattern.length();
-            }
-        }
-        return res;
-    } else {
-        return fullmatch ? std::regex_match(subject, regex)
-                         : std::regex_search(subject, regex);
-    }
+    ShaderGlobals* sg   = (ShaderGlobals*)sg_;
+    ShadingContext* ctx = sg->context;
+    const CompiledRegex& regex(ctx->find_regex(ustring_from(pattern_)));
+    return regex.execute(string_from(subject_), (int*)results, nresults,
+                         fullmatch);
+}
+
+// Same, for a constant pattern compiled when the shader was JITed
+OSL_SHADEOP int
+osl_regex_compiled_impl(void* regex_, ustringhash_pod subject_, void* results,
+                        int nresults, int fullmatch)
+{
+    const CompiledRegex* regex = (const CompiledRegex*)regex_;
+    return regex->execute(string_from(subject_), (int*)results, nresults,
+                          fullmatch);
 }
 
 // TODO: transition format to from llvm_gen_printf_legacy
@@ -177,7 +201,7 @@ osl_format(ustringhash_pod format_str_, ...)
     va_start(args, format_str_);
     std::string s = Strutil::vsprintf(format_str.c_str(), args);
     va_end(args);
-    return ustring(s).hash();
+    return make_string(s);
 }
 
 
@@ -186,14 +210,13 @@ OSL_SHADEOP int
 osl_split(ustringhash_pod str_, ustringhash_pod* results, ustringhash_pod sep_,
           int maxsplit, int resultslen)
 {
-    auto str = ustring_from(str_);
-    auto sep = ustring_from(sep_);
+    auto str = string_from(str_);
+    auto sep = string_from(sep_);
     maxsplit = OIIO::clamp(maxsplit, 0, resultslen);
-    std::vector<std::string> splits;
-    Strutil::split(str.string(), splits, sep.string(), maxsplit);
+    std::vector<string_view> splits = Strutil::splitsv(str, sep, maxsplit);
     int n = std::min(maxsplit, (int)splits.size());
     for (int i = 0; i < n; ++i)
-        results[i] = ustring(splits[i]).uhash().hash();
+        results[i] = make_string(splits[i]);
     return n;
 }
 
@@ -240,7 +263,7 @@ osl_formatfmt(OpaqueExecContextPtr exec_ctx,
     std::string decoded_str;
     OSL::decode_message(fmt_specification, arg_count, encoded_types, arg_values,
                         decoded_str);
-    return ustring(decoded_str).hash();
+    return make_string(decoded_str);
 }
 
 
@@ -30,6 +30,7 @@
 #include <OpenImageIO/refcnt.h>
 #include <OpenImageIO/texture.h>
 #include <OpenImageIO/thread.h>
+#include <OpenImageIO/timer.h>
 #include <OpenImageIO/ustring.h>
 
 #include "osl_pvt.h"
@@ -48,6 +49,9 @@
 #include "shading_state_uniform.h"
 #include "constantpool.h"
 #include "opcolor.h"
+#include "regexcache.h"
+#include "shadingtrace.h"
+#include "transientstrings.h"
 
 
 using namespace OSL;
@@ -68,13 +72,105 @@ OSL_NAMESPACE_BEGIN
 
 
 
+/// Classes of expensive ops that the layer profiler (the "profile_layers"
+/// option) times separately within each layer.
+enum ProfileOpClass {
+    ProfileOpTexture,
+    ProfileOpNoise,
+    ProfileOpGetattribute,
+    ProfileOpTrace,
+    ProfileOpPointcloud,
+    ProfileOpClosure,
+    ProfileOpNumClasses
+};
+
+/// Name of a ProfileOpClass, for reports.
+const char*
+profile_op_class_name(int opclass);
+
+
+
+/// Counters of one layer of a group gathered by the layer profiler.
+struct LayerProfile {
+    ustring name;               ///< Layer name
+    long long ticks      = 0;   ///< Time in the layer, upstream layers included
+    long long self_ticks = 0;   ///< Time in the layer alone
+    long long executions = 0;   ///< Number of times the layer ran
+    long long op_ticks[ProfileOpNumClasses] = {};  ///< Time per op class
+    long long op_calls[ProfileOpNumClasses] = {};  ///< Calls per op class
+
+    void clear();
+    void add(const LayerProfile& other);
+
+    /// Number of counters of a layer, in the order the two functions
+    /// below use for the per thread atomic copies.
+    static constexpr int ncounters = 3 + 2 * ProfileOpNumClasses;
+    /// Add our counters to an array of ncounters atomics. Only its owning
+    /// thread writes the array, so it needs no locked instructions.
+    void add_to_counters(std::atomic<long long>* counters) const;
+    /// Add the values of an array of ncounters atomics to our counters.
+    void add_counters(const std::atomic<long long>* counters);
+};
+
+
+
+/// The layer profile of one group, summed over threads.
+struct GroupLayerProfile {
+    ustring groupname;
+    std::vector<LayerProfile> layers;  ///< One per layer
+
+    void add(const GroupLayerProfile& other);
+};
+
+/// Layer profiles by ShaderGroup::id(), so that unnamed groups and groups
+/// that share a name are kept apart.
+typedef std::map<int, GroupLayerProfile> GroupLayerProfileMap;
+
+
+
 struct PerThreadInfo {
     PerThreadInfo();
     ~PerThreadInfo();
     ShadingContext* pop_context();  ///< Get the pool top and then pop
 
+    /// Add the execution profile of `executions` runs of the named group.
+    /// Only the owning thread writes the profile counters and getstats()
+    /// just reads them, so with profiling on threads never contend on
+    /// shared atomics.
+    void record_profile(ustring groupname, long long ticks,
+                        long long executions);
+
+    /// Add the layer profile of one execution of a group, one entry per
+    /// layer. Like record_profile(), the owning thread is the only writer
+    /// and only takes the lock the first time it records a group.
+    void record_layer_profile(int groupid, ustring groupname,
+                              const std::vector<LayerProfile>& layers);
+
     std::stack<ShadingContext*> context_pool;
     LLVM_Util::PerThreadInfo llvm_thread_info;
+
+    // Execution profile of this thread, see record_profile()
+    struct GroupProfile {
+        std::atomic<long long> ticks { 0 };
+        std::atomic<long long> executions { 0 };
+    };
+    std::atomic<long long> profile_ticks { 0 };
+    std::unordered_map<ustring, std::unique_ptr<GroupProfile>> profile_groups;
+    // Layer profile of this thread for one group, see
+    // record_layer_profile(). The names are set when the entry is created,
+    // the counters are LayerProfile::ncounters atomics per layer.
+    struct GroupLayerCounters {
+        ustring groupname;
+        std::vector<ustring> layernames;
+        std::unique_ptr<std::atomic<long long>[]> counters;
+
+        void add_to(GroupLayerProfile& profile) const;
+    };
+    // Keyed by ShaderGroup::id()
+    std::unordered_map<int, std::unique_ptr<GroupLayerCounters>>
+        profile_layers;
+    spin_mutex profile_mutex;  ///< Guards insertions into profile_groups
+                               ///< and profile_layers
 };
 
 
@@ -305,6 +401,14 @@ public:
     ///
     value_t peak(void) const { return m_peak; }
 
+    /// Restart the peak from the current value and forget the past
+    /// requests, leaving the current value alone.
+    void reset_peak()
+    {
+        m_requested = 0;
+        m_peak      = m_current;
+    }
+
     /// Reassign the current value, adjust peak and requested as necessary.
     ///
     const value_t operator=(value_t newval)
@@ -601,6 +705,9 @@ public:
     void message(const std::string& message) const;
 
     std::string getstats(int level = 1) const;
+    void getstats(ParamValueList& stats) const;
+    std::string getstats_json() const;
+    void reset_stats();
 
     ErrorHandler& errhandler() const { return *m_err; }
 
@@ -620,6 +727,11 @@ public:
                  int shadeindex, ShaderGlobals& ssg, void* userdata_base_ptr,
                  void* output_base_ptr, bool run = true);
 
+    bool execute_many(ShadingContext& ctx, ShaderGroup& group,
+                      int thread_index, int shadeindex_begin,
+                      span<ShaderGlobals> globals, void* userdata_base_ptr,
+                      void* output_base_ptr);
+
     const void* get_symbol(ShadingContext& ctx, ustring layername,
                            ustring symbolname, TypeDesc& type);
 
@@ -668,6 +780,9 @@ public:
     ustring llvm_prune_ir_strategy() const { return m_llvm_prune_ir_strategy; }
     bool fold_getattribute() const { return m_opt_fold_getattribute; }
     bool opt_texture_handle() const { return m_opt_texture_handle; }
+    bool opt_matrix_cache() const { return m_opt_matrix_cache; }
+    bool opt_transient_strings() const { return m_opt_transient_strings; }
+    bool opt_octave_loops() const { return m_opt_octave_loops; }
     int opt_passes() const { return m_opt_passes; }
     int max_warnings_per_thread() const
     {
@@ -678,7 +793,23 @@ public:
     bool lazy_trace() const { return m_lazy_trace; }
     bool userdata_isconnected() const { return m_userdata_isconnected; }
     int profile() const { return m_profile; }
+    bool profile_layers() const { return m_profile_layers; }
+    int trace_events() const { return m_trace_events; }
+    int trace_sample_rate() const { return m_trace_sample_rate; }
+    /// Record a span of the shading timeline, see ShadingTrace.
+    void trace_record(const char* name, ustring detail, long long start,
+                      long long end)
+    {
+        m_trace.record(name, detail, start, end,
+                       size_t(std::max(m_trace_buffer_size, 1)));
+    }
+    bool write_trace(string_view filename) const;
+
+    /// Return the compiled regex for the pattern from the cache shared by
+    /// all threads, compiling it the first time it is needed.
+    const CompiledRegex& find_regex(ustring pattern);
     bool no_noise() const { return m_no_noise; }
+    int gabor_impulse_table() const { return m_gabor_impulse_table; }
     bool no_pointcloud() const { return m_no_pointcloud; }
     bool force_derivs() const { return m_force_derivs; }
     bool allow_shader_replacement() const { return m_allow_shader_replacement; }
@@ -841,6 +972,14 @@ public:
 private:
     void printstats() const;
 
+    /// Sum the execution profile of the retired threads and the live ones:
+    /// total ticks, and ticks and executions per group.
+    long long
+    gather_profile(std::map<ustring, long long>& group_times,
+                   std::map<ustring, long long>& group_executions) const;
+    /// Sum the layer profiles of the retired threads and the live ones.
+    void gather_layer_profiles(GroupLayerProfileMap& layer_profiles) const;
+
     /// Find the index of the named layer in the shader group.
     /// If found, return the index >= 0 and put a pointer to the instance
     /// in inst; if not found, return -1 and set inst to NULL.
@@ -908,6 +1047,7 @@ private:
     bool m_countlayerexecs;       ///< Count number of layer execs?
     bool m_relaxed_param_typecheck;  ///< Allow parameters to be set from isomorphic types (same data layout)
     int m_profile;                 ///< Level of profiling of shader execution
+    bool m_profile_layers;         ///< Profile layers and expensive ops?
     int m_optimize;                ///< Runtime optimization level
     bool m_opt_simplify_param;     ///< Turn instance params into const?
     bool m_opt_constant_fold;      ///< Allow constant folding?
@@ -923,6 +1063,9 @@ private:
     bool m_opt_fold_getattribute;    ///< Constant-fold getattribute()?
     bool m_opt_middleman;            ///< Middle-man optimization?
     bool m_opt_texture_handle;       ///< Use texture handles?
+    bool m_opt_matrix_cache;         ///< Cache named space matrices?
+    bool m_opt_transient_strings;    ///< Intern only escaping strings?
+    bool m_opt_octave_loops;         ///< Fold cell/hash noise octave loops?
     bool m_opt_seed_bblock_aliases;  ///< Turn on basic block alias seeds
     bool m_opt_useparam;  ///< Perform extra useparam analysis for culling run layer calls
     bool m_opt_groupdata;  ///< Move eligible parameters out of groupdata into locals
@@ -968,6 +1111,7 @@ private:
     int m_max_optix_groupdata_alloc;  ///< Maximum OptiX groupdata buffer allocation
     bool m_buffer_printf;             ///< Buffer/batch printf output?
     bool m_no_noise;                  ///< Substitute trivial noise calls
+    int m_gabor_impulse_table;        ///< Share precomputed Gabor impulses?
     bool m_no_pointcloud;             ///< Substitute trivial pointcloud calls
     bool m_force_derivs;              ///< Force derivs on everything
     bool m_allow_shader_replacement;  ///< Allow shader masters to replace
@@ -975,6 +1119,12 @@ private:
     int m_opt_warnings;               ///< Warn on inability to optimize
     int m_gpu_opt_error;              ///< Error on inability to optimize
                                       ///<   away things that can't GPU.
+    int m_trace_events;               ///< Timeline tracing level
+    int m_trace_sample_rate;          ///< Trace one of every N executions
+    int m_trace_buffer_size;          ///< Trace events kept per thread
+    ustring m_trace_filename;         ///< Write the trace here at shutdown
+    mutable ShadingTrace m_trace;     ///< Per thread timeline spans
+    RegexCache m_regex_cache;         ///< Compiled regex's of all threads
 
     /// Experimental attributes to help tuning OptiX optimization passes
     bool m_optix_no_inline;              ///< Disable function inlining
@@ -1014,6 +1164,7 @@ private:
     atomic_int m_stat_preopt_ops;          ///< Stat: pre-optimization ops
     atomic_int m_stat_postopt_ops;         ///< Stat: post-optimization ops
     atomic_int m_stat_middlemen_eliminated;  ///< Stat: middlemen eliminated
+    atomic_int m_stat_octave_loops_folded;   ///< Stat: octave loops folded
     atomic_int m_stat_const_connections;     ///< Stat: const connections elim'd
     atomic_int m_stat_global_connections;   ///< Stat: global connections elim'd
     atomic_int m_stat_tex_calls_codegened;  ///< Stat: total texture calls
@@ -1075,7 +1226,14 @@ private:
     atomic_int m_groups_to_compile_count;
     atomic_int m_threads_currently_compiling;
     mutable std::map<ustring, long long> m_group_profile_times;
-    // N.B. group_profile_times is protected by m_stat_mutex.
+    mutable std::map<ustring, long long> m_group_profile_executions;
+    mutable GroupLayerProfileMap m_group_layer_profiles;
+    // N.B. group_profile_times/executions/layer_profiles are protected by
+    // m_stat_mutex.
+    // They and m_stat_total_shading_time_ticks only hold the profile of
+    // threads whose PerThreadInfo is gone, getstats adds the live ones.
+    std::vector<PerThreadInfo*> m_all_thread_info;
+    mutable spin_mutex m_all_thread_info_mutex;
 
     LLVM_Util::ScopedJitMemoryUser m_llvm_jit_memory_user;
 
@@ -1094,6 +1252,48 @@ private:
 
 
 
+/// Record the scope of a phase in the shading timeline when the
+/// "trace_events" option is at least `level` and name is not null.
+/// next() ends the current phase and starts another one, for functions
+/// that go through several phases in sequence.
+class TraceScope {
+public:
+    TraceScope(ShadingSystemImpl& shadingsys, const char* name,
+               ustring detail, int level = 1)
+        : m_shadingsys(shadingsys.trace_events() >= level ? &shadingsys
+                                                           : nullptr)
+        , m_name(name)
+        , m_detail(detail)
+        , m_start(m_shadingsys && name ? OIIO::Timer::now() : 0)
+    {
+    }
+    TraceScope(const TraceScope&) = delete;
+    ~TraceScope() { end(); }
+
+    void next(const char* name)
+    {
+        end();
+        m_name  = name;
+        m_start = m_shadingsys ? OIIO::Timer::now() : 0;
+    }
+
+    void end()
+    {
+        if (m_shadingsys && m_name)
+            m_shadingsys->trace_record(m_name, m_detail, m_start,
+                                       OIIO::Timer::now());
+        m_name = nullptr;
+    }
+
+private:
+    ShadingSystemImpl* m_shadingsys;
+    const char* m_name;
+    ustring m_detail;
+    long long m_start;
+};
+
+
+
 /// Describe one end of a parameter connection: the parameter number, and
 /// optionally an array index and/or channel number within that parameter.
 struct ConnectedParam {
@@ -1841,10 +2041,10 @@ public:
 
     long long int executions() const { return m_executions; }
 
-    void start_running()
+    void start_running(int count = 1)
     {
 #ifndef NDEBUG
-        m_executions++;
+        m_executions += count;
 #endif
     }
 
@@ -2056,7 +2256,6 @@ private:
     bool m_unknown_closures_needed;
     bool m_unknown_attributes_needed;
     atomic_ll m_executions { 0 };  ///< Number of times the group executed
-    atomic_ll m_stat_total_shading_time_ticks { 0 };  // Shading time (ticks)
 
     std::string m_optix_cache_key;
 
@@ -2123,6 +2322,13 @@ public:
                  ShaderGlobals& globals, void* userdata_base_ptr,
                  void* output_base_ptr, bool run);
 
+    /// Execute the shader group on many points, doing the group level
+    /// setup and cleanup only once. (See similarly named method of
+    /// ShadingSystem.)
+    bool execute_many(ShaderGroup& group, int threadindex,
+                      int shadeindex_begin, span<ShaderGlobals> globals,
+                      void* userdata_base_ptr, void* output_base_ptr);
+
 #if OSL_USE_BATCHED
     // Group all batched methods behind a templated interface
     // so we can support multiple widths
@@ -2300,9 +2506,9 @@ public:
     const void* symbol_data(const Symbol& sym) const;
 
     /// Return a reference to a compiled regular expression for the
-    /// given string, being careful to cache already-created ones so we
-    /// aren't constantly compiling new ones.
-    const std::regex& find_regex(ustring r);
+    /// given string. The context remembers the ones it has used, the
+    /// ShadingSystem compiles each pattern only once for all threads.
+    const CompiledRegex& find_regex(ustring r);
 
     /// Return a pointer to the shading group for this context.
     ///
@@ -2340,6 +2546,14 @@ public:
                            int array_lookup, int index, TypeDesc attr_type,
                            void* attr_dest);
 
+    /// Forget the object attributes remembered by osl_get_attribute.
+    void clear_attribute_cache()
+    {
+        m_attribute_objdata = nullptr;
+        m_attribute_cache.clear();
+        m_attribute_values.clear();
+    }
+
     PerThreadInfo* thread_info() const { return m_threadinfo; }
 
     TextureSystem::Perthread* texture_thread_info() const
@@ -2371,6 +2585,18 @@ public:
 
     void incr_layers_executed() { ++m_stat_layers_executed; }
 
+    // Layer profiler hooks called by the shadeops that BackendLLVM
+    // inserts when profile_layers is on. Begin/end calls nest, time spent
+    // in nested layers is not counted in the self time of a layer.
+    void profile_begin()
+    {
+        if (m_profile_depth < max_profile_depth)
+            m_profile_stack[m_profile_depth] = { m_profile_timer.ticks(), 0 };
+        ++m_profile_depth;
+    }
+    void profile_end_layer(int layer);
+    void profile_end_op(int layer, int opclass);
+
     void incr_get_userdata_calls() { ++m_stat_get_userdata_calls; }
 
     // Clear the stats we record per-execution in this context (unlocked)
@@ -2450,6 +2676,10 @@ public:
 private:
     void free_dict_resources();
 
+    // Bind the group to this context for npoints executions, optimizing
+    // and JITing it if needed. Returns false if there is nothing to run.
+    bool bind_group(ShaderGroup& group, int npoints);
+
     ShadingSystemImpl& m_shadingsys;  ///< Backpointer to shadingsys
     RendererServices* m_renderer;     ///< Ptr to renderer services
     PerThreadInfo* m_threadinfo;      ///< Ptr to our thread's info
@@ -2461,8 +2691,29 @@ private:
         nullptr, &OIIO::aligned_free
     };
     size_t m_heapsize = 0;
-    using RegexMap = std::unordered_map<ustring, std::unique_ptr<std::regex>>;
-    RegexMap m_regex_map;    ///< Compiled regex's
+    using RegexMap = std::unordered_map<ustring, const CompiledRegex*>;
+    RegexMap m_regex_map;    ///< Compiled regex's used by this context
+
+    // Attribute lookups of the object m_attribute_objdata, when the
+    // renderer supports("cache_object_attributes"). Names that turn out
+    // not to be "object:*" attributes are remembered as not cacheable, so
+    // they cost no string lookup either.
+    struct CachedAttribute {
+        ustringhash object;
+        ustringhash name;
+        TypeDesc type;
+        int index;       ///< Array element, or -1 for the whole value
+        int derivs;      ///< Were derivatives requested?
+        bool cacheable;  ///< Is it an "object:*" attribute?
+        bool ok;         ///< What the renderer returned
+        size_t offset;   ///< Of the value in m_attribute_values
+        size_t size;     ///< Of the value in m_attribute_values
+    };
+    static constexpr size_t max_cached_attributes = 32;
+    int m_cache_object_attributes = -1;  ///< Renderer support, -1 = unknown
+    void* m_attribute_objdata     = nullptr;
+    std::vector<CachedAttribute> m_attribute_cache;
+    std::vector<char> m_attribute_values;
     MessageList m_messages;  ///< Message blackboard
 #if OSL_USE_BATCHED
     BatchedMessageBuffer
@@ -2472,9 +2723,35 @@ private:
     int m_stat_get_userdata_calls;  ///< Number of calls to get_userdata
     int m_stat_layers_executed;     ///< Number of layers executed
     long long m_ticks;              ///< Time executing the shader
+    int m_npoints;                  ///< Points in the current execution
+
+    long long m_trace_executions = 0;  ///< Executions seen by the tracer
+
+    /// Return name if this execution is one of those sampled into the
+    /// timeline by the "trace_events" option, otherwise nullptr.
+    const char* trace_sample(const char* name)
+    {
+        if (shadingsys().trace_events() < 2)
+            return nullptr;
+        int rate = std::max(shadingsys().trace_sample_rate(), 1);
+        return (m_trace_executions++ % rate == 0) ? name : nullptr;
+    }
+
+    // Layer profiler state, see profile_begin()
+    struct ProfileFrame {
+        long long start;     ///< Timer ticks when the frame began
+        long long children;  ///< Ticks spent in nested layers
+    };
+    static constexpr int max_profile_depth = 256;
+    ProfileFrame m_profile_stack[max_profile_depth];
+    int m_profile_depth = 0;
+    OIIO::Timer m_profile_timer;
+    std::vector<LayerProfile> m_layer_profile;  ///< One per layer
+    void profile_layers_init();
 
     SimplePool<20 * 1024> m_closure_pool;
     SimplePool<64 * 1024> m_scratch_pool;
+    TransientStrings m_transient_strings;  ///< Strings made this execution
 
     Dictionary* m_dictionary;
 
@@ -2562,6 +2839,7 @@ struct NoiseParams {
     Vec3 direction;
     float bandwidth;
     float impulses;
+    int impulse_table;  ///< Take the gabor impulses from the shared table?
 
     OSL_HOSTDEVICE NoiseParams()
         : anisotropic(0)
@@ -2569,6 +2847,7 @@ struct NoiseParams {
         , direction(1.0f, 0.0f, 0.0f)
         , bandwidth(1.0f)
         , impulses(16.0f)
+        , impulse_table(0)
     {
     }
 };
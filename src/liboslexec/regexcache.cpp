@@ -0,0 +1,639 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <algorithm>
+#include <bitset>
+#include <cctype>
+#include <cstring>
+#include <map>
+
+#include "automata.h"
+#include "regexcache.h"
+
+
+OSL_NAMESPACE_BEGIN
+
+namespace pvt {
+
+
+// Past these sizes the pattern is left to std::regex
+static const int max_nfa_states = 4096;
+static const int max_dfa_states = 1024;
+
+typedef std::bitset<256> ByteSet;
+
+// The byte of a set holding a single one, or -1.
+static int
+single_byte(const ByteSet& set)
+{
+    if (set.count() != 1)
+        return -1;
+    int b = 0;
+    while (!set[b])
+        ++b;
+    return b;
+}
+
+// Nondeterministic automaton over the bytes of the subject (Thompson's
+// construction). Unlike NdfAutomata, whose transitions are ustring
+// symbols, a state moves on a set of bytes to `next`, and/or on lambda
+// (the empty word) to the states in `lambda`.
+struct NfaState {
+    ByteSet bytes;
+    int next = -1;
+    std::vector<int> lambda;
+};
+
+// A piece of the automaton under construction: it is entered by `in`
+// and left by `out`, which has no transitions yet.
+struct NfaFrag {
+    int in, out;
+};
+
+
+
+// Recursive descent parser of the ECMAScript regex grammar (the std::regex
+// default), building the NFA of the pattern as it goes. Every parse
+// function returns false for the constructs that the automata can't
+// express, which leaves the pattern to std::regex. The pattern is known
+// to be valid, std::regex accepted it first.
+class RegexNfaBuilder {
+public:
+    RegexNfaBuilder(string_view pattern, std::vector<NfaState>& states)
+        : m_pattern(pattern), m_end(pattern.size()), m_states(states)
+    {
+    }
+
+    bool build(NfaFrag& f, bool& anchored_begin, bool& anchored_end)
+    {
+        anchored_begin = m_pos < m_end && m_pattern[m_pos] == '^';
+        if (anchored_begin)
+            ++m_pos;
+        // A trailing '$' is an anchor unless it is escaped
+        size_t slashes = 0;
+        while (slashes + 2 <= m_end
+               && m_pattern[m_end - 2 - slashes] == '\\')
+            ++slashes;
+        anchored_end = m_end > m_pos && m_pattern[m_end - 1] == '$'
+                       && (slashes & 1) == 0;
+        if (anchored_end)
+            --m_end;
+        bool alternatives = false;
+        if (!alternation(f, alternatives) || m_pos != m_end)
+            return false;
+        // '^a|b' anchors only the first alternative
+        return !(alternatives && (anchored_begin || anchored_end));
+    }
+
+private:
+    int new_state()
+    {
+        m_states.emplace_back();
+        return int(m_states.size()) - 1;
+    }
+
+    void link(int from, int to) { m_states[from].lambda.push_back(to); }
+
+    bool empty(NfaFrag& f)
+    {
+        f.in = f.out = new_state();
+        return true;
+    }
+
+    bool bytes(const ByteSet& set, NfaFrag& f)
+    {
+        f.in                 = new_state();
+        f.out                = new_state();
+        m_states[f.in].bytes = set;
+        m_states[f.in].next  = f.out;
+        return true;
+    }
+
+    NfaFrag concat(NfaFrag a, NfaFrag b)
+    {
+        link(a.out, b.in);
+        return { a.in, b.out };
+    }
+
+    NfaFrag star(NfaFrag f)
+    {
+        int in  = new_state();
+        int out = new_state();
+        link(in, f.in);
+        link(in, out);
+        link(f.out, f.in);
+        link(f.out, out);
+        return { in, out };
+    }
+
+    NfaFrag optional(NfaFrag f)
+    {
+        int in  = new_state();
+        int out = new_state();
+        link(in, f.in);
+        link(in, out);
+        link(f.out, out);
+        return { in, out };
+    }
+
+    bool peek(char c) const { return m_pos < m_end && m_pattern[m_pos] == c; }
+
+    bool peek_digit() const
+    {
+        return m_pos < m_end && isdigit((unsigned char)m_pattern[m_pos]);
+    }
+
+    bool alternation(NfaFrag& f, bool& alternatives)
+    {
+        if (!concatenation(f))
+            return false;
+        while (peek('|')) {
+            ++m_pos;
+            NfaFrag g;
+            if (!concatenation(g))
+                return false;
+            int in  = new_state();
+            int out = new_state();
+            link(in, f.in);
+            link(in, g.in);
+            link(f.out, out);
+            link(g.out, out);
+            f            = { in, out };
+            alternatives = true;
+        }
+        return true;
+    }
+
+    bool concatenation(NfaFrag& f)
+    {
+        empty(f);
+        while (m_pos < m_end && !peek('|') && !peek(')')) {
+            NfaFrag g;
+            if (!repetition(g))
+                return false;
+            f = concat(f, g);
+        }
+        return true;
+    }
+
+    bool number(int& n)
+    {
+        if (!peek_digit())
+            return false;
+        n = 0;
+        while (peek_digit()) {
+            n = n * 10 + (m_pattern[m_pos++] - '0');
+            if (n > max_nfa_states)
+                return false;
+        }
+        return true;
+    }
+
+    bool repetition(NfaFrag& f)
+    {
+        size_t atom_begin = m_pos;
+        if (!atom(f))
+            return false;
+        if (m_pos >= m_end)
+            return true;
+        char c = m_pattern[m_pos];
+        int lo = 0, hi = -1;  // hi < 0 for no upper bound
+        if (c == '*') {
+            ++m_pos;
+            f = star(f);
+        } else if (c == '+') {
+            ++m_pos;
+            link(f.out, f.in);
+            int out = new_state();
+            link(f.out, out);
+            f.out = out;
+        } else if (c == '?') {
+            ++m_pos;
+            f = optional(f);
+        } else if (c == '{') {
+            ++m_pos;
+            if (!number(lo))
+                return false;
+            hi = lo;
+            if (peek(',')) {
+                ++m_pos;
+                hi = -1;
+                if (!peek('}') && !number(hi))
+                    return false;
+            }
+            if (!peek('}') || (hi >= 0 && hi < lo))
+                return false;
+            ++m_pos;
+            size_t quantifier_end = m_pos;
+            // The copies of the atom are built by parsing it again
+            auto copy = [&](NfaFrag& g) {
+                m_pos = atom_begin;
+                return atom(g);
+            };
+            NfaFrag result;
+            empty(result);
+            for (int i = 0; i < std::max(lo, hi); ++i) {
+                NfaFrag g = f;
+                if (i && !copy(g))
+                    return false;
+                result = concat(result, i < lo ? g : optional(g));
+                if (int(m_states.size()) > max_nfa_states)
+                    return false;
+            }
+            if (hi < 0) {
+                NfaFrag g = f;
+                if (lo && !copy(g))
+                    return false;
+                result = concat(result, star(g));
+            }
+            f     = result;
+            m_pos = quantifier_end;
+        } else {
+            return true;
+        }
+        if (peek('?'))  // Lazy quantifiers match the same subjects
+            ++m_pos;
+        return int(m_states.size()) <= max_nfa_states;
+    }
+
+    bool atom(NfaFrag& f)
+    {
+        char c = m_pattern[m_pos++];
+        ByteSet set;
+        switch (c) {
+        case '(': {
+            if (peek('?')) {
+                // Only the non-capturing group, not the lookaheads
+                if (m_pos + 1 >= m_end || m_pattern[m_pos + 1] != ':')
+                    return false;
+                m_pos += 2;
+            }
+            bool alternatives = false;
+            if (!alternation(f, alternatives) || !peek(')'))
+                return false;
+            ++m_pos;
+            return true;
+        }
+        case '[': return bracket(set) && bytes(set, f);
+        case '.':
+            set.set();
+            set.reset('\n');
+            set.reset('\r');
+            return bytes(set, f);
+        case '\\': return escape(set, false) && bytes(set, f);
+        case '^':
+        case '$':
+        case '*':
+        case '+':
+        case '?':
+        case '{': return false;
+        default: set.set((unsigned char)c); return bytes(set, f);
+        }
+    }
+
+    // Parse the escape after a backslash into a set of bytes.
+    bool escape(ByteSet& set, bool in_bracket)
+    {
+        if (m_pos >= m_end)
+            return false;
+        char c = m_pattern[m_pos++];
+        switch (c) {
+        case 'd':
+        case 'D':
+        case 'w':
+        case 'W':
+        case 's':
+        case 'S': {
+            ByteSet cls;
+            for (int b = 0; b < 256; ++b) {
+                bool in = false;
+                switch (tolower(c)) {
+                case 'd': in = b >= '0' && b <= '9'; break;
+                case 'w': in = isalnum(b) || b == '_'; break;
+                case 's': in = b == ' ' || (b >= '\t' && b <= '\r'); break;
+                }
+                cls[b] = b < 128 && in;
+            }
+            if (isupper(c))
+                cls.flip();
+            set |= cls;
+            return true;
+        }
+        case 't': set.set('\t'); return true;
+        case 'n': set.set('\n'); return true;
+        case 'r': set.set('\r'); return true;
+        case 'f': set.set('\f'); return true;
+        case 'v': set.set('\v'); return true;
+        case 'b':
+            // Backspace in a bracket, otherwise a word boundary
+            if (!in_bracket)
+                return false;
+            set.set('\b');
+            return true;
+        case '0':
+            if (peek_digit())
+                return false;
+            set.set(0);
+            return true;
+        case 'x': {
+            int value = 0;
+            for (int i = 0; i < 2; ++i, ++m_pos) {
+                char h = m_pos < m_end ? m_pattern[m_pos] : 0;
+                if (!isxdigit((unsigned char)h))
+                    return false;
+                value = value * 16
+                        + (isdigit((unsigned char)h) ? h - '0'
+                                                     : tolower(h) - 'a' + 10);
+            }
+            set.set(value);
+            return true;
+        }
+        default:
+            // Back references, \B, \cX, \uXXXX, ... are left to std::regex
+            if (isalnum((unsigned char)c) || (unsigned char)c >= 128)
+                return false;
+            set.set((unsigned char)c);
+            return true;
+        }
+    }
+
+    // Parse a bracket expression, after its '['.
+    bool bracket(ByteSet& set)
+    {
+        bool negate = peek('^');
+        if (negate)
+            ++m_pos;
+        if (peek(']'))
+            return false;  // Grammars disagree on "[]" and "[^]"
+        while (!peek(']')) {
+            if (m_pos >= m_end)
+                return false;
+            ByteSet item;
+            int lo = -1;  // The byte, unless item is a class escape
+            char c = m_pattern[m_pos++];
+            if (c == '[' && m_pos < m_end
+                && strchr(":=.", m_pattern[m_pos]))
+                return false;  // POSIX classes, collating elements
+            if (c == '\\') {
+                if (!escape(item, true))
+                    return false;
+                lo = single_byte(item);
+            } else {
+                lo = (unsigned char)c;
+                item.set(lo);
+            }
+            if (peek('-') && m_pos + 1 < m_end
+                && m_pattern[m_pos + 1] != ']') {
+                // A range, whose ends must be single bytes
+                ++m_pos;
+                ByteSet hi_item;
+                int hi = -1;
+                char h = m_pattern[m_pos++];
+                if (h == '\\') {
+                    if (!escape(hi_item, true))
+                        return false;
+                    hi = single_byte(hi_item);
+                } else {
+                    hi = (unsigned char)h;
+                }
+                if (lo < 0 || hi < lo)
+                    return false;
+                for (int b = lo; b <= hi; ++b)
+                    item.set(b);
+            }
+            set |= item;
+        }
+        ++m_pos;
+        if (negate)
+            set.flip();
+        return true;
+    }
+
+    string_view m_pattern;
+    size_t m_pos = 0;
+    size_t m_end;
+    std::vector<NfaState>& m_states;
+};
+
+
+
+struct CompiledRegex::Dfa {
+    int nclasses = 0;
+    int start    = 0;
+    std::vector<int> next;     ///< [state * nclasses + class], -1 = dead
+    std::vector<char> accept;  ///< Per state
+};
+
+
+
+static void
+lambda_closure(const std::vector<NfaState>& nfa, IntSet& states)
+{
+    std::vector<int> stack(states.begin(), states.end());
+    while (!stack.empty()) {
+        int s = stack.back();
+        stack.pop_back();
+        for (int t : nfa[s].lambda)
+            if (states.insert(t).second)
+                stack.push_back(t);
+    }
+}
+
+
+
+// Subset construction, as ndfautoToDfauto does for the light path
+// expressions. With `restart`, the initial state is added to every state
+// set, so a match may begin anywhere in the subject.
+static std::unique_ptr<CompiledRegex::Dfa>
+build_dfa(const std::vector<NfaState>& nfa, NfaFrag frag,
+          const unsigned char* byte_class, int nclasses, bool restart)
+{
+    std::vector<int> representative(nclasses, -1);
+    for (int b = 255; b >= 0; --b)
+        representative[byte_class[b]] = b;
+
+    IntSet initial = { frag.in };
+    lambda_closure(nfa, initial);
+
+    std::unique_ptr<CompiledRegex::Dfa> dfa(new CompiledRegex::Dfa);
+    dfa->nclasses = nclasses;
+    std::vector<IntSet> sets;
+    std::unordered_map<StateSetKey, int, StateSetKeyHash> index;
+    StateSetKey key;
+    auto state_of = [&](const IntSet& set) {
+        keyFromStateSet(set, key);
+        auto found = index.find(key);
+        if (found != index.end())
+            return found->second;
+        int id = int(sets.size());
+        index.emplace(key, id);
+        sets.push_back(set);
+        return id;
+    };
+    dfa->start = state_of(initial);
+    for (size_t s = 0; s < sets.size(); ++s) {
+        if (sets.size() > size_t(max_dfa_states))
+            return nullptr;
+        dfa->accept.push_back(sets[s].count(frag.out) != 0);
+        for (int c = 0; c < nclasses; ++c) {
+            IntSet moved = restart ? initial : IntSet();
+            for (int n : sets[s]) {
+                if (nfa[n].next >= 0 && nfa[n].bytes[representative[c]])
+                    moved.insert(nfa[n].next);
+            }
+            lambda_closure(nfa, moved);
+            dfa->next.push_back(moved.empty() ? -1 : state_of(moved));
+        }
+    }
+    return dfa;
+}
+
+
+
+// Run the automaton over the subject. With `early`, any prefix of the
+// subject reaching an accepting state is a match.
+static bool
+run_dfa(const CompiledRegex::Dfa& dfa, const unsigned char* byte_class,
+        string_view subject, bool early)
+{
+    int state = dfa.start;
+    if (early && dfa.accept[state])
+        return true;
+    const int* next = dfa.next.data();
+    for (unsigned char c : subject) {
+        state = next[state * dfa.nclasses + byte_class[c]];
+        if (state < 0)
+            return false;
+        if (early && dfa.accept[state])
+            return true;
+    }
+    return dfa.accept[state];
+}
+
+
+
+CompiledRegex::CompiledRegex(ustring pattern) : m_pattern(pattern)
+{
+    try {
+        m_regex = std::regex(pattern.string());
+    } catch (const std::regex_error& e) {
+        m_error = e.what();
+        return;
+    }
+
+    std::vector<NfaState> nfa;
+    NfaFrag frag;
+    bool anchored_begin = false;
+    RegexNfaBuilder builder(pattern, nfa);
+    if (!builder.build(frag, anchored_begin, m_anchored_end))
+        return;
+
+    // Bytes that no transition tells apart share a column of the tables
+    memset(m_byte_class, 0, sizeof(m_byte_class));
+    int nclasses = 1;
+    for (const NfaState& s : nfa) {
+        if (s.next < 0)
+            continue;
+        std::map<std::pair<int, bool>, int> split;
+        for (int b = 0; b < 256; ++b) {
+            auto c = split.emplace(std::make_pair(int(m_byte_class[b]),
+                                                  bool(s.bytes[b])),
+                                   int(split.size()));
+            m_byte_class[b] = (unsigned char)c.first->second;
+        }
+        nclasses = int(split.size());
+    }
+
+    // regex_match anchors both ends, so the anchors don't matter to it
+    m_match_dfa  = build_dfa(nfa, frag, m_byte_class, nclasses, false);
+    m_search_dfa = build_dfa(nfa, frag, m_byte_class, nclasses,
+                             !anchored_begin);
+}
+
+
+
+CompiledRegex::~CompiledRegex() {}
+
+
+
+bool
+CompiledRegex::matches(string_view subject, bool fullmatch) const
+{
+    if (!valid())
+        return false;
+    if (fullmatch) {
+        if (m_match_dfa)
+            return run_dfa(*m_match_dfa, m_byte_class, subject, false);
+        return std::regex_match(subject.begin(), subject.end(), m_regex);
+    } else {
+        if (m_search_dfa)
+            return run_dfa(*m_search_dfa, m_byte_class, subject,
+                           !m_anchored_end);
+        return std::regex_search(subject.begin(), subject.end(), m_regex);
+    }
+}
+
+
+
+int
+CompiledRegex::execute(string_view subject, int* results, int nresults,
+                       bool fullmatch) const
+{
+    if (nresults <= 0)
+        return matches(subject, fullmatch);
+    const char* start = subject.data();
+    const char* end   = start + subject.size();
+    std::match_results<const char*> mresults;
+    int res = 0;
+    // Only the subjects that match need std::regex for the submatches
+    if (valid() && (!has_automata() || matches(subject, fullmatch)))
+        res = fullmatch ? std::regex_match(start, end, mresults, m_regex)
+                        : std::regex_search(start, end, mresults, m_regex);
+    for (int r = 0; r < nresults; ++r) {
+        if (r / 2 < (int)mresults.size()) {
+            if ((r & 1) == 0)
+                results[r] = mresults[r / 2].first - start;
+            else
+                results[r] = mresults[r / 2].second - start;
+        } else {
+            results[r] = m_pattern.length();
+        }
+    }
+    return res;
+}
+
+
+
+RegexCache::RegexCache() {}
+
+
+
+RegexCache::~RegexCache() {}
+
+
+
+const CompiledRegex&
+RegexCache::find(ustring pattern, bool* created)
+{
+    if (created)
+        *created = false;
+    {
+        OIIO::spin_lock lock(m_mutex);
+        auto found = m_regexes.find(pattern);
+        if (found != m_regexes.end())
+            return *found->second;
+    }
+    // Compile without holding the lock. If another thread compiled the
+    // same pattern meanwhile, its copy wins and ours is discarded.
+    std::unique_ptr<CompiledRegex> regex(new CompiledRegex(pattern));
+    OIIO::spin_lock lock(m_mutex);
+    auto inserted = m_regexes.emplace(pattern, std::move(regex));
+    if (created)
+        *created = inserted.second;
+    return *inserted.first->second;
+}
+
+
+}  // namespace pvt
+OSL_NAMESPACE_END
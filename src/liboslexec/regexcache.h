@@ -0,0 +1,95 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <memory>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <OSL/oslconfig.h>
+
+#include <OpenImageIO/thread.h>
+
+
+OSL_NAMESPACE_BEGIN
+
+namespace pvt {
+
+
+/// A pattern compiled for the regex_match and regex_search shadeops.
+///
+/// Besides the std::regex, the patterns that describe regular languages
+/// (nearly all of those found in shaders) get deterministic automata over
+/// the bytes of the subject, which tell whether it matches in a single
+/// pass over its characters. The much slower backtracking std::regex is
+/// then only needed to find the submatch positions of the subjects that
+/// do match, and for the constructs the automata don't support (back
+/// references, lookaheads, word boundaries, ...).
+///
+/// All the methods are const and may be called concurrently.
+class CompiledRegex {
+public:
+    explicit CompiledRegex(ustring pattern);
+    ~CompiledRegex();
+
+    ustring pattern() const { return m_pattern; }
+
+    /// False if the pattern isn't a valid regex, in which case it never
+    /// matches and error() says why.
+    bool valid() const { return m_error.empty(); }
+    const std::string& error() const { return m_error; }
+
+    /// Does the whole subject (fullmatch) or any part of it match?
+    bool matches(string_view subject, bool fullmatch) const;
+
+    /// The regex shadeops: return whether the subject matches, and if
+    /// nresults > 0, fill in the begin and end offsets of the match and
+    /// of its submatches, as many as fit in results[0..nresults-1].
+    int execute(string_view subject, int* results, int nresults,
+                bool fullmatch) const;
+
+    /// The std::regex, for the callers that need its submatches.
+    const std::regex& regex() const { return m_regex; }
+
+    /// Does either kind of match run on an automaton?
+    bool has_automata() const { return m_match_dfa || m_search_dfa; }
+
+    struct Dfa;
+
+private:
+    ustring m_pattern;
+    std::regex m_regex;
+    std::string m_error;
+    unsigned char m_byte_class[256];   ///< Shared by both automata
+    std::unique_ptr<Dfa> m_match_dfa;  ///< For regex_match, or nullptr
+    std::unique_ptr<Dfa> m_search_dfa;  ///< For regex_search, or nullptr
+    bool m_anchored_end = false;        ///< Did the pattern end with '$'?
+};
+
+
+
+/// Thread-safe cache of the patterns compiled by one ShadingSystem, shared
+/// by all its contexts. Patterns are compiled the first time any thread
+/// asks for them and live as long as the cache, so the references it
+/// returns may be kept (including by JITed code, for constant patterns).
+class RegexCache {
+public:
+    RegexCache();
+    ~RegexCache();
+
+    /// Return the compiled pattern. If `created` is given, it is set to
+    /// whether this call compiled it.
+    const CompiledRegex& find(ustring pattern, bool* created = nullptr);
+
+private:
+    mutable OIIO::spin_mutex m_mutex;  ///< Guards m_regexes
+    std::unordered_map<ustring, std::unique_ptr<CompiledRegex>> m_regexes;
+};
+
+
+}  // namespace pvt
+OSL_NAMESPACE_END
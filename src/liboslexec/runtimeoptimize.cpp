@@ -2,6 +2,7 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
 #include <vector>
@@ -24,6 +25,14 @@ static ustring u_assign("assign");
 static ustring u_add("add");
 static ustring u_sub("sub");
 static ustring u_mul("mul");
+static ustring u_lt("lt");
+static ustring u_abs("abs");
+static ustring u_fabs("fabs");
+static ustring u_noise("noise");
+static ustring u_cellnoise("cellnoise");
+static ustring u_hashnoise("hashnoise");
+static ustring u_fbm("fbm");
+static ustring u_turbulence("turbulence");
 static ustring u_if("if");
 static ustring u_for("for");
 static ustring u_while("while");
@@ -2032,6 +2041,257 @@ RuntimeOptimizer::eliminate_middleman()
 
 
 
+/// Find the fBm and turbulence loops over cell or hash noise that have
+/// constant bounds, and replace each with one fbm or turbulence op that
+/// evaluates all the octaves in a single call. The loops must have the
+/// form shaders usually give them,
+///     for (int i = A; i < N; ++i) {
+///         sum += amp * cellnoise(P * freq);
+///         freq *= lacunarity;
+///         amp *= gain;
+///     }
+/// with constant A, N, lacunarity, and gain (for turbulence, the noise
+/// becomes abs(noise * 2 - 1)); see octave_noise() in oslnoise.h.
+int
+RuntimeOptimizer::fold_octave_loops()
+{
+    if (shadingsys().no_noise())
+        return 0;  // Leave the noise calls for llvm_gen_noise to replace
+    int changed = 0;
+    for (int opnum = 0, e = (int)inst()->ops().size(); opnum < e; ++opnum)
+        if (inst()->ops()[opnum].opname() == u_for && fold_octave_loop(opnum))
+            ++changed;
+    return changed;
+}
+
+
+
+bool
+RuntimeOptimizer::fold_octave_loop(int opnum)
+{
+    OpcodeVec& code(inst()->ops());
+    const Opcode& loop(code[opnum]);
+    int done = loop.jump(3);
+
+    // The ops of each part of the loop, skipping nops
+    auto live_ops = [&](int begin, int end) {
+        std::vector<int> ops;
+        for (int n = begin; n < end; ++n)
+            if (code[n].opname() != u_nop)
+                ops.push_back(n);
+        return ops;
+    };
+    std::vector<int> init = live_ops(opnum + 1, loop.jump(0));
+    std::vector<int> cond = live_ops(loop.jump(0), loop.jump(1));
+    std::vector<int> body = live_ops(loop.jump(1), loop.jump(2));
+    std::vector<int> iter = live_ops(loop.jump(2), done);
+    if (init.size() != 1 || cond.size() != 1 || iter.empty()
+        || iter.size() > 2 || (body.size() != 6 && body.size() != 9))
+        return false;
+
+    auto is_op = [&](int n, ustring opname, int nargs) {
+        return code[n].opname() == opname && code[n].nargs() == nargs;
+    };
+    auto arg = [&](int n, int a) { return oparg(code[n], a); };
+    auto sym = [&](int s) { return inst()->symbol(s); };
+    auto const_int = [&](int s, int& val) {
+        if (s < 0 || !sym(s)->is_constant() || !sym(s)->typespec().is_int())
+            return false;
+        val = sym(s)->get_int();
+        return true;
+    };
+    auto const_float = [&](int s, float& val) {
+        if (s < 0 || !sym(s)->is_constant())
+            return false;
+        if (sym(s)->typespec().is_float())
+            val = sym(s)->get_float();
+        else if (sym(s)->typespec().is_int())
+            val = float(sym(s)->get_int());
+        else
+            return false;
+        return true;
+    };
+    auto is_float = [&](int s) { return sym(s)->typespec().is_float(); };
+    auto is_triple = [&](int s) { return sym(s)->typespec().is_triple(); };
+    // For commutative ops, the argument of op n that isn't s, or -1
+    auto other_arg = [&](int n, int s) {
+        return arg(n, 1) == s ? arg(n, 2) : arg(n, 2) == s ? arg(n, 1) : -1;
+    };
+
+    // Temporaries the loop writes, which must not be used outside of it
+    std::vector<int> temps;
+
+    // for (int i = A;  i < N;  ++i)
+    int first, last, step;
+    if (!is_op(init[0], u_assign, 2) || !const_int(arg(init[0], 1), first))
+        return false;
+    int i = arg(init[0], 0);
+    if (!sym(i)->typespec().is_int() || !is_op(cond[0], u_lt, 3)
+        || arg(cond[0], 0) != oparg(loop, 0) || arg(cond[0], 1) != i
+        || !const_int(arg(cond[0], 2), last))
+        return false;
+    temps.push_back(arg(cond[0], 0));
+    if (iter.size() == 2) {  // i++ saves the old value in a temp first
+        if (!is_op(iter[0], u_assign, 2) || arg(iter[0], 1) != i)
+            return false;
+        temps.push_back(arg(iter[0], 0));
+    }
+    if (!is_op(iter.back(), u_add, 3) || arg(iter.back(), 0) != i
+        || arg(iter.back(), 1) != i || !const_int(arg(iter.back(), 2), step)
+        || step != 1)
+        return false;
+
+    // T1 = P * freq;  N = cellnoise(T1)
+    int b = 0;
+    if (!is_op(body[b], u_mul, 3) || !is_triple(arg(body[b], 0)))
+        return false;
+    int T1   = arg(body[b], 0);
+    int P    = arg(body[b], 1);
+    int freq = arg(body[b], 2);
+    if (is_float(P))
+        std::swap(P, freq);
+    if (!is_triple(P) || !is_float(freq))
+        return false;
+    temps.push_back(T1);
+    ++b;
+    ustring noisename;
+    if (is_op(body[b], u_cellnoise, 2) || is_op(body[b], u_hashnoise, 2)) {
+        noisename = code[body[b]].opname();
+    } else if (is_op(body[b], u_noise, 3)
+               && sym(arg(body[b], 1))->is_constant()
+               && sym(arg(body[b], 1))->typespec().is_string()) {
+        ustring name = sym(arg(body[b], 1))->get_string();
+        if (name == Strings::cell || name == Strings::cellnoise)
+            noisename = Strings::cellnoise;
+        else if (name == Strings::hash || name == Strings::hashnoise)
+            noisename = Strings::hashnoise;
+    }
+    if (noisename.empty() || arg(body[b], code[body[b]].nargs() - 1) != T1
+        || !is_float(arg(body[b], 0)))
+        return false;
+    int N = arg(body[b], 0);
+    temps.push_back(N);
+    ++b;
+
+    // Turbulence:  N = abs(N * 2 - 1)
+    bool turbulence = (body.size() == 9);
+    if (turbulence) {
+        float two, one;
+        if (!is_op(body[b], u_mul, 3)
+            || !const_float(other_arg(body[b], N), two) || two != 2.0f
+            || !is_op(body[b + 1], u_sub, 3)
+            || arg(body[b + 1], 1) != arg(body[b], 0)
+            || !const_float(arg(body[b + 1], 2), one) || one != 1.0f
+            || !(is_op(body[b + 2], u_abs, 2)
+                 || is_op(body[b + 2], u_fabs, 2))
+            || arg(body[b + 2], 1) != arg(body[b + 1], 0))
+            return false;
+        for (int k = 0; k < 3; ++k, ++b) {
+            if (!is_float(arg(body[b], 0)))
+                return false;
+            temps.push_back(arg(body[b], 0));
+        }
+        N = temps.back();
+    }
+
+    // sum += amp * N
+    if (!is_op(body[b], u_mul, 3) || !is_float(arg(body[b], 0)))
+        return false;
+    int amp = other_arg(body[b], N);
+    int T3  = arg(body[b], 0);
+    temps.push_back(T3);
+    ++b;
+    if (!is_op(body[b], u_add, 3))
+        return false;
+    int sum = arg(body[b], 0);
+    if (amp < 0 || !is_float(amp) || !is_float(sum)
+        || other_arg(body[b], sum) != T3)
+        return false;
+    ++b;
+
+    // freq *= lacunarity;  amp *= gain  (in either order)
+    float lacunarity = 0.0f, gain = 0.0f;
+    bool found_freq = false, found_amp = false;
+    for (; b < (int)body.size(); ++b) {
+        int x = arg(body[b], 0);
+        if (!is_op(body[b], u_mul, 3) || (x != freq && x != amp)
+            || arg(body[b], 1) != x)
+            return false;
+        if (x == freq && !found_freq)
+            found_freq = const_float(arg(body[b], 2), lacunarity);
+        else if (x == amp && !found_amp)
+            found_amp = const_float(arg(body[b], 2), gain);
+        else
+            return false;
+    }
+    if (!found_freq || !found_amp)
+        return false;
+
+    // All the symbols the loop writes must be distinct, and none of them
+    // may be P.
+    std::vector<int> written(temps);
+    written.insert(written.end(), { i, sum, freq, amp });
+    std::sort(written.begin(), written.end());
+    if (std::adjacent_find(written.begin(), written.end()) != written.end()
+        || std::binary_search(written.begin(), written.end(), P))
+        return false;
+    for (int t : temps) {
+        const Symbol* T(sym(t));
+        if (T->symtype() != SymTypeTemp || T->firstwrite() < opnum
+            || T->lastwrite() >= done
+            || (T->everread()
+                && (T->firstread() < opnum || T->lastread() >= done)))
+            return false;
+    }
+    // The fbm op doesn't compute derivatives. Those of the noise are zero
+    // anyway, and by insisting that freq and amp are locals only ever set
+    // to constants outside of the loop, theirs are too, so the ones of sum
+    // carry through unchanged.
+    for (int s : { freq, amp }) {
+        const Symbol* S(sym(s));
+        if (S->symtype() != SymTypeLocal)
+            return false;
+        for (int n = S->firstwrite(); n <= S->lastwrite(); ++n) {
+            if (n >= opnum && n < done)
+                continue;
+            for (int a = 0; a < code[n].nargs(); ++a)
+                if (arg(n, a) == s && code[n].argwrite(a)
+                    && !(is_op(n, u_assign, 2)
+                         && sym(arg(n, 1))->is_constant()))
+                    return false;
+        }
+    }
+
+    // Replace the loop op with the fbm (or turbulence) op, the counter
+    // initialization with the counter's final value, and nop the rest.
+    int args[] = { sum,
+                   add_constant(noisename),
+                   P,
+                   freq,
+                   amp,
+                   add_constant(std::max(last - first, 0)),
+                   add_constant(lacunarity),
+                   add_constant(gain) };
+    int final_i    = add_constant(std::max(first, last));
+    ustring newop  = turbulence ? u_turbulence : u_fbm;
+    Opcode& foldop = inst()->ops()[opnum];
+    if (debug() > 1)
+        debug_turn_into(foldop, 1, newop, sum, P, -1, "octave loop");
+    foldop.reset(newop, 8);
+    foldop.set_args(inst()->args().size(), 8);
+    inst()->args().insert(inst()->args().end(), std::begin(args),
+                          std::end(args));
+    foldop.argread(0, true);
+    foldop.argwrite(3, true);
+    foldop.argwrite(4, true);
+    turn_into_assign(inst()->ops()[init[0]], final_i, "octave loop counter");
+    turn_into_nop(init[0] + 1, done, "octave loop");
+    shadingsys().m_stat_octave_loops_folded += 1;
+    return true;
+}
+
+
+
 int
 RuntimeOptimizer::optimize_assignment(Opcode& op, int opnum)
 {
@@ -2421,6 +2681,16 @@ RuntimeOptimizer::optimize_instance()
             changed += c;
         }
 
+        // Evaluate the octave loops of cell and hash noise in one call.
+        // The batched backends have no fbm op, so leave those groups be.
+        if (optimize() >= 2 && shadingsys().opt_octave_loops()
+            && !m_opt_batched_analysis) {
+            int c = fold_octave_loops();
+            if (c)
+                track_variable_lifetimes();
+            changed += c;
+        }
+
         // Elide unconnected parameters that are never read.
         if (optimize() >= 1)
             changed += remove_unused_params();
@@ -2576,112 +2846,145 @@ RuntimeOptimizer::syms_used_in_op(Opcode& op, std::vector<int>& rsyms,
 static const int DerivSym = -1;
 
 
-// Recursively mark symbols that have derivatives from dependency map
+// Recursively mark symbols that have derivatives from dependency map.
+// The map is over value nodes, node_sym gives the symbol of each node.
 void
 RuntimeOptimizer::mark_symbol_derivatives(SymDependency& symdeps,
-                                          SymIntSet& visited, int d)
+                                          SymIntSet& visited,
+                                          const std::vector<int>& node_sym,
+                                          int d)
 {
     for (auto&& r : symdeps[d]) {
         if (visited.find(r) == visited.end()) {
             visited.insert(r);
 
-            Symbol* s = inst()->symbol(r);
+            Symbol* s = inst()->symbol(node_sym[r]);
 
             if (s->typespec().elementtype().is_float_based())
                 s->has_derivs(true);
 
-            mark_symbol_derivatives(symdeps, visited, r);
+            mark_symbol_derivatives(symdeps, visited, node_sym, r);
         }
     }
 }
 
 
-/// Run through all the ops, for each one marking its 'written'
-/// arguments as dependent upon its 'read' arguments (and performing
-/// unification as we go), yielding a dependency map that lets us look
-/// up any symbol and see the set of other symbols on which it ever
-/// depends on during execution of the shader.
+/// Run through all the ops, for each one marking the values it writes as
+/// dependent upon the values it reads, yielding a dependency map that
+/// lets us find every value that can flow into an argument that takes
+/// derivatives, and mark the symbols holding those values.
 void
 RuntimeOptimizer::track_variable_dependencies()
 {
     SymDependency symdeps;
 
-    // It's important to note that this is simplistically conservative
-    // in that it overestimates dependencies.  To see why this is the
-    // case, consider the following code:
+    // The nodes of the dependency map are values rather than symbols,
+    // which avoids overestimating dependencies when a variable is reused.
+    // Consider:
     //       // inputs a,b; outputs x,y; local variable t
     //       t = a;
     //       x = t;
     //       t = b;
     //       y = t;
-    // We can see that x depends on a and y depends on b.  But the
-    // dependency analysis we do below thinks that y also depends on a
-    // (because t depended on both a and b, but at different times).
+    // If y needs derivatives, only b (and t) should get them, not a. So a
+    // symbol gets a new value node (an SSA-like version) every time it
+    // is wholly overwritten by a simple assignment that is executed
+    // unconditionally in the main code, and later reads depend on that
+    // node only. Writes inside conditionals and loops, partial writes
+    // (array elements, components) and writes by ops that might leave
+    // the old value in place all update the current node instead, which
+    // keeps them conservative: the node depends on everything that
+    // might have been assigned to it. Symbols touched by init ops, which
+    // may run lazily at any point, are never versioned.
     //
-    // This naivite will never miss a dependency, but it may
-    // overestimate dependencies.  (Hence we call this "conservative"
-    // rather than "wrong.")  We deem this acceptable for now, since
-    // it's so much easier to implement the conservative dependency
-    // analysis, and it's not yet clear that getting it closer to
-    // optimal will have any performance impact on final shaders. Also
-    // because this is probably no worse than the "dependency slop" that
-    // would happen with loops and conditionals.  But we certainly may
-    // revisit with a more sophisticated algorithm if this crops up
-    // a legitimate issue.
-    //
-    // Because of this conservative approach, it is critical that this
-    // analysis is done BEFORE temporaries are coalesced (which would
-    // cause them to be reassigned in exactly the way that confuses this
-    // analysis).
+    // This analysis must be done BEFORE temporaries are coalesced, since
+    // it relies on distinct temporaries holding distinct values.
 
     symdeps.clear();
+    find_conditionals();
+
+    int nsyms     = (int)inst()->symbols().size();
+    int mainbegin = inst()->maincodebegin();
+    int mainend   = inst()->maincodeend();
+
+    // Node n < nsyms is the initial value of symbol n, versions get new
+    // node ids past the end.
+    std::vector<int> node_sym(nsyms);
+    std::vector<int> cur_node(nsyms);
+    for (int i = 0; i < nsyms; ++i)
+        node_sym[i] = cur_node[i] = i;
+
+    OpcodeVec& code(inst()->ops());
+    std::vector<char> versioned(nsyms, true);
+    for (int opnum = 0; opnum < (int)code.size(); ++opnum) {
+        if (opnum >= mainbegin && opnum < mainend)
+            continue;
+        const Opcode& op(code[opnum]);
+        for (int a = 0; a < op.nargs(); ++a)
+            versioned[inst()->arg(op.firstarg() + a)] = false;
+    }
 
     std::vector<int> read, written;
     bool forcederivs = shadingsys().force_derivs();
     // Loop over all ops...
-    for (auto&& op : inst()->ops()) {
+    for (int opnum = 0; opnum < (int)code.size(); ++opnum) {
+        Opcode& op(code[opnum]);
         // Gather the list of syms read and written by the op.  Reuse the
         // vectors defined outside the loop to cut down on malloc/free.
         read.clear();
         written.clear();
         syms_used_in_op(op, read, written);
+        if (written.empty())
+            continue;
 
         // FIXME -- special cases here!  like if any ops implicitly read
         // or write to globals without them needing to be arguments.
 
+        // If the op takes derivs, make the pseudo-symbol DerivSym depend
+        // on the values of those arguments.
+        if (op.argtakesderivs_all() || forcederivs) {
+            for (int a = 0; a < op.nargs(); ++a)
+                if (op.argtakesderivs(a) || forcederivs) {
+                    Symbol& s(*opargsym(op, a));
+                    // Constants can't take derivs
+                    if (s.symtype() == SymTypeConst)
+                        continue;
+                    // Non-float types can't take derivs
+                    if (s.typespec().is_closure()
+                        || s.typespec().simpletype().basetype
+                               != TypeDesc::FLOAT)
+                        continue;
+                    // Careful -- not all globals can take derivs
+                    if (s.symtype() == SymTypeGlobal
+                        && !(s.mangled() == Strings::P
+                             || s.mangled() == Strings::I
+                             || s.mangled() == Strings::u
+                             || s.mangled() == Strings::v
+                             || s.mangled() == Strings::Ps))
+                        continue;
+                    add_dependency(symdeps, DerivSym,
+                                   cur_node[inst()->arg(a + op.firstarg())]);
+                }
+        }
+
+        // Does the op start a new value of its result?
+        bool new_value = opnum >= mainbegin && opnum < mainend
+                         && op_is_unconditionally_executed(opnum)
+                         && is_simple_assign(op) && versioned[oparg(op, 0)];
+
         // For each symbol w written by the op...
         for (auto&& w : written) {
+            int wnode = cur_node[w];
+            if (new_value) {
+                wnode = (int)node_sym.size();
+                node_sym.push_back(w);
+            }
             // For each symbol r read by the op, make w depend on r.
             // (Unless r is a constant , in which case it's not necessary.)
             for (auto&& r : read)
                 if (inst()->symbol(r)->symtype() != SymTypeConst)
-                    add_dependency(symdeps, w, r);
-            // If the op takes derivs, make the pseudo-symbol DerivSym
-            // depend on those arguments.
-            if (op.argtakesderivs_all() || forcederivs) {
-                for (int a = 0; a < op.nargs(); ++a)
-                    if (op.argtakesderivs(a) || forcederivs) {
-                        Symbol& s(*opargsym(op, a));
-                        // Constants can't take derivs
-                        if (s.symtype() == SymTypeConst)
-                            continue;
-                        // Non-float types can't take derivs
-                        if (s.typespec().is_closure()
-                            || s.typespec().simpletype().basetype
-                                   != TypeDesc::FLOAT)
-                            continue;
-                        // Careful -- not all globals can take derivs
-                        if (s.symtype() == SymTypeGlobal
-                            && !(s.mangled() == Strings::P
-                                 || s.mangled() == Strings::I
-                                 || s.mangled() == Strings::u
-                                 || s.mangled() == Strings::v
-                                 || s.mangled() == Strings::Ps))
-                            continue;
-                        add_dependency(symdeps, DerivSym,
-                                       inst()->arg(a + op.firstarg()));
-                    }
-            }
+                    add_dependency(symdeps, wnode, cur_node[r]);
+            cur_node[w] = wnode;
         }
     }
 
@@ -2689,7 +2992,6 @@ RuntimeOptimizer::track_variable_dependencies()
     // need derivs.  It's probably marked that way because another layer
     // downstream connects to it and needs derivatives of that
     // connection.
-    int snum = 0;
     for (auto&& s : inst()->symbols()) {
         // Globals that get written should always provide derivs.
         // Exclude N, since its derivs are unreliable anyway, so no point
@@ -2706,14 +3008,16 @@ RuntimeOptimizer::track_variable_dependencies()
                 && !s.typespec().is_closure_based())
                 s.has_derivs(true);
         }
-        if (s.has_derivs())
-            add_dependency(symdeps, DerivSym, snum);
-        ++snum;
     }
+    // We don't know which of their values those need derivs, so all of
+    // them do.
+    for (int n = 0, e = (int)node_sym.size(); n < e; ++n)
+        if (inst()->symbol(node_sym[n])->has_derivs())
+            add_dependency(symdeps, DerivSym, n);
 
     // Mark all symbols needing derivatives as such
     SymIntSet visited;
-    mark_symbol_derivatives(symdeps, visited, DerivSym);
+    mark_symbol_derivatives(symdeps, visited, node_sym, DerivSym);
 
     // Only some globals are allowed to have derivatives
     for (auto&& s : inst()->symbols()) {
@@ -3143,6 +3447,7 @@ void
 RuntimeOptimizer::run()
 {
     Timer rop_timer;
+    TraceScope trace(shadingsys(), "runtime optimize", group().name());
     int nlayers = (int)group().nlayers();
     if (debug())
         shadingcontext()->infofmt(
@@ -334,7 +334,7 @@ public:
     void add_dependency(SymDependency& dmap, int A, int B);
 
     void mark_symbol_derivatives(SymDependency& symdeps, SymIntSet& visited,
-                                 int d);
+                                 const std::vector<int>& node_sym, int d);
 
     void mark_outgoing_connections();
 
@@ -345,6 +345,11 @@ public:
 
     int eliminate_middleman();
 
+    /// Replace loops that sum octaves of cell or hash noise with a single
+    /// fbm or turbulence op. Return the number of loops replaced.
+    int fold_octave_loops();
+    bool fold_octave_loop(int opnum);
+
     /// Squeeze out unused symbols from an instance that has been
     /// optimized.
     void collapse_syms();
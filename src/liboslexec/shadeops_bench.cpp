@@ -0,0 +1,772 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+
+/////////////////////////////////////////////////////////////////////////
+/// \file
+///
+/// Microbenchmarks for the shadeop families.
+///
+/// Every kernel is timed over the same set of points, first through the
+/// scalar (and Dual2) implementations one point at a time, then through
+/// the batched entry points that each USE_BATCHED target library
+/// (lib_b<width>_<ISA>_oslexec) exports, a Block at a time with every lane
+/// active -- the same functions the JIT calls when it executes a batch.
+///
+/// Results are reported in points per second and can also be written as
+/// JSON to compare releases, or the USE_BATCHED targets on a given machine.
+///
+/////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include <OpenImageIO/argparse.h>
+#include <OpenImageIO/benchmark.h>
+#include <OpenImageIO/filesystem.h>
+#include <OpenImageIO/fmath.h>
+#include <OpenImageIO/imagebuf.h>
+#include <OpenImageIO/plugin.h>
+#include <OpenImageIO/strutil.h>
+#include <OpenImageIO/sysutil.h>
+#include <OpenImageIO/texture.h>
+
+#include "oslexec_pvt.h"
+#include <OSL/Imathx/Imathx.h>
+#include <OSL/dual.h>
+#include <OSL/dual_vec.h>
+#include <OSL/encodedtypes.h>
+#include <OSL/hashes.h>
+#include <OSL/llvm_util.h>
+#include <OSL/oslnoise.h>
+#include <OSL/rendererservices.h>
+#include <OSL/wide.h>
+
+#include "opcolor.h"
+#include "opcolor_impl.h"
+#include "splineimpl.h"
+
+using namespace OSL;
+using namespace OIIO;
+
+// Name of the USE_BATCHED target whose compiler flags this build of the
+// benchmark was made with, if any.
+#ifndef OSL_BENCH_TARGET
+#    define OSL_BENCH_TARGET "default"
+#endif
+
+// Comma separated USE_BATCHED targets whose libraries are timed, e.g.
+// "b16_AVX512,b8_AVX2".
+#ifndef OSL_BENCH_BATCHED_TARGETS
+#    define OSL_BENCH_BATCHED_TARGETS ""
+#endif
+
+
+static int iterations = 1 << 20;  // points shaded per trial
+static int ntrials    = 5;
+static std::string jsonfile;
+static std::string libpath;
+static std::vector<std::string> filters;
+
+// Number of points every kernel shades per call, divisible by every width
+static const int npoints = 256;
+
+
+
+struct BenchResult {
+    std::string family;
+    std::string kernel;
+    std::string variant;
+    double points_per_second;
+    double ns_per_point;
+    double stddev_ns;
+};
+
+static std::vector<BenchResult> results;
+
+
+
+static bool
+selected(string_view family, string_view kernel)
+{
+    if (filters.empty())
+        return true;
+    std::string name = Strutil::fmt::format("{}/{}", family, kernel);
+    for (auto& f : filters)
+        if (Strutil::contains(name, f))
+            return true;
+    return false;
+}
+
+
+
+// Time func, which shades all npoints points every call.
+template<typename FUNC>
+static void
+run(string_view family, string_view kernel, string_view variant, FUNC&& func)
+{
+    Benchmarker bench;
+    bench.iterations(std::max(1, iterations / npoints));
+    bench.trials(ntrials);
+    bench.work(npoints);
+    bench.indent(2);
+    bench(Strutil::fmt::format("{}/{} {}", family, kernel, variant), func);
+
+    BenchResult r;
+    r.family            = family;
+    r.kernel            = kernel;
+    r.variant           = variant;
+    r.ns_per_point      = bench.avg() * 1.0e9 / npoints;
+    r.stddev_ns         = bench.stddev() * 1.0e9 / npoints;
+    r.points_per_second = bench.avg() > 0.0 ? npoints / bench.avg() : 0.0;
+    results.push_back(r);
+}
+
+
+
+// Shade the points one at a time, like the scalar shadeops.
+template<typename R, typename A, typename OP>
+static void
+shade_scalar(const std::vector<A>& in, std::vector<R>& out, const OP& op)
+{
+    for (size_t i = 0, e = in.size(); i < e; ++i)
+        op(out[i], in[i]);
+    DoNotOptimize(out.data());
+    clobber_all_memory();
+}
+
+
+
+template<int W, typename T>
+static std::vector<Block<T, W>>
+to_blocks(const std::vector<T>& values)
+{
+    std::vector<Block<T, W>> blocks(values.size() / W);
+    for (size_t i = 0, e = values.size(); i < e; ++i)
+        blocks[i / W].set(int(i % W), values[i]);
+    return blocks;
+}
+
+
+
+// A USE_BATCHED target library, opened to time the batched shadeops it
+// exports.
+struct BatchedLib {
+    std::string target;  // e.g. "b16_AVX512"
+    int width;
+    Plugin::Handle handle;
+};
+
+static std::vector<BatchedLib> batched_libs;
+
+
+
+// Open the library of every USE_BATCHED target that this host can run,
+// looking along libpath, or else where testshade looks for them.
+static void
+open_batched_libs()
+{
+    std::string searchpath = libpath;
+    if (searchpath.empty()) {
+        std::string exedir = Filesystem::parent_path(
+            Sysutil::this_program_path());
+        searchpath = Strutil::fmt::format("{}/../lib64:{}/../lib:{}", exedir,
+                                          exedir, exedir);
+    }
+    std::vector<std::string> dirs;
+    Filesystem::searchpath_split(searchpath, dirs);
+
+    for (string_view target : Strutil::splitsv(OSL_BENCH_BATCHED_TARGETS,
+                                               ",")) {
+        // "b16_AVX512_noFMA" is width 16, ISA AVX512_noFMA
+        size_t sep      = target.find('_');
+        int width       = Strutil::stoi(target.substr(1, sep - 1));
+        string_view isa = target.substr(sep + 1);
+        // The TargetISA names of the SSE targets differ from their suffix
+        if (isa == "SSE4_2")
+            isa = "SSE4.2";
+        else if (isa == "SSE2")
+            isa = "x64";
+        if (!LLVM_Util::supports_isa(LLVM_Util::lookup_isa_by_name(isa))) {
+            std::cout << "  skipping " << target << ", not supported here\n";
+            continue;
+        }
+        std::string libname
+            = Strutil::fmt::format("lib_{}_oslexec.{}", target,
+                                   Plugin::plugin_extension());
+        std::string filename = Filesystem::searchpath_find(libname, dirs);
+        if (filename.empty()) {
+            std::cout << "  skipping " << target << ", " << libname
+                      << " not found along \"" << searchpath << "\"\n";
+            continue;
+        }
+        Plugin::Handle handle = Plugin::open(filename, /*global=*/false);
+        if (!handle) {
+            std::cout << "  skipping " << target << ": "
+                      << Plugin::geterror() << "\n";
+            continue;
+        }
+        batched_libs.push_back({ std::string(target), width, handle });
+    }
+}
+
+
+
+// The batched entry point for opname in lib, e.g. "noise_WfWv" resolves
+// osl_b16_AVX512_noise_WfWv_masked, or nullptr if lib doesn't export it.
+static void*
+find_batched_op(const BatchedLib& lib, string_view opname)
+{
+    std::string name = Strutil::fmt::format("osl_{}_{}_masked", lib.target,
+                                            opname);
+    return Plugin::getsym(lib.handle, name.c_str(), /*report_error=*/false);
+}
+
+
+
+// Calls the most common form of batched shadeop, which takes the result
+// and argument Blocks followed by the mask of active lanes.
+struct CallBatchedOp {
+    void operator()(void* op, void* result, void* arg,
+                    unsigned int mask_value) const
+    {
+        typedef void (*OpFunc)(void*, void*, unsigned int);
+        reinterpret_cast<OpFunc>(op)(result, arg, mask_value);
+    }
+};
+
+
+
+// Calls a binary batched shadeop with the argument Block as both operands.
+struct CallBatchedBinaryOp {
+    void operator()(void* op, void* result, void* arg,
+                    unsigned int mask_value) const
+    {
+        typedef void (*OpFunc)(void*, void*, void*, unsigned int);
+        reinterpret_cast<OpFunc>(op)(result, arg, arg, mask_value);
+    }
+};
+
+
+
+template<int W, typename R, typename A, typename CALL>
+static void
+run_batched(string_view family, string_view kernel, const std::vector<A>& in,
+            const BatchedLib& lib, void* op, const CALL& call)
+{
+    auto win = to_blocks<W>(in);
+    std::vector<Block<R, W>> wout(win.size());
+    const unsigned int all_lanes = (1u << W) - 1;
+    run(family, kernel, lib.target, [&]() {
+        for (size_t b = 0, e = win.size(); b < e; ++b)
+            call(op, &wout[b], const_cast<Block<A, W>*>(&win[b]), all_lanes);
+        DoNotOptimize(wout.data());
+        clobber_all_memory();
+    });
+}
+
+
+
+// Time a kernel through its scalar op, which must be callable as
+// op(R& result, const A& arg), and through the batched entry point named
+// batched_op (if any) of every target library, which is called as
+// call(entry_point, Block<R>* result, Block<A>* arg, mask_value).
+template<typename R, typename A, typename OP, typename CALL = CallBatchedOp>
+static void
+bench_kernel(string_view family, string_view kernel, const std::vector<A>& in,
+             const OP& op, string_view batched_op = {},
+             const CALL& call = CALL())
+{
+    if (!selected(family, kernel))
+        return;
+    std::vector<R> out(in.size());
+    run(family, kernel, "scalar", [&]() { shade_scalar(in, out, op); });
+    for (const BatchedLib& lib : batched_libs) {
+        void* entry = batched_op.size() ? find_batched_op(lib, batched_op)
+                                        : nullptr;
+        if (!entry)
+            continue;
+        switch (lib.width) {
+        case 4: run_batched<4, R>(family, kernel, in, lib, entry, call); break;
+        case 8: run_batched<8, R>(family, kernel, in, lib, entry, call); break;
+        case 16:
+            run_batched<16, R>(family, kernel, in, lib, entry, call);
+            break;
+        }
+    }
+}
+
+
+
+// Points in a region where the kernels do representative work
+static std::vector<Vec3>
+make_points()
+{
+    std::vector<Vec3> P(npoints);
+    for (int i = 0; i < npoints; ++i) {
+        float f = float(i) / npoints;
+        P[i]    = Vec3(7.3f * f - 2.1f, 3.7f * f * f + 0.3f,
+                       std::sin(11.0f * f) * 4.0f);
+    }
+    return P;
+}
+
+
+
+static std::vector<Dual2<Vec3>>
+make_dual_points(const std::vector<Vec3>& P)
+{
+    std::vector<Dual2<Vec3>> dP(P.size());
+    for (size_t i = 0; i < P.size(); ++i)
+        dP[i] = Dual2<Vec3>(P[i], Vec3(0.01f, 0.0f, 0.002f),
+                            Vec3(0.0f, 0.01f, 0.003f));
+    return dP;
+}
+
+
+
+static std::vector<float>
+make_floats(float lo, float hi)
+{
+    std::vector<float> x(npoints);
+    for (int i = 0; i < npoints; ++i)
+        x[i] = lo + (hi - lo) * (float(i) + 0.5f) / npoints;
+    return x;
+}
+
+
+
+static std::vector<Dual2<float>>
+make_dual_floats(const std::vector<float>& x)
+{
+    std::vector<Dual2<float>> dx(x.size());
+    for (size_t i = 0; i < x.size(); ++i)
+        dx[i] = Dual2<float>(x[i], 0.01f, 0.005f);
+    return dx;
+}
+
+
+
+static void
+bench_noise()
+{
+    std::cout << "\nNoise:\n";
+    auto P  = make_points();
+    auto dP = make_dual_points(P);
+
+    bench_kernel<float>("noise", "perlin(v)", P,
+                        [](float& r, const Vec3& p) {
+                            pvt::NoiseScalar impl;
+                            impl(r, p);
+                        }, "noise_WfWv");
+    bench_kernel<Dual2<float>>("noise", "perlin(dv)", dP,
+                               [](Dual2<float>& r, const Dual2<Vec3>& p) {
+                                   pvt::NoiseScalar impl;
+                                   impl(r, p);
+                               }, "noise_WdfWdv");
+    bench_kernel<Vec3>("noise", "vperlin(v)", P, [](Vec3& r, const Vec3& p) {
+        pvt::NoiseScalar impl;
+        impl(r, p);
+    }, "noise_WvWv");
+    bench_kernel<float>("noise", "simplex(v)", P, [](float& r, const Vec3& p) {
+        pvt::SimplexNoiseScalar impl;
+        impl(r, p);
+    }, "simplexnoise_WfWv");
+    bench_kernel<Dual2<float>>("noise", "simplex(dv)", dP,
+                               [](Dual2<float>& r, const Dual2<Vec3>& p) {
+                                   pvt::SimplexNoiseScalar impl;
+                                   impl(r, p);
+                               }, "simplexnoise_WdfWdv");
+    bench_kernel<float>("noise", "cell(v)", P, [](float& r, const Vec3& p) {
+        pvt::CellNoise impl;
+        impl(r, p);
+    }, "cellnoise_WfWv");
+    bench_kernel<float>("noise", "hash(v)", P, [](float& r, const Vec3& p) {
+        pvt::HashNoise impl;
+        impl(r, p);
+    }, "hashnoise_WfWv");
+    // The same gabor noise, drawing the impulses of every cell, then
+    // taking them from the shared impulse table
+    for (int table = 0; table <= 1; ++table) {
+        NoiseParams opt;
+        opt.impulse_table = table;
+        bench_kernel<Dual2<float>>("noise",
+                                   table ? "gabor(dv) table" : "gabor(dv)", dP,
+                                   [&opt](Dual2<float>& r,
+                                          const Dual2<Vec3>& p) {
+                                       r = pvt::gabor(p, &opt);
+                                   });
+    }
+}
+
+
+
+static void
+bench_matrix()
+{
+    std::cout << "\nMatrix:\n";
+    auto P  = make_points();
+    auto dP = make_dual_points(P);
+    std::vector<Matrix44> M(npoints);
+    for (int i = 0; i < npoints; ++i) {
+        float a = 0.1f * i;
+        M[i].setEulerAngles(Vec3(a, 0.5f * a, 0.25f * a));
+        M[i].scale(Vec3(1.0f + 0.01f * i, 2.0f, 0.5f));
+        M[i][3][0] = P[i].x;
+        M[i][3][1] = P[i].y;
+        M[i][3][2] = P[i].z;
+    }
+    const Matrix44 xform = M[npoints / 3];
+
+    // The batched transforms take (Pin, Pout, transform, mask of the lanes
+    // whose transform was found, mask), here with a uniform transform
+    auto call_transform = [&](void* op, void* result, void* arg,
+                              unsigned int mask_value) {
+        typedef void (*OpFunc)(void*, void*, void*, unsigned int,
+                               unsigned int);
+        reinterpret_cast<OpFunc>(op)(arg, result, const_cast<Matrix44*>(&xform),
+                                     mask_value, mask_value);
+    };
+
+    bench_kernel<Vec3>("matrix", "transform(m,p)", P,
+                       [=](Vec3& r, const Vec3& p) {
+                           robust_multVecMatrix(xform, p, r);
+                       }, "transform_point_WvWvm", call_transform);
+    bench_kernel<Dual2<Vec3>>("matrix", "transform(m,dp)", dP,
+                              [=](Dual2<Vec3>& r, const Dual2<Vec3>& p) {
+                                  robust_multVecMatrix(xform, p, r);
+                              }, "transform_point_WdvWdvm", call_transform);
+    bench_kernel<Vec3>("matrix", "transformv(m,v)", P,
+                       [=](Vec3& r, const Vec3& v) {
+                           r = multiplyDirByMatrix(xform, v);
+                       }, "transform_vector_WvWvm", call_transform);
+    bench_kernel<Matrix44>("matrix", "mul(m,m)", M,
+                           [](Matrix44& r, const Matrix44& m) {
+                               r = multiplyMatrixByMatrix(m, m);
+                           }, "mul_WmWmWm", CallBatchedBinaryOp());
+    // No batched entry point, the JIT inverts matrices through div
+    bench_kernel<Matrix44>("matrix", "inverse(m)", M,
+                           [](Matrix44& r, const Matrix44& m) {
+                               r = OSL::affineInverse(m);
+                           });
+    bench_kernel<Matrix44>("matrix", "transpose(m)", M,
+                           [](Matrix44& r, const Matrix44& m) {
+                               r = inlinedTransposed(m);
+                           }, "transpose_WmWm");
+    bench_kernel<float>("matrix", "determinant(m)", M,
+                        [](float& r, const Matrix44& m) { r = det4x4(m); },
+                        "determinant_WfWm");
+}
+
+
+
+static void
+bench_transcendental()
+{
+    std::cout << "\nTranscendental:\n";
+    auto x  = make_floats(0.01f, 8.0f);
+    auto dx = make_dual_floats(x);
+
+    bench_kernel<float>("transcendental", "exp(f)", x,
+                        [](float& r, const float& a) { r = fast_exp(a); },
+                        "exp_WfWf");
+    bench_kernel<Dual2<float>>("transcendental", "exp(df)", dx,
+                               [](Dual2<float>& r, const Dual2<float>& a) {
+                                   r = fast_exp(a);
+                               }, "exp_WdfWdf");
+    bench_kernel<float>("transcendental", "log(f)", x,
+                        [](float& r, const float& a) { r = fast_log(a); },
+                        "log_WfWf");
+    bench_kernel<Dual2<float>>("transcendental", "log(df)", dx,
+                               [](Dual2<float>& r, const Dual2<float>& a) {
+                                   r = fast_log(a);
+                               }, "log_WdfWdf");
+    bench_kernel<float>("transcendental", "sin(f)", x,
+                        [](float& r, const float& a) { r = fast_sin(a); },
+                        "sin_WfWf");
+    bench_kernel<Dual2<float>>("transcendental", "sin(df)", dx,
+                               [](Dual2<float>& r, const Dual2<float>& a) {
+                                   r = fast_sin(a);
+                               }, "sin_WdfWdf");
+    bench_kernel<float>("transcendental", "pow(f,f)", x,
+                        [](float& r, const float& a) {
+                            r = fast_safe_pow(a, a);
+                        }, "pow_WfWfWf", CallBatchedBinaryOp());
+    bench_kernel<Dual2<float>>("transcendental", "pow(df,df)", dx,
+                               [](Dual2<float>& r, const Dual2<float>& a) {
+                                   r = fast_safe_pow(a, a);
+                               }, "pow_WdfWdfWdf", CallBatchedBinaryOp());
+}
+
+
+
+static void
+bench_spline()
+{
+    std::cout << "\nSpline:\n";
+    auto x  = make_floats(0.0f, 1.0f);
+    auto dx = make_dual_floats(x);
+    // Knots live in a static so the lambdas can capture nothing and still
+    // be inlined into the SIMD loops
+    static const int nknots     = 16;
+    static float knots[nknots]  = { 0.0f, 0.1f, 0.4f, 0.2f, 0.9f, 0.7f,
+                                    0.3f, 0.5f, 0.6f, 0.8f, 1.0f, 0.9f,
+                                    0.4f, 0.2f, 0.1f, 0.0f };
+    static ustringhash bases[] = { Hashes::catmullrom, Hashes::bspline,
+                                   Hashes::linear };
+
+    for (ustringhash basis : bases) {
+        auto interp = pvt::Spline::SplineInterp::create(basis);
+        ustring name = ustring_from(basis);
+        std::string kernel(name.c_str());
+        // The batched splines take (result, basis name, x, knots, knot
+        // count, knot array length, mask), here with uniform knots
+        auto call_spline = [=](void* op, void* result, void* arg,
+                               unsigned int mask_value) {
+            typedef void (*OpFunc)(void*, const char*, void*, float*, int, int,
+                                   unsigned int);
+            reinterpret_cast<OpFunc>(op)(result, name.c_str(), arg, knots,
+                                         nknots, nknots, mask_value);
+        };
+        bench_kernel<float>("spline", kernel + "(f)", x,
+                            [=](float& r, const float& a) {
+                                float xa = a;
+                                interp.evaluate<float, float, float, float,
+                                                false>(r, xa, knots, nknots,
+                                                       nknots);
+                            }, "spline_WfWff", call_spline);
+        bench_kernel<Dual2<float>>(
+            "spline", kernel + "(df)", dx,
+            [=](Dual2<float>& r, const Dual2<float>& a) {
+                Dual2<float> xa = a;
+                interp.evaluate<Dual2<float>, Dual2<float>, float, float,
+                                false>(r, xa, knots, nknots, nknots);
+            }, "spline_WdfWdff", call_spline);
+    }
+}
+
+
+
+static void
+bench_color()
+{
+    std::cout << "\nColor:\n";
+    std::vector<Color3> C(npoints);
+    std::vector<Dual2<Color3>> dC(npoints);
+    for (int i = 0; i < npoints; ++i) {
+        float f = (float(i) + 0.5f) / npoints;
+        C[i]    = Color3(f, 1.0f - 0.5f * f, 0.25f + 0.5f * f);
+        dC[i]   = Dual2<Color3>(C[i], Color3(0.01f), Color3(0.02f));
+    }
+    auto T = make_floats(800.0f, 12000.0f);
+
+    // The batched color ops find the color system through the
+    // BatchedShaderGlobals, so only their scalar variants are timed.
+    static pvt::ColorSystem cs;
+    cs.set_colorspace(Hashes::Rec709);
+
+    bench_kernel<Color3>("color", "hsv_to_rgb(c)", C,
+                         [](Color3& r, const Color3& c) {
+                             r = pvt::hsv_to_rgb(c);
+                         });
+    bench_kernel<Dual2<Color3>>("color", "hsv_to_rgb(dc)", dC,
+                                [](Dual2<Color3>& r, const Dual2<Color3>& c) {
+                                    r = pvt::hsv_to_rgb(c);
+                                });
+    bench_kernel<Color3>("color", "rgb_to_hsv(c)", C,
+                         [](Color3& r, const Color3& c) {
+                             r = pvt::rgb_to_hsv(c);
+                         });
+    bench_kernel<Color3>("color", "blackbody(f)", T,
+                         [](Color3& r, const float& t) {
+                             r = cs.blackbody_rgb(t);
+                         });
+    bench_kernel<float>("color", "luminance(c)", C,
+                        [](float& r, const Color3& c) {
+                            r = cs.luminance(c);
+                        });
+}
+
+
+
+// String formatting has no wide form, the batched shadeops format each
+// active lane with the same code, so only the scalar variant is timed.
+static void
+bench_string()
+{
+    std::cout << "\nString:\n";
+    if (!selected("string", "format"))
+        return;
+    auto P = make_points();
+    struct Args {
+        float x, y, z;
+        int32_t i;
+    };
+    std::vector<Args> args(npoints);
+    for (int i = 0; i < npoints; ++i)
+        args[i] = { P[i].x, P[i].y, P[i].z, i };
+    static const EncodedType types[] = { EncodedType::kFloat,
+                                         EncodedType::kFloat,
+                                         EncodedType::kFloat,
+                                         EncodedType::kInt32 };
+    ustringhash fmt("P = ({:.3f}, {:.3f}, {:.3f}) id = {}");
+    std::string decoded;
+    run("string", "format", "scalar", [&]() {
+        for (auto& a : args) {
+            // Packed the same way the shadeops encode their arguments
+            uint8_t values[sizeof(float) * 3 + sizeof(int32_t)];
+            memcpy(values, &a, sizeof(values));
+            decode_message(fmt.hash(), 4, types, values, decoded);
+            DoNotOptimize(decoded.data());
+        }
+    });
+}
+
+
+
+// Texture lookups go through RendererServices, so only the scalar entry
+// points are timed: through RendererServices::texture and straight to the
+// TextureSystem, the difference being the cost of the dispatch.
+static void
+bench_texture()
+{
+    std::cout << "\nTexture:\n";
+    if (!selected("texture", "texture(s,t)"))
+        return;
+    const int res       = 64;
+    std::string texfile = Filesystem::unique_path(
+        Filesystem::temp_directory_path() + "/shadeops_bench_%%%%%%.tif");
+    ImageBuf img(ImageSpec(res, res, 3, TypeDesc::FLOAT));
+    for (int y = 0; y < res; ++y)
+        for (int x = 0; x < res; ++x) {
+            float c[3] = { float(x) / res, float(y) / res, float(x ^ y) / res };
+            img.setpixel(x, y, c);
+        }
+    if (!img.write(texfile)) {
+        std::cout << "  could not write " << texfile << ": " << img.geterror()
+                  << "\n";
+        return;
+    }
+
+    RendererServices rs;
+    TextureSystem* texsys = rs.texturesys();
+    ustring filename(texfile);
+    TextureSystem::Perthread* thread_info = texsys->get_perthread_info();
+    TextureSystem::TextureHandle* handle
+        = texsys->get_texture_handle(filename, thread_info);
+    auto s = make_floats(0.0f, 1.0f);
+    TextureOpt opt;
+    float result[3];
+
+    run("texture", "texture(s,t)", "rendererservices", [&]() {
+        for (float u : s) {
+            rs.texture(ustringhash(filename), handle, thread_info, opt,
+                       nullptr, u, 1.0f - u, 0.002f, 0.0f, 0.0f, 0.002f, 3,
+                       result, nullptr, nullptr, nullptr);
+            DoNotOptimize(result[0]);
+        }
+    });
+    run("texture", "texture(s,t)", "texturesystem", [&]() {
+        for (float u : s) {
+            texsys->texture(handle, thread_info, opt, u, 1.0f - u, 0.002f,
+                            0.0f, 0.0f, 0.002f, 3, result);
+            DoNotOptimize(result[0]);
+        }
+    });
+
+    texsys->invalidate(filename);
+    Filesystem::remove(texfile);
+}
+
+
+
+static void
+write_json(const std::string& filename)
+{
+    std::ofstream out(filename);
+    if (!out) {
+        std::cerr << "shadeops_bench: could not open " << filename << "\n";
+        return;
+    }
+    out << "{\n";
+    out << Strutil::fmt::format("  \"osl_version\": \"{}\",\n",
+                                OSL_LIBRARY_VERSION_STRING);
+    out << Strutil::fmt::format("  \"target\": \"{}\",\n", OSL_BENCH_TARGET);
+    out << Strutil::fmt::format("  \"points_per_call\": {},\n", npoints);
+    out << Strutil::fmt::format("  \"trials\": {},\n", ntrials);
+    out << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        out << Strutil::fmt::format(
+            "    {{ \"family\": \"{}\", \"kernel\": \"{}\", "
+            "\"variant\": \"{}\", \"points_per_second\": {:.6g}, "
+            "\"ns_per_point\": {:.6g}, \"stddev_ns\": {:.6g} }}{}\n",
+            r.family, r.kernel, r.variant, r.points_per_second,
+            r.ns_per_point, r.stddev_ns, i + 1 < results.size() ? "," : "");
+    }
+    out << "  ]\n}\n";
+}
+
+
+
+static void
+getargs(int argc, const char* argv[])
+{
+    ArgParse ap;
+    // clang-format off
+    ap.intro("shadeops_bench -- shadeop microbenchmarks\n"
+             OSL_INTRO_STRING)
+      .usage("shadeops_bench [options]");
+    ap.arg("--iterations %d", &iterations)
+      .help(Strutil::fmt::format("Number of points shaded per trial (default: {})", iterations));
+    ap.arg("--trials %d", &ntrials)
+      .help("Number of trials");
+    ap.arg("--filter %L:SUBSTRING", &filters)
+      .help("Only run the kernels whose family/kernel name contains SUBSTRING (may be repeated)");
+    ap.arg("--json %s:FILENAME", &jsonfile)
+      .help("Write the results as JSON to FILENAME");
+    ap.arg("--libpath %s:DIRS", &libpath)
+      .help("Colon separated directories to search for the batched target libraries");
+    // clang-format on
+    ap.parse(argc, argv);
+}
+
+
+
+int
+main(int argc, char const* argv[])
+{
+#if !defined(NDEBUG) || defined(OIIO_CI) || defined(OIIO_CODE_COVERAGE)
+    // For the sake of test time, reduce the default iterations for DEBUG,
+    // CI, and code coverage builds. Explicit use of --iterations or --trials
+    // will override this, since it comes before the getargs() call.
+    iterations /= 10;
+    ntrials = 1;
+#endif
+
+    getargs(argc, argv);
+
+    std::cout << "Shadeop benchmarks, target " << OSL_BENCH_TARGET << ", "
+              << Sysutil::hardware_concurrency() << " hardware threads\n";
+    open_batched_libs();
+    for (const BatchedLib& lib : batched_libs)
+        std::cout << "  timing the batched shadeops of " << lib.target << "\n";
+
+    bench_noise();
+    bench_matrix();
+    bench_transcendental();
+    bench_spline();
+    bench_color();
+    bench_string();
+    bench_texture();
+
+    if (jsonfile.size())
+        write_json(jsonfile);
+    for (const BatchedLib& lib : batched_libs)
+        Plugin::close(lib.handle);
+    return 0;
+}
@@ -2,11 +2,14 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <fstream>
 #include <mutex>
 #include <string>
+#include <tuple>
 #include <vector>
 
 #include "oslexec_pvt.h"
@@ -268,6 +271,18 @@ ShadingSystem::execute(ShadingContext& ctx, ShaderGroup& group,
 
 
 
+bool
+ShadingSystem::execute_many(ShadingContext& ctx, ShaderGroup& group,
+                            int thread_index, int shadeindex_begin,
+                            span<ShaderGlobals> globals,
+                            void* userdata_base_ptr, void* output_base_ptr)
+{
+    return m_impl->execute_many(ctx, group, thread_index, shadeindex_begin,
+                                globals, userdata_base_ptr, output_base_ptr);
+}
+
+
+
 bool
 ShadingSystem::execute_init(ShadingContext& ctx, ShaderGroup& group,
                             int thread_index, int shade_index,
@@ -396,6 +411,96 @@ ShadingSystem::BatchedExecutor<WidthT>::execute_layer(
                output_base_ptr, layernumber)
                               : false;
 }
+
+template<int WidthT>
+static void
+copy_to_lane(VaryingShaderGlobals<WidthT>& vsg, int lane,
+             const ShaderGlobals& sg)
+{
+    vsg.P[lane]              = sg.P;
+    vsg.dPdx[lane]           = sg.dPdx;
+    vsg.dPdy[lane]           = sg.dPdy;
+    vsg.dPdz[lane]           = sg.dPdz;
+    vsg.I[lane]              = sg.I;
+    vsg.dIdx[lane]           = sg.dIdx;
+    vsg.dIdy[lane]           = sg.dIdy;
+    vsg.N[lane]              = sg.N;
+    vsg.Ng[lane]             = sg.Ng;
+    vsg.u[lane]              = sg.u;
+    vsg.dudx[lane]           = sg.dudx;
+    vsg.dudy[lane]           = sg.dudy;
+    vsg.v[lane]              = sg.v;
+    vsg.dvdx[lane]           = sg.dvdx;
+    vsg.dvdy[lane]           = sg.dvdy;
+    vsg.dPdu[lane]           = sg.dPdu;
+    vsg.dPdv[lane]           = sg.dPdv;
+    vsg.time[lane]           = sg.time;
+    vsg.dtime[lane]          = sg.dtime;
+    vsg.dPdtime[lane]        = sg.dPdtime;
+    vsg.Ps[lane]             = sg.Ps;
+    vsg.dPsdx[lane]          = sg.dPsdx;
+    vsg.dPsdy[lane]          = sg.dPsdy;
+    vsg.object2common[lane]  = sg.object2common;
+    vsg.shader2common[lane]  = sg.shader2common;
+    vsg.Ci[lane]             = nullptr;
+    vsg.surfacearea[lane]    = sg.surfacearea;
+    vsg.flipHandedness[lane] = sg.flipHandedness;
+    vsg.backfacing[lane]     = sg.backfacing;
+}
+
+template<int WidthT>
+bool
+ShadingSystem::BatchedExecutor<WidthT>::execute_stream(
+    ShadingContext& ctx, cspan<ShadeRequest> requests,
+    void* userdata_base_ptr, void* output_base_ptr,
+    const BatchDone& batch_done)
+{
+    // Bin the requests: sort their indices so that the points that can
+    // share a batch are next to each other, in stream order.
+    auto bin_key = [&](int i) {
+        const ShaderGlobals& sg(*requests[i].sg);
+        return std::make_tuple(requests[i].group, sg.raytype, sg.renderstate,
+                               sg.tracedata, sg.objdata, sg.renderer);
+    };
+    std::vector<int> order(requests.size());
+    for (int i = 0, e = int(order.size()); i < e; ++i)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(),
+                     [&](int a, int b) { return bin_key(a) < bin_key(b); });
+
+    auto bsg = std::make_unique<BatchedShaderGlobals<WidthT>>();
+    bool ok  = true;
+    for (size_t begin = 0, end = 0; begin < order.size(); begin = end) {
+        const ShadeRequest& first(requests[order[begin]]);
+        auto key = bin_key(order[begin]);
+        for (end = begin + 1; end < order.size() && bin_key(order[end]) == key;
+             ++end)
+            ;
+        UniformShaderGlobals& usg(bsg->uniform);
+        usg.renderstate = first.sg->renderstate;
+        usg.tracedata   = first.sg->tracedata;
+        usg.objdata     = first.sg->objdata;
+        usg.context     = nullptr;
+        usg.renderer    = first.sg->renderer;
+        usg.raytype     = first.sg->raytype;
+
+        // Full batches, then the tail of the bin with its lanes masked off
+        for (size_t b = begin; b < end; b += WidthT) {
+            int batch_size = int(std::min(end - b, size_t(WidthT)));
+            Block<int, WidthT> wide_shadeindex;
+            for (int lane = 0; lane < batch_size; ++lane) {
+                const ShadeRequest& r(requests[order[b + lane]]);
+                copy_to_lane(bsg->varying, lane, *r.sg);
+                wide_shadeindex[lane] = r.shadeindex;
+            }
+            ok &= execute(ctx, *first.group, batch_size, wide_shadeindex,
+                          *bsg, userdata_base_ptr, output_base_ptr);
+            if (batch_done)
+                batch_done(batch_size, &order[b], *bsg);
+        }
+    }
+    return ok;
+}
 #endif
 
 bool
@@ -662,6 +767,38 @@ ShadingSystem::getstats(int level) const
 
 
 
+void
+ShadingSystem::getstats(OIIO::ParamValueList& stats) const
+{
+    m_impl->getstats(stats);
+}
+
+
+
+std::string
+ShadingSystem::getstats_json() const
+{
+    return m_impl->getstats_json();
+}
+
+
+
+void
+ShadingSystem::reset_stats()
+{
+    m_impl->reset_stats();
+}
+
+
+
+bool
+ShadingSystem::write_trace(string_view filename) const
+{
+    return m_impl->write_trace(filename);
+}
+
+
+
 void
 ShadingSystem::register_closure(string_view name, int id,
                                 const ClosureParam* params,
@@ -1046,6 +1183,168 @@ PerThreadInfo::pop_context()
 
 
 
+void
+PerThreadInfo::record_profile(ustring groupname, long long ticks,
+                              long long executions)
+{
+    // We are the only writer, so plain relaxed loads and stores are
+    // enough, no locked read-modify-write instructions.
+    auto add = [](std::atomic<long long>& counter, long long val) {
+        counter.store(counter.load(std::memory_order_relaxed) + val,
+                      std::memory_order_relaxed);
+    };
+    add(profile_ticks, ticks);
+    // Only the owning thread inserts, so it can look up without the lock
+    auto found = profile_groups.find(groupname);
+    if (found == profile_groups.end()) {
+        spin_lock lock(profile_mutex);
+        found = profile_groups
+                    .emplace(groupname, std::make_unique<GroupProfile>())
+                    .first;
+    }
+    add(found->second->ticks, ticks);
+    add(found->second->executions, executions);
+}
+
+
+
+void
+PerThreadInfo::record_layer_profile(int groupid, ustring groupname,
+                                    const std::vector<LayerProfile>& layers)
+{
+    // Only the owning thread inserts, so it can look up without the lock
+    auto found = profile_layers.find(groupid);
+    if (found == profile_layers.end()) {
+        auto g       = std::make_unique<GroupLayerCounters>();
+        g->groupname = groupname;
+        for (const LayerProfile& l : layers)
+            g->layernames.push_back(l.name);
+        size_t n = layers.size() * LayerProfile::ncounters;
+        g->counters.reset(new std::atomic<long long>[n]);
+        for (size_t i = 0; i < n; ++i)
+            g->counters[i].store(0, std::memory_order_relaxed);
+        spin_lock lock(profile_mutex);
+        found = profile_layers.emplace(groupid, std::move(g)).first;
+    }
+    const GroupLayerCounters& g(*found->second);
+    size_t nlayers = std::min(layers.size(), g.layernames.size());
+    for (size_t i = 0; i < nlayers; ++i)
+        layers[i].add_to_counters(&g.counters[i * LayerProfile::ncounters]);
+}
+
+
+
+void
+PerThreadInfo::GroupLayerCounters::add_to(GroupLayerProfile& profile) const
+{
+    if (profile.groupname.empty())
+        profile.groupname = groupname;
+    if (profile.layers.size() < layernames.size())
+        profile.layers.resize(layernames.size());
+    for (size_t i = 0, e = layernames.size(); i < e; ++i) {
+        LayerProfile& l(profile.layers[i]);
+        if (l.name.empty())
+            l.name = layernames[i];
+        l.add_counters(&counters[i * LayerProfile::ncounters]);
+    }
+}
+
+
+
+const char*
+profile_op_class_name(int opclass)
+{
+    static const char* names[ProfileOpNumClasses]
+        = { "texture", "noise",      "getattribute",
+            "trace",   "pointcloud", "closure" };
+    return (opclass >= 0 && opclass < ProfileOpNumClasses) ? names[opclass]
+                                                            : "unknown";
+}
+
+
+
+void
+LayerProfile::clear()
+{
+    ticks      = 0;
+    self_ticks = 0;
+    executions = 0;
+    for (int c = 0; c < ProfileOpNumClasses; ++c) {
+        op_ticks[c] = 0;
+        op_calls[c] = 0;
+    }
+}
+
+
+
+void
+LayerProfile::add(const LayerProfile& other)
+{
+    if (name.empty())
+        name = other.name;
+    ticks += other.ticks;
+    self_ticks += other.self_ticks;
+    executions += other.executions;
+    for (int c = 0; c < ProfileOpNumClasses; ++c) {
+        op_ticks[c] += other.op_ticks[c];
+        op_calls[c] += other.op_calls[c];
+    }
+}
+
+
+
+void
+LayerProfile::add_to_counters(std::atomic<long long>* counters) const
+{
+    // We are the only writer, so plain relaxed loads and stores are
+    // enough, no locked read-modify-write instructions.
+    auto add = [&](int i, long long val) {
+        if (val)
+            counters[i].store(counters[i].load(std::memory_order_relaxed)
+                                  + val,
+                              std::memory_order_relaxed);
+    };
+    add(0, ticks);
+    add(1, self_ticks);
+    add(2, executions);
+    for (int c = 0; c < ProfileOpNumClasses; ++c) {
+        add(3 + c, op_ticks[c]);
+        add(3 + ProfileOpNumClasses + c, op_calls[c]);
+    }
+}
+
+
+
+void
+LayerProfile::add_counters(const std::atomic<long long>* counters)
+{
+    auto get = [&](int i) {
+        return counters[i].load(std::memory_order_relaxed);
+    };
+    ticks += get(0);
+    self_ticks += get(1);
+    executions += get(2);
+    for (int c = 0; c < ProfileOpNumClasses; ++c) {
+        op_ticks[c] += get(3 + c);
+        op_calls[c] += get(3 + ProfileOpNumClasses + c);
+    }
+}
+
+
+
+void
+GroupLayerProfile::add(const GroupLayerProfile& other)
+{
+    if (groupname.empty())
+        groupname = other.groupname;
+    if (layers.size() < other.layers.size())
+        layers.resize(other.layers.size());
+    for (size_t i = 0, e = other.layers.size(); i < e; ++i)
+        layers[i].add(other.layers[i]);
+}
+
+
+
 namespace Strings {
 #define STRDECL(str, var_name) const ustring var_name(str);
 #include <OSL/strdecls.h>
@@ -1083,6 +1382,7 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     , m_countlayerexecs(false)
     , m_relaxed_param_typecheck(false)
     , m_profile(0)
+    , m_profile_layers(false)
     , m_optimize(2)
     , m_opt_simplify_param(true)
     , m_opt_constant_fold(true)
@@ -1098,6 +1398,9 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     , m_opt_fold_getattribute(true)
     , m_opt_middleman(true)
     , m_opt_texture_handle(true)
+    , m_opt_matrix_cache(true)
+    , m_opt_transient_strings(true)
+    , m_opt_octave_loops(true)
     , m_opt_seed_bblock_aliases(true)
     , m_opt_useparam(false)
     , m_opt_groupdata(true)
@@ -1133,12 +1436,16 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     , m_max_optix_groupdata_alloc(0)
     , m_buffer_printf(true)
     , m_no_noise(false)
+    , m_gabor_impulse_table(0)
     , m_no_pointcloud(false)
     , m_force_derivs(false)
     , m_allow_shader_replacement(false)
     , m_exec_repeat(1)
     , m_opt_warnings(0)
     , m_gpu_opt_error(0)
+    , m_trace_events(0)
+    , m_trace_sample_rate(1000)
+    , m_trace_buffer_size(1 << 16)
     , m_optix_no_inline(false)
     , m_optix_no_inline_layer_funcs(false)
     , m_optix_merge_layer_funcs(true)
@@ -1177,6 +1484,7 @@ ShadingSystemImpl::ShadingSystemImpl(RendererServices* renderer,
     m_stat_preopt_ops                        = 0;
     m_stat_postopt_ops                       = 0;
     m_stat_middlemen_eliminated              = 0;
+    m_stat_octave_loops_folded               = 0;
     m_stat_const_connections                 = 0;
     m_stat_global_connections                = 0;
     m_stat_tex_calls_codegened               = 0;
@@ -1352,6 +1660,7 @@ shading_system_setup_op_descriptors(
     OP (exp2,        generic,             exp2,          true,      0);
     OP (expm1,       generic,             expm1,         true,      0);
     OP (fabs,        generic,             abs,           true,      0);
+    OP (fbm,         octave_noise,        none,          false,     0);
     OP (filterwidth, filterwidth,         deriv,         true,      0);
     OP (floor,       generic,             floor,         true,      0);
     OP (fmod,        modulus,             none,          true,      0);
@@ -1449,6 +1758,7 @@ shading_system_setup_op_descriptors(
     OP (transformv,  transform,           transform,     true,      0);
     OP (transpose,   generic,             none,          true,      0);
     OP (trunc,       generic,             none,          true,      0);
+    OP (turbulence,  octave_noise,        none,          false,     0);
     OP (useparam,    useparam,            useparam,      false,     0);
     OP (vector,      construct_triple,    triple,        true,      0);
     OP (warning,     printf,              warning,       false,     SIDE);
@@ -1535,6 +1845,8 @@ ShadingSystemImpl::~ShadingSystemImpl()
     }
 
     printstats();
+    if (m_trace_filename.size())
+        write_trace(m_trace_filename);
     // N.B. just let m_texsys go -- if we asked for one to be created,
     // we asked for a shared one.
 
@@ -1638,6 +1950,9 @@ ShadingSystemImpl::attribute(string_view name, TypeDesc type, const void* val)
     ATTR_SET("opt_fold_getattribute", int, m_opt_fold_getattribute);
     ATTR_SET("opt_middleman", int, m_opt_middleman);
     ATTR_SET("opt_texture_handle", int, m_opt_texture_handle);
+    ATTR_SET("opt_matrix_cache", int, m_opt_matrix_cache);
+    ATTR_SET("opt_transient_strings", int, m_opt_transient_strings);
+    ATTR_SET("opt_octave_loops", int, m_opt_octave_loops);
     ATTR_SET("opt_seed_bblock_aliases", int, m_opt_seed_bblock_aliases);
     ATTR_SET("opt_useparam", int, m_opt_useparam);
     ATTR_SET("opt_groupdata", int, m_opt_groupdata);
@@ -1670,6 +1985,7 @@ ShadingSystemImpl::attribute(string_view name, TypeDesc type, const void* val)
     ATTR_SET("greedyjit", int, m_greedyjit);
     ATTR_SET("relaxed_param_typecheck", int, m_relaxed_param_typecheck);
     ATTR_SET("countlayerexecs", int, m_countlayerexecs);
+    ATTR_SET("profile_layers", int, m_profile_layers);
     ATTR_SET("max_warnings_per_thread", int,
              m_shading_state_uniform.m_max_warnings_per_thread);
     ATTR_SET("max_local_mem_KB", int, m_max_local_mem_KB);
@@ -1677,12 +1993,16 @@ ShadingSystemImpl::attribute(string_view name, TypeDesc type, const void* val)
     ATTR_SET("max_optix_groupdata_alloc", int, m_max_optix_groupdata_alloc);
     ATTR_SET("buffer_printf", int, m_buffer_printf);
     ATTR_SET("no_noise", int, m_no_noise);
+    ATTR_SET("gabor_impulse_table", int, m_gabor_impulse_table);
     ATTR_SET("no_pointcloud", int, m_no_pointcloud);
     ATTR_SET("force_derivs", int, m_force_derivs);
     ATTR_SET("allow_shader_replacement", int, m_allow_shader_replacement);
     ATTR_SET("exec_repeat", int, m_exec_repeat);
     ATTR_SET("opt_warnings", int, m_opt_warnings);
     ATTR_SET("gpu_opt_error", int, m_gpu_opt_error);
+    ATTR_SET("trace_events", int, m_trace_events);
+    ATTR_SET("trace_sample_rate", int, m_trace_sample_rate);
+    ATTR_SET("trace_buffer_size", int, m_trace_buffer_size);
     ATTR_SET("optix_no_inline", int, m_optix_no_inline);
     ATTR_SET("optix_no_inline_layer_funcs", int, m_optix_no_inline_layer_funcs);
     ATTR_SET("optix_merge_layer_funcs", int, m_optix_merge_layer_funcs);
@@ -1697,6 +2017,7 @@ ShadingSystemImpl::attribute(string_view name, TypeDesc type, const void* val)
     ATTR_SET_STRING("only_groupname", m_only_groupname);
     ATTR_SET_STRING("archive_groupname", m_archive_groupname);
     ATTR_SET_STRING("archive_filename", m_archive_filename);
+    ATTR_SET_STRING("trace_filename", m_trace_filename);
 
     // cases for special handling
     if (name == "searchpath:shader" && type == TypeDesc::STRING) {
@@ -1828,6 +2149,9 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
     ATTR_DECODE("opt_fold_getattribute", int, m_opt_fold_getattribute);
     ATTR_DECODE("opt_middleman", int, m_opt_middleman);
     ATTR_DECODE("opt_texture_handle", int, m_opt_texture_handle);
+    ATTR_DECODE("opt_matrix_cache", int, m_opt_matrix_cache);
+    ATTR_DECODE("opt_transient_strings", int, m_opt_transient_strings);
+    ATTR_DECODE("opt_octave_loops", int, m_opt_octave_loops);
     ATTR_DECODE("opt_seed_bblock_aliases", int, m_opt_seed_bblock_aliases);
     ATTR_DECODE("opt_useparam", int, m_opt_useparam);
     ATTR_DECODE("opt_groupdata", int, m_opt_groupdata);
@@ -1860,6 +2184,7 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
     ATTR_DECODE("connection_error", int, m_connection_error);
     ATTR_DECODE("greedyjit", int, m_greedyjit);
     ATTR_DECODE("countlayerexecs", int, m_countlayerexecs);
+    ATTR_DECODE("profile_layers", int, m_profile_layers);
     ATTR_DECODE("relaxed_param_typecheck", int, m_relaxed_param_typecheck);
     ATTR_DECODE("max_warnings_per_thread", int,
                 m_shading_state_uniform.m_max_warnings_per_thread);
@@ -1872,17 +2197,22 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
     ATTR_DECODE_STRING("only_groupname", m_only_groupname);
     ATTR_DECODE_STRING("archive_groupname", m_archive_groupname);
     ATTR_DECODE_STRING("archive_filename", m_archive_filename);
+    ATTR_DECODE_STRING("trace_filename", m_trace_filename);
     ATTR_DECODE("max_local_mem_KB", int, m_max_local_mem_KB);
     ATTR_DECODE("compile_report", int, m_compile_report);
     ATTR_DECODE("max_optix_groupdata_alloc", int, m_max_optix_groupdata_alloc);
     ATTR_DECODE("buffer_printf", int, m_buffer_printf);
     ATTR_DECODE("no_noise", int, m_no_noise);
+    ATTR_DECODE("gabor_impulse_table", int, m_gabor_impulse_table);
     ATTR_DECODE("no_pointcloud", int, m_no_pointcloud);
     ATTR_DECODE("force_derivs", int, m_force_derivs);
     ATTR_DECODE("allow_shader_replacement", int, m_allow_shader_replacement);
     ATTR_DECODE("exec_repeat", int, m_exec_repeat);
     ATTR_DECODE("opt_warnings", int, m_opt_warnings);
     ATTR_DECODE("gpu_opt_error", int, m_gpu_opt_error);
+    ATTR_DECODE("trace_events", int, m_trace_events);
+    ATTR_DECODE("trace_sample_rate", int, m_trace_sample_rate);
+    ATTR_DECODE("trace_buffer_size", int, m_trace_buffer_size);
     ATTR_DECODE("optix_no_inline", int, m_optix_no_inline);
     ATTR_DECODE("optix_no_inline_layer_funcs", int,
                 m_optix_no_inline_layer_funcs);
@@ -1907,6 +2237,7 @@ ShadingSystemImpl::getattribute(string_view name, TypeDesc type, void* val)
     ATTR_DECODE("stat:preopt_ops", int, m_stat_preopt_ops);
     ATTR_DECODE("stat:postopt_ops", int, m_stat_postopt_ops);
     ATTR_DECODE("stat:middlemen_eliminated", int, m_stat_middlemen_eliminated);
+    ATTR_DECODE("stat:octave_loops_folded", int, m_stat_octave_loops_folded);
     ATTR_DECODE("stat:const_connections", int, m_stat_const_connections);
     ATTR_DECODE("stat:global_connections", int, m_stat_global_connections);
     ATTR_DECODE("stat:tex_calls_codegened", int, m_stat_tex_calls_codegened);
@@ -2437,6 +2768,7 @@ ShadingSystemImpl::getstats(int level) const
     BOOLOPT(range_checking);
     BOOLOPT(greedyjit);
     BOOLOPT(countlayerexecs);
+    BOOLOPT(profile_layers);
     BOOLOPT(opt_simplify_param);
     BOOLOPT(opt_constant_fold);
     BOOLOPT(opt_stale_assign);
@@ -2451,6 +2783,9 @@ ShadingSystemImpl::getstats(int level) const
     BOOLOPT(opt_fold_getattribute);
     BOOLOPT(opt_middleman);
     BOOLOPT(opt_texture_handle);
+    BOOLOPT(opt_matrix_cache);
+    BOOLOPT(opt_transient_strings);
+    BOOLOPT(opt_octave_loops);
     BOOLOPT(opt_seed_bblock_aliases);
     BOOLOPT(opt_batched_analysis);
     BOOLOPT(llvm_jit_fma);
@@ -2459,12 +2794,15 @@ ShadingSystemImpl::getstats(int level) const
     STROPT(llvm_jit_target);
     INTOPT(opt_passes);
     INTOPT(no_noise);
+    INTOPT(gabor_impulse_table);
     INTOPT(no_pointcloud);
     INTOPT(force_derivs);
     INTOPT(allow_shader_replacement);
     INTOPT(exec_repeat);
     INTOPT(opt_warnings);
     INTOPT(gpu_opt_error);
+    INTOPT(trace_events);
+    INTOPT(trace_sample_rate);
     BOOLOPT(optix_no_inline);
     BOOLOPT(optix_no_inline_layer_funcs);
     BOOLOPT(optix_merge_layer_funcs);
@@ -2475,6 +2813,7 @@ ShadingSystemImpl::getstats(int level) const
     STROPT(debug_layername);
     STROPT(archive_groupname);
     STROPT(archive_filename);
+    STROPT(trace_filename);
 #undef BOOLOPT
 #undef INTOPT
 #undef STROPT
@@ -2584,6 +2923,7 @@ ShadingSystemImpl::getstats(int level) const
           (int)m_stat_global_connections);
     print(out, "  Middlemen eliminated: {}\n",
           (int)m_stat_middlemen_eliminated);
+    print(out, "  Octave loops folded: {}\n", (int)m_stat_octave_loops_folded);
     print(out, "  Derivatives needed on {} / {} symbols ({:.1f}%)\n",
           (int)m_stat_syms_with_derivs, (int)m_stat_postopt_syms,
           (100.0 * (int)m_stat_syms_with_derivs)
@@ -2671,52 +3011,433 @@ ShadingSystemImpl::getstats(int level) const
     out << "    LLVM JIT memory: " << Strutil::memformat(jitmem) << '\n';
 
     if (m_profile) {
+        std::map<ustring, long long> group_times, group_executions;
+        long long total_ticks = gather_profile(group_times, group_executions);
         out << "  Execution profile:\n";
         out << "    Total shader execution time: "
-            << Strutil::timeintervalformat(OIIO::Timer::seconds(
-                                               m_stat_total_shading_time_ticks),
+            << Strutil::timeintervalformat(OIIO::Timer::seconds(total_ticks),
                                            2)
             << " (sum of all threads)\n";
-        // Account for times of any groups that haven't yet been destroyed
-        {
-            spin_lock lock(m_all_shader_groups_mutex);
-            for (auto&& grp : m_all_shader_groups) {
-                if (ShaderGroupRef g = grp.lock()) {
-                    long long ticks = g->m_stat_total_shading_time_ticks;
-                    m_group_profile_times[g->name()] += ticks;
-                    g->m_stat_total_shading_time_ticks -= ticks;
+        std::vector<GroupTimeVal> grouptimes(group_times.begin(),
+                                             group_times.end());
+        std::sort(grouptimes.begin(), grouptimes.end(), group_time_compare());
+        if (grouptimes.size() > 5)
+            grouptimes.resize(5);
+        if (grouptimes.size())
+            out << "    Most expensive shader groups:\n";
+        for (const auto& g : grouptimes) {
+            out << "      "
+                << Strutil::timeintervalformat(OIIO::Timer::seconds(g.second),
+                                               2)
+                << ' ' << (g.first.size() ? g.first.c_str() : "<unnamed group>")
+                << " (" << group_executions[g.first] << " executions)\n";
+        }
+    }
+
+    if (m_profile_layers) {
+        GroupLayerProfileMap layer_profiles;
+        gather_layer_profiles(layer_profiles);
+        // Most expensive groups first, measured by the self time of all
+        // their layers
+        std::vector<std::pair<long long, const GroupLayerProfile*>> grouptimes;
+        for (const auto& g : layer_profiles) {
+            long long ticks = 0;
+            for (const LayerProfile& l : g.second.layers)
+                ticks += l.self_ticks;
+            grouptimes.emplace_back(ticks, &g.second);
+        }
+        std::stable_sort(grouptimes.begin(), grouptimes.end(),
+                         [](const auto& a, const auto& b) {
+                             return a.first > b.first;
+                         });
+        if (grouptimes.size() > 5)
+            grouptimes.resize(5);
+        if (grouptimes.size())
+            out << "  Layer profile (self time / time with upstream layers):\n";
+        auto timestr = [](long long ticks) {
+            return Strutil::timeintervalformat(OIIO::Timer::seconds(ticks), 2);
+        };
+        for (const auto& g : grouptimes) {
+            ustring groupname = g.second->groupname;
+            out << "    " << timestr(g.first) << ' '
+                << (groupname.size() ? groupname.c_str() : "<unnamed group>")
+                << '\n';
+            std::vector<LayerProfile> layers = g.second->layers;
+            std::sort(layers.begin(), layers.end(),
+                      [](const LayerProfile& a, const LayerProfile& b) {
+                          return a.self_ticks > b.self_ticks;
+                      });
+            if (layers.size() > 10)
+                layers.resize(10);
+            for (const LayerProfile& l : layers) {
+                if (!l.executions)
+                    continue;
+                out << "      " << timestr(l.self_ticks) << " / "
+                    << timestr(l.ticks) << " layer "
+                    << (l.name.size() ? l.name.c_str() : "<unnamed layer>")
+                    << " (" << l.executions << " executions)\n";
+                for (int c = 0; c < ProfileOpNumClasses; ++c) {
+                    if (l.op_calls[c])
+                        out << "        " << timestr(l.op_ticks[c]) << ' '
+                            << profile_op_class_name(c) << " (" << l.op_calls[c]
+                            << " calls)\n";
                 }
             }
         }
-        {
-            spin_lock lock(m_stat_mutex);
-            std::vector<GroupTimeVal> grouptimes;
-            for (std::map<ustring, long long>::const_iterator m
-                 = m_group_profile_times.begin();
-                 m != m_group_profile_times.end(); ++m) {
-                grouptimes.emplace_back(m->first, m->second);
-            }
-            std::sort(grouptimes.begin(), grouptimes.end(),
-                      group_time_compare());
-            if (grouptimes.size() > 5)
-                grouptimes.resize(5);
-            if (grouptimes.size())
-                out << "    Most expensive shader groups:\n";
-            for (std::vector<GroupTimeVal>::const_iterator i
-                 = grouptimes.begin();
-                 i != grouptimes.end(); ++i) {
-                out << "      "
-                    << Strutil::timeintervalformat(OIIO::Timer::seconds(
-                                                       i->second),
-                                                   2)
-                    << ' '
-                    << (i->first.size() ? i->first.c_str() : "<unnamed group>")
-                    << "\n";
+    }
+
+    return out.str();
+}
+
+
+
+long long
+ShadingSystemImpl::gather_profile(
+    std::map<ustring, long long>& group_times,
+    std::map<ustring, long long>& group_executions) const
+{
+    long long total_ticks = m_stat_total_shading_time_ticks;
+    {
+        spin_lock lock(m_stat_mutex);
+        group_times      = m_group_profile_times;
+        group_executions = m_group_profile_executions;
+    }
+    spin_lock lock(m_all_thread_info_mutex);
+    for (PerThreadInfo* t : m_all_thread_info) {
+        total_ticks += t->profile_ticks.load(std::memory_order_relaxed);
+        spin_lock plock(t->profile_mutex);
+        for (auto& g : t->profile_groups) {
+            group_times[g.first] += g.second->ticks.load(
+                std::memory_order_relaxed);
+            group_executions[g.first] += g.second->executions.load(
+                std::memory_order_relaxed);
+        }
+    }
+    return total_ticks;
+}
+
+
+
+void
+ShadingSystemImpl::gather_layer_profiles(
+    GroupLayerProfileMap& layer_profiles) const
+{
+    {
+        spin_lock lock(m_stat_mutex);
+        layer_profiles = m_group_layer_profiles;
+    }
+    spin_lock lock(m_all_thread_info_mutex);
+    for (PerThreadInfo* t : m_all_thread_info) {
+        spin_lock plock(t->profile_mutex);
+        for (auto& g : t->profile_layers)
+            g.second->add_to(layer_profiles[g.first]);
+    }
+}
+
+
+
+void
+ShadingSystemImpl::getstats(ParamValueList& stats) const
+{
+    stats.clear();
+    auto add_int = [&](string_view name, int val) {
+        stats.attribute(name, TypeInt, &val);
+    };
+    auto add_ll = [&](string_view name, long long val) {
+        stats.attribute(name, TypeDesc::INT64, &val);
+    };
+    auto add_time = [&](string_view name, double val) {
+        stats.attribute(name, TypeDesc::DOUBLE, &val);
+    };
+    auto add_mem = [&](string_view name, const PeakCounter<off_t>& mem) {
+        add_ll(fmtformat("stat:{}_current", name), mem.current());
+        add_ll(fmtformat("stat:{}_peak", name), mem.peak());
+        add_ll(fmtformat("stat:{}_requested", name), mem.requested());
+    };
+
+    add_int("stat:shaders_requested", m_stat_shaders_requested);
+    add_int("stat:masters", m_stat_shaders_loaded);
+    add_int("stat:instances_current", m_stat_instances.current());
+    add_int("stat:instances_peak", m_stat_instances.peak());
+    add_int("stat:contexts_current", m_stat_contexts.current());
+    add_int("stat:contexts_peak", m_stat_contexts.peak());
+    add_int("stat:groups", m_stat_groups);
+    add_int("stat:instances", m_stat_groupinstances);
+    add_int("stat:instances_compiled", m_stat_instances_compiled);
+    add_int("stat:groups_compiled", m_stat_groups_compiled);
+    add_int("stat:empty_instances", m_stat_empty_instances);
+    add_int("stat:merged_inst", m_stat_merged_inst);
+    add_int("stat:merged_inst_opt", m_stat_merged_inst_opt);
+    add_int("stat:empty_groups", m_stat_empty_groups);
+    add_int("stat:regexes", m_stat_regexes);
+    add_int("stat:preopt_syms", m_stat_preopt_syms);
+    add_int("stat:postopt_syms", m_stat_postopt_syms);
+    add_int("stat:syms_with_derivs", m_stat_syms_with_derivs);
+    add_int("stat:preopt_ops", m_stat_preopt_ops);
+    add_int("stat:postopt_ops", m_stat_postopt_ops);
+    add_int("stat:middlemen_eliminated", m_stat_middlemen_eliminated);
+    add_int("stat:octave_loops_folded", m_stat_octave_loops_folded);
+    add_int("stat:const_connections", m_stat_const_connections);
+    add_int("stat:global_connections", m_stat_global_connections);
+    add_int("stat:tex_calls_codegened", m_stat_tex_calls_codegened);
+    add_int("stat:tex_calls_as_handles", m_stat_tex_calls_as_handles);
+    add_int("stat:useparam_ops", m_stat_useparam_ops);
+    add_int("stat:call_layers_inserted", m_stat_call_layers_inserted);
+    add_int("stat:pointcloud_max_results", m_stat_pointcloud_max_results);
+    add_int("stat:pointcloud_failures", m_stat_pointcloud_failures);
+    add_ll("stat:layers_executed", m_stat_layers_executed);
+    add_ll("stat:getattribute_calls", m_stat_getattribute_calls);
+    add_ll("stat:get_userdata_calls", m_stat_get_userdata_calls);
+    add_ll("stat:noise_calls", m_stat_noise_calls);
+    add_ll("stat:pointcloud_searches", m_stat_pointcloud_searches);
+    add_ll("stat:pointcloud_searches_total_results",
+           m_stat_pointcloud_searches_total_results);
+    add_ll("stat:pointcloud_gets", m_stat_pointcloud_gets);
+    add_ll("stat:pointcloud_writes", m_stat_pointcloud_writes);
+    add_ll("stat:reparam_calls_total", m_stat_reparam_calls_total);
+    add_ll("stat:reparam_bytes_total", m_stat_reparam_bytes_total);
+    add_ll("stat:reparam_calls_changed", m_stat_reparam_calls_changed);
+    add_ll("stat:reparam_bytes_changed", m_stat_reparam_bytes_changed);
+    {
+        spin_lock lock(m_stat_mutex);
+        add_time("stat:master_load_time", m_stat_master_load_time);
+        add_time("stat:optimization_time", m_stat_optimization_time);
+        add_time("stat:opt_locking_time", m_stat_opt_locking_time);
+        add_time("stat:specialization_time", m_stat_specialization_time);
+        add_time("stat:total_llvm_time", m_stat_total_llvm_time);
+        add_time("stat:llvm_setup_time", m_stat_llvm_setup_time);
+        add_time("stat:llvm_irgen_time", m_stat_llvm_irgen_time);
+        add_time("stat:llvm_opt_time", m_stat_llvm_opt_time);
+        add_time("stat:llvm_jit_time", m_stat_llvm_jit_time);
+        add_time("stat:inst_merge_time", m_stat_inst_merge_time);
+        add_time("stat:getattribute_time", m_stat_getattribute_time);
+        add_time("stat:getattribute_fail_time", m_stat_getattribute_fail_time);
+        add_int("stat:max_llvm_local_mem", m_stat_max_llvm_local_mem);
+        add_mem("memory", m_stat_memory);
+        add_mem("mem_master", m_stat_mem_master);
+        add_mem("mem_master_ops", m_stat_mem_master_ops);
+        add_mem("mem_master_args", m_stat_mem_master_args);
+        add_mem("mem_master_syms", m_stat_mem_master_syms);
+        add_mem("mem_master_defaults", m_stat_mem_master_defaults);
+        add_mem("mem_master_consts", m_stat_mem_master_consts);
+        add_mem("mem_inst", m_stat_mem_inst);
+        add_mem("mem_inst_syms", m_stat_mem_inst_syms);
+        add_mem("mem_inst_paramvals", m_stat_mem_inst_paramvals);
+        add_mem("mem_inst_connections", m_stat_mem_inst_connections);
+    }
+    add_ll("stat:llvm_jit_memory",
+           (long long)LLVM_Util::total_jit_memory_held());
+
+    if (m_profile) {
+        std::map<ustring, long long> group_times, group_executions;
+        long long total_ticks = gather_profile(group_times, group_executions);
+        add_time("profile:total_time", OIIO::Timer::seconds(total_ticks));
+        for (const auto& g : group_times) {
+            add_time(fmtformat("profile:group:{}:time", g.first),
+                     OIIO::Timer::seconds(g.second));
+            add_ll(fmtformat("profile:group:{}:executions", g.first),
+                   group_executions[g.first]);
+        }
+    }
+
+    if (m_profile_layers) {
+        GroupLayerProfileMap layer_profiles;
+        gather_layer_profiles(layer_profiles);
+        // Groups are named by their name, unless it is empty or shared by
+        // another profiled group, in which case the id is appended.
+        std::map<ustring, int> name_count;
+        for (const auto& g : layer_profiles)
+            ++name_count[g.second.groupname];
+        for (const auto& g : layer_profiles) {
+            ustring groupname = g.second.groupname;
+            std::string group = groupname.string();
+            if (groupname.empty() || name_count[groupname] > 1)
+                group = fmtformat("{}#{}", groupname, g.first);
+            for (size_t i = 0, e = g.second.layers.size(); i < e; ++i) {
+                const LayerProfile& l(g.second.layers[i]);
+                if (!l.executions)
+                    continue;
+                std::string prefix = fmtformat("profile:group:{}:layer:{}:",
+                                               group, i);
+                stats.attribute(prefix + "name", l.name);
+                add_time(prefix + "time", OIIO::Timer::seconds(l.ticks));
+                add_time(prefix + "self_time",
+                         OIIO::Timer::seconds(l.self_ticks));
+                add_ll(prefix + "executions", l.executions);
+                for (int c = 0; c < ProfileOpNumClasses; ++c) {
+                    if (!l.op_calls[c])
+                        continue;
+                    const char* opclass = profile_op_class_name(c);
+                    add_time(fmtformat("{}{}_time", prefix, opclass),
+                             OIIO::Timer::seconds(l.op_ticks[c]));
+                    add_ll(fmtformat("{}{}_calls", prefix, opclass),
+                           l.op_calls[c]);
+                }
             }
         }
     }
+}
 
-    return out.str();
+
+
+std::string
+ShadingSystemImpl::getstats_json() const
+{
+    ParamValueList stats;
+    getstats(stats);
+
+    auto quote = [](string_view str) {
+        std::string r = "\"";
+        for (char c : str) {
+            if (c == '"' || c == '\\')
+                (r += '\\') += c;
+            else if ((unsigned char)c < 0x20)
+                r += fmtformat("\\u{:04x}", int(c));
+            else
+                r += c;
+        }
+        return r + '"';
+    };
+    std::string out = "{";
+    const char* sep = "\n  ";
+    for (const ParamValue& p : stats) {
+        std::string val;
+        if (p.type() == TypeDesc::INT64)
+            val = fmtformat("{}", *(const long long*)p.data());
+        else if (p.type() == TypeInt)
+            val = fmtformat("{}", p.get_int());
+        else if (p.type() == TypeDesc::DOUBLE) {
+            double d = *(const double*)p.data();
+            val      = std::isfinite(d) ? fmtformat("{}", d) : "null";
+        } else
+            val = quote(p.get_string());
+        out += fmtformat("{}{}: {}", sep, quote(p.name()), val);
+        sep = ",\n  ";
+    }
+    out += "\n}\n";
+    return out;
+}
+
+
+
+void
+ShadingSystemImpl::reset_stats()
+{
+    m_stat_shaders_loaded                    = 0;
+    m_stat_shaders_requested                 = 0;
+    m_stat_groups                            = 0;
+    m_stat_groupinstances                    = 0;
+    m_stat_instances_compiled                = 0;
+    m_stat_groups_compiled                   = 0;
+    m_stat_empty_instances                   = 0;
+    m_stat_merged_inst                       = 0;
+    m_stat_merged_inst_opt                   = 0;
+    m_stat_empty_groups                      = 0;
+    m_stat_regexes                           = 0;
+    m_stat_preopt_syms                       = 0;
+    m_stat_postopt_syms                      = 0;
+    m_stat_syms_with_derivs                  = 0;
+    m_stat_preopt_ops                        = 0;
+    m_stat_postopt_ops                       = 0;
+    m_stat_middlemen_eliminated              = 0;
+    m_stat_octave_loops_folded               = 0;
+    m_stat_const_connections                 = 0;
+    m_stat_global_connections                = 0;
+    m_stat_tex_calls_codegened               = 0;
+    m_stat_tex_calls_as_handles              = 0;
+    m_stat_useparam_ops                      = 0;
+    m_stat_call_layers_inserted              = 0;
+    m_stat_getattribute_calls                = 0;
+    m_stat_get_userdata_calls                = 0;
+    m_stat_noise_calls                       = 0;
+    m_stat_pointcloud_searches               = 0;
+    m_stat_pointcloud_searches_total_results = 0;
+    m_stat_pointcloud_max_results            = 0;
+    m_stat_pointcloud_failures               = 0;
+    m_stat_pointcloud_gets                   = 0;
+    m_stat_pointcloud_writes                 = 0;
+    m_stat_layers_executed                   = 0;
+    m_stat_total_shading_time_ticks          = 0;
+    m_stat_reparam_calls_total               = 0;
+    m_stat_reparam_bytes_total               = 0;
+    m_stat_reparam_calls_changed             = 0;
+    m_stat_reparam_bytes_changed             = 0;
+    {
+        spin_lock lock(m_stat_mutex);
+        m_stat_master_load_time       = 0;
+        m_stat_optimization_time      = 0;
+        m_stat_opt_locking_time       = 0;
+        m_stat_specialization_time    = 0;
+        m_stat_total_llvm_time        = 0;
+        m_stat_llvm_setup_time        = 0;
+        m_stat_llvm_irgen_time        = 0;
+        m_stat_llvm_opt_time          = 0;
+        m_stat_llvm_jit_time          = 0;
+        m_stat_inst_merge_time        = 0;
+        m_stat_getattribute_time      = 0;
+        m_stat_getattribute_fail_time = 0;
+        m_stat_max_llvm_local_mem     = 0;
+        m_stat_instances.reset_peak();
+        m_stat_contexts.reset_peak();
+        m_stat_memory.reset_peak();
+        m_stat_mem_master.reset_peak();
+        m_stat_mem_master_ops.reset_peak();
+        m_stat_mem_master_args.reset_peak();
+        m_stat_mem_master_syms.reset_peak();
+        m_stat_mem_master_defaults.reset_peak();
+        m_stat_mem_master_consts.reset_peak();
+        m_stat_mem_inst.reset_peak();
+        m_stat_mem_inst_syms.reset_peak();
+        m_stat_mem_inst_paramvals.reset_peak();
+        m_stat_mem_inst_connections.reset_peak();
+        m_group_profile_times.clear();
+        m_group_profile_executions.clear();
+        m_group_layer_profiles.clear();
+    }
+    // The live threads keep their group entries, since the owner looks
+    // them up without the lock, we just zero the counters.
+    spin_lock lock(m_all_thread_info_mutex);
+    for (PerThreadInfo* t : m_all_thread_info) {
+        t->profile_ticks.store(0, std::memory_order_relaxed);
+        spin_lock plock(t->profile_mutex);
+        for (auto& g : t->profile_groups) {
+            g.second->ticks.store(0, std::memory_order_relaxed);
+            g.second->executions.store(0, std::memory_order_relaxed);
+        }
+        for (auto& g : t->profile_layers) {
+            size_t n = g.second->layernames.size() * LayerProfile::ncounters;
+            for (size_t i = 0; i < n; ++i)
+                g.second->counters[i].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+
+
+bool
+ShadingSystemImpl::write_trace(string_view filename) const
+{
+    std::ofstream out;
+    OIIO::Filesystem::open(out, filename);
+    if (out)
+        out << m_trace.json();
+    if (!out) {
+        errorfmt("Could not write the shading trace to \"{}\"", filename);
+        return false;
+    }
+    return true;
+}
+
+
+
+const CompiledRegex&
+ShadingSystemImpl::find_regex(ustring pattern)
+{
+    bool created = false;
+    const CompiledRegex& regex(m_regex_cache.find(pattern, &created));
+    if (created)
+        m_stat_regexes += 1;
+    return regex;
 }
 
 
@@ -3444,7 +4165,10 @@ ShadingSystemImpl::ReParameter(ShaderGroup& group, string_view layername_,
 PerThreadInfo*
 ShadingSystemImpl::create_thread_info()
 {
-    return new PerThreadInfo;
+    PerThreadInfo* threadinfo = new PerThreadInfo;
+    spin_lock lock(m_all_thread_info_mutex);
+    m_all_thread_info.push_back(threadinfo);
+    return threadinfo;
 }
 
 
@@ -3452,6 +4176,26 @@ ShadingSystemImpl::create_thread_info()
 void
 ShadingSystemImpl::destroy_thread_info(PerThreadInfo* threadinfo)
 {
+    if (!threadinfo)
+        return;
+    {
+        spin_lock lock(m_all_thread_info_mutex);
+        auto found = std::find(m_all_thread_info.begin(),
+                               m_all_thread_info.end(), threadinfo);
+        if (found != m_all_thread_info.end())
+            m_all_thread_info.erase(found);
+    }
+    // Keep the profile of the thread we are retiring
+    m_stat_total_shading_time_ticks += threadinfo->profile_ticks.load();
+    {
+        spin_lock lock(m_stat_mutex);
+        for (auto& g : threadinfo->profile_groups) {
+            m_group_profile_times[g.first] += g.second->ticks.load();
+            m_group_profile_executions[g.first] += g.second->executions.load();
+        }
+        for (auto& g : threadinfo->profile_layers)
+            g.second->add_to(m_group_layer_profiles[g.first]);
+    }
     delete threadinfo;
 }
 
@@ -3480,6 +4224,7 @@ ShadingSystemImpl::release_context(ShadingContext* ctx)
     if (!ctx)
         return;
     ctx->process_errors();
+    ctx->clear_attribute_cache();
     ctx->thread_info()->context_pool.push(ctx);
 }
 
@@ -3497,6 +4242,18 @@ ShadingSystemImpl::execute(ShadingContext& ctx, ShaderGroup& group,
 
 
 
+bool
+ShadingSystemImpl::execute_many(ShadingContext& ctx, ShaderGroup& group,
+                                int thread_index, int shadeindex_begin,
+                                span<ShaderGlobals> globals,
+                                void* userdata_base_ptr, void* output_base_ptr)
+{
+    return ctx.execute_many(group, thread_index, shadeindex_begin, globals,
+                            userdata_base_ptr, output_base_ptr);
+}
+
+
+
 const void*
 ShadingSystemImpl::get_symbol(ShadingContext& ctx, ustring layername,
                               ustring symbolname, TypeDesc& type)
@@ -3880,6 +4637,8 @@ ShadingSystemImpl::Batched<WidthT>::jit_group(ShaderGroup& group,
     if (group.batch_jitted())
         return;  // already optimized
 
+    TraceScope trace(m_ssi, "batched jit_group", group.name());
+
     bool ctx_allocated         = false;
     PerThreadInfo* thread_info = nullptr;
     if (!ctx) {
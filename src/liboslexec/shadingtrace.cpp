@@ -0,0 +1,136 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include <algorithm>
+
+#include "shadingtrace.h"
+
+#include <OpenImageIO/strutil.h>
+
+
+OSL_NAMESPACE_BEGIN
+
+namespace pvt {
+
+
+TraceBuffer::TraceBuffer(int tid, size_t capacity)
+    : m_tid(tid), m_slots(std::max(capacity, size_t(1)))
+{
+}
+
+
+
+void
+TraceBuffer::copy_events(std::vector<TraceEvent>& events) const
+{
+    size_t head  = m_head.load(std::memory_order_acquire);
+    size_t size  = m_slots.size();
+    size_t first = head > size ? head - size : 0;
+    for (size_t h = first; h < head; ++h) {
+        const Slot& s = m_slots[h % size];
+        if (s.seq.load(std::memory_order_acquire) != 2 * h + 2)
+            continue;  // Being written or already overwritten
+        TraceEvent e;
+        e.name   = s.name.load(std::memory_order_relaxed);
+        e.detail = ustring::from_unique(
+            s.detail.load(std::memory_order_relaxed));
+        e.start = s.start.load(std::memory_order_relaxed);
+        e.end   = s.end.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (s.seq.load(std::memory_order_relaxed) != 2 * h + 2)
+            continue;  // Overwritten while we copied it
+        events.push_back(e);
+    }
+}
+
+
+
+static std::atomic<long long> trace_next_id { 1 };
+
+ShadingTrace::ShadingTrace()
+    : m_id(trace_next_id++), m_epoch(OIIO::Timer::now())
+{
+}
+
+
+
+ShadingTrace::~ShadingTrace() {}
+
+
+
+TraceBuffer*
+ShadingTrace::thread_buffer(size_t capacity)
+{
+    // Threads keep the buffer they last used, so recording only takes the
+    // lock the first time a thread records into this trace.
+    struct Cache {
+        long long id        = 0;
+        TraceBuffer* buffer = nullptr;
+    };
+    static thread_local Cache cache;
+    if (cache.id == m_id)
+        return cache.buffer;
+
+    std::thread::id self = std::this_thread::get_id();
+    OIIO::spin_lock lock(m_mutex);
+    auto found = std::find_if(m_buffers.begin(), m_buffers.end(),
+                              [&](const auto& b) { return b.first == self; });
+    if (found == m_buffers.end()) {
+        m_buffers.emplace_back(self, std::make_unique<TraceBuffer>(
+                                         int(m_buffers.size()), capacity));
+        found = m_buffers.end() - 1;
+    }
+    cache.id     = m_id;
+    cache.buffer = found->second.get();
+    return cache.buffer;
+}
+
+
+
+std::string
+ShadingTrace::json() const
+{
+    auto usec = [&](long long ticks) {
+        return OIIO::Timer::seconds(ticks - m_epoch) * 1.0e6;
+    };
+    std::string out = "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    const char* sep = "\n";
+    OIIO::spin_lock lock(m_mutex);
+    std::vector<TraceEvent> events;
+    for (const auto& b : m_buffers) {
+        const TraceBuffer& buf(*b.second);
+        out += fmtformat(
+            "{}{{\"ph\": \"M\", \"pid\": 0, \"tid\": {}, \"name\": "
+            "\"thread_name\", \"args\": {{\"name\": \"thread {}\"}}}}",
+            sep, buf.tid(), buf.tid());
+        sep = ",\n";
+        events.clear();
+        buf.copy_events(events);
+        for (const TraceEvent& e : events) {
+            out += fmtformat(
+                ",\n{{\"ph\": \"X\", \"pid\": 0, \"tid\": {}, \"name\": "
+                "\"{}\", \"cat\": \"osl\", \"ts\": {:.3f}, \"dur\": {:.3f}, "
+                "\"args\": {{\"name\": \"{}\"}}}}",
+                buf.tid(), e.name, usec(e.start),
+                usec(e.end) - usec(e.start),
+                OIIO::Strutil::escape_chars(e.detail.string()));
+        }
+    }
+    out += "\n]}\n";
+    return out;
+}
+
+
+
+void
+ShadingTrace::clear()
+{
+    OIIO::spin_lock lock(m_mutex);
+    for (auto& b : m_buffers)
+        b.second->clear();
+}
+
+
+}  // namespace pvt
+OSL_NAMESPACE_END
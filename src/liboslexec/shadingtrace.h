@@ -0,0 +1,122 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <OSL/oslconfig.h>
+
+#include <OpenImageIO/thread.h>
+#include <OpenImageIO/timer.h>
+
+
+OSL_NAMESPACE_BEGIN
+
+namespace pvt {
+
+
+/// One span of the shading timeline: a phase (name) of the work done on
+/// a shader or group (detail), between two OIIO::Timer::now() ticks.
+struct TraceEvent {
+    const char* name = nullptr;  ///< Phase, must be a static string
+    ustring detail;              ///< Shader or group the phase worked on
+    long long start = 0;         ///< Ticks when the phase started
+    long long end   = 0;         ///< Ticks when the phase ended
+};
+
+
+
+/// Fixed size ring of the trace events of one thread. Only the owning
+/// thread writes, without locks; when the ring is full the oldest
+/// events are overwritten. Readers may run concurrently and skip the
+/// slots that get overwritten while they are being copied.
+class TraceBuffer {
+public:
+    TraceBuffer(int tid, size_t capacity);
+
+    int tid() const { return m_tid; }
+
+    /// Append an event, only called by the owning thread.
+    void record(const char* name, ustring detail, long long start,
+                long long end)
+    {
+        size_t h  = m_head.load(std::memory_order_relaxed);
+        Slot& s   = m_slots[h % m_slots.size()];
+        // Odd sequence while the slot is being written
+        s.seq.store(2 * h + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        s.name.store(name, std::memory_order_relaxed);
+        s.detail.store(detail.c_str(), std::memory_order_relaxed);
+        s.start.store(start, std::memory_order_relaxed);
+        s.end.store(end, std::memory_order_relaxed);
+        s.seq.store(2 * h + 2, std::memory_order_release);
+        m_head.store(h + 1, std::memory_order_release);
+    }
+
+    /// Append the events still held in the ring to `events`, oldest first.
+    void copy_events(std::vector<TraceEvent>& events) const;
+
+    /// Forget all events, only safe while the owning thread is idle.
+    void clear() { m_head.store(0, std::memory_order_release); }
+
+private:
+    // The fields of a TraceEvent, atomic so that readers may copy them
+    // while the owning thread writes the slot; seq tells them apart.
+    struct Slot {
+        std::atomic<size_t> seq { 0 };
+        std::atomic<const char*> name { nullptr };
+        std::atomic<const char*> detail { nullptr };  // ustring chars
+        std::atomic<long long> start { 0 };
+        std::atomic<long long> end { 0 };
+    };
+    int m_tid;
+    std::vector<Slot> m_slots;
+    std::atomic<size_t> m_head { 0 };
+};
+
+
+
+/// Per thread recorder of the shading timeline (master loads, runtime
+/// optimization, LLVM phases, sampled executions) of one ShadingSystem,
+/// dumped in the Chrome trace event format that chrome://tracing and
+/// Perfetto load.
+class ShadingTrace {
+public:
+    ShadingTrace();
+    ~ShadingTrace();
+
+    /// Record one span on the calling thread's buffer, creating it with
+    /// room for `capacity` events the first time the thread records.
+    void record(const char* name, ustring detail, long long start,
+                long long end, size_t capacity)
+    {
+        thread_buffer(capacity)->record(name, detail, start, end);
+    }
+
+    /// Return the recorded events as a Chrome trace event JSON document.
+    std::string json() const;
+
+    /// Forget all the recorded events.
+    void clear();
+
+private:
+    TraceBuffer* thread_buffer(size_t capacity);
+
+    // Unique among all ShadingTrace objects, it tags the thread local
+    // cache of the buffer so it can't be used with another ShadingTrace.
+    const long long m_id;
+    const long long m_epoch;  ///< Ticks when the trace started
+    mutable OIIO::spin_mutex m_mutex;  ///< Guards m_buffers
+    std::vector<std::pair<std::thread::id, std::unique_ptr<TraceBuffer>>>
+        m_buffers;
+};
+
+
+}  // namespace pvt
+OSL_NAMESPACE_END
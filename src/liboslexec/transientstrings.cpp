@@ -0,0 +1,37 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#include "transientstrings.h"
+
+#include <OpenImageIO/ustring.h>
+
+
+OSL_NAMESPACE_BEGIN
+
+namespace pvt {
+
+
+thread_local TransientStrings* TransientStrings::s_current = nullptr;
+
+
+
+ustringhash_pod
+TransientStrings::add(string_view s)
+{
+    if (s.empty())
+        return ustringhash_pod();
+    ustringhash_pod h = ustring::strhash(s);
+    if (m_index.find(h) != m_index.end())
+        return h;
+    if (m_used == m_strings.size())
+        m_strings.emplace_back();
+    std::string& str = m_strings[m_used++];
+    str.assign(s.data(), s.size());
+    m_index.emplace(h, string_view(str));
+    return h;
+}
+
+
+}  // namespace pvt
+OSL_NAMESPACE_END
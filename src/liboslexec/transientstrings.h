@@ -0,0 +1,86 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+#pragma once
+
+#include <deque>
+#include <string>
+#include <unordered_map>
+
+#include <OSL/oslconfig.h>
+
+
+OSL_NAMESPACE_BEGIN
+
+namespace pvt {
+
+
+/// Strings made by the string shadeops (concat, substr, format, split)
+/// during one execution of a group. They are identified by the same hash
+/// their ustring would have, so comparisons and hashing of the hash don't
+/// change, but their characters are only kept here until the next
+/// execution instead of being interned in the global ustring table.
+/// The shader code calls osl_intern_s on the results that escape into
+/// outputs, messages, attributes, etc., so only those are interned.
+class TransientStrings {
+public:
+    TransientStrings() = default;
+    TransientStrings(const TransientStrings&) = delete;
+    TransientStrings& operator=(const TransientStrings&) = delete;
+
+    /// Return the hash of `s`, keeping a copy of its characters until
+    /// clear() unless it is already known.
+    ustringhash_pod add(string_view s);
+
+    /// Retrieve the characters of a string previously passed to add(),
+    /// returning false if `h` isn't the hash of one.
+    bool find(ustringhash_pod h, string_view& s) const
+    {
+        if (m_index.empty())
+            return false;
+        auto found = m_index.find(h);
+        if (found == m_index.end())
+            return false;
+        s = found->second;
+        return true;
+    }
+
+    /// Forget all the strings, keeping the memory for reuse.
+    void clear()
+    {
+        m_index.clear();
+        m_used = 0;
+    }
+
+    /// The strings of the context executing on the calling thread, or
+    /// nullptr outside of shader execution.
+    static TransientStrings* current() { return s_current; }
+
+    /// Makes `strings` current on the calling thread for its lifetime.
+    class Scope {
+    public:
+        explicit Scope(TransientStrings& strings) : m_prev(s_current)
+        {
+            s_current = &strings;
+        }
+        ~Scope() { s_current = m_prev; }
+
+    private:
+        TransientStrings* m_prev;
+    };
+
+private:
+    static thread_local TransientStrings* s_current;
+
+    // Deque elements don't move, so the views in m_index remain valid as
+    // strings are added; the std::strings past m_used keep their capacity
+    // to be reused after clear().
+    std::deque<std::string> m_strings;
+    size_t m_used = 0;
+    std::unordered_map<ustringhash_pod, string_view> m_index;
+};
+
+
+}  // namespace pvt
+OSL_NAMESPACE_END
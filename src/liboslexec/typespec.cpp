@@ -20,15 +20,38 @@ namespace pvt {  // OSL::pvt
 
 
 
+static thread_local std::vector<std::shared_ptr<StructSpec>>*
+    thread_struct_list = nullptr;
+
+
+
 std::vector<std::shared_ptr<StructSpec>>&
 TypeSpec::struct_list()
 {
+    if (thread_struct_list)
+        return *thread_struct_list;
     static std::vector<std::shared_ptr<StructSpec>> m_structs;
     return m_structs;
 }
 
 
 
+TypeSpec::StructListScope::StructListScope(
+    std::vector<std::shared_ptr<StructSpec>>& structs)
+    : m_prev(thread_struct_list)
+{
+    thread_struct_list = &structs;
+}
+
+
+
+TypeSpec::StructListScope::~StructListScope()
+{
+    thread_struct_list = m_prev;
+}
+
+
+
 TypeSpec::TypeSpec(const char* name, int structid, int arraylen)
     : m_simple(TypeDesc::UNKNOWN, arraylen)
     , m_structure((short)structid)
@@ -302,7 +302,8 @@ __OSL_OP(regex_impl)(void* bsg_, const char* subject_, void* results,
 
     const std::string& subject(ustring::from_unique(subject_).string());
     std::match_results<std::string::const_iterator> mresults;
-    const std::regex& regex(ctx->find_regex(USTR(pattern)));
+    const CompiledRegex& compiled(ctx->find_regex(USTR(pattern)));
+    const std::regex& regex(compiled.regex());
     if (nresults > 0) {
         std::string::const_iterator start = subject.begin();
         int res = fullmatch ? std::regex_match(subject, mresults, regex)
@@ -320,8 +321,7 @@ __OSL_OP(regex_impl)(void* bsg_, const char* subject_, void* results,
         }
         return res;
     } else {
-        return fullmatch ? regex_match(subject, regex)
-                         : regex_search(subject, regex);
+        return compiled.matches(subject, fullmatch);
     }
 }
 
@@ -354,7 +354,8 @@ __OSL_MASKED_OP(regex_impl)(void* bsg_, void* wsuccess_ptr, void* wsubject_ptr,
 
         const std::string& subject = usubject.string();
         std::match_results<std::string::const_iterator> mresults;
-        const std::regex& regex(ctx->find_regex(pattern));
+        const CompiledRegex& compiled(ctx->find_regex(pattern));
+        const std::regex& regex(compiled.regex());
         if (nresults > 0) {
             std::string::const_iterator start = subject.begin();
             int res = fullmatch ? std::regex_match(subject, mresults, regex)
@@ -371,8 +372,7 @@ __OSL_MASKED_OP(regex_impl)(void* bsg_, void* wsuccess_ptr, void* wsubject_ptr,
             }
             wsuccess[lane] = res;
         } else {
-            wsuccess[lane] = fullmatch ? regex_match(subject, regex)
-                                       : regex_search(subject, regex);
+            wsuccess[lane] = compiled.matches(subject, fullmatch);
         }
     });
 }
@@ -2,6 +2,13 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
+#ifndef __CUDA_ARCH__
+#    include <atomic>
+#    include <cstdint>
+#    include <cstring>
+#    include <memory>
+#endif
+
 #include <OSL/sfmath.h>
 
 #include "gabornoise.h"
@@ -31,6 +38,7 @@ struct GaborParams {
     float lambda;
     float sqrt_lambda_inv;
     float radius, radius2, radius3, radius_inv;
+    bool impulse_table;  // Take the impulses from the shared table?
 
     OSL_HOSTDEVICE
     GaborParams(const NoiseParams& opt)
@@ -41,6 +49,7 @@ struct GaborParams {
         , weight(Gabor_Impulse_Weight)
         , bandwidth(hostdevice::clamp(opt.bandwidth, 0.01f, 100.0f))
         , periodic(false)
+        , impulse_table(opt.impulse_table != 0)
     {
 #if OSL_FAST_MATH
         float TWO_to_bandwidth = OIIO::fast_exp2(bandwidth);
@@ -113,6 +122,57 @@ gabor_sample(GaborParams& gp, const Vec3& /*x_c*/, fast_rng& rng, Vec3& omega,
 }
 
 
+// Evaluate the contribution of one gabor impulse, with phase phi_i and
+// frequency omega_i, at x_k_i (relative to the impulse, which must be
+// within the truncation radius).
+static OSL_HOSTDEVICE Dual2<float>
+gabor_impulse(GaborParams& gp, const Dual2<Vec3>& x_k_i, const Vec3& omega_i,
+              float phi_i)
+{
+    if (!gp.do_filter) {
+        // N.B. if determinant(gp.filter) is too small, we will
+        // run into numerical problems.  But the filtering isn't
+        // needed in that case anyway, so just don't filter.
+        // This seems to only come up when the filter region is
+        // tiny.
+        return gabor_kernel(gp.weight, omega_i, phi_i, gp.a, x_k_i);  // 3D
+    }
+
+    // Transform the impulse's anisotropy into tangent space
+    Vec3 omega_i_t;
+    multMatrix(gp.local, omega_i, omega_i_t);
+
+    // Slice to get a 2D kernel
+    Dual2<float> d_i = -dot(gp.N, x_k_i);
+    Dual2<float> w_i_t_s;
+    Vec2 omega_i_t_s;
+    Dual2<float> phi_i_t_s;
+    slice_gabor_kernel_3d(d_i, gp.weight, gp.a, omega_i_t, phi_i, w_i_t_s,
+                          omega_i_t_s, phi_i_t_s);
+
+    // Filter the 2D kernel
+    Dual2<float> w_i_t_s_f;
+    float a_i_t_s_f;
+    Vec2 omega_i_t_s_f;
+    Dual2<float> phi_i_t_s_f;
+    filter_gabor_kernel_2d(gp.filter, w_i_t_s, gp.a, omega_i_t_s, phi_i_t_s,
+                           w_i_t_s_f, a_i_t_s_f, omega_i_t_s_f, phi_i_t_s_f);
+
+    // Now evaluate the 2D filtered kernel
+    Dual2<Vec3> xkit;
+    multMatrix(gp.local, x_k_i, xkit);
+    Dual2<Vec2> x_k_i_t = make_Vec2(comp_x(xkit), comp_y(xkit));
+    Dual2<float> gk     = gabor_kernel(w_i_t_s_f, omega_i_t_s_f, phi_i_t_s_f,
+                                       a_i_t_s_f, x_k_i_t);  // 2D
+    if (!std::isfinite(gk.val())) {
+        // Numeric failure of the filtered version.  Fall
+        // back on the unfiltered.
+        gk = gabor_kernel(gp.weight, omega_i, phi_i, gp.a, x_k_i);  // 3D
+    }
+    return gk;
+}
+
+
 // Evaluate the summed contribution of all gabor impulses within the
 // cell whose corner is c_i.  x_c_i is vector from x (the point
 // we are trying to evaluate noise at) and c_i.
@@ -137,58 +197,256 @@ gabor_cell(GaborParams& gp, const Vec3& c_i, const Dual2<Vec3>& x_c_i,
         float phi_i;
         Vec3 omega_i;
         gabor_sample(gp, c_i, rng, omega_i, phi_i);
-        if (x_k_i.val().length2() < gp.radius2) {
-            if (!gp.do_filter) {
-                // N.B. if determinant(gp.filter) is too small, we will
-                // run into numerical problems.  But the filtering isn't
-                // needed in that case anyway, so just don't filter.
-                // This seems to only come up when the filter region is
-                // tiny.
-                sum += gabor_kernel(gp.weight, omega_i, phi_i, gp.a,
-                                    x_k_i);  // 3D
-            } else {
-                // Transform the impulse's anisotropy into tangent space
-                Vec3 omega_i_t;
-                multMatrix(gp.local, omega_i, omega_i_t);
-
-                // Slice to get a 2D kernel
-                Dual2<float> d_i = -dot(gp.N, x_k_i);
-                Dual2<float> w_i_t_s;
-                Vec2 omega_i_t_s;
-                Dual2<float> phi_i_t_s;
-                slice_gabor_kernel_3d(d_i, gp.weight, gp.a, omega_i_t, phi_i,
-                                      w_i_t_s, omega_i_t_s, phi_i_t_s);
-
-                // Filter the 2D kernel
-                Dual2<float> w_i_t_s_f;
-                float a_i_t_s_f;
-                Vec2 omega_i_t_s_f;
-                Dual2<float> phi_i_t_s_f;
-                filter_gabor_kernel_2d(gp.filter, w_i_t_s, gp.a, omega_i_t_s,
-                                       phi_i_t_s, w_i_t_s_f, a_i_t_s_f,
-                                       omega_i_t_s_f, phi_i_t_s_f);
-
-                // Now evaluate the 2D filtered kernel
-                Dual2<Vec3> xkit;
-                multMatrix(gp.local, x_k_i, xkit);
-                Dual2<Vec2> x_k_i_t = make_Vec2(comp_x(xkit), comp_y(xkit));
-                Dual2<float> gk     = gabor_kernel(w_i_t_s_f, omega_i_t_s_f,
-                                                   phi_i_t_s_f, a_i_t_s_f,
-                                                   x_k_i_t);  // 2D
-                if (!std::isfinite(gk.val())) {
-                    // Numeric failure of the filtered version.  Fall
-                    // back on the unfiltered.
-                    gk = gabor_kernel(gp.weight, omega_i, phi_i, gp.a,
-                                      x_k_i);  // 3D
-                }
-                sum += gk;
-            }
+        if (x_k_i.val().length2() < gp.radius2)
+            sum += gabor_impulse(gp, x_k_i, omega_i, phi_i);
+    }
+
+    return sum;
+}
+
+
+
+#ifndef __CUDA_ARCH__
+
+// The impulses of one cell, as gabor_cell draws them from the cell's
+// fast_rng. The positions are kept as arrays, padded to a multiple of four
+// with impulses too far away to count, so that their distances to the
+// point being evaluated can be checked four at a time.
+struct GaborCellImpulses {
+    static constexpr int max_impulses = 16;
+    int n;
+    OIIO_SIMD4_ALIGN float x[max_impulses], y[max_impulses], z[max_impulses];
+    Vec3 omega[max_impulses];
+    float phi[max_impulses];
+
+    int padded_size() const { return (n + 3) & ~3; }
+};
+
+
+
+// Everything the impulses of a cell depend on.
+struct GaborCellKey {
+    int cell[3];      ///< The cell, after wrapping for periodic noise
+    int seed;         ///< Which component of gabor3
+    int anisotropic;  ///< The sampling mode
+    float mean;       ///< Expected number of impulses per cell
+    Vec3 omega;       ///< Direction (unused and zero if isotropic)
+
+    bool operator==(const GaborCellKey& k) const
+    {
+        return cell[0] == k.cell[0] && cell[1] == k.cell[1]
+               && cell[2] == k.cell[2] && seed == k.seed
+               && anisotropic == k.anisotropic && mean == k.mean
+               && omega == k.omega;
+    }
+};
+
+
+
+// Fixed size, direct mapped table of the impulses of recently used cells,
+// shared by all threads. Each slot is guarded by a sequence number that
+// is odd while a thread fills it in: other writers leave the slot alone,
+// and readers that see the sequence change while they copy it treat the
+// lookup as a miss. The key and impulses are stored as words that are
+// loaded and stored with relaxed atomics, so a reader racing a writer
+// may copy a torn slot, which it then discards, but never reads memory
+// that is being written non-atomically.
+class GaborImpulseTable {
+public:
+    static constexpr unsigned int nslots = 1 << 14;
+
+    GaborImpulseTable() : m_slots(new Slot[nslots]()) {}
+
+    // Copy the impulses stored for the key into imp, if they are there.
+    bool find(const GaborCellKey& key, unsigned int hash,
+              GaborCellImpulses& imp) const
+    {
+        const Slot& s(m_slots[hash & (nslots - 1)]);
+        unsigned int seq = s.seq.load(std::memory_order_acquire);
+        if (seq == 0 || (seq & 1))
+            return false;  // Empty, or being written
+        GaborCellKey k;
+        load_words(s.key, &k, 1);
+        if (!(k == key))
+            return false;  // Another cell
+        imp.n = s.n.load(std::memory_order_relaxed);
+        if (imp.n < 0 || imp.n > GaborCellImpulses::max_impulses)
+            return false;  // Torn by a writer
+        int e = imp.padded_size();
+        load_words(s.x, imp.x, e);
+        load_words(s.y, imp.y, e);
+        load_words(s.z, imp.z, e);
+        load_words(s.omega, imp.omega, e);
+        load_words(s.phi, imp.phi, e);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return s.seq.load(std::memory_order_relaxed) == seq;
+    }
+
+    // Store the impulses of the key's cell, unless another thread is
+    // storing into the same slot.
+    void insert(const GaborCellKey& key, unsigned int hash,
+                const GaborCellImpulses& imp)
+    {
+        Slot& s(m_slots[hash & (nslots - 1)]);
+        unsigned int seq = s.seq.load(std::memory_order_relaxed);
+        if ((seq & 1)
+            || !s.seq.compare_exchange_strong(seq, seq + 1,
+                                              std::memory_order_acquire))
+            return;
+        std::atomic_thread_fence(std::memory_order_release);
+        int e = imp.padded_size();
+        store_words(s.key, &key, 1);
+        s.n.store(imp.n, std::memory_order_relaxed);
+        store_words(s.x, imp.x, e);
+        store_words(s.y, imp.y, e);
+        store_words(s.z, imp.z, e);
+        store_words(s.omega, imp.omega, e);
+        store_words(s.phi, imp.phi, e);
+        s.seq.store(seq + 2, std::memory_order_release);
+    }
+
+private:
+    using Word = std::atomic<uint32_t>;
+    static constexpr int max_impulses = GaborCellImpulses::max_impulses;
+    static_assert(sizeof(GaborCellKey) % sizeof(uint32_t) == 0,
+                  "GaborCellKey must be a whole number of words");
+    static_assert(sizeof(Vec3) == 3 * sizeof(uint32_t),
+                  "Vec3 must be three words");
+
+    struct Slot {
+        std::atomic<unsigned int> seq { 0 };  ///< Zero until first stored
+        Word key[sizeof(GaborCellKey) / sizeof(uint32_t)];
+        std::atomic<int> n;
+        Word x[max_impulses], y[max_impulses], z[max_impulses];
+        Word omega[3 * max_impulses];
+        Word phi[max_impulses];
+    };
+
+    // Copy n T's from the words of a slot, or into them
+    template<typename T>
+    static void load_words(const Word* words, T* val, int n)
+    {
+        constexpr int nw = sizeof(T) / sizeof(uint32_t);
+        uint32_t w[nw];
+        for (int i = 0; i < n; ++i, words += nw) {
+            for (int j = 0; j < nw; ++j)
+                w[j] = words[j].load(std::memory_order_relaxed);
+            memcpy((void*)&val[i], w, sizeof(T));
+        }
+    }
+    template<typename T>
+    static void store_words(Word* words, const T* val, int n)
+    {
+        constexpr int nw = sizeof(T) / sizeof(uint32_t);
+        uint32_t w[nw];
+        for (int i = 0; i < n; ++i, words += nw) {
+            memcpy(w, (const void*)&val[i], sizeof(T));
+            for (int j = 0; j < nw; ++j)
+                words[j].store(w[j], std::memory_order_relaxed);
         }
     }
 
+    std::unique_ptr<Slot[]> m_slots;
+};
+
+
+
+static GaborImpulseTable&
+gabor_table()
+{
+    static GaborImpulseTable table;  // Allocated the first time it's used
+    return table;
+}
+
+
+
+// Draw the impulses of the cell the way gabor_cell does. Return false if
+// there are too many of them to store.
+static bool
+gabor_draw_impulses(GaborParams& gp, const Vec3& c_i, int seed,
+                    GaborCellImpulses& imp)
+{
+    fast_rng rng(gp.periodic ? Vec3(wrap(c_i, gp.period)) : c_i, seed);
+    imp.n = rng.poisson(gp.lambda * gp.radius3);
+    if (imp.n > GaborCellImpulses::max_impulses)
+        return false;
+    for (int i = 0; i < imp.n; i++) {
+        // Same order of rng() calls as gabor_cell
+        float z_rng = rng(), y_rng = rng(), x_rng = rng();
+        imp.x[i] = x_rng;
+        imp.y[i] = y_rng;
+        imp.z[i] = z_rng;
+        gabor_sample(gp, c_i, rng, imp.omega[i], imp.phi[i]);
+    }
+    for (int i = imp.n, e = imp.padded_size(); i < e; ++i) {
+        imp.x[i] = imp.y[i] = imp.z[i] = 1.0e6f;
+        imp.omega[i] = Vec3(0.0f);
+        imp.phi[i]   = 0.0f;
+    }
+    return true;
+}
+
+
+
+// Same as gabor_cell, but with the cell's impulses taken from the shared
+// table (drawn and stored the first time the cell is seen). The impulses
+// are checked against the truncation radius four at a time, and only the
+// few within it are evaluated, in the same order as gabor_cell would.
+// What this saves is drawing the impulses and the rejected ones; the
+// kernels of the accepted impulses are evaluated one by one with the same
+// scalar code as gabor_cell, so that the results stay bit-identical.
+static Dual2<float>
+gabor_cell_from_table(GaborParams& gp, const Vec3& c_i,
+                      const Dual2<Vec3>& x_c_i, int seed)
+{
+    Vec3 cell = gp.periodic ? Vec3(wrap(c_i, gp.period)) : c_i;
+    GaborCellKey key;
+    key.cell[0]     = OIIO::ifloor(cell.x);
+    key.cell[1]     = OIIO::ifloor(cell.y);
+    key.cell[2]     = OIIO::ifloor(cell.z);
+    key.seed        = seed;
+    key.anisotropic = gp.anisotropic;
+    key.mean        = gp.lambda * gp.radius3;
+    key.omega       = gp.anisotropic == 0 ? Vec3(0.0f) : gp.omega;
+    unsigned int hash
+        = OIIO::bjhash::bjfinal(inthash(unsigned(key.cell[0]),
+                                        unsigned(key.cell[1]),
+                                        unsigned(key.cell[2]), unsigned(seed)),
+                                unsigned(bitcast_to_uint(key.mean)),
+                                unsigned(key.anisotropic));
+
+    GaborImpulseTable& table(gabor_table());
+    GaborCellImpulses imp;
+    if (!table.find(key, hash, imp)) {
+        if (!gabor_draw_impulses(gp, c_i, seed, imp))
+            return gabor_cell(gp, c_i, x_c_i, seed);
+        table.insert(key, hash, imp);
+    }
+
+    Dual2<float> sum = 0;
+    const Vec3& x(x_c_i.val());
+    vfloat4 radius(gp.radius), radius2(gp.radius2);
+    for (int i = 0; i < imp.n; i += 4) {
+        vfloat4 dx = radius * (vfloat4(x.x) - vfloat4(imp.x + i));
+        vfloat4 dy = radius * (vfloat4(x.y) - vfloat4(imp.y + i));
+        vfloat4 dz = radius * (vfloat4(x.z) - vfloat4(imp.z + i));
+        int inside = (dx * dx + dy * dy + dz * dz < radius2).bitmask();
+        for (int j = 0; inside; ++j, inside >>= 1) {
+            if (inside & 1) {
+                Dual2<Vec3> x_k_i(Vec3(dx[j], dy[j], dz[j]),
+                                  gp.radius * x_c_i.dx(),
+                                  gp.radius * x_c_i.dy());
+                sum += gabor_impulse(gp, x_k_i, imp.omega[i + j],
+                                     imp.phi[i + j]);
+            }
+        }
+    }
     return sum;
 }
 
+#endif
+
+
 
 // Sum the contributions of gabor impulses in all neighboring cells
 // surrounding position x_g.
@@ -205,6 +463,12 @@ gabor_grid(GaborParams& gp, const Dual2<Vec3>& x_g, int seed = 0)
                 Vec3 c(i, j, k);
                 Vec3 c_i          = floor_x_g + c;
                 Dual2<Vec3> x_c_i = x_c - c;
+#ifndef __CUDA_ARCH__
+                if (gp.impulse_table) {
+                    sum += gabor_cell_from_table(gp, c_i, x_c_i, seed);
+                    continue;
+                }
+#endif
                 sum += gabor_cell(gp, c_i, x_c_i, seed);
             }
         }
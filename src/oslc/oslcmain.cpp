@@ -3,13 +3,18 @@
 // https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
 
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <OpenImageIO/filesystem.h>
+#include <OpenImageIO/strutil.h>
 #include <OpenImageIO/sysutil.h>
 #include <OpenImageIO/thread.h>
 
@@ -25,7 +30,7 @@ usage()
     std::cout
         << "oslc -- Open Shading Language compiler " OSL_LIBRARY_VERSION_STRING
            "\n" OSL_COPYRIGHT_STRING "\n"
-           "Usage:  oslc [options] file\n"
+           "Usage:  oslc [options] file [file...]\n"
            "  Options:\n"
            "\t--help         Print this usage message\n"
            "\t-o filename    Specify output filename\n"
@@ -39,6 +44,12 @@ usage()
            "\t-E             Only preprocess the input and output to stdout\n"
            "\t-Werror        Treat all warnings as errors\n"
            "\t-embed-source  Embed preprocessed source in the oso file\n"
+           "\t-share-stdosl  Preprocess stdosl.h once and share it (implied\n"
+           "\t               with several files)\n"
+           "\t-j N           Compile several files with N threads (default:\n"
+           "\t               all cores)\n"
+           "\t-cache dir     Reuse the oso of identical earlier compiles kept\n"
+           "\t               in dir\n"
            "\t-buffer        (debugging) Force compile from buffer\n"
            "\t-MD, -MMD      Write a depfile containing headers used, to a file\n"
            "\t-M, -MM        Like -MD, but write depfile to stdout\n"
@@ -87,6 +98,48 @@ static OSLC_ErrorHandler default_oslc_error_handler;
 
 
 
+// Compile one shader with its own compiler, return true on success.
+static bool
+compile_shader(const std::string& shader_path,
+               const std::vector<std::string>& args, bool compile_from_buffer,
+               bool quiet)
+{
+    static OIIO::mutex print_mutex;
+    OSLCompiler compiler(&default_oslc_error_handler);
+    bool ok = true;
+    if (compile_from_buffer) {
+        // Force a compile-from-buffer for debugging purposes
+        std::string sourcecode;
+        ok = OIIO::Filesystem::read_text_file(shader_path, sourcecode);
+        std::string osobuffer;
+        if (ok)
+            ok = compiler.compile_buffer(sourcecode, osobuffer, args, "",
+                                         shader_path);
+        if (ok) {
+            OIIO::ofstream file;
+            OIIO::Filesystem::open(file, compiler.output_filename());
+            if (file)
+                file << osobuffer;
+            ok = file.good();
+        }
+    } else {
+        // Ordinary compile from file
+        ok = compiler.compile(shader_path, args);
+    }
+
+    OIIO::lock_guard guard(print_mutex);
+    if (ok) {
+        if (!quiet)
+            std::cout << "Compiled " << shader_path << " -> "
+                      << compiler.output_filename() << "\n";
+    } else {
+        std::cout << "FAILED " << shader_path << "\n";
+    }
+    return ok;
+}
+
+
+
 int
 main(int argc, const char* argv[])
 {
@@ -110,7 +163,10 @@ main(int argc, const char* argv[])
     std::vector<std::string> args;
     bool quiet               = false;
     bool compile_from_buffer = false;
-    std::string shader_path;
+    bool to_stdout           = false;  // -E, -M, -MM
+    bool single_output       = false;  // -o, -MF, -MT
+    int nthreads             = 0;
+    std::vector<std::string> shader_paths;
 
     // Parse arguments from command line
     for (int a = 1; a < argc; ++a) {
@@ -125,13 +181,16 @@ main(int argc, const char* argv[])
                    || !strcmp(argv[a], "-MM")
                    || !strcmp(argv[a], "--user-dependencies")) {
             args.emplace_back(argv[a]);
-            quiet = true;
+            quiet     = true;
+            to_stdout = true;
         } else if (!strcmp(argv[a], "-v") || !strcmp(argv[a], "-d")
                    || !strcmp(argv[a], "-O") || !strcmp(argv[a], "-O0")
                    || !strcmp(argv[a], "-O1") || !strcmp(argv[a], "-O2")
                    || !strcmp(argv[a], "-Werror")
                    || !strcmp(argv[a], "-embed-source")
                    || !strcmp(argv[a], "--embed-source")
+                   || !strcmp(argv[a], "-share-stdosl")
+                   || !strcmp(argv[a], "--share-stdosl")
                    || !strcmp(argv[a], "-MD")
                    || !strcmp(argv[a], "--write-dependencies")
                    || !strcmp(argv[a], "-MMD")
@@ -140,6 +199,9 @@ main(int argc, const char* argv[])
                    || OIIO::Strutil::starts_with(argv[a], "-MT")) {
             // Valid command-line argument
             args.emplace_back(argv[a]);
+            if (OIIO::Strutil::starts_with(argv[a], "-MF")
+                || OIIO::Strutil::starts_with(argv[a], "-MT"))
+                single_output = true;
             if (a < argc - 1
                 && (!strcmp(argv[a], "-MF") || !strcmp(argv[a], "-MT"))) {
                 ++a;
@@ -150,6 +212,18 @@ main(int argc, const char* argv[])
             args.emplace_back(argv[a]);
             ++a;
             args.emplace_back(argv[a]);
+            single_output = true;
+        } else if ((!strcmp(argv[a], "-cache") || !strcmp(argv[a], "--cache"))
+                   && a < argc - 1) {
+            // Build cache directory
+            args.emplace_back(argv[a]);
+            ++a;
+            args.emplace_back(argv[a]);
+        } else if (!strcmp(argv[a], "-j") && a < argc - 1) {
+            nthreads = OIIO::Strutil::stoi(argv[++a]);
+        } else if (OIIO::Strutil::starts_with(argv[a], "-j")
+                   && isdigit((unsigned char)argv[a][2])) {
+            nthreads = OIIO::Strutil::stoi(argv[a] + 2);
         } else if (argv[a][0] == '-'
                    && (argv[a][1] == 'D' || argv[a][1] == 'U'
                        || argv[a][1] == 'I')) {
@@ -158,47 +232,51 @@ main(int argc, const char* argv[])
             compile_from_buffer = true;
         } else {
             // Shader to compile
-            shader_path = argv[a];
+            shader_paths.emplace_back(argv[a]);
         }
     }
 
-    if (shader_path.empty()) {
+    if (shader_paths.empty()) {
         std::cout << "ERROR: Missing shader path"
                   << "\n\n";
         usage();
         return EXIT_FAILURE;
     }
-
-    OSLCompiler compiler(&default_oslc_error_handler);
-    bool ok = true;
-    if (compile_from_buffer) {
-        // Force a compile-from-buffer for debugging purposes
-        std::string sourcecode;
-        ok = OIIO::Filesystem::read_text_file(shader_path, sourcecode);
-        std::string osobuffer;
-        if (ok)
-            ok = compiler.compile_buffer(sourcecode, osobuffer, args, "",
-                                         shader_path);
-        if (ok) {
-            OIIO::ofstream file;
-            OIIO::Filesystem::open(file, compiler.output_filename());
-            if (file)
-                file << osobuffer;
-            ok = file.good();
-        }
-    } else {
-        // Ordinary compile from file
-        ok = compiler.compile(shader_path, args);
-    }
-
-    if (ok) {
-        if (!quiet)
-            std::cout << "Compiled " << shader_path << " -> "
-                      << compiler.output_filename() << "\n";
-    } else {
-        std::cout << "FAILED " << shader_path << "\n";
+    if (shader_paths.size() > 1 && single_output) {
+        std::cout << "ERROR: -o, -MF and -MT need a single shader path"
+                  << "\n\n";
+        usage();
         return EXIT_FAILURE;
     }
 
-    return EXIT_SUCCESS;
+    if (shader_paths.size() == 1)
+        return compile_shader(shader_paths[0], args, compile_from_buffer,
+                              quiet)
+                   ? EXIT_SUCCESS
+                   : EXIT_FAILURE;
+
+    // Several shaders: compile them on a pool of threads, each with its
+    // own compiler, all sharing one preprocessed stdosl.h. Output to
+    // stdout would interleave, so that is done one shader at a time.
+    args.emplace_back("-share-stdosl");
+    if (nthreads <= 0)
+        nthreads = int(std::thread::hardware_concurrency());
+    if (to_stdout)
+        nthreads = 1;
+    nthreads = std::max(1, std::min(nthreads, int(shader_paths.size())));
+    std::atomic<size_t> next(0);
+    std::atomic<bool> ok(true);
+    auto worker = [&]() {
+        for (size_t i = next++; i < shader_paths.size(); i = next++)
+            if (!compile_shader(shader_paths[i], args, compile_from_buffer,
+                                quiet))
+                ok = false;
+    };
+    std::vector<std::thread> threads;
+    for (int t = 1; t < nthreads; ++t)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& t : threads)
+        t.join();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
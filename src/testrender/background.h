@@ -7,6 +7,14 @@
 #include <OSL/dual_vec.h>
 #include <OSL/oslconfig.h>
 #include <algorithm>  // upper_bound
+#ifndef __CUDACC__
+#    include <OpenImageIO/filesystem.h>
+#    include <OpenImageIO/parallel.h>
+#    include <cstdint>
+#    include <cstdio>
+#    include <string>
+#    include <vector>
+#endif
 
 OSL_NAMESPACE_BEGIN
 
@@ -49,31 +57,43 @@ struct Background {
 #endif
     }
 
-    template<typename F, typename T> void prepare(int resolution, F cb, T* data)
+#ifndef __CUDACC__
+    // Build the importance map. cb(dirs, results, n) must shade the n
+    // directions into results[0..n-1]; it is called concurrently, with
+    // batches of whole rows of the map.
+    template<typename F> void prepare(int resolution, F cb)
     {
         // These values are set via set_variables() in CUDA
-        res = resolution;
-        if (res < 32)
-            res = 32;  // validate
-        invres      = 1.0f / res;
-        invjacobian = res * res / float(4 * M_PI);
-        values      = new Vec3[res * res];
-        rows        = new float[res];
-        cols        = new float[res * res];
+        allocate(resolution);
 
-        for (int y = 0, i = 0; y < res; y++) {
-            for (int x = 0; x < res; x++, i++) {
-                values[i] = cb(map(x + 0.5f, y + 0.5f), data);
-                cols[i]   = std::max(std::max(values[i].x, values[i].y),
-                                     values[i].z)
-                          + ((x > 0) ? cols[i - 1] : 0.0f);
+        // Shading dominates, so batches of rows are shaded in parallel
+        OIIO::parallel_for_chunked(0, res, 0, [&](int64_t y0, int64_t y1) {
+            std::vector<Dual2<Vec3>> dirs;
+            dirs.reserve((y1 - y0) * res);
+            for (int y = int(y0); y < int(y1); y++)
+                for (int x = 0; x < res; x++)
+                    dirs.push_back(map(x + 0.5f, y + 0.5f));
+            cb(dirs.data(), values + y0 * res, int(dirs.size()));
+        });
+
+        // Each row's cdf is an independent prefix sum, only the one over
+        // the row totals has to wait for all of them
+        OIIO::parallel_for(0, res, [&](int64_t y) {
+            const int i0 = int(y) * res;
+            float sum    = 0;
+            for (int x = 0; x < res; x++) {
+                const Vec3& c = values[i0 + x];
+                sum += std::max(std::max(c.x, c.y), c.z);
+                cols[i0 + x] = sum;
             }
-            rows[y] = cols[i - 1] + ((y > 0) ? rows[y - 1] : 0.0f);
+            rows[y] = sum;
             // normalize the pdf for this scanline (if it was non-zero)
-            if (cols[i - 1] > 0)
+            if (sum > 0)
                 for (int x = 0; x < res; x++)
-                    cols[i - res + x] /= cols[i - 1];
-        }
+                    cols[i0 + x] /= sum;
+        });
+        for (int y = 1; y < res; y++)
+            rows[y] += rows[y - 1];
         // normalize the pdf across all scanlines
         for (int y = 0; y < res; y++) {
             rows[y] /= rows[res - 1];
@@ -81,13 +101,13 @@ struct Background {
 
         // both eval and sample below return a "weight" that is
         // value[i] / row*col_pdf, so might as well bake it into the table
-        for (int y = 0, i = 0; y < res; y++) {
+        OIIO::parallel_for(0, res, [&](int64_t y) {
             float row_pdf = rows[y] - (y > 0 ? rows[y - 1] : 0.0f);
-            for (int x = 0; x < res; x++, i++) {
+            for (int x = 0, i = int(y) * res; x < res; x++, i++) {
                 float col_pdf = cols[i] - (x > 0 ? cols[i - 1] : 0.0f);
                 values[i] /= row_pdf * col_pdf * invjacobian;
             }
-        }
+        });
 #if 0  // DEBUG: visualize importance table
         using namespace OIIO;
         ImageOutput* out = ImageOutput::create("bg.exr");
@@ -98,6 +118,46 @@ struct Background {
 #endif
     }
 
+    // Save the prepared map, tagged with a key identifying what it was
+    // built from (shaders, parameters, resolution), so later runs can
+    // load() it instead of shading it again.
+    bool save(const std::string& filename, uint64_t key) const
+    {
+        FILE* f = OIIO::Filesystem::fopen(filename, "wb");
+        if (!f)
+            return false;
+        const uint64_t header[3] = { cache_magic, key, uint64_t(res) };
+        const size_t n           = size_t(res) * res;
+        bool ok = fwrite(header, sizeof(header), 1, f) == 1
+                  && fwrite(values, sizeof(Vec3), n, f) == n
+                  && fwrite(rows, sizeof(float), res, f) == size_t(res)
+                  && fwrite(cols, sizeof(float), n, f) == n;
+        return (fclose(f) == 0) && ok;
+    }
+
+    // Load a map saved with the same key, return false (leaving the map
+    // empty) if there is none.
+    bool load(const std::string& filename, uint64_t key, int resolution)
+    {
+        FILE* f = OIIO::Filesystem::fopen(filename, "rb");
+        if (!f)
+            return false;
+        allocate(resolution);
+        uint64_t header[3] = { 0, 0, 0 };
+        const size_t n     = size_t(res) * res;
+        bool ok = fread(header, sizeof(header), 1, f) == 1
+                  && header[0] == cache_magic && header[1] == key
+                  && header[2] == uint64_t(res)
+                  && fread(values, sizeof(Vec3), n, f) == n
+                  && fread(rows, sizeof(float), res, f) == size_t(res)
+                  && fread(cols, sizeof(float), n, f) == n;
+        fclose(f);
+        if (!ok)
+            release();
+        return ok;
+    }
+#endif
+
     OSL_HOSTDEVICE
     Vec3 eval(const Vec3& dir, float& pdf) const
     {
@@ -227,6 +287,33 @@ struct Background {
 #endif
 
 private:
+#ifndef __CUDACC__
+    static constexpr uint64_t cache_magic = 0x3147424c534fULL;  // "OSLBG1"
+
+    void allocate(int resolution)
+    {
+        release();
+        res = resolution;
+        if (res < 32)
+            res = 32;  // validate
+        invres      = 1.0f / res;
+        invjacobian = res * res / float(4 * M_PI);
+        values      = new Vec3[res * res];
+        rows        = new float[res];
+        cols        = new float[res * res];
+    }
+
+    void release()
+    {
+        delete[] values;
+        delete[] rows;
+        delete[] cols;
+        values = nullptr;
+        rows   = nullptr;
+        cols   = nullptr;
+    }
+#endif
+
     OSL_HOSTDEVICE Dual2<Vec3> map(float x, float y) const
     {
         // pixel coordinates of entry (x,y)
@@ -158,6 +158,8 @@ setupRaytracer(SimpleRaytracer& raytracer, const bool bg_only)
     raytracer.lightprims_size = render_params.lightprims_size;
     raytracer.m_lightprims    = reinterpret_cast<unsigned int*>(
         render_params.lightprims);
+    raytracer.m_light_alias = reinterpret_cast<const AliasEntry*>(
+        render_params.light_alias);
     raytracer.m_mesh_surfacearea = reinterpret_cast<const float*>(
         render_params.surfacearea);
     raytracer.m_meshids = reinterpret_cast<const int*>(render_params.mesh_ids);
@@ -53,6 +53,7 @@ struct SimpleRaytracer {
     int show_globals                = 0;
     const int* m_shader_is_light    = nullptr;
     const unsigned* m_lightprims    = nullptr;
+    const AliasEntry* m_light_alias = nullptr;
     size_t lightprims_size          = 0;
     const int* m_shaderids          = nullptr;
     const int* m_meshids            = nullptr;
@@ -873,6 +873,12 @@ OptixRaytracer::upload_mesh_data()
     COPY_TO_DEVICE(d_lightprims, OptixRaytracer::lightprims().data(),
                    lightprims_size);
 
+    const size_t light_alias_size = OptixRaytracer::light_alias().size()
+                                    * sizeof(AliasEntry);
+    d_light_alias = DEVICE_ALLOC(light_alias_size);
+    COPY_TO_DEVICE(d_light_alias, OptixRaytracer::light_alias().data(),
+                   light_alias_size);
+
     // Copy the mesh ID for each triangle to the device
     std::vector<int> mesh_ids;
     for (size_t triIdx = 0; triIdx < scene.triangles.size(); ++triIdx) {
@@ -1032,7 +1038,8 @@ OptixRaytracer::prepare_render()
 
     // Set up the OptiX scene graph
     build_accel();
-    prepare_lights();
+    // the light shaders can't run on the host, so lights are picked by area
+    prepare_lights(/*eval_emission=*/false);
     upload_mesh_data();
     make_optix_materials();
     prepare_background();
@@ -1102,6 +1109,7 @@ OptixRaytracer::render(int xres OSL_MAYBE_UNUSED, int yres OSL_MAYBE_UNUSED)
     params.shader_ids      = d_shader_ids;
     params.shader_is_light = d_shader_is_light;
     params.lightprims      = d_lightprims;
+    params.light_alias     = d_light_alias;
     params.lightprims_size = OptixRaytracer::lightprims().size();
     params.mesh_ids        = d_mesh_ids;
     params.surfacearea     = d_surfacearea;
@@ -116,6 +116,7 @@ private:
     CUdeviceptr d_mesh_ids            = 0;
     CUdeviceptr d_surfacearea         = 0;
     CUdeviceptr d_lightprims          = 0;
+    CUdeviceptr d_light_alias         = 0;
     CUdeviceptr d_interactive_params  = 0;
     CUdeviceptr d_bg_values           = 0;
     CUdeviceptr d_bg_rows             = 0;
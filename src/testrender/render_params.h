@@ -53,6 +53,7 @@ struct RenderParams {
     CUdeviceptr mesh_ids;
     CUdeviceptr surfacearea;
     CUdeviceptr lightprims;
+    CUdeviceptr light_alias;
     size_t lightprims_size;
 
     // for the background
@@ -9,6 +9,9 @@
 #include <OpenImageIO/hash.h>
 #include <algorithm>
 #include <cmath>
+#ifndef __CUDACC__
+#    include <vector>
+#endif
 
 OSL_NAMESPACE_BEGIN
 
@@ -207,6 +210,65 @@ struct MIS {
     }
 };
 
+// One entry of an alias table (Walker, Vose), which picks entry i with
+// probability pdf in constant time: the entry floor(x * n) is picked with
+// probability q, and its alias otherwise.
+struct AliasEntry {
+    float q;
+    unsigned alias;
+    float pdf;
+};
+
+struct AliasTable {
+#ifndef __CUDACC__
+    // Fill table[0..n-1] so entry i is picked in proportion to weights[i].
+    // If no weight is positive, all the entries are equally likely.
+    static void build(const float* weights, unsigned n, AliasEntry* table)
+    {
+        double sum = 0;
+        for (unsigned i = 0; i < n; i++)
+            sum += std::max(weights[i], 0.0f);
+        std::vector<double> scaled(n);
+        std::vector<unsigned> small, large;
+        for (unsigned i = 0; i < n; i++) {
+            double p = sum > 0 ? std::max(weights[i], 0.0f) / sum : 1.0 / n;
+            table[i]  = { 1.0f, i, float(p) };
+            scaled[i] = p * n;
+            (scaled[i] < 1 ? small : large).push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            unsigned l = small.back();
+            unsigned g = large.back();
+            small.pop_back();
+            large.pop_back();
+            table[l].q     = float(scaled[l]);
+            table[l].alias = g;
+            scaled[g]      = (scaled[g] + scaled[l]) - 1;
+            (scaled[g] < 1 ? small : large).push_back(g);
+        }
+        // Whatever is left is within roundoff of 1 and keeps itself
+    }
+#endif
+
+    // Pick an entry with the uniform number x in [0,1), which is remapped
+    // to a new uniform number in [0,1) that the caller may reuse.
+    template<typename Table>
+    static OSL_HOSTDEVICE unsigned sample(const Table& table, unsigned n,
+                                          float& x)
+    {
+        float xn   = x * n;
+        unsigned i = std::min(unsigned(xn), n - 1);
+        xn -= i;
+        const float one_minus_eps = 0x1.fffffep-1f;
+        if (xn < table[i].q) {
+            x = std::min(xn / table[i].q, one_minus_eps);
+            return i;
+        }
+        x = std::min((xn - table[i].q) / (1 - table[i].q), one_minus_eps);
+        return table[i].alias;
+    }
+};
+
 // "Practical Hash-based Owen Scrambling" - Brent Burley - JCGT 2020
 //    https://jcgt.org/published/0009/04/01/
 struct Sampler {
@@ -19,7 +19,10 @@ namespace pugi = OIIO::pugi;
 #    include "simpleraytracer.h"
 #endif
 
+#include <algorithm>
 #include <cmath>
+#include <map>
+#include <tuple>
 
 // Create ustrings for all strings used by the free function renderer services.
 // Required to allow the reverse mapping of hash->string to work when processing messages
@@ -1039,7 +1042,17 @@ SimpleRaytracer::subpixel_radiance(float x, float y, Sampler& sampler,
         // add self-emission
         float k = 1;
         if (m_shader_is_light[shaderID] && lightprims_size > 0) {
-            const float light_pick_pdf = 1.0f / lightprims_size;
+            // find the hit triangle among the (sorted) lights to know how
+            // likely it was to be picked
+            size_t lo = 0, hi = lightprims_size - 1;
+            while (lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                if (m_lightprims[mid] < unsigned(hit.id))
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            const float light_pick_pdf = m_light_alias[lo].pdf;
             // figure out the probability of reaching this point
             float light_pdf = light_pick_pdf
                               * scene.shapepdf(hit.id, r.origin, sg.P);
@@ -1091,12 +1104,12 @@ SimpleRaytracer::subpixel_radiance(float x, float y, Sampler& sampler,
 
         // trace a shadow ray to one of the light emitting primitives
         if (lightprims_size > 0) {
-            const float light_pick_pdf = 1.0f / lightprims_size;
-
-            // uniform probability for each light
-            float xl = xi * lightprims_size;
-            int ls   = floorf(xl);
-            xl -= ls;
+            // pick a light in proportion to its power, xl is reused to
+            // sample a point on it
+            float xl    = xi;
+            unsigned ls = AliasTable::sample(m_light_alias, lightprims_size,
+                                             xl);
+            const float light_pick_pdf = m_light_alias[ls].pdf;
 
             uint32_t lid = m_lightprims[ls];
             if (lid != hit.id) {
@@ -1168,19 +1181,28 @@ SimpleRaytracer::subpixel_radiance(float x, float y, Sampler& sampler,
 }
 
 
+static OSL_HOSTDEVICE Vec3
+pixel_jitter(Sampler& sampler, bool no_jitter)
+{
+    // jitter pixel coordinate [0,1)^2
+    Vec3 j = no_jitter ? Vec3(0.5f, 0.5f, 0) : sampler.get();
+    // warp distribution to approximate a tent filter [-1,+1)^2
+    j.x *= 2;
+    j.x = j.x < 1 ? sqrtf(j.x) - 1 : 1 - sqrtf(2 - j.x);
+    j.y *= 2;
+    j.y = j.y < 1 ? sqrtf(j.y) - 1 : 1 - sqrtf(2 - j.y);
+    return j;
+}
+
+
+
 OSL_HOSTDEVICE Color3
 SimpleRaytracer::antialias_pixel(int x, int y, ShadingContext* ctx)
 {
     Color3 result(0, 0, 0);
     for (int si = 0, n = aa * aa; si < n; si++) {
         Sampler sampler(x, y, si);
-        // jitter pixel coordinate [0,1)^2
-        Vec3 j = no_jitter ? Vec3(0.5f, 0.5f, 0) : sampler.get();
-        // warp distribution to approximate a tent filter [-1,+1)^2
-        j.x *= 2;
-        j.x = j.x < 1 ? sqrtf(j.x) - 1 : 1 - sqrtf(2 - j.x);
-        j.y *= 2;
-        j.y = j.y < 1 ? sqrtf(j.y) - 1 : 1 - sqrtf(2 - j.y);
+        Vec3 j = pixel_jitter(sampler, no_jitter);
         // trace eye ray (apply jitter from center of the pixel)
         Color3 r = subpixel_radiance(x + 0.5f + j.x, y + 0.5f + j.y, sampler,
                                      ctx);
@@ -1198,6 +1220,7 @@ SimpleRaytracer::prepare_render()
     // Retrieve and validate options
     aa                = std::max(1, options.get_int("aa"));
     no_jitter         = options.get_int("no_jitter") != 0;
+    wavefront         = options.get_int("wavefront") != 0;
     max_bounces       = options.get_int("max_bounces");
     rr_depth          = options.get_int("rr_depth");
     show_albedo_scale = options.get_float("show_albedo_scale");
@@ -1205,19 +1228,31 @@ SimpleRaytracer::prepare_render()
 
     // prepare background importance table (if requested)
     if (backgroundResolution > 0 && backgroundShaderID >= 0) {
-        // get a context so we can make several background shader calls
-        OSL::PerThreadInfo* thread_info = shadingsys->create_thread_info();
-        ShadingContext* ctx             = shadingsys->get_context(thread_info);
-
-        // build importance table to optimize background sampling
-        auto evaler = [this](const Dual2<Vec3>& dir, ShadingContext* ctx) {
-            return this->eval_background(dir, ctx);
-        };
-        background.prepare(backgroundResolution, evaler, ctx);
-
-        // release context
-        shadingsys->release_context(ctx);
-        shadingsys->destroy_thread_info(thread_info);
+        // reuse the table of a previous run with the same background
+        std::string cache = options.get_string("background_cache");
+        uint64_t key      = cache.size() ? background_key() : 0;
+        if (cache.size() && background.load(cache, key, backgroundResolution)) {
+            errhandler().infofmt("Loaded background importance table from {}",
+                                 cache);
+        } else {
+            // build importance table to optimize background sampling, each
+            // batch of directions gets its own context
+            auto evaler = [this](const Dual2<Vec3>* dirs, Vec3* results,
+                                 int n) {
+                OSL::PerThreadInfo* thread_info
+                    = shadingsys->create_thread_info();
+                ShadingContext* ctx = shadingsys->get_context(thread_info);
+                for (int i = 0; i < n; i++)
+                    results[i] = this->eval_background(dirs[i], ctx);
+                shadingsys->release_context(ctx);
+                shadingsys->destroy_thread_info(thread_info);
+            };
+            background.prepare(backgroundResolution, evaler);
+            if (cache.size() && !background.save(cache, key))
+                errhandler().warningfmt(
+                    "Could not save background importance table to {}",
+                    cache);
+        }
     } else {
         // we aren't directly evaluating the background
         backgroundResolution = 0;
@@ -1243,8 +1278,34 @@ SimpleRaytracer::prepare_render()
 
 
 
+uint64_t
+SimpleRaytracer::background_key()
+{
+    // The serialized group covers the layers, their parameter values and
+    // connections. The compiled shaders may change under the same names,
+    // so their contents are hashed too.
+    ShaderGroupRef group = m_shaders[backgroundShaderID].surf;
+    ustring pickle;
+    shadingsys->getattribute(group.get(), "pickle", pickle);
+    uint64_t key = OIIO::Strutil::strhash(pickle) ^ backgroundResolution;
+    int nlayers  = 0;
+    shadingsys->getattribute(group.get(), "num_layers", nlayers);
+    std::vector<ustring> osofiles(nlayers);
+    shadingsys->getattribute(group.get(), "layer_osofiles",
+                             TypeDesc(TypeDesc::STRING, nlayers),
+                             osofiles.data());
+    for (ustring oso : osofiles) {
+        std::string text;
+        OIIO::Filesystem::read_text_file(oso, text);
+        key = key * 31 + OIIO::Strutil::strhash(text);
+    }
+    return key;
+}
+
+
+
 void
-SimpleRaytracer::prepare_lights()
+SimpleRaytracer::prepare_lights(bool eval_emission)
 {
     m_mesh_surfacearea.reserve(scene.last_index.size());
 
@@ -1269,6 +1330,55 @@ SimpleRaytracer::prepare_lights()
     if (!m_lightprims.empty())
         errhandler().infofmt("Found {} triangles to be treated as lights",
                              m_lightprims.size());
+
+    // Pick the lights in proportion to the power they emit, estimated as
+    // their area times the radiance their shader emits at their center,
+    // so a scene mixing a few bright lights with many dim ones spends its
+    // shadow rays on the lights that matter.
+    const unsigned nlights = m_lightprims.size();
+    std::vector<float> power(nlights);
+    for (unsigned i = 0; i < nlights; i++)
+        power[i] = scene.primitivearea(m_lightprims[i]);
+    if (eval_emission && nlights > 0) {
+        OSL::PerThreadInfo* thread_info = shadingsys->create_thread_info();
+        ShadingContext* ctx             = shadingsys->get_context(thread_info);
+        std::vector<float> radiance(nlights);
+        float max_radiance = 0;
+        for (unsigned i = 0; i < nlights; i++) {
+            const unsigned t = m_lightprims[i];
+            const Vec3 va    = scene.verts[scene.triangles[t].a];
+            const Vec3 vb    = scene.verts[scene.triangles[t].b];
+            const Vec3 vc    = scene.verts[scene.triangles[t].c];
+            Vec3 n           = (vb - va).cross(vc - va);
+            float len        = n.length();
+            if (len == 0)
+                continue;  // degenerate, never sampled anyway
+            n /= len;
+            // look at the center of the triangle from just above it
+            const float dist = 1e-3f * std::sqrt(len);
+            Ray ray((va + vb + vc) * (1.0f / 3) + n * dist, -n, 0, 0,
+                    Ray::SHADOW);
+            ShaderGlobals sg;
+            globals_from_hit(sg, ray, dist, t, 1.0f / 3, 1.0f / 3);
+            shadingsys->execute(*ctx, *m_shaders[scene.shaderid(t)].surf, sg);
+            ShadingResult result;
+            process_closure(sg, result, (const ClosureColor*)sg.Ci, true);
+            const Color3 Le = result.Le;
+            radiance[i]     = std::max((Le.x + Le.y + Le.z) / 3, 0.0f);
+            max_radiance    = std::max(max_radiance, radiance[i]);
+        }
+        shadingsys->release_context(ctx);
+        shadingsys->destroy_thread_info(thread_info);
+        // A single shading point can miss the emission of a textured light,
+        // so keep every light reachable with at least a fraction of the
+        // brightest one's radiance. Without any emission, stick to areas.
+        if (max_radiance > 0) {
+            for (unsigned i = 0; i < nlights; i++)
+                power[i] *= std::max(radiance[i], 0.01f * max_radiance);
+        }
+    }
+    m_light_alias.resize(nlights);
+    AliasTable::build(power.data(), nlights, m_light_alias.data());
 }
 
 
@@ -1283,84 +1393,146 @@ SimpleRaytracer::prepare_geometry()
         }
     }
     if (have_displacement) {
-        errhandler().infofmt("Evaluating displacement shaders");
-        // Loop through all triangles and run displacement shader if there is one
-        // or copy the input point if there is none
+        // Each vertex is displaced once per displacement shader, uv and
+        // normal of the triangle corners around it, not once per corner.
+        // Corners across a uv seam or a hard edge keep their own inputs, so
+        // they are shaded separately. Only Ng and the surface area of the
+        // corners merged this way are averaged.
+        struct DispVertex {
+            int vert;
+            int shaderID;
+            int corners = 0;
+            Vec3 Ng     = Vec3(0, 0, 0);
+            Vec3 N      = Vec3(0, 0, 0);
+            Vec2 uv     = Vec2(0, 0);
+            float area  = 0;
+        };
+        std::vector<DispVertex> disp;
+        // (vert, shader, uv index, normal index)
+        std::map<std::tuple<int, int, int, int>, int> disp_index;
         std::vector<Vec3> disp_verts(scene.verts.size(), Vec3(0, 0, 0));
         std::vector<int> valance(
             scene.verts.size(),
             0);  // number of times each vertex has been displaced
 
-        OSL::PerThreadInfo* thread_info = shadingsys->create_thread_info();
-        ShadingContext* ctx             = shadingsys->get_context(thread_info);
-
         bool has_smooth_normals = false;
         for (int primID = 0, nprims = scene.triangles.size(); primID < nprims;
              primID++) {
+            int v[3] = { scene.triangles[primID].a, scene.triangles[primID].b,
+                         scene.triangles[primID].c };
             Vec3 p[3], n[3];
             Vec2 uv[3];
-
-            p[0] = scene.verts[scene.triangles[primID].a];
-            p[1] = scene.verts[scene.triangles[primID].b];
-            p[2] = scene.verts[scene.triangles[primID].c];
-
-            valance[scene.triangles[primID].a]++;
-            valance[scene.triangles[primID].b]++;
-            valance[scene.triangles[primID].c]++;
+            int nid[3], uvid[3];
+            for (int i = 0; i < 3; i++) {
+                p[i] = scene.verts[v[i]];
+                valance[v[i]]++;
+            }
 
             int shaderID = scene.shaderid(primID);
             if (shaderID < 0 || !m_shaders[shaderID].disp) {
-                disp_verts[scene.triangles[primID].a] += p[0];
-                disp_verts[scene.triangles[primID].b] += p[1];
-                disp_verts[scene.triangles[primID].c] += p[2];
+                for (int i = 0; i < 3; i++)
+                    disp_verts[v[i]] += p[i];
                 continue;
             }
 
-
             Vec3 Ng    = (p[0] - p[1]).cross(p[0] - p[2]);
             float area = 0.5f * Ng.length();
             Ng         = Ng.normalize();
             if (scene.n_triangles[primID].a >= 0) {
-                n[0]               = scene.normals[scene.n_triangles[primID].a];
-                n[1]               = scene.normals[scene.n_triangles[primID].b];
-                n[2]               = scene.normals[scene.n_triangles[primID].c];
+                nid[0]             = scene.n_triangles[primID].a;
+                nid[1]             = scene.n_triangles[primID].b;
+                nid[2]             = scene.n_triangles[primID].c;
+                n[0]               = scene.normals[nid[0]];
+                n[1]               = scene.normals[nid[1]];
+                n[2]               = scene.normals[nid[2]];
                 has_smooth_normals = true;
             } else {
+                // The face normal is only shared within this triangle
+                nid[0] = nid[1] = nid[2] = -1 - primID;
                 n[0] = n[1] = n[2] = Ng;
             }
 
             if (scene.uv_triangles[primID].a >= 0) {
-                uv[0] = scene.uvs[scene.uv_triangles[primID].a];
-                uv[1] = scene.uvs[scene.uv_triangles[primID].b];
-                uv[2] = scene.uvs[scene.uv_triangles[primID].c];
+                uvid[0] = scene.uv_triangles[primID].a;
+                uvid[1] = scene.uv_triangles[primID].b;
+                uvid[2] = scene.uv_triangles[primID].c;
+                uv[0]   = scene.uvs[uvid[0]];
+                uv[1]   = scene.uvs[uvid[1]];
+                uv[2]   = scene.uvs[uvid[2]];
             } else {
+                uvid[0] = uvid[1] = uvid[2] = -1;
                 uv[0] = uv[1] = uv[2] = Vec2(0, 0);
             }
 
-            // displace each vertex
             for (int i = 0; i < 3; i++) {
-                ShaderGlobals sg = {};
-                sg.P             = p[i];
-                sg.Ng            = Ng;
-                sg.N             = n[i];
-                sg.u             = uv[i].x;
-                sg.v             = uv[i].y;
-                sg.I             = (p[i] - camera.eye).normalize();
-                sg.surfacearea   = area;
-                sg.renderstate   = &sg;
-
-                shadingsys->execute(*ctx, *m_shaders[shaderID].disp, sg);
-
-                p[i] = sg.P;
+                auto key   = std::make_tuple(v[i], shaderID, uvid[i], nid[i]);
+                auto found = disp_index.emplace(key, int(disp.size()));
+                if (found.second) {
+                    // The merged corners all share this uv and N
+                    disp.emplace_back();
+                    disp.back().vert     = v[i];
+                    disp.back().shaderID = shaderID;
+                    disp.back().N        = n[i];
+                    disp.back().uv       = uv[i];
+                }
+                DispVertex& d = disp[found.first->second];
+                d.corners++;
+                d.Ng += Ng;
+                d.area += area;
             }
-            disp_verts[scene.triangles[primID].a] += p[0];
-            disp_verts[scene.triangles[primID].b] += p[1];
-            disp_verts[scene.triangles[primID].c] += p[2];
         }
+        disp_index.clear();
+
+        // Shade the vertices of each shader together
+        std::stable_sort(disp.begin(), disp.end(),
+                         [](const DispVertex& a, const DispVertex& b) {
+                             return a.shaderID < b.shaderID;
+                         });
+        errhandler().infofmt("Evaluating displacement shaders on {} vertices",
+                             disp.size());
+        std::vector<Vec3> disp_P(disp.size());
+        OIIO::parallel_for_chunked(
+            0, int64_t(disp.size()), 1024, [&](int64_t begin, int64_t end) {
+                OSL::PerThreadInfo* thread_info
+                    = shadingsys->create_thread_info();
+                ShadingContext* ctx = shadingsys->get_context(thread_info);
+                std::vector<ShaderGlobals> sgs(end - begin);
+                for (int64_t k = begin; k < end; ++k) {
+                    const DispVertex& d = disp[k];
+                    float w             = 1.0f / d.corners;
+                    ShaderGlobals& sg   = sgs[k - begin];
+                    sg                  = {};
+                    sg.P                = scene.verts[d.vert];
+                    sg.Ng               = d.Ng * w;
+                    sg.N                = d.N;
+                    sg.u                = d.uv.x;
+                    sg.v                = d.uv.y;
+                    sg.I                = (sg.P - camera.eye).normalize();
+                    sg.surfacearea      = d.area * w;
+                    sg.renderstate      = &sg;
+                }
+                // One execute_many per run of vertices with the same shader
+                int64_t run = begin;
+                while (run < end) {
+                    int64_t run_end = run + 1;
+                    while (run_end < end
+                           && disp[run_end].shaderID == disp[run].shaderID)
+                        ++run_end;
+                    shadingsys->execute_many(
+                        *ctx, *m_shaders[disp[run].shaderID].disp, 0,
+                        int(run),
+                        span<ShaderGlobals>(&sgs[run - begin], run_end - run),
+                        nullptr, nullptr);
+                    run = run_end;
+                }
+                for (int64_t k = begin; k < end; ++k)
+                    disp_P[k] = sgs[k - begin].P;
+                shadingsys->release_context(ctx);
+                shadingsys->destroy_thread_info(thread_info);
+            });
 
-        // release context
-        shadingsys->release_context(ctx);
-        shadingsys->destroy_thread_info(thread_info);
+        for (size_t k = 0; k < disp.size(); ++k)
+            disp_verts[disp[k].vert] += disp_P[k] * float(disp[k].corners);
 
         // average each vertex by the number of times it was displaced
         for (int i = 0, n = scene.verts.size(); i < n; i++) {
@@ -1412,13 +1584,17 @@ SimpleRaytracer::render(int xres, int yres)
             // within a thread.
             ShadingContext* ctx = shadingsys->get_context(thread_info);
 
-            OIIO::ImageBuf::Iterator<float> p(pixelbuf,
-                                              OIIO::ROI(0, xres, ybegin, yend));
-            for (; !p.done(); ++p) {
-                Color3 c = antialias_pixel(p.x(), p.y(), ctx);
-                p[0]     = c.x;
-                p[1]     = c.y;
-                p[2]     = c.z;
+            if (wavefront) {
+                wavefront_render_rows(xres, int(ybegin), int(yend), ctx);
+            } else {
+                OIIO::ImageBuf::Iterator<float> p(
+                    pixelbuf, OIIO::ROI(0, xres, ybegin, yend));
+                for (; !p.done(); ++p) {
+                    Color3 c = antialias_pixel(p.x(), p.y(), ctx);
+                    p[0]     = c.x;
+                    p[1]     = c.y;
+                    p[2]     = c.z;
+                }
             }
 
             // We're done shading with this context.
@@ -1433,6 +1609,287 @@ SimpleRaytracer::render(int xres, int yres)
 
 
 
+namespace {
+
+// One path of the wavefront integrator, between two bounces
+struct WavefrontPath {
+    Ray ray;
+    Sampler sampler;
+    Color3 weight;
+    float bsdf_pdf;
+    int prev_id;
+    int bounce;
+    int pixel;  // index among the pixels of the rows being rendered
+};
+
+// A hit of the current bounce, waiting to be shaded
+struct WavefrontHit {
+    int shaderID;
+    int path;
+    Intersection hit;
+};
+
+// A shadow ray toward the background (lid < 0) or toward a point of the
+// light triangle lid, with the contribution of its path if it gets there
+struct WavefrontShadow {
+    Ray ray;
+    Color3 contrib;
+    float dist;
+    unsigned skip_id;
+    int lid;
+    float u, v;
+    int pixel;
+};
+
+}  // namespace
+
+
+
+void
+SimpleRaytracer::wavefront_render_rows(int xres, int ybegin, int yend,
+                                       ShadingContext* ctx)
+{
+    // This follows subpixel_radiance step by step, and draws the same
+    // random numbers for each path, but traces all the paths of a wave
+    // one bounce at a time. Each bounce intersects all the rays, then
+    // shades the hits sorted by shader, then traces the shadow rays and
+    // shades the lights they reach, again sorted by shader.
+    constexpr float inf          = std::numeric_limits<float>::infinity();
+    constexpr int wave_size      = 1 << 14;  // paths in flight per thread
+    const int spp                = aa * aa;
+    const int npixels            = xres * (yend - ybegin);
+    const size_t lightprims_size = m_lightprims.size();
+
+    std::vector<Color3> pixels(npixels, Color3(0, 0, 0));
+    std::vector<WavefrontPath> paths, next;
+    std::vector<WavefrontHit> hits;
+    std::vector<WavefrontShadow> shadows, light_hits;
+    ShaderGlobals sg;
+
+    const int64_t total = int64_t(npixels) * spp;
+    for (int64_t first = 0; first < total; first += wave_size) {
+        // camera rays of the next wave of samples
+        paths.clear();
+        for (int64_t k = first, end = std::min(total, first + wave_size);
+             k < end; k++) {
+            int pixel = int(k / spp);
+            int x     = pixel % xres;
+            int y     = ybegin + pixel / xres;
+            Sampler sampler(x, y, int(k % spp));
+            Vec3 j = pixel_jitter(sampler, no_jitter);
+            paths.push_back({ camera.get(x + 0.5f + j.x, y + 0.5f + j.y),
+                              sampler, Color3(1, 1, 1), inf, -1, 0, pixel });
+        }
+
+        while (!paths.empty()) {
+            // Trace all the rays of this bounce
+            hits.clear();
+            for (int i = 0, n = int(paths.size()); i < n; i++) {
+                const WavefrontPath& p = paths[i];
+                Intersection hit = scene.intersect(p.ray, inf, p.prev_id);
+                if (hit.t == inf) {
+                    // we hit nothing? check background shader
+                    if (backgroundShaderID < 0)
+                        continue;
+                    if (p.bounce > 0 && backgroundResolution > 0) {
+                        float bg_pdf = 0;
+                        Vec3 bg      = background.eval(p.ray.direction, bg_pdf);
+                        pixels[p.pixel]
+                            += p.weight * bg
+                               * MIS::power_heuristic<MIS::WEIGHT_WEIGHT>(
+                                   p.bsdf_pdf, bg_pdf);
+                    } else {
+                        pixels[p.pixel] += p.weight
+                                           * eval_background(p.ray.direction,
+                                                             ctx, p.bounce);
+                    }
+                    continue;
+                }
+                if (show_globals) {
+                    // visualize the main fields of the shader globals
+                    globals_from_hit(sg, p.ray, hit.t, hit.id, hit.u, hit.v);
+                    Vec3 v = sg.Ng;
+                    if (show_globals == 2)
+                        v = sg.N;
+                    if (show_globals == 3)
+                        v = sg.dPdu.normalize();
+                    if (show_globals == 4)
+                        v = sg.dPdv.normalize();
+                    if (show_globals == 5)
+                        v = Vec3(sg.u, sg.v, 0);
+                    Color3 c(v.x, v.y, v.z);
+                    if (show_globals != 5)
+                        c = c * 0.5f + Color3(0.5f);
+                    pixels[p.pixel] += p.weight * c;
+                    continue;
+                }
+                int shaderID = scene.shaderid(hit.id);
+                if (shaderID < 0 || !m_shaders[shaderID].surf)
+                    continue;  // no shader attached? done
+                hits.push_back({ shaderID, i, hit });
+            }
+
+            // Shade the hits of each shader together
+            std::stable_sort(hits.begin(), hits.end(),
+                             [](const WavefrontHit& a, const WavefrontHit& b) {
+                                 return a.shaderID < b.shaderID;
+                             });
+            next.clear();
+            shadows.clear();
+            for (const WavefrontHit& h : hits) {
+                const WavefrontPath& p  = paths[h.path];
+                const Intersection& hit = h.hit;
+                globals_from_hit(sg, p.ray, hit.t, hit.id, hit.u, hit.v);
+                shadingsys->execute(*ctx, *m_shaders[h.shaderID].surf, sg);
+                ShadingResult result;
+                bool last_bounce = p.bounce == max_bounces;
+                process_closure(sg, result, (const ClosureColor*)sg.Ci,
+                                last_bounce);
+
+                // add self-emission
+                float k = 1;
+                if (m_shader_is_light[h.shaderID] && lightprims_size > 0) {
+                    size_t l = std::lower_bound(m_lightprims.begin(),
+                                                m_lightprims.end(), hit.id)
+                               - m_lightprims.begin();
+                    float light_pdf = m_light_alias[l].pdf
+                                      * scene.shapepdf(hit.id, p.ray.origin,
+                                                       sg.P);
+                    k = MIS::power_heuristic<MIS::WEIGHT_EVAL>(p.bsdf_pdf,
+                                                               light_pdf);
+                }
+                pixels[p.pixel] += p.weight * k * result.Le;
+
+                // last bounce? nothing left to do
+                if (last_bounce)
+                    continue;
+
+                // build internal pdf for sampling between bsdf closures
+                result.bsdf.prepare(-sg.I, p.weight, p.bounce >= rr_depth);
+
+                if (show_albedo_scale > 0) {
+                    pixels[p.pixel] += p.weight
+                                       * result.bsdf.get_albedo(-sg.I)
+                                       * show_albedo_scale;
+                    continue;
+                }
+
+                WavefrontPath np = p;
+                Vec3 s           = np.sampler.get();
+                float xi         = s.x;
+                float yi         = s.y;
+                float zi         = s.z;
+                const float radius = p.ray.radius + p.ray.spread * hit.t;
+
+                // queue one ray to the background
+                if (backgroundResolution > 0) {
+                    Dual2<Vec3> bg_dir;
+                    float bg_pdf   = 0;
+                    Vec3 bg        = background.sample(xi, yi, bg_dir, bg_pdf);
+                    BSDF::Sample b = result.bsdf.eval(-sg.I, bg_dir.val());
+                    Color3 contrib = p.weight * b.weight * bg
+                                     * MIS::power_heuristic<MIS::WEIGHT_WEIGHT>(
+                                         bg_pdf, b.pdf);
+                    if ((contrib.x + contrib.y + contrib.z) > 0)
+                        shadows.push_back({ Ray(sg.P, bg_dir.val(), radius, 0,
+                                                Ray::SHADOW),
+                                            contrib, inf, hit.id, -1, 0, 0,
+                                            p.pixel });
+                }
+
+                // queue a shadow ray to one of the light emitting primitives
+                if (lightprims_size > 0) {
+                    float xl    = xi;
+                    unsigned ls = AliasTable::sample(m_light_alias,
+                                                     lightprims_size, xl);
+                    uint32_t lid = m_lightprims[ls];
+                    if (lid != hit.id) {
+                        LightSample sample = scene.sample(lid, sg.P, xl, yi);
+                        BSDF::Sample b     = result.bsdf.eval(-sg.I,
+                                                              sample.dir);
+                        Color3 contrib = p.weight * b.weight
+                                         * MIS::power_heuristic<
+                                             MIS::EVAL_WEIGHT>(
+                                             m_light_alias[ls].pdf
+                                                 * sample.pdf,
+                                             b.pdf);
+                        if ((contrib.x + contrib.y + contrib.z) > 0)
+                            shadows.push_back(
+                                { Ray(sg.P, sample.dir, radius, 0,
+                                      Ray::SHADOW),
+                                  contrib, sample.dist, hit.id, int(lid),
+                                  sample.u, sample.v, p.pixel });
+                    }
+                }
+
+                // continue the path with an indirect ray
+                BSDF::Sample bs = result.bsdf.sample(-sg.I, xi, yi, zi);
+                np.weight *= bs.weight;
+                if (!(np.weight.x > 0) && !(np.weight.y > 0)
+                    && !(np.weight.z > 0))
+                    continue;  // filter out all 0's or NaNs
+                np.bsdf_pdf      = bs.pdf;
+                np.ray.raytype   = Ray::DIFFUSE;
+                np.ray.direction = bs.wi;
+                np.ray.radius    = radius;
+                np.ray.spread    = std::max(np.ray.spread, bs.roughness);
+                np.ray.origin    = sg.P;
+                np.prev_id       = hit.id;
+                np.bounce++;
+                next.push_back(np);
+            }
+
+            // Trace the shadow rays, then shade the lights they reached,
+            // again grouped by shader
+            light_hits.clear();
+            for (const WavefrontShadow& s : shadows) {
+                if (s.lid < 0) {
+                    Intersection shadow_hit = scene.intersect(s.ray, inf,
+                                                              s.skip_id);
+                    if (shadow_hit.t == inf)  // ray reached the background?
+                        pixels[s.pixel] += s.contrib;
+                } else {
+                    Intersection shadow_hit = scene.intersect(s.ray, s.dist,
+                                                              s.skip_id,
+                                                              s.lid);
+                    if (shadow_hit.t == s.dist)
+                        light_hits.push_back(s);
+                }
+            }
+            std::stable_sort(light_hits.begin(), light_hits.end(),
+                             [&](const WavefrontShadow& a,
+                                 const WavefrontShadow& b) {
+                                 return scene.shaderid(a.lid)
+                                        < scene.shaderid(b.lid);
+                             });
+            for (const WavefrontShadow& s : light_hits) {
+                globals_from_hit(sg, s.ray, s.dist, s.lid, s.u, s.v);
+                // execute the light shader (for emissive closures only)
+                shadingsys->execute(*ctx,
+                                    *m_shaders[scene.shaderid(s.lid)].surf,
+                                    sg);
+                ShadingResult light_result;
+                process_closure(sg, light_result, (const ClosureColor*)sg.Ci,
+                                true);
+                pixels[s.pixel] += s.contrib * light_result.Le;
+            }
+
+            std::swap(paths, next);
+        }
+    }
+
+    OIIO::ImageBuf::Iterator<float> p(pixelbuf,
+                                      OIIO::ROI(0, xres, ybegin, yend));
+    for (int i = 0; !p.done(); ++p, ++i) {
+        Color3 c = pixels[i] * (1.0f / spp);
+        p[0]     = c.x;
+        p[1]     = c.y;
+        p[2]     = c.z;
+    }
+}
+
+
+
 void
 SimpleRaytracer::clear()
 {
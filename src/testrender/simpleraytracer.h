@@ -86,8 +86,14 @@ public:
 
     virtual void parse_scene_xml(const std::string& scenefile);
     virtual void prepare_render();
-    void prepare_lights();
+    // Collect the light triangles and build the table picking them for
+    // next event estimation, in proportion to their area times the power
+    // their shader emits at their center (when eval_emission is true and
+    // shaders can run on the host, otherwise just their area).
+    void prepare_lights(bool eval_emission = true);
     void prepare_geometry();
+    // Identify the background shader group, for caching its importance map
+    uint64_t background_key();
     virtual void warmup() {}
     virtual void render(int xres, int yres);
     virtual void clear();
@@ -102,6 +108,7 @@ public:
 
     const std::vector<bool>& shader_is_light() { return m_shader_is_light; }
     const std::vector<unsigned>& lightprims() { return m_lightprims; }
+    const std::vector<AliasEntry>& light_alias() { return m_light_alias; }
 
     Camera camera;
     Scene scene;
@@ -129,12 +136,15 @@ private:
     int rr_depth             = 5;
     float show_albedo_scale  = 0.0f;
     int show_globals         = 0;
+    bool wavefront           = false;
     MaterialVec m_shaders;
     std::vector<bool> m_shader_is_light;
     std::vector<float>
         m_mesh_surfacearea;  // surface area of all triangles in each mesh (one entry per mesh)
     std::vector<unsigned>
         m_lightprims;  // array of all triangles that have a "light" shader on them
+    std::vector<AliasEntry>
+        m_light_alias;  // picks the entries of m_lightprims by emitted power
 
     class ErrorHandler;  // subclass ErrorHandler for SimpleRaytracer
     std::unique_ptr<OIIO::ErrorHandler> m_errhandler;
@@ -197,6 +207,11 @@ private:
     Color3 subpixel_radiance(float x, float y, Sampler& sampler,
                              ShadingContext* ctx);
     Color3 antialias_pixel(int x, int y, ShadingContext* ctx);
+    // Alternative to antialias_pixel for whole rows of the image, tracing
+    // all their paths one bounce at a time and shading the hits of each
+    // bounce grouped by shader.
+    void wavefront_render_rows(int xres, int ybegin, int yend,
+                               ShadingContext* ctx);
 
     friend class ErrorHandler;
 };
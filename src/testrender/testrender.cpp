@@ -51,12 +51,14 @@ static std::string texoptions;
 static int xres = 640, yres = 480;
 static int aa = 1, max_bounces = 1000000, rr_depth = 5;
 static bool no_jitter          = false;
+static bool wavefront          = false;
 static float show_albedo_scale = 0.0f;
 static int show_globals        = 0;
 static int num_threads         = 0;
 static int iters               = 1;
 static std::string scenefile, imagefile;
 static std::string shaderpath;
+static std::string bgcache;
 static bool shadingsys_options_set = false;
 static bool use_optix              = OIIO::Strutil::stoi(
     OIIO::Sysutil::getenv("TESTSHADE_OPTIX"));
@@ -176,6 +178,8 @@ getargs(int argc, const char* argv[])
       .help("Trace NxN rays per pixel");
     ap.arg("--no-jitter", &no_jitter)
       .help("Disable AA pixel jitter");
+    ap.arg("--wavefront", &wavefront)
+      .help("Trace the paths one bounce at a time, shading hits grouped by shader (CPU only)");
     ap.arg("-albedo %f:SCALE", &show_albedo_scale)
       .help("Visualize the albedo of each pixel instead of path tracing");
     ap.arg("-normals")
@@ -193,6 +197,8 @@ getargs(int argc, const char* argv[])
     ap.arg("-uvs")
       .help("Visualize the texture coordinates instead of path tracing")
       .action([&](cspan<const char*> argv) { show_globals = 5; });
+    ap.arg("--bgcache %s:FILE", &bgcache)
+      .help("Load the background importance table from FILE if it was built from the same background shaders, or save it there");
     ap.arg("--iters %d:N", &iters)
       .help("Number of iterations");
     ap.arg("-O0", &O0)
@@ -291,8 +297,11 @@ main(int argc, const char* argv[])
     rend->attribute("rr_depth", rr_depth);
     rend->attribute("aa", aa);
     rend->attribute("no_jitter", (int)no_jitter);
+    rend->attribute("wavefront", (int)wavefront);
     rend->attribute("show_albedo_scale", show_albedo_scale);
     rend->attribute("show_globals", show_globals);
+    if (bgcache.size())
+        rend->attribute("background_cache", bgcache);
     OIIO::attribute("threads", num_threads);
 
 #if OSL_USE_OPTIX
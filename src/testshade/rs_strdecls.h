@@ -32,6 +32,7 @@ RS_STRDECL("myspace", myspace)
 RS_STRDECL("options", options)
 RS_STRDECL("blahblah", blahblah)
 RS_STRDECL("shading:index", shading_index)
+RS_STRDECL("object:queries", object_queries)
 RS_STRDECL("s", s)
 RS_STRDECL("t", t)
 RS_STRDECL("red", red)
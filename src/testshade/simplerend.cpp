@@ -262,6 +262,8 @@ SimpleRenderer::supports(string_view feature) const
         return true;
     else if (m_use_rs_bitcode && feature == "build_interpolated_getter")
         return true;
+    else if (m_cache_object_attributes && feature == "cache_object_attributes")
+        return true;
     return false;
 }
 
@@ -479,6 +481,13 @@ SimpleRenderer::get_array_attribute(ShaderGlobals* sg, bool derivatives,
         return true;
     }
 
+    // To test the caching of object attributes, count the queries
+    if (object.empty() && name == RS::Hashes::object_queries
+        && type == TypeInt) {
+        *(int*)val = ++m_object_queries;
+        return true;
+    }
+
     // If no named attribute was found, allow userdata to bind to the
     // attribute request.
     if (object.empty() && index == -1)
@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <map>
 #include <memory>
 #include <unordered_map>
@@ -156,6 +157,10 @@ public:
     virtual void finalize_pixel_buffer() {}
 
     void use_rs_bitcode(bool enabled) { m_use_rs_bitcode = enabled; }
+    void cache_object_attributes(bool enabled)
+    {
+        m_cache_object_attributes = enabled;
+    }
 
     static void register_JIT_Global_Variables();
 
@@ -201,7 +206,10 @@ protected:
     std::vector<ustring> m_outputvars;
     std::vector<std::shared_ptr<OIIO::ImageBuf>> m_outputbufs;
     std::unique_ptr<OIIO::ErrorHandler> m_errhandler { new OIIO::ErrorHandler };
-    bool m_use_rs_bitcode = false;
+    bool m_use_rs_bitcode          = false;
+    bool m_cache_object_attributes = false;
+    // How many times "object:queries" was asked for
+    std::atomic<int> m_object_queries { 0 };
 
     // Named transforms
     typedef std::map<ustringhash, std::shared_ptr<Transformation>> TransformMap;
@@ -83,6 +83,7 @@ static bool do_oslquery          = false;
 static bool print_groupdata      = false;
 static bool inbuffer             = false;
 static bool use_shade_image      = false;
+static bool use_execute_many     = false;
 static bool userdata_isconnected = false;
 static bool print_outputs        = false;
 static bool output_placement     = true;
@@ -118,6 +119,10 @@ static OSL::Matrix44 Mshad;  // "shader" space to "common" space matrix
 static OSL::Matrix44 Mobj;   // "object" space to "common" space matrix
 static ShaderGroupRef shadergroup;
 static std::string archivegroup;
+static std::string tracefile;
+static std::vector<std::string> printstats;
+static std::string statsjson;
+static bool resetstats = false;
 static int exprcount               = 0;
 static bool shadingsys_options_set = false;
 static float uscale = 1, vscale = 1;
@@ -129,6 +134,7 @@ static char* userdata_base_ptr = nullptr;
 static char* output_base_ptr   = nullptr;
 static bool use_rs_bitcode
     = false;  // use free function bitcode version of renderer services
+static bool cache_object_attributes = false;
 static int jbufferMB = 16;
 
 // Testshade thread tracking and assignment.
@@ -251,6 +257,10 @@ set_shadingsys_options()
     }
 
     shadingsys->attribute("profile", int(profile));
+    if (tracefile.size()) {
+        shadingsys->attribute("trace_events", 2);
+        shadingsys->attribute("trace_filename", tracefile);
+    }
     shadingsys->attribute("debug_nan", debugnan);
     shadingsys->attribute("debug_uninit", debug_uninit);
     shadingsys->attribute("userdata_isconnected", userdata_isconnected);
@@ -282,6 +292,9 @@ set_shadingsys_options()
     if (const char* opt_env = getenv("TESTSHADE_BATCHED"))
         batched = atoi(opt_env);
 
+    if (const char* opt_env = getenv("TESTSHADE_EXECMANY"))
+        use_execute_many = atoi(opt_env);
+
     max_batch_size = 16;
     if (const char* opt_env = getenv("TESTSHADE_MAX_BATCH_SIZE"))
         max_batch_size = atoi(opt_env);
@@ -694,6 +707,23 @@ print_info()
 
 
 
+// Print the --printstat statistics, looked up in the structured stats
+static void
+print_structured_stats()
+{
+    OIIO::ParamValueList stats;
+    shadingsys->getstats(stats);
+    for (const std::string& name : printstats) {
+        auto found = stats.find(name);
+        std::cout << name << " = "
+                  << (found != stats.end() ? found->get_string()
+                                           : std::string("<not found>"))
+                  << "\n";
+    }
+}
+
+
+
 static void
 getargs(int argc, const char* argv[])
 {
@@ -737,6 +767,14 @@ getargs(int argc, const char* argv[])
       .help("populate Dx(v) & Dy(v) with varying values (vs. uniform)");
     ap.arg("--profile", &profile)
       .help("Print profile information");
+    ap.arg("--trace %s:FILENAME", &tracefile)
+      .help("Write a Chrome trace of the JIT and sampled executions");
+    ap.arg("--printstat %L:NAME", &printstats)
+      .help("Print one of the structured statistics after shading (may be repeated)");
+    ap.arg("--statsjson %s:FILENAME", &statsjson)
+      .help("Write the structured statistics as JSON after shading");
+    ap.arg("--resetstats", &resetstats)
+      .help("Reset the statistics after shading, then print the --printstat ones again");
     ap.arg("--saveptx", &saveptx)
       .help("Save the generated PTX (OptiX mode only)");
     ap.arg("--warmup", &warmup)
@@ -837,6 +875,8 @@ getargs(int argc, const char* argv[])
     ap.arg("--noshadeimage %!", &use_shade_image)
       .help("Don't use shade_image utility")
       .action(OIIO::ArgParse::store_false());
+    ap.arg("--execmany", &use_execute_many)
+      .help("Shade each row of points with a single execute_many call");
     ap.arg("--expr %s:EXPR")
       .action([&](cspan<const char*> argv){ stash_shader_arg(argv); })
       .help("Specify an OSL expression to evaluate");
@@ -857,6 +897,8 @@ getargs(int argc, const char* argv[])
       .help("Set a different locale");
     ap.arg("--use_rs_bitcode", &use_rs_bitcode)
       .help("Use free function bitcode Renderer services");
+    ap.arg("--cache_object_attributes", &cache_object_attributes)
+      .help("Let the shading system remember \"object:*\" attributes");
     ap.arg("--jbufferMB %d:JBUFFER",  &jbufferMB)
       .help("journal jbuffer size in MB");
 
@@ -969,6 +1011,11 @@ setup_shaderglobals(ShaderGlobals& sg, ShadingSystem* shadingsys, int x, int y)
     // different for each object.
     sg.object2common = OSL::TransformationPtr(&Mobj);
 
+    // All points are on the same object, which the shading system may
+    // remember the "object:*" attributes of.
+    if (cache_object_attributes)
+        sg.objdata = &Mobj;
+
     // Just make it look like all shades are the result of 'raytype' rays.
     sg.raytype = raytype_bit;
 
@@ -1589,9 +1636,29 @@ shade_region(SimpleRenderer* rend, ShaderGroup* shadergroup, OIIO::ROI roi,
 
     raytype_bit = shadingsys->raytype_bit(ustring(raytype_name));
 
+    // With --execmany, every row is shaded by a single execute_many call.
+    // The context only holds the symbols of the last point of the row, so
+    // that needs the outputs to be placed in the output buffers.
+    bool execute_rows = use_execute_many && entrylayer_index.empty()
+                        && !(save && (print_outputs || !output_placement));
+    std::vector<ShaderGlobals> row_globals;
+
     // Loop over all pixels in the image (in x and y)...
     for (int y = roi.ybegin; y < roi.yend; ++y) {
         int shadeindex = y * xres + roi.xbegin;
+        if (execute_rows) {
+            row_globals.resize(roi.width());
+            for (int x = roi.xbegin; x < roi.xend; ++x)
+                setup_shaderglobals(row_globals[x - roi.xbegin], shadingsys,
+                                    x, y);
+            if (this_threads_index == uninitialized_thread_index) {
+                this_threads_index = next_thread_index.fetch_add(1u);
+            }
+            shadingsys->execute_many(*ctx, *shadergroup, this_threads_index,
+                                     shadeindex, row_globals,
+                                     userdata_base_ptr, output_base_ptr);
+            continue;
+        }
         for (int x = roi.xbegin; x < roi.xend; ++x, ++shadeindex) {
             // In a real renderer, this is where you would figure
             // out what object point is visible in this pixel (or
@@ -2041,6 +2108,7 @@ test_shade(int argc, const char* argv[])
     }
 
     rend->use_rs_bitcode(use_rs_bitcode);
+    rend->cache_object_attributes(cache_object_attributes);
 
     if (groupname.size())
         shadingsys->attribute(shadergroup.get(), "groupname", groupname);
@@ -2309,6 +2377,22 @@ test_shade(int argc, const char* argv[])
         std::cout << ustring::getstats() << "\n";
     }
 
+    if (statsjson.size()) {
+        std::ofstream out(statsjson);
+        out << shadingsys->getstats_json();
+        if (!out)
+            std::cerr << "testshade: could not write " << statsjson << "\n";
+    }
+    if (printstats.size())
+        print_structured_stats();
+    if (resetstats) {
+        shadingsys->reset_stats();
+        if (printstats.size()) {
+            std::cout << "After reset_stats:\n";
+            print_structured_stats();
+        }
+    }
+
     // TODO: Include batched support
     if ((debug1 || print_groupdata) && !batched) {
         int groupdata_size;
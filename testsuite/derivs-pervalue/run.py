@@ -0,0 +1,14 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# reuse.osl keeps two values in the same variable and only the second one
+# needs derivatives. Tracked per value, it needs derivatives on as many
+# symbols as separate.osl, which uses a variable per value. Tracked per
+# symbol, the first value and its inputs would get derivatives too.
+stat = "--printstat stat:syms_with_derivs "
+command += osl_app("testshade") + stat + "reuse > reuse.txt 2>&1 ;\n"
+command += osl_app("testshade") + stat + "separate > separate.txt 2>&1 ;\n"
+command += pythonbin + " src/compare_derivs.py reuse.txt separate.txt >> out.txt ;\n"
@@ -0,0 +1,23 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Compare the stat:syms_with_derivs printed by two testshade runs
+
+from __future__ import print_function
+import sys
+
+def syms_with_derivs (filename) :
+    for line in open(filename) :
+        if line.startswith("stat:syms_with_derivs = ") :
+            return int(line.split("=")[1])
+    return -1
+
+reuse = syms_with_derivs(sys.argv[1])
+separate = syms_with_derivs(sys.argv[2])
+print ("some symbols need derivatives:", separate > 0)
+print ("reusing a variable needs no more derivatives:", reuse == separate)
+if reuse != separate :
+    print ("  reuse:", reuse, "separate:", separate)
@@ -0,0 +1,239 @@
+// Copyright Contributors to the Open Shading Language project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+
+/*
+
+This is an example of shading a stream of points that use different shader
+groups and ray types with BatchedExecutor::execute_stream, which forms the
+batches itself.
+
+* Every third point is shaded by group "B", the others by group "A", which
+  instance the same `streamtag` shader with a different `tag`.
+* Odd points are shaded for shadow rays, even ones for camera rays.
+* Each point's output goes to the output arena at its shadeindex, which is
+  the reverse of its position in the stream.
+
+The program checks that no batch mixes groups or ray types, that the
+stream needed no more batches than its bins do, and prints every output.
+
+NOTE: built and run like testsuite/example-batched-deformer
+*/
+
+#include <cstring>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include <OpenImageIO/filesystem.h>
+#include <OpenImageIO/strutil.h>
+#include <OpenImageIO/sysutil.h>
+
+#include <OSL/oslexec.h>
+#include <OSL/rendererservices.h>
+
+#include <OSL/batched_rendererservices.h>
+
+
+
+template<int WidthT>
+class MyBatchedRendererServices final
+    : public OSL::BatchedRendererServices<WidthT> {
+    OSL_USING_DATA_WIDTH(WidthT);
+
+    // Explicitly let code generator know what we have or haven't overridden
+    // so it can call an internal optimized version vs. a virtual function.
+    bool is_overridden_get_inverse_matrix_WmWxWf() const override
+    {
+        return false;
+    }
+    bool is_overridden_get_matrix_WmWsWf() const override { return false; }
+    bool is_overridden_get_inverse_matrix_WmsWf() const override
+    {
+        return false;
+    }
+    bool is_overridden_get_inverse_matrix_WmWsWf() const override
+    {
+        return false;
+    }
+    bool is_overridden_texture() const override { return false; }
+    bool is_overridden_texture3d() const override { return false; }
+    bool is_overridden_environment() const override { return false; }
+    bool is_overridden_pointcloud_search() const override { return false; }
+    bool is_overridden_pointcloud_get() const override { return false; }
+    bool is_overridden_pointcloud_write() const override { return false; }
+};
+
+class MyRendererServices final : public OSL::RendererServices {
+public:
+    OSL::BatchedRendererServices<16>* batched(OSL::WidthOf<16>) override
+    {
+        return &m_batch_16_rs;
+    }
+    OSL::BatchedRendererServices<8>* batched(OSL::WidthOf<8>) override
+    {
+        return &m_batch_8_rs;
+    }
+    OSL::BatchedRendererServices<4>* batched(OSL::WidthOf<4>) override
+    {
+        return &m_batch_4_rs;
+    }
+
+private:
+    MyBatchedRendererServices<16> m_batch_16_rs;
+    MyBatchedRendererServices<8> m_batch_8_rs;
+    MyBatchedRendererServices<4> m_batch_4_rs;
+};
+
+
+
+// A group instancing streamtag with the given tag, whose output goes to the
+// output arena at the shadeindex of each point.
+static OSL::ShaderGroupRef
+make_group(OSL::ShadingSystem& shadsys, const char* name, float tag)
+{
+    OSL::ShaderGroupRef group = shadsys.ShaderGroupBegin(name);
+    shadsys.Parameter(*group, "tag", tag);
+    shadsys.Shader(*group, "surface", "streamtag", "layer1");
+    shadsys.ShaderGroupEnd(*group);
+
+    const char* output_names[] = { "out" };
+    shadsys.attribute(group.get(), "renderer_outputs",
+                      OSL::TypeDesc(OSL::TypeDesc::STRING, 1), &output_names);
+    OSL::SymLocationDesc outputs("layer1.out", OSL::TypePoint, false,
+                                 OSL::SymArena::Outputs, 0,
+                                 sizeof(OSL::Vec3));
+    shadsys.add_symlocs(group.get(), outputs);
+    return group;
+}
+
+
+
+int
+main(int argc, char* argv[])
+{
+    MyRendererServices renderer;
+    std::unique_ptr<OSL::ShadingSystem> shadsys(
+        new OSL::ShadingSystem(&renderer));
+
+    // For batched allow FMA if build of OSL supports it
+    const int llvm_jit_fma = 1;
+    shadsys->attribute("llvm_jit_fma", llvm_jit_fma);
+
+    // build searchpath for ISA specific OSL shared libraries based on expected
+    // location of library directories relative to the executables path.
+    static const char* relative_lib_dirs[] =
+#if (defined(_WIN32) || defined(_WIN64))
+        { "\\..\\..\\..\\lib64", "\\..\\..\\..\\lib" };
+#else
+        { "/../../../lib64", "/../../../lib" };
+#endif
+    auto executable_directory = OIIO::Filesystem::parent_path(
+        OIIO::Sysutil::this_program_path());
+    int dirNum = 0;
+    std::string librarypath;
+    for (const char* relative_lib_dir : relative_lib_dirs) {
+        if (dirNum++ > 0)
+            librarypath += ":";
+        librarypath += executable_directory + relative_lib_dir;
+    }
+    shadsys->attribute("searchpath:library", librarypath);
+
+    const char* raytypes[] = { "camera", "shadow" };
+    shadsys->attribute("raytypes", OSL::TypeDesc(OSL::TypeDesc::STRING, 2),
+                       raytypes);
+
+    int batch_width = -1;
+    if (shadsys->configure_batch_execution_at(16)) {
+        batch_width = 16;
+    } else if (shadsys->configure_batch_execution_at(8)) {
+        batch_width = 8;
+    } else if (shadsys->configure_batch_execution_at(4)) {
+        batch_width = 4;
+    } else {
+        std::cout
+            << "Error:  Hardware doesn't support 4, 8 or 16 wide SIMD or the OSL has not been configured and built with a proper USE_BATCHED."
+            << std::endl;
+        return -1;
+    }
+
+    OSL::ShaderGroupRef groupA = make_group(*shadsys, "A", 1.0f);
+    OSL::ShaderGroupRef groupB = make_group(*shadsys, "B", 2.0f);
+    int camera = shadsys->raytype_bit(OSL::ustring("camera"));
+    int shadow = shadsys->raytype_bit(OSL::ustring("shadow"));
+
+    OSL::PerThreadInfo* perthread = shadsys->create_thread_info();
+    OSL::ShadingContext* ctx      = shadsys->get_context(perthread);
+
+    // A stream long enough for several full batches and a tail in every bin
+    const int npoints = 37;
+    std::vector<OSL::ShaderGlobals> sg(npoints);
+    std::vector<OSL::Vec3> Pout(npoints, OSL::Vec3(0.0f));
+    for (int i = 0; i < npoints; ++i) {
+        memset((void*)&sg[i], 0, sizeof(OSL::ShaderGlobals));
+        sg[i].P       = OSL::Vec3(float(i), 0.0f, 0.0f);
+        sg[i].raytype = (i % 2) ? shadow : camera;
+    }
+
+    auto shade_stream = [&](auto integral_constant_width) -> void {
+        constexpr int WidthT = integral_constant_width();
+        using Executor       = OSL::ShadingSystem::BatchedExecutor<WidthT>;
+
+        std::vector<typename Executor::ShadeRequest> requests(npoints);
+        std::map<std::pair<OSL::ShaderGroup*, int>, int> bin_sizes;
+        for (int i = 0; i < npoints; ++i) {
+            OSL::ShaderGroup* group = (i % 3 == 0) ? groupB.get()
+                                                   : groupA.get();
+            requests[i] = { group, &sg[i], npoints - 1 - i };
+            ++bin_sizes[{ group, sg[i].raytype }];
+        }
+        int fewest_batches = 0;
+        for (auto& bin : bin_sizes)
+            fewest_batches += (bin.second + WidthT - 1) / WidthT;
+
+        int batches = 0, mixed = 0, shaded = 0;
+        bool ok     = shadsys->batched<WidthT>().execute_stream(
+            *ctx, requests, /*userdata arena start=*/nullptr,
+            /*output arena start=*/Pout.data(),
+            [&](int batch_size, const int* request_indices,
+                OSL::BatchedShaderGlobals<WidthT>& globals_batch) {
+                ++batches;
+                shaded += batch_size;
+                const auto& first = requests[request_indices[0]];
+                for (int lane = 0; lane < batch_size; ++lane) {
+                    const auto& r = requests[request_indices[lane]];
+                    if (r.group != first.group
+                        || r.sg->raytype != globals_batch.uniform.raytype) {
+                        ++mixed;
+                        break;
+                    }
+                }
+            });
+
+        OIIO::Strutil::print("execute_stream succeeded: {}\n", ok);
+        OIIO::Strutil::print("points shaded: {}\n", shaded);
+        OIIO::Strutil::print("batches mixing groups or ray types: {}\n",
+                             mixed);
+        OIIO::Strutil::print("as few batches as the bins allow: {}\n",
+                             batches == fewest_batches);
+        for (int i = 0; i < npoints; ++i) {
+            OSL::Vec3 out = Pout[requests[i].shadeindex];
+            OIIO::Strutil::print("{:2}: group {} {:6} -> ({:g} {:g} {:g})\n", i,
+                                 requests[i].group == groupB.get() ? "B" : "A",
+                                 sg[i].raytype == shadow ? "shadow" : "camera",
+                                 out[0], out[1], out[2]);
+        }
+    };
+
+    if (batch_width == 16) {
+        shade_stream(std::integral_constant<int, 16> {});
+    } else if (batch_width == 8) {
+        shade_stream(std::integral_constant<int, 8> {});
+    } else {
+        shade_stream(std::integral_constant<int, 4> {});
+    }
+
+    shadsys->release_context(ctx);
+    shadsys->destroy_thread_info(perthread);
+}
@@ -0,0 +1,10 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Every read asks the renderer, unless it lets the shading system remember
+# the "object:*" attributes. Then the one context only asks once.
+command = testshade("-t 1 -g 2 2 test")
+command += testshade("-t 1 -g 2 2 --cache_object_attributes test")
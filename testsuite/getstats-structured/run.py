@@ -0,0 +1,10 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Query a few of the structured stats, before and after reset_stats, and
+# check that the JSON export parses and agrees with them.
+command = testshade("-g 2 2 --printstat stat:shaders_requested --printstat stat:groups_compiled --printstat stat:instances_compiled --printstat stat:no_such_stat --statsjson stats.json --resetstats test")
+command += pythonbin + " src/check_stats_json.py stats.json >> out.txt ;\n"
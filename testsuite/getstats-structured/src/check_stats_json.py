@@ -0,0 +1,23 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Check the file written by testshade --statsjson: a flat JSON object whose
+# "stat:" entries are all numbers.
+
+from __future__ import print_function
+import json
+import numbers
+import sys
+
+with open(sys.argv[1]) as f :
+    stats = json.load(f)
+
+print ("stats json is an object:", isinstance(stats, dict))
+numeric = all(isinstance(v, numbers.Number)
+              for k, v in stats.items() if k.startswith("stat:"))
+print ("all stat: entries are numbers:", numeric)
+for key in [ "stat:groups_compiled", "stat:instances_compiled" ] :
+    print (key, "=", stats.get(key))
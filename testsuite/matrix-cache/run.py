@@ -0,0 +1,10 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Two layers transforming between the same named spaces, with the
+# per-shade matrix cache on and off.
+command += testshade("--layer alayer a --layer blayer b --connect alayer Pobj blayer Pobj --connect alayer Mshad blayer Mshad")
+command += testshade("--options opt_matrix_cache=0 --layer alayer a --layer blayer b --connect alayer Pobj blayer Pobj --connect alayer Mshad blayer Mshad")
@@ -0,0 +1,25 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Same as noise-gabor, with the impulses taken from the shared table by
+# several threads at once. The table must not change a single pixel, so
+# the image has to match the noise-gabor references exactly, or the image
+# rendered here without the table (for hosts where noise-gabor itself is
+# off by an LSB).
+if not os.path.exists ("./ref") :
+    os.mkdir ("./ref")
+for f in glob.glob (os.path.join (test_source_dir, "..", "noise-gabor", "ref", "*")) :
+    shutil.copyfile (f, os.path.join ("ref", os.path.basename(f)))
+
+command = oslc("../common/shaders/testnoise.osl")
+command += (osl_app("testshade") + " -t 4 -g 512 512 -od uint8 -o Cout ref/out-notable.tif"
+            + " -param noisename gabor testnoise > notable.txt 2>&1 ;\n")
+command += testshade ("-t 4 -g 512 512 --options gabor_impulse_table=1 -od uint8 -o Cout out.tif -param noisename gabor testnoise")
+outputs = [ "out.txt", "out.tif" ]
+failthresh = 0
+failpercent = 0
+hardfail = 0
+failrelative = 0
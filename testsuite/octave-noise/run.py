@@ -0,0 +1,11 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Octave loops that the runtime optimizer folds into fbm and turbulence ops,
+# compared with the same loops when the octave count isn't known. The
+# second run turns the fold off, and must print the same results.
+command = testshade("--printstat stat:octave_loops_folded test")
+command += testshade("--options opt_octave_loops=0 --printstat stat:octave_loops_folded test")
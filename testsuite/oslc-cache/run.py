@@ -0,0 +1,18 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# The first compile fills the build cache.  The second one names the cache
+# directory differently, writes another output and finds the same header in
+# another directory, none of which may change the key, so it must be a hit.
+# Its oso must only differ in the options line, which must be its own, and
+# its depfile must name the header it found, not the one of the first compile.
+compile_osl_files = False
+command = oslc ("-q -cache oslc-cache -Isrc/a test.osl")
+command += testshade ("test")
+command += (osl_app("oslc") + oslcargs
+            + " -v -cache ./oslc-cache -Isrc/b -MMD -MF hit.d -o hit.oso"
+            + " test.osl > hit.txt 2>&1 ;\n")
+command += pythonbin + " src/check_cache.py oslc-cache hit.txt >> out.txt ;\n"
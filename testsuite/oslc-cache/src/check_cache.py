@@ -0,0 +1,39 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Check that the second compile of the oslc-cache test was a cache hit:
+# oslc -v said so, the cache holds the single entry of the first compile,
+# the oso of the hit is the same as that of the first compile but for its
+# own options line, and its depfile names the headers it found.
+
+from __future__ import print_function
+import os
+import sys
+
+cachedir = sys.argv[1]
+with open(sys.argv[2]) as f :
+    log = f.read()
+
+print ("second compile used the cache:", "Using cached oso" in log)
+entries = [f for f in os.listdir(cachedir) if f.endswith(".oso")]
+print ("cache entries:", len(entries))
+
+def split_options (oso) :
+    lines = oso.splitlines()
+    options = [l for l in lines if l.startswith("# options: ")]
+    rest = [l for l in lines if not l.startswith("# options: ")]
+    return options, rest
+
+with open("test.oso") as f :
+    first_options, first = split_options(f.read())
+with open("hit.oso") as f :
+    hit_options, hit = split_options(f.read())
+print ("oso of the hit matches:", first == hit)
+print ("options of the hit are its own:", len(hit_options) == 1
+       and "-o hit.oso" in hit_options[0] and "-Isrc/b" in hit_options[0])
+with open("hit.d") as f :
+    print ("depfile of the hit:")
+    print (f.read(), end="")
@@ -0,0 +1,14 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Compile shaders that declare structs in one oslc run, on several threads,
+# so that each compile has to keep its structs apart from the others'.
+compile_osl_files = False
+command = oslc ("-q -j 4 box.osl pair.osl ray.osl sample.osl")
+command += testshade ("box")
+command += testshade ("pair")
+command += testshade ("ray")
+command += testshade ("sample")
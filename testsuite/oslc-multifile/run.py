@@ -0,0 +1,12 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Compile both shaders in one oslc run, on two threads, so they share the
+# preprocessed stdosl.h.
+compile_osl_files = False
+command = oslc ("-q -j 2 -DSCALE=2 first.osl second.osl")
+command += testshade ("first")
+command += testshade ("second")
@@ -0,0 +1,18 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Performance test, only run by the perf mode of runtest.py.
+# A chain of 16 stages, each feeding the next.
+nstages = 16
+spaces = [ "hsv", "hsl", "YIQ", "xyY" ]
+layers = ""
+for i in range(nstages) :
+    layers += "--param scale {} --param angle {} --param space {} ".format (
+                  1.0 + 0.1 * i, 10.0 * i, spaces[i % len(spaces)])
+    layers += "--layer s{} stage ".format (i)
+    if i > 0 :
+        layers += "--connect s{} Cout s{} Cin ".format (i - 1, i)
+perf_shade = "-g 512 512 -od half -o Cout out.exr " + layers
@@ -0,0 +1,8 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Performance test, only run by the perf mode of runtest.py
+perf_shade = "-g 512 512 -od half -o Cout out.exr noisy"
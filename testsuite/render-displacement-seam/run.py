@@ -0,0 +1,12 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# The displacement reads a texture with the sphere's uvs. The corners on
+# either side of the uv seam and around the poles must be shaded with
+# their own uv, not merged into one displaced vertex.
+command = (osl_app("testrender") + " -v -r 64 64 -aa 1 scene.xml out.exr"
+           + " > log.txt 2>&1 ;\n")
+command += pythonbin + " src/check_seam.py log.txt 4 >> out.txt ;\n"
@@ -0,0 +1,26 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Check the number of displacement shades of a sphere with the given
+# resolution. The grid has W = 2 * resolution columns and H = resolution
+# rows. Every grid vertex is shaded once, plus once more for the seam
+# column, and each pole once per uv of the triangles around it.
+
+from __future__ import print_function
+import re
+import sys
+
+log = open(sys.argv[1]).read()
+res = int(sys.argv[2])
+W = 2 * res
+H = res
+
+m = re.search(r"Evaluating displacement shaders on (\d+) vertices", log)
+shaded = int(m.group(1)) if m else -1
+print("displacement shades:", shaded)
+print("sphere vertices:", 2 + W * H)
+print("seam and pole corners shaded with their own uv:",
+      shaded == W * H + H + 2 * W)
@@ -0,0 +1,21 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Renders the render-cornell scene with its shaders, and compares against
+# its references: the wavefront integrator must match the recursive one.
+cornell = os.path.join (test_source_dir, "..", "render-cornell")
+for f in glob.glob (os.path.join (cornell, "*.osl")) + [ os.path.join (cornell, "cornell.xml") ] :
+    shutil.copyfile (f, os.path.basename(f))
+if not os.path.exists ("./ref") :
+    if platform.system() == 'Windows' :
+        shutil.copytree (os.path.join (cornell, "ref"), "./ref")
+    else :
+        os.symlink (os.path.join (cornell, "ref"), "./ref")
+
+failthresh = 0.01
+failpercent = 1
+outputs = [ "out.exr" ]
+command = testrender("-r 256 256 -aa 4 --wavefront cornell.xml out.exr")
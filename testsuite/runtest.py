@@ -13,6 +13,7 @@ import difflib
 import filecmp
 import shutil
 import re
+import json
 from itertools import chain
 
 from optparse import OptionParser
@@ -39,6 +40,7 @@ OSL_TESTSUITE_ROOT = make_relpath(os.getenv('OSL_TESTSUITE_ROOT',
                                              '../../../testsuite'))
 os.environ['OSLHOME'] = os.path.join(OSL_SOURCE_DIR, "src")
 OSL_REGRESSION_TEST = os.environ.get("OSL_REGRESSION_TEST", None)
+OSL_PERF_TEST = int(os.environ.get("OSL_PERF_TEST", "0"))
 
 
 # Options for the command line
@@ -101,6 +103,19 @@ image_extensions = [ ".tif", ".tx", ".exr", ".jpg", ".png", ".rla",
 compile_osl_files = True
 splitsymbol = ';'
 
+# Control performance mode (OSL_PERF_TEST). A perf test's run.py sets
+# perf_shade to the testshade arguments that shade its group, and may
+# override the rest.
+perf_shade = None
+perf_threads = [ 1, 8 ]
+perf_iters = 4
+perf_batched = int(os.environ.get("OSL_PERF_BATCHED", "0"))
+# Allowed relative increase of each stat over the baseline, and the
+# smallest baseline values that are compared at all (seconds or bytes),
+# below which the measurements are mostly noise.
+perf_tolerance = { "time" : 0.25, "memory" : 0.10 }
+perf_floor = { "time" : 0.05, "memory" : 1024*1024 }
+
 #print ("srcdir = " + srcdir)
 #print ("tmpdir = " + tmpdir)
 #print ("path = " + path)
@@ -385,6 +400,164 @@ def runtest (command, outputs, failureok=0, failthresh=0, failpercent=0, regress
     return (err)
 
 
+# Convert the output of Strutil::timeintervalformat ("1h 2m 3.45s") to
+# seconds.
+def parse_timeinterval (text) :
+    secs = 0.0
+    for value, unit in re.findall (r"([0-9.]+)\s*([dhms])", text) :
+        secs += float(value) * { "d":86400, "h":3600, "m":60, "s":1 }[unit]
+    return secs
+
+
+# Convert the output of Strutil::memformat ("1.5 MB") to bytes.
+def parse_mem (text) :
+    m = re.match (r"\s*([0-9.]+)\s*([KMG]?B)", text)
+    if not m :
+        return 0
+    scale = { "B":1, "KB":1024, "MB":1024**2, "GB":1024**3 }[m.group(2)]
+    return int(float(m.group(1)) * scale)
+
+
+# Gather the stats printed by testshade --runstats into a dictionary.
+# Stats ending in "_time" are in seconds, "_memory" in bytes.
+def parse_perf_stats (output) :
+    times = { "setup_time" : r"^Setup\s*:\s*(.*)$",
+              "warmup_time" : r"^Warmup\s*:\s*(.*)$",
+              "run_time" : r"^Run\s*:\s*(.*)$",
+              "opt_time" : r"Runtime optimization cost:\s*(.*)$",
+              "specialization_time" : r"runtime specialization:\s*(.*)$",
+              "llvm_setup_time" : r"LLVM setup:\s*(.*)$",
+              "llvm_irgen_time" : r"LLVM IR gen:\s*(.*)$",
+              "llvm_opt_time" : r"LLVM optimize:\s*(.*)$",
+              "llvm_jit_time" : r"LLVM JIT:\s*(.*)$",
+              "exec_time" : r"Total shader execution time:\s*(.*)\(" }
+    stats = {}
+    for name, pattern in times.items() :
+        m = re.search (pattern, output, re.MULTILINE)
+        if m :
+            stats[name] = parse_timeinterval (m.group(1))
+    llvm = [ v for k, v in stats.items() if k.startswith("llvm_") ]
+    if llvm :
+        stats["llvm_time"] = sum(llvm)
+    m = re.search (r"Memory total:.*,\s*(.*) peak", output)
+    if m :
+        stats["peak_memory"] = parse_mem (m.group(1))
+    m = re.search (r"LLVM JIT memory:\s*(.*)$", output, re.MULTILINE)
+    if m :
+        stats["jit_memory"] = parse_mem (m.group(1))
+    return stats
+
+
+# Return the list of regressions of the runs in 'current' against the ones
+# in 'baseline'. Only increases count, improvements are just reported.
+def compare_perf (current, baseline) :
+    scale = float(os.getenv("OSL_PERF_TOLERANCE_SCALE", "1.0"))
+    regressions = []
+    for run, stats in sorted(current.items()) :
+        if run not in baseline :
+            print ("NEW perf run ", run, " (not in baseline)")
+            continue
+        for name, value in sorted(stats.items()) :
+            if name not in baseline[run] :
+                continue
+            kind = "memory" if name.endswith("_memory") else "time"
+            base = baseline[run][name]
+            if base < perf_floor[kind] and value < perf_floor[kind] :
+                continue
+            limit = base * (1.0 + perf_tolerance[kind] * scale)
+            ratio = value / base if base > 0 else float("inf")
+            line = "{} {}: {:.4g} vs baseline {:.4g} ({:+.1f}%)".format (
+                       run, name, value, base, (ratio - 1.0) * 100.0)
+            if value > limit and value - base > perf_floor[kind] :
+                regressions.append (line)
+                print ("REGRESSION " + line)
+            elif ratio < 1.0 - perf_tolerance[kind] * scale :
+                print ("IMPROVED " + line)
+    return regressions
+
+
+# Performance mode: shade the group of perf_shade at each of perf_threads
+# thread counts (and batched, when built with batched support), collect
+# the --runstats numbers in perf.json and compare them to the stored
+# baseline. Without a baseline, or when OSL_PERF_UPDATE_BASELINE is set,
+# the results become the new baseline.
+def runperf (compiles) :
+    os.chdir (srcdir)
+    open ("out.txt", "w").close()    # truncate out.txt
+    for sub_command in compiles.split(splitsymbol) :
+        sub_command = sub_command.strip()
+        if sub_command and subprocess.call (sub_command, shell=True) != 0 :
+            print ("#### Error: this command failed: ", sub_command)
+            print ("FAIL")
+            return 1
+    if perf_shade is None :
+        print ("#### Error: perf test does not set perf_shade")
+        print ("FAIL")
+        return 1
+
+    env = dict(os.environ)
+    for var in [ "TESTSHADE_BATCHED", "TESTSHADE_OPTIX", "TESTSHADE_RS_BITCODE" ] :
+        env.pop (var, None)
+    if os.environ.__contains__('OSL_TESTSHADE_NAME') :
+        testshadename = os.environ['OSL_TESTSHADE_NAME'] + " "
+    else :
+        testshadename = osl_app("testshade")
+    extra = " --profile" if int(os.getenv("OSL_PERF_PROFILE", "0")) else ""
+    modes = [ ("", "") ]
+    if perf_batched :
+        modes.append ((".batched", " --batched"))
+
+    results = {}
+    for threads in perf_threads :
+        for suffix, flags in modes :
+            run = "t{}{}".format (threads, suffix)
+            cmd = (testshadename + "--runstats --warmup" + extra + flags
+                   + " -t {} --iters {} ".format (threads, perf_iters)
+                   + perf_shade)
+            print ("command = ", cmd)
+            proc = subprocess.run (cmd, shell=True, env=env,
+                                   stdout=subprocess.PIPE,
+                                   stderr=subprocess.STDOUT,
+                                   universal_newlines=True)
+            open ("out.txt", "a").write (proc.stdout)
+            if proc.returncode != 0 :
+                print ("#### Error: this command failed: ", cmd)
+                print ("FAIL")
+                print ("Output was:\n--------")
+                print (proc.stdout)
+                print ("--------")
+                return 1
+            results[run] = parse_perf_stats (proc.stdout)
+
+    perf = { "test" : mytest, "iters" : perf_iters, "runs" : results }
+    with open ("perf.json", "w") as f :
+        json.dump (perf, f, indent=4, sort_keys=True)
+    print (json.dumps (perf, indent=4, sort_keys=True))
+
+    baseline_dir = os.getenv ("OSL_PERF_BASELINE_DIR",
+                              os.path.join (OSL_BUILD_DIR, "testsuite",
+                                            "perf-baselines"))
+    baseline_file = os.path.join (baseline_dir, mytest + ".json")
+    if (int(os.getenv("OSL_PERF_UPDATE_BASELINE", "0"))
+            or not os.path.exists (baseline_file)) :
+        if not os.path.exists (baseline_dir) :
+            os.makedirs (baseline_dir)
+        shutil.copyfile ("perf.json", baseline_file)
+        print ("Recorded perf baseline ", baseline_file)
+        return 0
+
+    baseline = json.load (open (baseline_file))
+    if baseline.get("iters") != perf_iters :
+        print ("#### Warning: baseline was recorded with a different --iters")
+    regressions = compare_perf (results, baseline.get("runs", {}))
+    if regressions :
+        print ("FAIL: {} perf regressions against {}".format (
+                   len(regressions), baseline_file))
+        return 1
+    print ("PASS: perf matches ", baseline_file)
+    return 0
+
+
 ##########################################################################
 
 
@@ -425,8 +598,8 @@ if 'OSL_TESTSUITE_THRESH_SCALE' in os.environ :
 for filetype in [ "*.osl", "*.h", "*.oslgroup", "*.xml" ] :
     for testfile in glob.glob (os.path.join (test_source_dir, filetype)) :
         shutil.copyfile (testfile, os.path.basename(testfile))
+compiles = ""
 if compile_osl_files :
-    compiles = ""
     oslfiles = glob.glob ("*.osl")
     oslfiles.sort() ## sort the shaders to compile so that they always compile in the same order
     for testfile in oslfiles :
@@ -441,7 +614,9 @@ if (os.path.exists("ref/out.tif") and ("out.tif" not in outputs)) :
     outputs.append ("out.tif")
 
 # Run the test and check the outputs
-if OSL_REGRESSION_TEST != None :
+if OSL_PERF_TEST :
+    ret = runperf (compiles)
+elif OSL_REGRESSION_TEST != None :
     # need to produce baseline images
     ret = runtest (command, outputs, failureok=failureok,
                    failthresh=failthresh, failpercent=failpercent, regression="BASELINE", filter_re=filter_re)
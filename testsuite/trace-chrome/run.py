@@ -0,0 +1,10 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Write a Chrome trace of the JIT and the sampled executions, and check
+# that it parses and holds the expected spans.
+command = testshade("-g 2 2 --trace trace.json test")
+command += pythonbin + " src/check_trace.py trace.json >> out.txt ;\n"
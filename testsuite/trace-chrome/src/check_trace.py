@@ -0,0 +1,41 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Check the file written by testshade --trace: Chrome trace event JSON
+# holding a thread_name record per thread and complete ("X") spans.  The
+# batched spans are named like the scalar ones with a "batched " prefix,
+# which is dropped so every variant of the test prints the same names.
+
+from __future__ import print_function
+import json
+import numbers
+import sys
+
+with open(sys.argv[1]) as f :
+    trace = json.load(f)
+
+events = trace["traceEvents"]
+print ("trace json has a traceEvents list:", isinstance(events, list))
+
+threads = set(e["tid"] for e in events
+              if e["ph"] == "M" and e["name"] == "thread_name")
+spans = [e for e in events if e["ph"] == "X"]
+print ("every span names a thread:",
+       all(e["tid"] in threads for e in spans))
+print ("every span has a start and duration:",
+       all(isinstance(e["ts"], numbers.Number) and
+           isinstance(e["dur"], numbers.Number) and e["dur"] >= 0
+           for e in spans))
+
+def unbatched (name) :
+    return name[len("batched "):] if name.startswith("batched ") else name
+
+print ("span names:")
+for name in sorted(set(unbatched(e["name"]) for e in spans)) :
+    print ("   ", name)
+print ("master load of:",
+       sorted(set(e["args"]["name"] for e in spans
+                  if e["name"] == "master load")))
@@ -0,0 +1,9 @@
+#!/usr/bin/env python
+
+# Copyright Contributors to the Open Shading Language project.
+# SPDX-License-Identifier: BSD-3-Clause
+# https://github.com/AcademySoftwareFoundation/OpenShadingLanguage
+
+# Strings made by the string ops, kept transient or always interned.
+command += testshade("test")
+command += testshade("--options opt_transient_strings=0 test")